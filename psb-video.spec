@@ -80,4 +80,5 @@ rm -rf %{buildroot}
 # >> files
 %{drimoduledir}/pvr_drv_video.so
 %{fwdir}/*.bin
+%{_includedir}/psb_video/psb_va_ext.h
 # << files
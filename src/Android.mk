@@ -37,6 +37,7 @@ LOCAL_SRC_FILES :=              \
     psb_drv_video.c         \
     psb_drv_debug.c         \
     psb_surface_attrib.c    \
+    psb_surface_import.c    \
     psb_output.c		\
     android/psb_output_android.c            \
     android/psb_android_glue.cpp            \
@@ -62,6 +63,7 @@ LOCAL_SRC_FILES :=		\
     psb_drv_video.c         \
     psb_drv_debug.c         \
     psb_surface_attrib.c    \
+    psb_surface_import.c    \
     psb_output.c		\
     android/psb_output_android.c            \
     android/psb_android_glue.cpp            \
@@ -82,6 +84,7 @@ LOCAL_SRC_FILES :=		\
     pnw_hostcode.c		\
     pnw_hostheader.c	\
     pnw_hostjpeg.c		\
+    pnw_hostrc.c		\
     pnw_jpeg.c		\
     pnw_rotate.c	\
     tng_vld_dec.c	\
@@ -124,6 +127,9 @@ endif
 LOCAL_MODULE_TAGS := eng
 LOCAL_MODULE := pvr_drv_video
 
+LOCAL_COPY_HEADERS_TO := libpsb_video
+LOCAL_COPY_HEADERS := psb_va_ext.h
+
 
 ifneq ($(filter $(TARGET_BOARD_PLATFORM),baytrail cherrytrail bigcore braswell),)
 LOCAL_SHARED_LIBRARIES := libdl libdrm libwsbm libcutils \
@@ -151,7 +157,7 @@ LOCAL_SRC_FILES += \
     tng_VP8.c \
     tng_jpegdec.c \
     tng_cmdbuf.c tng_hostheader.c tng_hostcode.c tng_picmgmt.c tng_hostbias.c \
-    tng_H264ES.c tng_H263ES.c tng_MPEG4ES.c tng_jpegES.c tng_slotorder.c tng_hostair.c \
+    tng_H264ES.c tng_H263ES.c tng_MPEG4ES.c tng_jpegES.c tng_slotorder.c tng_hostair.c tng_hostrc.c \
     tng_trace.c
 LOCAL_SRC_FILES += \
     vsp_VPP.c \
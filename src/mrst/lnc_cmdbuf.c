@@ -391,12 +391,18 @@ lncDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
     ca.fence_flags = fence_flags;
     ca.fence_arg = (uint64_t)((unsigned long)fence_rep);
 
+    wsbmWriteLockKernelBO();
     do {
         ret = drmCommandWrite(fd, ioctl_offset, &ca, sizeof(ca));
+        if (ret == EAGAIN) {
+            /* this engine's queue is full, let other engines submit meanwhile */
+            wsbmWriteUnlockKernelBO();
+            wsbmWriteLockKernelBO();
+        }
     } while (ret == EAGAIN);
 
     if (ret)
-        goto out;
+        goto out_unlock;
 
     for (i = 0; i < buffer_count; i++) {
         struct psb_validate_arg *arg = &(arg_list[i]);
@@ -404,15 +410,17 @@ lncDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
 
         if (!arg->handled) {
             ret = -EFAULT;
-            goto out;
+            goto out_unlock;
         }
         if (arg->ret != 0) {
             ret = arg->ret;
-            goto out;
+            goto out_unlock;
         }
         wsbmUpdateKBuf(wsbmKBuf(buffer_list[i]->drm_buf),
                        rep->gpu_offset, rep->placement, rep->fence_type_mask);
     }
+out_unlock:
+    wsbmWriteUnlockKernelBO();
 out:
     free(arg_list);
     for (i = 0; i < buffer_count; i++) {
@@ -533,9 +541,9 @@ int lnc_context_flush_cmdbuf(object_context_p obj_context)
     ASSERT(cmdbuffer_size < CMD_SIZE);
     ASSERT((unsigned char *) cmdbuf->cmd_idx < CMD_END(cmdbuf));
     /* LOCK */
-    ret = LOCK_HARDWARE(driver_data);
+    ret = LOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
     if (ret) {
-        UNLOCK_HARDWARE(driver_data);
+        UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
         DEBUG_FAILURE_RET;
         return ret;
     }
@@ -557,14 +565,12 @@ int lnc_context_flush_cmdbuf(object_context_p obj_context)
 #define LNC_ENGINE_ENCODE  5
 #endif
 
-    wsbmWriteLockKernelBO();
     ret = lncDRMCmdBuf(driver_data->drm_fd, driver_data->execIoctlOffset,
                        cmdbuf->buffer_refs, cmdbuf->buffer_refs_count, wsbmKBufHandle(wsbmKBuf(cmdbuf->buf.drm_buf)),
                        0, cmdbuffer_size,/*unsigned cmdBufSize*/
                        wsbmKBufHandle(wsbmKBuf(cmdbuf->buf.drm_buf)), reloc_offset, num_relocs,
                        0, LNC_ENGINE_ENCODE, fence_flags, &fence_rep);
-    wsbmWriteUnlockKernelBO();
-    UNLOCK_HARDWARE(driver_data);
+    UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
 
     if (ret) {
         obj_context->lnc_cmdbuf = NULL;
@@ -85,7 +85,12 @@ static int reg_poll_n = 0;
 #define psb_deblock_reg_get(group, reg) \
         *cmdbuf->regio_idx++ = (group##_##reg##_##OFFSET + group##_##BASE) | MSVDX_DEBLOCK_REG_GET; reg_get_count++;
 
-#if 1
+/* Build with -DH264_DEBLOCK_POLLn=0 to drop the command space polls, templates included */
+#ifndef H264_DEBLOCK_POLLn
+#define H264_DEBLOCK_POLLn      1
+#endif
+
+#if H264_DEBLOCK_POLLn
 #define h264_pollForSpaceForNCommands(NumCommands)\
         *cmdbuf->regio_idx++ = (MSVDX_CORE_CR_MSVDX_COMMAND_SPACE_OFFSET + MSVDX_CORE_BASE) | MSVDX_DEBLOCK_REG_POLLn; \
         *cmdbuf->regio_idx++ = NumCommands; reg_poll_n++;
@@ -96,6 +101,38 @@ static int reg_poll_n = 0;
 #define PollForSpaceForXCommands  \
         *cmdbuf->regio_idx++ = (MSVDX_CORE_CR_MSVDX_COMMAND_SPACE_OFFSET + MSVDX_CORE_BASE) | MSVDX_DEBLOCK_REG_POLLx; reg_poll_x++;
 
+/* Compile-time forms of the words written by the macros above, used to build command templates */
+#if H264_DEBLOCK_POLLn
+#define H264_DEBLOCK_POLLn_WORDS(NumCommands) \
+        ((MSVDX_CORE_CR_MSVDX_COMMAND_SPACE_OFFSET + MSVDX_CORE_BASE) | MSVDX_DEBLOCK_REG_POLLn), NumCommands,
+#else
+#define H264_DEBLOCK_POLLn_WORDS(NumCommands)
+#endif
+#define H264_DEBLOCK_POLLn_SIZE (2 * H264_DEBLOCK_POLLn)
+
+#define H264_DEBLOCK_TABLE_SET_WORD(group, reg, index) \
+        ((group##_##reg##_OFFSET + group##_##BASE + index*group##_##reg##_STRIDE) | MSVDX_DEBLOCK_REG_SET)
+
+#define H264_DEBLOCK_FIELD_VALUE(group, reg, field, value) \
+        (((value) << group##_##reg##_##field##_SHIFT) & group##_##reg##_##field##_MASK)
+
+/*
+ * All SLICE_PARAMS fields are copied into bytes 0x5C/0x5D of the stored MB, so the
+ * masked 14 bits below change exactly when h264_getCurrentSliceCmd() would change.
+ * Comparing them lets the second pass walk runs of MBs belonging to the same slice
+ * without unpacking and repacking the slice command for every macroblock.
+ */
+#define H264_SLICE_KEY_MASK \
+        (MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_COPY_H264_BE_SLICE0_BETA_OFFSET_DIV2_MASK | \
+         MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_COPY_H264_BE_SLICE0_FIELD_TYPE_MASK | \
+         MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_COPY_H264_BE_SLICE0_CODE_TYPE_MASK | \
+         ((MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_COPY_DISABLE_DEBLOCK_FILTER_IDC_MASK | \
+           MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_COPY_H264_BE_SLICE0_ALPHA_CO_OFFSET_DIV2_MASK) << 8))
+
+#define h264_getSliceKey(MbData) \
+        ((((uint32_t)(MbData)[MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_COPY_DISABLE_DEBLOCK_FILTER_IDC_OFFSET] << 8) | \
+          (MbData)[MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_COPY_H264_BE_SLICE0_CODE_TYPE_OFFSET]) & H264_SLICE_KEY_MASK)
+
 typedef enum {
     H264_BLOCKSIZE_16X16                = 0, /* 1 block */
     H264_BLOCKSIZE_16X8                 = 1, /* 2 blocks */
@@ -291,53 +328,53 @@ h264_currentInterBlockSequence(psb_cmdbuf_p cmdbuf, uint8_t * MbData)
     }
 }
 
+/* Intra prediction commands do not depend on the MB data, only on I_PCM or not */
+static const uint32_t CurrentIntraTemplate[2][H264_DEBLOCK_POLLn_SIZE + 4] = {
+    {
+        H264_DEBLOCK_POLLn_WORDS(2)
+        H264_DEBLOCK_TABLE_SET_WORD(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, 0),
+        H264_DEBLOCK_FIELD_VALUE(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, INTRA_PRED_BLOCK_SIZE, 0),      /* I_16x16      */
+        H264_DEBLOCK_TABLE_SET_WORD(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, 4),
+        H264_DEBLOCK_FIELD_VALUE(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, INTRA_PRED_BLOCK_SIZE, 1)       /* I_8x8        */
+    },
+    {
+        H264_DEBLOCK_POLLn_WORDS(2)
+        H264_DEBLOCK_TABLE_SET_WORD(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, 0),
+        H264_DEBLOCK_FIELD_VALUE(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, INTRA_PRED_BLOCK_SIZE, 3),      /* I_PCM        */
+        H264_DEBLOCK_TABLE_SET_WORD(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, 4),
+        H264_DEBLOCK_FIELD_VALUE(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, INTRA_PRED_BLOCK_SIZE, 3)       /* I_PCM        */
+    }
+};
+
+static const uint32_t Above1IntraTemplate[2][H264_DEBLOCK_POLLn_SIZE + 2] = {
+    {
+        H264_DEBLOCK_POLLn_WORDS(1)
+        H264_DEBLOCK_TABLE_SET_WORD(MSVDX_CMDS, INTRA_BLOCK_PREDICTION_ABOVE1, 0),
+        H264_DEBLOCK_FIELD_VALUE(MSVDX_CMDS, INTRA_BLOCK_PREDICTION_ABOVE1, INTRA_PRED_BLOCK_SIZE_ABOVE1, 0)
+    },
+    {
+        H264_DEBLOCK_POLLn_WORDS(1)
+        H264_DEBLOCK_TABLE_SET_WORD(MSVDX_CMDS, INTRA_BLOCK_PREDICTION_ABOVE1, 0),
+        H264_DEBLOCK_FIELD_VALUE(MSVDX_CMDS, INTRA_BLOCK_PREDICTION_ABOVE1, INTRA_PRED_BLOCK_SIZE_ABOVE1, 3)
+    }
+};
+
 void
 h264_currentIntraBlockPrediction(psb_cmdbuf_p cmdbuf, uint8_t * MbData, int bMbIsIPCM)
 {
-    uint32_t    BlockSizeY, BlockSizeC;
-    uint32_t    IntraCmdY, IntraCmdC;
-
-    /* select block size I_PCM or I_16x16 */
-    BlockSizeY = (1 == bMbIsIPCM) ? 3 : 0;
-    /* select block size I_PCM or I_8x8 */
-    BlockSizeC = (1 == bMbIsIPCM) ? 3 : 1;
-
-    IntraCmdY = IntraCmdC = 0;
-
-    REGIO_WRITE_FIELD(
-        IntraCmdY,
-        MSVDX_CMDS, INTRA_BLOCK_PREDICTION,
-        INTRA_PRED_BLOCK_SIZE,
-        BlockSizeY);
-    REGIO_WRITE_FIELD(
-        IntraCmdC,
-        MSVDX_CMDS, INTRA_BLOCK_PREDICTION,
-        INTRA_PRED_BLOCK_SIZE,
-        BlockSizeC);
-
-    h264_pollForSpaceForNCommands(2);
-    psb_deblock_reg_table_set(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, 0, IntraCmdY);
-    psb_deblock_reg_table_set(MSVDX_CMDS, INTRA_BLOCK_PREDICTION, 4, IntraCmdC);
+    memcpy(cmdbuf->regio_idx, CurrentIntraTemplate[bMbIsIPCM], sizeof(CurrentIntraTemplate[0]));
+    cmdbuf->regio_idx += sizeof(CurrentIntraTemplate[0]) / sizeof(uint32_t);
+    reg_poll_n += H264_DEBLOCK_POLLn;
+    reg_set_count += 2;
 }
 
 void
 h264_above1IntraBlockPrediction(psb_cmdbuf_p cmdbuf, uint8_t * MbData, int bMbIsIPCM)
 {
-    uint32_t    BlockSizeY;
-    uint32_t    IntraCmdY;
-
-    /* select block size I_PCM or I_16x16 */
-    BlockSizeY = (1 == bMbIsIPCM) ? 3 : 0;
-    IntraCmdY = 0;
-
-    REGIO_WRITE_FIELD(
-        IntraCmdY,
-        MSVDX_CMDS, INTRA_BLOCK_PREDICTION_ABOVE1,
-        INTRA_PRED_BLOCK_SIZE_ABOVE1,
-        BlockSizeY);
-
-    h264_pollForSpaceForNCommands(1);
-    psb_deblock_reg_table_set(MSVDX_CMDS, INTRA_BLOCK_PREDICTION_ABOVE1, 0, IntraCmdY);
+    memcpy(cmdbuf->regio_idx, Above1IntraTemplate[bMbIsIPCM], sizeof(Above1IntraTemplate[0]));
+    cmdbuf->regio_idx += sizeof(Above1IntraTemplate[0]) / sizeof(uint32_t);
+    reg_poll_n += H264_DEBLOCK_POLLn;
+    reg_set_count++;
 }
 
 void
@@ -470,17 +507,14 @@ int h264_secondPass(
     uint32_t    Height
 )
 {
-    uint32_t    i, PicSize;
+    uint32_t    X, Y, RowSize;
     uint32_t    EndOfPictureCmd;
     uint32_t    EndOfSliceCmd;
-    uint32_t    SliceCmd, OldSliceCmd;
+    uint32_t    SliceCmd, SliceKey;
     uint32_t    EnableReg;
     uint8_t     * CurrMb;
-    uint8_t     * Above1Mb;
     int bRetCode = 0;
 
-    PicSize = Width * Height;
-
     /* End of Slice command */
     EndOfSliceCmd = 0;
     REGIO_WRITE_FIELD(EndOfSliceCmd, MSVDX_CMDS, END_SLICE_PICTURE, PICTURE_END, 0);
@@ -496,39 +530,30 @@ int h264_secondPass(
     PollForSpaceForXCommands;
 
     /* Send Slice Command */
+    SliceKey = h264_getSliceKey(MbData);
     SliceCmd = h264_getCurrentSliceCmd(MbData);
     h264_pollForSpaceForNCommands(2);
     psb_deblock_reg_set(MSVDX_CMDS, SLICE_PARAMS, SliceCmd);
     psb_deblock_reg_set(MSVDX_CMDS, SLICE_PARAMS_ABOVE1, SliceCmd);
-    /* process top row */
-    for (i = 0, CurrMb = MbData;
-         i < Width;
-         i++, CurrMb += H264_MACROBLOCK_DATA_SIZE) {
-        OldSliceCmd = SliceCmd;
-        SliceCmd = h264_getCurrentSliceCmd(CurrMb);
-        if (OldSliceCmd != SliceCmd) {
-            h264_pollForSpaceForNCommands(2);
-            psb_deblock_reg_set(MSVDX_CMDS, END_SLICE_PICTURE, EndOfSliceCmd);
-            psb_deblock_reg_set(MSVDX_CMDS, SLICE_PARAMS, SliceCmd);
-        }
 
-        h264_macroblockCmdSequence(cmdbuf, CurrMb, i, 0, 1);
-    }
-
-    /* process rest of picture */
-    for (Above1Mb = MbData;
-         i < PicSize;
-         i++, CurrMb += H264_MACROBLOCK_DATA_SIZE, Above1Mb += H264_MACROBLOCK_DATA_SIZE) {
-        OldSliceCmd = SliceCmd;
-        SliceCmd = h264_getCurrentSliceCmd(CurrMb);
-        if (OldSliceCmd != SliceCmd) {
-            h264_pollForSpaceForNCommands(2);
-            psb_deblock_reg_set(MSVDX_CMDS, END_SLICE_PICTURE, EndOfSliceCmd);
-            psb_deblock_reg_set(MSVDX_CMDS, SLICE_PARAMS, SliceCmd);
+    /* walk the picture row by row, the MB above is always one row back in the MB data */
+    RowSize = Width * H264_MACROBLOCK_DATA_SIZE;
+    for (Y = 0, CurrMb = MbData; Y < Height; Y++) {
+        for (X = 0; X < Width; X++, CurrMb += H264_MACROBLOCK_DATA_SIZE) {
+            /* only rebuild the slice command at the end of a run of MBs from the same slice */
+            if (h264_getSliceKey(CurrMb) != SliceKey) {
+                SliceKey = h264_getSliceKey(CurrMb);
+                SliceCmd = h264_getCurrentSliceCmd(CurrMb);
+                h264_pollForSpaceForNCommands(2);
+                psb_deblock_reg_set(MSVDX_CMDS, END_SLICE_PICTURE, EndOfSliceCmd);
+                psb_deblock_reg_set(MSVDX_CMDS, SLICE_PARAMS, SliceCmd);
+            }
+
+            /* top row has no above1 MB */
+            if (Y > 0)
+                h264_macroblockCmdSequence(cmdbuf, CurrMb - RowSize, X, Y - 1, 0);
+            h264_macroblockCmdSequence(cmdbuf, CurrMb, X, Y, 1);
         }
-
-        h264_macroblockCmdSequence(cmdbuf, Above1Mb, (i % Width), (i / Width) - 1, 0);
-        h264_macroblockCmdSequence(cmdbuf, CurrMb, (i % Width), (i / Width), 1);
     }
 
     /* send end of pic + restart back end */
@@ -240,11 +240,8 @@ static VAStatus pnw__H263ES_process_sequence_param(context_ENC_p ctx, object_buf
     else
         ctx->sRCParams.IntraFreq = pSequenceParams->intra_period;
 
-    ctx->sRCParams.InitialLevel = (3 * ctx->sRCParams.BufferSize) >> 4;
     /* Aligned with target frame size */
-    ctx->sRCParams.InitialLevel += (frame_size / 2);
-    ctx->sRCParams.InitialLevel /= frame_size;
-    ctx->sRCParams.InitialLevel *= frame_size;
+    ctx->sRCParams.InitialLevel = pnw__rc_initial_level(ctx->sRCParams.BufferSize, frame_size);
     ctx->sRCParams.InitialDelay = ctx->sRCParams.BufferSize - ctx->sRCParams.InitialLevel;
     ctx->buffer_size = ctx->sRCParams.BufferSize;
 
@@ -483,6 +483,12 @@ static VAStatus pnw_H264_CreateContext(
         DEBUG_FAILURE;
     }
 
+    if (vaStatus == VA_STATUS_SUCCESS) {
+        /* same size as in psb__H264_process_picture_param */
+        uint32_t size_mb = ((obj_context->picture_width + 15) / 16) * ((obj_context->picture_height + 15) / 16);
+        vld_dec_preallocate_colocated_buffers(&ctx->dec_ctx, ((size_mb + 100) * 128 + 0xfff) & ~0xfff);
+    }
+
     if (vaStatus != VA_STATUS_SUCCESS) {
         pnw_H264_DestroyContext(obj_context);
     }
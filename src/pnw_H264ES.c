@@ -309,11 +309,8 @@ static VAStatus pnw__H264ES_process_sequence_param(context_ENC_p ctx, object_buf
         ctx->buffer_size = ctx->sRCParams.BitsPerSecond;
         ctx->initial_buffer_fullness = ctx->sRCParams.BitsPerSecond;
         ctx->sRCParams.BufferSize = ctx->buffer_size;
-        ctx->sRCParams.InitialLevel = (3 * ctx->sRCParams.BufferSize) >> 4;
         /* Aligned with target frame size */
-        ctx->sRCParams.InitialLevel += (frame_size / 2);
-        ctx->sRCParams.InitialLevel /= frame_size;
-        ctx->sRCParams.InitialLevel *= frame_size;
+        ctx->sRCParams.InitialLevel = pnw__rc_initial_level(ctx->sRCParams.BufferSize, frame_size);
         ctx->sRCParams.InitialDelay = ctx->buffer_size - ctx->sRCParams.InitialLevel;
     }
 
@@ -1133,10 +1130,7 @@ static VAStatus pnw__H264ES_process_misc_param(context_ENC_p ctx, object_buffer_
                             ctx->sRCParams.BitsPerSecond);
                     break;
                 }
-                ctx->sRCParams.InitialLevel = (3 * ctx->sRCParams.BufferSize) >> 4;
-                ctx->sRCParams.InitialLevel += (frame_size / 2);
-                ctx->sRCParams.InitialLevel /= frame_size;
-                ctx->sRCParams.InitialLevel *= frame_size;
+                ctx->sRCParams.InitialLevel = pnw__rc_initial_level(ctx->sRCParams.BufferSize, frame_size);
                 ctx->sRCParams.InitialDelay =
                     ctx->sRCParams.BufferSize - ctx->sRCParams.InitialLevel;
             }
@@ -1210,7 +1204,7 @@ static VAStatus pnw__H264ES_process_misc_param(context_ENC_p ctx, object_buffer_
                         "and initial_buffer_fullness.\n"
                         "Will assign default value to them later \n");
 
-            if (ctx->initial_buffer_fullness > ctx->buffer_size) {
+            if (hrd_param->initial_buffer_fullness > hrd_param->buffer_size) {
                 drv_debug_msg(VIDEO_DEBUG_ERROR, "initial_buffer_fullnessi(%d) shouldn't be"
                         " larger that buffer_size(%d)!\n",
                         hrd_param->initial_buffer_fullness,
@@ -1341,6 +1341,12 @@ static VAStatus pnw_MPEG4_CreateContext(
         DEBUG_FAILURE;
     }
 
+    if (vaStatus == VA_STATUS_SUCCESS) {
+        /* same size as in psb__MPEG4_process_picture_param */
+        uint32_t mbInPic = PIXELS_TO_MB(obj_context->picture_width) * PIXELS_TO_MB(obj_context->picture_height) + 4;
+        vld_dec_preallocate_colocated_buffers(&ctx->dec_ctx, ((mbInPic * 200) + 0xfff) & ~0xfff);
+    }
+
     ctx->field_type = 2;
 
     if (vaStatus != VA_STATUS_SUCCESS) {
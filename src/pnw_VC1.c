@@ -561,6 +561,12 @@ static VAStatus pnw_VC1_CreateContext(
         DEBUG_FAILURE;
     }
 
+    if (vaStatus == VA_STATUS_SUCCESS) {
+        /* same size as in psb__VC1_process_picture_param, field pictures need less */
+        uint32_t size_mb = PIXELS_TO_MB(obj_context->picture_width) * PIXELS_TO_MB(obj_context->picture_height);
+        vld_dec_preallocate_colocated_buffers(&ctx->dec_ctx, ((size_mb + 1) * 2 + 128) * VC1_MB_PARAM_STRIDE);
+    }
+
     if (vaStatus != VA_STATUS_SUCCESS) {
         pnw_VC1_DestroyContext(obj_context);
     }
@@ -85,6 +85,7 @@ VAStatus pnw_cmdbuf_create(
     cmdbuf->reloc_base = NULL;
     cmdbuf->reloc_idx = NULL;
     cmdbuf->buffer_refs_count = 0;
+    memset(&cmdbuf->buffer_ref_set, 0, sizeof(cmdbuf->buffer_ref_set));
     cmdbuf->buffer_refs_allocated = 10;
     cmdbuf->buffer_refs = (psb_buffer_p *) calloc(1, sizeof(psb_buffer_p) * cmdbuf->buffer_refs_allocated);
     if (NULL == cmdbuf->buffer_refs) {
@@ -149,6 +150,7 @@ void pnw_cmdbuf_destroy(pnw_cmdbuf_p cmdbuf)
         psb_buffer_destroy(&cmdbuf->buf);
         cmdbuf->size = 0;
     }
+    psb_buffer_ref_set_destroy(&cmdbuf->buffer_ref_set);
     if (cmdbuf->buffer_refs_allocated) {
         free(cmdbuf->buffer_refs);
         cmdbuf->buffer_refs = NULL;
@@ -176,6 +178,7 @@ int pnw_cmdbuf_reset(pnw_cmdbuf_p cmdbuf)
     cmdbuf->reloc_idx = NULL;
 
     cmdbuf->buffer_refs_count = 0;
+    psb_buffer_ref_set_reset(&cmdbuf->buffer_ref_set);
     cmdbuf->cmd_count = 0;
 
     ret = psb_buffer_map(&cmdbuf->buf, &cmdbuf->cmd_base);
@@ -219,21 +222,16 @@ int pnw_cmdbuf_unmap(pnw_cmdbuf_p cmdbuf)
  */
 int pnw_cmdbuf_buffer_ref(pnw_cmdbuf_p cmdbuf, psb_buffer_p buf)
 {
-    int item_loc = 0;
+    uint32_t handle = wsbmKBufHandle(wsbmKBuf(buf->drm_buf));
+    int item_loc = psb_buffer_ref_set_find(&cmdbuf->buffer_ref_set, handle);
 
     /*Reserve the same TTM BO twice will cause kernel lock up*/
-    while ((item_loc < cmdbuf->buffer_refs_count)
-           && (wsbmKBufHandle(wsbmKBuf(cmdbuf->buffer_refs[item_loc]->drm_buf))
-               != wsbmKBufHandle(wsbmKBuf(buf->drm_buf))))
-        //while( (item_loc < cmdbuf->buffer_refs_count) && (cmdbuf->buffer_refs[item_loc] != buf) )
-    {
-        item_loc++;
-    }
-    if (item_loc == cmdbuf->buffer_refs_count) {
+    if (item_loc < 0) {
         /* Add new entry */
+        item_loc = cmdbuf->buffer_refs_count;
         if (item_loc >= cmdbuf->buffer_refs_allocated) {
             /* Allocate more entries */
-            int new_size = cmdbuf->buffer_refs_allocated + 10;
+            int new_size = cmdbuf->buffer_refs_allocated ? cmdbuf->buffer_refs_allocated * 2 : 10;
             psb_buffer_p *new_array;
             new_array = (psb_buffer_p *) calloc(1, sizeof(psb_buffer_p) * new_size);
             if (NULL == new_array) {
@@ -244,6 +242,9 @@ int pnw_cmdbuf_buffer_ref(pnw_cmdbuf_p cmdbuf, psb_buffer_p buf)
             cmdbuf->buffer_refs_allocated = new_size;
             cmdbuf->buffer_refs = new_array;
         }
+        if (psb_buffer_ref_set_add(&cmdbuf->buffer_ref_set, handle, item_loc)) {
+            return -1; /* Allocation failure */
+        }
         cmdbuf->buffer_refs[item_loc] = buf;
         cmdbuf->buffer_refs_count++;
         buf->status = psb_bs_queued;
@@ -420,6 +421,7 @@ pnwDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
         req->next = (unsigned long) & (arg_list[i+1]);
 
         req->buffer_handle = wsbmKBufHandle(wsbmKBuf(buffer_list[i]->drm_buf));
+        psb_buffer_gpu_access(buffer_list[i]);
         //req->group = 0;
         req->set_flags = (PSB_GPU_ACCESS_READ | PSB_GPU_ACCESS_WRITE) & mask;
         req->clear_flags = (~(PSB_GPU_ACCESS_READ | PSB_GPU_ACCESS_WRITE)) & mask;
@@ -444,12 +446,18 @@ pnwDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
     ca.fence_flags = fence_flags;
     ca.fence_arg = (uint64_t)((unsigned long)fence_rep);
 
+    wsbmWriteLockKernelBO();
     do {
         ret = drmCommandWrite(fd, ioctl_offset, &ca, sizeof(ca));
+        if (ret == EAGAIN) {
+            /* this engine's queue is full, let other engines submit meanwhile */
+            wsbmWriteUnlockKernelBO();
+            wsbmWriteLockKernelBO();
+        }
     } while (ret == EAGAIN);
 
     if (ret)
-        goto out;
+        goto out_unlock;
 
     for (i = 0; i < buffer_count; i++) {
         struct psb_validate_arg *arg = &(arg_list[i]);
@@ -457,15 +465,17 @@ pnwDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
 
         if (!arg->handled) {
             ret = -EFAULT;
-            goto out;
+            goto out_unlock;
         }
         if (arg->ret != 0) {
             ret = arg->ret;
-            goto out;
+            goto out_unlock;
         }
         wsbmUpdateKBuf(wsbmKBuf(buffer_list[i]->drm_buf),
                        rep->gpu_offset, rep->placement, rep->fence_type_mask);
     }
+out_unlock:
+    wsbmWriteUnlockKernelBO();
 out:
     free(arg_list);
     for (i = 0; i < buffer_count; i++) {
@@ -573,9 +583,9 @@ int pnw_context_flush_cmdbuf(object_context_p obj_context)
     ASSERT(cmdbuffer_size < CMD_SIZE);
     ASSERT((unsigned char *) cmdbuf->cmd_idx < CMD_END(cmdbuf));
     /* LOCK */
-    ret = LOCK_HARDWARE(driver_data);
+    ret = LOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
     if (ret) {
-        UNLOCK_HARDWARE(driver_data);
+        UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
         DEBUG_FAILURE_RET;
         return ret;
     }
@@ -597,15 +607,13 @@ int pnw_context_flush_cmdbuf(object_context_p obj_context)
 #define LNC_ENGINE_ENCODE  5
 #endif
 
-    wsbmWriteLockKernelBO();
     ret = pnwDRMCmdBuf(driver_data->drm_fd, driver_data->execIoctlOffset, /* FIXME Still use ioctl cmd? */
                        cmdbuf->buffer_refs, cmdbuf->buffer_refs_count, wsbmKBufHandle(wsbmKBuf(cmdbuf->buf.drm_buf)),
                        0, cmdbuffer_size,/*unsigned cmdBufSize*/
                        wsbmKBufHandle(wsbmKBuf(cmdbuf->buf.drm_buf)), reloc_offset, num_relocs,
                        0, LNC_ENGINE_ENCODE, fence_flags, &fence_rep); /* FIXME use LNC_ENGINE_ENCODE */
 
-    wsbmWriteUnlockKernelBO();
-    UNLOCK_HARDWARE(driver_data);
+    UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
 
     if (ret) {
         obj_context->pnw_cmdbuf = NULL;
@@ -109,6 +109,7 @@ struct pnw_cmdbuf_s {
     psb_buffer_p *buffer_refs;
     int buffer_refs_count;
     int buffer_refs_allocated;
+    psb_buffer_ref_set_t buffer_ref_set;
 
 };
 
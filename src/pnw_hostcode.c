@@ -1221,18 +1221,16 @@ static void pnw__setup_busize(context_ENC_p ctx)
         drv_debug_msg(VIDEO_DEBUG_GENERAL, "Patched Basic unit to %d (original=%d)\n", ctx->sRCParams.BUSize, old_busize);
 }
 
-
 static void pnw__update_rcdata(
     context_ENC_p psContext,
     PIC_PARAMS *psPicParams,
     IMG_RC_PARAMS *psRCParams)
 {
-    double      L1, L2, L3, L4, L5, L6, flBpp;
-    IMG_INT16           i16TempQP;
+    double      flBpp;
     IMG_INT32   i32BufferSizeInFrames = 0;
 
-    flBpp = 1.0 * psRCParams->BitsPerSecond
-            / (psRCParams->FrameRate * psContext->Width * psContext->Height);
+    flBpp = pnw__rc_bits_per_pixel(psRCParams->BitsPerSecond, psRCParams->FrameRate,
+                                   psContext->Width, psContext->Height);
 
     if (psContext->Width <= 176) {
         /* for very small franes we need to adjust the calculations */
@@ -1247,64 +1245,22 @@ static void pnw__update_rcdata(
     psPicParams->sInParams.BitsPerMB    = psPicParams->sInParams.BitsPerBU / psRCParams->BUSize;
     psPicParams->sInParams.TransferRate = psRCParams->BitsPerSecond / psRCParams->FrameRate;
 
-    i32BufferSizeInFrames = psRCParams->BufferSize / psPicParams->sInParams.BitsPerFrm;
+    if (psPicParams->sInParams.BitsPerFrm)
+        i32BufferSizeInFrames = psRCParams->BufferSize / psPicParams->sInParams.BitsPerFrm;
 
     /* select thresholds and initial Qps etc that are codec dependent */
     switch (psContext->eCodec) {
     case IMG_CODEC_H264_CBR:
     case IMG_CODEC_H264_VCM:
     case IMG_CODEC_H264_VBR:
-        L1 = 0.1;
-        L2 = 0.15;
-        L3 = 0.2;
-
         /* Set MaxQP to avoid blocky image in low bitrate */
         /* RCScaleFactor indicates the size of GOP for rate control */
-        if (psContext->eCodec == IMG_CODEC_H264_VCM) {
-            psPicParams->sInParams.MaxQPVal = 51;
-            psPicParams->sInParams.RCScaleFactor = 16;
-        }
-        else {
-            psPicParams->sInParams.MaxQPVal = 51;
-            psPicParams->sInParams.RCScaleFactor = 16;
-        }
+        psPicParams->sInParams.MaxQPVal = 51;
+        psPicParams->sInParams.RCScaleFactor = 16;
 
         /* Setup MAX and MIN Quant Values */
-        if (flBpp >= 0.50)
-            i16TempQP = 4;
-        else
-            i16TempQP = (unsigned int)(26 - (40 * flBpp));
-
-        psPicParams->sInParams.MinQPVal = (max(min(psPicParams->sInParams.MaxQPVal, i16TempQP), 0));
-
-        L1 = 0.050568;
-        L2 = 0.202272;
-        L3 = 0.40454321;
-        L4 = 0.80908642;
-        L5 = 1.011358025;
-        if (flBpp < L1)
-            psPicParams->sInParams.SeInitQP = (IMG_UINT8)(47 - 78.10 * flBpp);
-
-        else if (flBpp >= L1 && flBpp < L2)
-            psPicParams->sInParams.SeInitQP = (IMG_UINT8)(45 - 66.67 * flBpp);
-
-        else if (flBpp >= L2 && flBpp < L3)
-            psPicParams->sInParams.SeInitQP = (IMG_UINT8)(36 - 24.72 * flBpp);
-
-        else if (flBpp >= L3 && flBpp < L4)
-            psPicParams->sInParams.SeInitQP = (IMG_UINT8)(34 - 19.78 * flBpp);
-
-        else if (flBpp >= L4 && flBpp < L5)
-            psPicParams->sInParams.SeInitQP = (IMG_UINT8)(27 - 9.89 * flBpp);
-
-        else if (flBpp >= L5 && flBpp < 4)
-            psPicParams->sInParams.SeInitQP = (IMG_UINT8)(20 - 4.95 * flBpp);
-        else
-            psPicParams->sInParams.SeInitQP = psPicParams->sInParams.MinQPVal;
-
-        if (psPicParams->sInParams.SeInitQP < psPicParams->sInParams.MinQPVal)
-            psPicParams->sInParams.SeInitQP = psPicParams->sInParams.MinQPVal;
-
+        psPicParams->sInParams.MinQPVal = pnw__rc_h264_min_qp(flBpp);
+        psPicParams->sInParams.SeInitQP = pnw__rc_h264_initial_qp(flBpp, psPicParams->sInParams.MinQPVal);
         break;
 
     case IMG_CODEC_MPEG4_CBR:
@@ -1314,50 +1270,8 @@ static void pnw__update_rcdata(
         psPicParams->sInParams.RCScaleFactor = 16;
         psPicParams->sInParams.MaxQPVal  = 31;
 
-        if (psContext->Width <= 176) {
-            L1 = 0.043;
-            L2 = 0.085;
-            L3 = 0.126;
-            L4 = 0.168;
-            L5 = 0.336;
-            L6 = 0.505;
-        } else if (psContext->Width == 352) {
-            L1 = 0.065;
-            L2 = 0.085;
-            L3 = 0.106;
-            L4 = 0.126;
-            L5 = 0.168 ;
-            L6 = 0.210;
-        } else {
-            L1 = 0.051;
-            L2 = 0.0770;
-            L3 = 0.096;
-            L4 = 0.145;
-            L5 = 0.193;
-            L6 = 0.289;
-        }
-
         /* Calculate Initial QP if it has not been specified */
-        if (flBpp < L1)
-            psPicParams->sInParams.SeInitQP = 31;
-
-        else if (flBpp >= L1 && flBpp < L2)
-            psPicParams->sInParams.SeInitQP = 26;
-
-        else if (flBpp >= L2 && flBpp < L3)
-            psPicParams->sInParams.SeInitQP = 22;
-
-        else if (flBpp >= L3 && flBpp < L4)
-            psPicParams->sInParams.SeInitQP = 18;
-
-        else if (flBpp >= L4 && flBpp < L5)
-            psPicParams->sInParams.SeInitQP = 14;
-
-        else if (flBpp >= L5 && flBpp < L6)
-            psPicParams->sInParams.SeInitQP = 10;
-        else
-            psPicParams->sInParams.SeInitQP = 8;
-
+        psPicParams->sInParams.SeInitQP = pnw__rc_other_initial_qp(flBpp, psContext->Width);
         psPicParams->sInParams.AvQPVal =  psPicParams->sInParams.SeInitQP;
 
         if (flBpp >= 0.25
@@ -1396,17 +1310,7 @@ static void pnw__update_rcdata(
             psPicParams->sInParams.VCMBitrateMargin -= 5;
         }
         psPicParams->sInParams.ForeceSkipMargin = 0; /* start skipping MBs when within 500 bits of slice or frame limit */
-        if (psRCParams->BitsPerSecond < 1000000) {      // 1 Mbits/s
-            psPicParams->sInParams.ScaleFactor = 0;
-        } else if (psRCParams->BitsPerSecond < 2000000) { // 2 Mbits/s
-            psPicParams->sInParams.ScaleFactor = 1;
-        } else if (psRCParams->BitsPerSecond < 4000000) { // 4 Mbits/s
-            psPicParams->sInParams.ScaleFactor = 2;
-        } else if (psRCParams->BitsPerSecond < 8000000) { // 8 Mbits/s
-            psPicParams->sInParams.ScaleFactor = 3;
-        } else {
-            psPicParams->sInParams.ScaleFactor = 4;
-        }
+        psPicParams->sInParams.ScaleFactor = pnw__rc_scale_factor(psRCParams->BitsPerSecond, IMG_FALSE);
 
         psPicParams->sInParams.BufferSize = i32BufferSizeInFrames;
 
@@ -1417,18 +1321,7 @@ static void pnw__update_rcdata(
         /* Initialize the parameters of fluid flow traffic model. */
         psPicParams->sInParams.BufferSize = psRCParams->BufferSize;
 
-        /* HRD consideration - These values are used by H.264 reference code. */
-        if (psRCParams->BitsPerSecond < 1000000) {      /* 1 Mbits/s */
-            psPicParams->sInParams.ScaleFactor = 0;
-        } else if (psRCParams->BitsPerSecond < 2000000) { /* 2 Mbits/s */
-            psPicParams->sInParams.ScaleFactor = 1;
-        } else if (psRCParams->BitsPerSecond < 4000000) { /* 4 Mbits/s */
-            psPicParams->sInParams.ScaleFactor = 2;
-        } else if (psRCParams->BitsPerSecond < 8000000) { /* 8 Mbits/s */
-            psPicParams->sInParams.ScaleFactor = 3;
-        } else {
-            psPicParams->sInParams.ScaleFactor = 4;
-        }
+        psPicParams->sInParams.ScaleFactor = pnw__rc_scale_factor(psRCParams->BitsPerSecond, IMG_FALSE);
         break;
 
     case IMG_CODEC_MPEG4_CBR:
@@ -1436,7 +1329,7 @@ static void pnw__update_rcdata(
         psPicParams->Flags |= ISCBR_FLAGS;
 
         flBpp  = 256 * (psRCParams->BitsPerSecond / psContext->Width);
-        flBpp /= (psContext->Height * psRCParams->FrameRate);
+        flBpp /= ((double)psContext->Height * psRCParams->FrameRate);
 
         if ((psPicParams->sInParams.MBPerFrm > 1024 && flBpp < 16) || (psPicParams->sInParams.MBPerFrm <= 1024 && flBpp < 24))
             psPicParams->sInParams.HalfFrameRate = 1;
@@ -1470,15 +1363,7 @@ static void pnw__update_rcdata(
                 psPicParams->sInParams.BufferSize = 112 * 16384; // Simple Profile L5 Constraints
         }
 
-        /* These scale factor are used only for rate control to avoid overflow */
-        /* in fixed-point calculation these scale factors are decided by bit rate */
-        if (psRCParams->BitsPerSecond < 640000) {
-            psPicParams->sInParams.ScaleFactor  = 2;                                            /* related to complexity */
-        } else if (psRCParams->BitsPerSecond < 2000000) {
-            psPicParams->sInParams.ScaleFactor  = 4;
-        } else {
-            psPicParams->sInParams.ScaleFactor  = 6;
-        }
+        psPicParams->sInParams.ScaleFactor = pnw__rc_scale_factor(psRCParams->BitsPerSecond, IMG_TRUE);
         break;
     default:
         break;
@@ -34,6 +34,7 @@
 #include "pnw_cmdbuf.h"
 #include "pnw_hostjpeg.h"
 #include "pnw_hostheader.h"
+#include "pnw_hostrc.h"
 
 #define TOPAZ_PIC_PARAMS_VERBOSE 0
 
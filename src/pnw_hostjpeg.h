@@ -627,6 +627,7 @@ typedef struct context_jpeg_ENC_s {
     unsigned char *ctx;
     IMG_UINT32 ui32SizePerCodedBuffer;
     IMG_UINT8  ui8ScanNum;
+    IMG_BOOL   bContiguousOutput;  /* hand out the JFIF stream as one coded segment, VA_PSB_JPEG_OUTPUT_CONTIGUOUS */
 } TOPAZSC_JPEG_ENCODER_CONTEXT;
 
 //////////////////////////////////////////////////////
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "pnw_hostrc.h"
+
+/*
+ * Rate control heuristics below only depend on their arguments, so the
+ * values they give can be checked for any stream setup without a context.
+ */
+double pnw__rc_bits_per_pixel(
+    IMG_UINT32 BitsPerSecond,
+    IMG_UINT32 FrameRate,
+    IMG_UINT16 Width,
+    IMG_UINT16 Height)
+{
+    /* high frame rates at large sizes overflow an integer product */
+    return 1.0 * BitsPerSecond / ((double)FrameRate * Width * Height);
+}
+
+IMG_UINT8 pnw__rc_h264_min_qp(double flBpp)
+{
+    IMG_INT16 i16TempQP;
+
+    if (flBpp >= 0.50)
+        i16TempQP = 4;
+    else
+        i16TempQP = (unsigned int)(26 - (40 * flBpp));
+
+    if (i16TempQP > 51)
+        i16TempQP = 51;
+    if (i16TempQP < 0)
+        i16TempQP = 0;
+
+    return i16TempQP;
+}
+
+IMG_UINT8 pnw__rc_h264_initial_qp(double flBpp, IMG_UINT8 MinQPVal)
+{
+    const double L1 = 0.050568;
+    const double L2 = 0.202272;
+    const double L3 = 0.40454321;
+    const double L4 = 0.80908642;
+    const double L5 = 1.011358025;
+    IMG_UINT8 SeInitQP;
+
+    if (flBpp < L1)
+        SeInitQP = (IMG_UINT8)(47 - 78.10 * flBpp);
+
+    else if (flBpp >= L1 && flBpp < L2)
+        SeInitQP = (IMG_UINT8)(45 - 66.67 * flBpp);
+
+    else if (flBpp >= L2 && flBpp < L3)
+        SeInitQP = (IMG_UINT8)(36 - 24.72 * flBpp);
+
+    else if (flBpp >= L3 && flBpp < L4)
+        SeInitQP = (IMG_UINT8)(34 - 19.78 * flBpp);
+
+    else if (flBpp >= L4 && flBpp < L5)
+        SeInitQP = (IMG_UINT8)(27 - 9.89 * flBpp);
+
+    else if (flBpp >= L5 && flBpp < 4)
+        SeInitQP = (IMG_UINT8)(20 - 4.95 * flBpp);
+    else
+        SeInitQP = MinQPVal;
+
+    if (SeInitQP < MinQPVal)
+        SeInitQP = MinQPVal;
+
+    return SeInitQP;
+}
+
+IMG_UINT8 pnw__rc_other_initial_qp(double flBpp, IMG_UINT16 Width)
+{
+    double L1, L2, L3, L4, L5, L6;
+
+    if (Width <= 176) {
+        L1 = 0.043;
+        L2 = 0.085;
+        L3 = 0.126;
+        L4 = 0.168;
+        L5 = 0.336;
+        L6 = 0.505;
+    } else if (Width == 352) {
+        L1 = 0.065;
+        L2 = 0.085;
+        L3 = 0.106;
+        L4 = 0.126;
+        L5 = 0.168 ;
+        L6 = 0.210;
+    } else {
+        L1 = 0.051;
+        L2 = 0.0770;
+        L3 = 0.096;
+        L4 = 0.145;
+        L5 = 0.193;
+        L6 = 0.289;
+    }
+
+    if (flBpp < L1)
+        return 31;
+    else if (flBpp >= L1 && flBpp < L2)
+        return 26;
+    else if (flBpp >= L2 && flBpp < L3)
+        return 22;
+    else if (flBpp >= L3 && flBpp < L4)
+        return 18;
+    else if (flBpp >= L4 && flBpp < L5)
+        return 14;
+    else if (flBpp >= L5 && flBpp < L6)
+        return 10;
+    return 8;
+}
+
+IMG_UINT8 pnw__rc_scale_factor(IMG_UINT32 BitsPerSecond, IMG_BOOL bVBR)
+{
+    if (bVBR) {
+        /* These scale factor are used only for rate control to avoid overflow */
+        /* in fixed-point calculation these scale factors are decided by bit rate */
+        if (BitsPerSecond < 640000)
+            return 2;                       /* related to complexity */
+        else if (BitsPerSecond < 2000000)
+            return 4;
+        return 6;
+    }
+
+    /* HRD consideration - These values are used by H.264 reference code. */
+    if (BitsPerSecond < 1000000)            /* 1 Mbits/s */
+        return 0;
+    else if (BitsPerSecond < 2000000)       /* 2 Mbits/s */
+        return 1;
+    else if (BitsPerSecond < 4000000)       /* 4 Mbits/s */
+        return 2;
+    else if (BitsPerSecond < 8000000)       /* 8 Mbits/s */
+        return 3;
+    return 4;
+}
+
+/*
+ * Initial buffer level: 3/16 of the buffer, aligned with the target frame
+ * size. Without bits per frame (a rate below the frame rate) it is left
+ * unaligned instead of dividing by zero.
+ */
+IMG_UINT32 pnw__rc_initial_level(IMG_UINT32 BufferSize, IMG_UINT32 FrameSize)
+{
+    IMG_UINT64 Level = ((IMG_UINT64)3 * BufferSize) >> 4;
+
+    if (FrameSize)
+        Level = ((Level + FrameSize / 2) / FrameSize) * FrameSize;
+
+    return (IMG_UINT32)Level;
+}
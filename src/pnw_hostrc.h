@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _PNW_HOSTRC_H_
+#define _PNW_HOSTRC_H_
+
+#include "img_types.h"
+
+double pnw__rc_bits_per_pixel(
+    IMG_UINT32 BitsPerSecond,
+    IMG_UINT32 FrameRate,
+    IMG_UINT16 Width,
+    IMG_UINT16 Height);
+IMG_UINT8 pnw__rc_h264_min_qp(double flBpp);
+IMG_UINT8 pnw__rc_h264_initial_qp(double flBpp, IMG_UINT8 MinQPVal);
+IMG_UINT8 pnw__rc_other_initial_qp(double flBpp, IMG_UINT16 Width);
+IMG_UINT8 pnw__rc_scale_factor(IMG_UINT32 BitsPerSecond, IMG_BOOL bVBR);
+IMG_UINT32 pnw__rc_initial_level(IMG_UINT32 BufferSize, IMG_UINT32 FrameSize);
+
+#endif //_PNW_HOSTRC_H_
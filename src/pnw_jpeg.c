@@ -40,6 +40,7 @@
 #include "pnw_hostcode.h"
 #include "pnw_hostheader.h"
 #include "pnw_hostjpeg.h"
+#include "psb_va_ext.h"
 
 #define INIT_CONTEXT_JPEG       context_ENC_p ctx = (context_ENC_p) obj_context->format_data
 #define SURFACE(id)    ((object_surface_p) object_heap_lookup( &ctx->obj_context->driver_data->surface_heap, id ))
@@ -94,6 +95,9 @@ static void pnw_jpeg_QueryConfigAttributes(
                and a surface of that source size is allocatable. */
             attrib_list[i].value = 0; /* No pure limitation */
             break;
+        case VAConfigAttribPSBJPEGOutput:
+            attrib_list[i].value = VA_PSB_JPEG_OUTPUT_SEGMENTS | VA_PSB_JPEG_OUTPUT_CONTIGUOUS;
+            break;
         default:
             attrib_list[i].value = VA_ATTRIB_NOT_SUPPORTED;
             break;
@@ -116,6 +120,11 @@ static VAStatus pnw_jpeg_ValidateConfig(
             break;
         case VAConfigAttribRateControl:
             break;
+        case VAConfigAttribPSBJPEGOutput:
+            if (obj_config->attrib_list[i].value != VA_PSB_JPEG_OUTPUT_SEGMENTS &&
+                obj_config->attrib_list[i].value != VA_PSB_JPEG_OUTPUT_CONTIGUOUS)
+                return VA_STATUS_ERROR_INVALID_VALUE;
+            break;
         default:
             return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
         }
@@ -197,6 +206,14 @@ static VAStatus pnw_jpeg_CreateContext(
     jpeg_ctx_p = ctx->jpeg_ctx;
     jpeg_ctx_p->eFormat = ctx->eFormat;
 
+    for (i = 0; i < obj_config->attrib_count; i++) {
+        if (VAConfigAttribPSBJPEGOutput == obj_config->attrib_list[i].type &&
+            VA_PSB_JPEG_OUTPUT_CONTIGUOUS == obj_config->attrib_list[i].value) {
+            drv_debug_msg(VIDEO_DEBUG_GENERAL, "JPEG encoding: output the JFIF stream as one coded segment\n");
+            jpeg_ctx_p->bContiguousOutput = IMG_TRUE;
+        }
+    }
+
     /*Chroma sampling step x_step X y_step*/
     jpeg_ctx_p->ui8ScanNum = JPEG_SCANNING_COUNT(ctx->Width, ctx->Height, ctx->NumCores, jpeg_ctx_p->eFormat);
 
@@ -387,6 +404,9 @@ static VAStatus pnw__jpeg_process_picture_param(context_ENC_p ctx, object_buffer
         return VA_STATUS_ERROR_INVALID_BUFFER;
     }
 
+    /* a new image, markers get appended again on its first map */
+    CLEAR_CODEDBUF_INFO(MAPPED, ctx->coded_buf->codedbuf_aux_info);
+
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "Set Quant Tables\n");
     /*Set Quant Tables*/
     for (i = ctx->NumCores - 1; i >= 0; i--)
@@ -690,6 +710,10 @@ VAStatus pnw_jpeg_AppendMarkers(object_context_p obj_context, unsigned char *raw
 
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "Add two bytes to last part of coded buffer,"
                              " total: %d\n", pContext->jpeg_coded_buf.ui32BytesWritten);
+
+    if (pContext->bContiguousOutput)
+        psb_codedbuf_compact_jpeg(raw_coded_buf);
+
     return VA_STATUS_SUCCESS;
 }
 
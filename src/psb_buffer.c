@@ -32,6 +32,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wsbm/wsbm_manager.h>
 
@@ -56,6 +57,7 @@
 #include "pnw_jpeg.h"
 #include "pnw_H264ES.h"
 #include "tng_jpegES.h"
+#include "tng_hostcode.h"
 #endif
 
 #include "linux/vsp_fw.h"
@@ -195,6 +197,8 @@ VAStatus psb_buffer_create(psb_driver_data_p driver_data,
     buf->pl_flags = placement;
     buf->status = psb_bs_ready;
     buf->wsbm_synccpu_flag = 0;
+    buf->map_addr = NULL;
+    buf->gpu_busy = 0;
 
     return VA_STATUS_SUCCESS;
 }
@@ -265,12 +269,16 @@ VAStatus psb_buffer_create_from_ub(psb_driver_data_p driver_data,
     ret = wsbmBODataUB(buf->drm_buf, size, NULL, NULL, 0, vaddr);
     if (ret) {
         drv_debug_msg(VIDEO_DEBUG_ERROR, "Failed to alloc wsbm buffers, buf->drm_buf is 0x%x, size is %d, vaddr is 0x%x\n", buf->drm_buf, size, vaddr);
-        return 1;
+        wsbmBOUnreference(&buf->drm_buf);
+        UNLOCK_HARDWARE(driver_data);
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
     }
 
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "Create BO from user buffer 0x%08x (%d byte),BO GPU offset hint=0x%08x\n",
     vaddr, size, wsbmBOOffsetHint(buf->drm_buf));
 
+    UNLOCK_HARDWARE(driver_data);
+
     buf->pl_flags = placement;
     buf->status = psb_bs_ready;
     buf->wsbm_synccpu_flag = 0;
@@ -309,6 +317,8 @@ VAStatus psb_buffer_reference(psb_driver_data_p driver_data,
 
     memcpy(buf, reference_buf, sizeof(*buf));
     buf->drm_buf = NULL;
+    buf->map_addr = NULL;
+    buf->gpu_busy = 0;
 
     ret = LOCK_HARDWARE(driver_data);
     if (ret) {
@@ -380,6 +390,40 @@ VAStatus psb_kbuffer_reference(psb_driver_data_p driver_data,
 
     return VA_STATUS_SUCCESS;
 }
+
+/*
+ * Buffers that only this process hands to the video engines keep their CPU
+ * mapping for their lifetime, and map/unmap only moves the buffer between
+ * the GPU and CPU domains. The GPU owns a buffer from the submission that
+ * validates it until the next map, which syncs it for the CPU once; maps of
+ * a buffer the GPU has not seen since need no ioctl, so filling a new buffer
+ * never waits. Shared, cached and user memory, and tracing, keep the
+ * sync/map/release cycle on every map.
+ */
+static int psb_buffer_is_persistent(psb_buffer_p buf)
+{
+    return (buf->type == psb_bt_cpu_vpu || buf->type == psb_bt_vpu_only) &&
+           !(buf->pl_flags & (WSBM_PL_FLAG_SHARED | WSBM_PL_FLAG_CACHED)) &&
+           !buf->user_ptr && !buf->handle && !psb_video_trace_fp;
+}
+
+static int psb_buffer_synccpu_flag(int access)
+{
+    int flag = 0;
+
+    if (access & PSB_BUFFER_MAP_READ)
+        flag |= WSBM_SYNCCPU_READ;
+    if (access & PSB_BUFFER_MAP_WRITE)
+        flag |= WSBM_SYNCCPU_WRITE;
+
+    return flag;
+}
+
+void psb_buffer_gpu_access(psb_buffer_p buf)
+{
+    buf->gpu_busy = 1;
+}
+
 /*
  * Destroy buffer
  */
@@ -390,6 +434,10 @@ void psb_buffer_destroy(psb_buffer_p buf)
         return;
     if (psb_bs_unfinished != buf->status) {
         ASSERT(buf->driver_data);
+        if (psb_buffer_is_persistent(buf) && buf->map_addr) {
+            wsbmBOUnmap(buf->drm_buf);
+            buf->map_addr = NULL;
+        }
         wsbmBOUnreference(&buf->drm_buf);
         if (buf->rar_handle)
             buf->rar_handle = 0;
@@ -404,12 +452,41 @@ void psb_buffer_destroy(psb_buffer_p buf)
  * Returns 0 on success
  */
 int psb_buffer_map(psb_buffer_p buf, unsigned char **address /* out */)
+{
+    return psb_buffer_map_access(buf, address, PSB_BUFFER_MAP_READ | PSB_BUFFER_MAP_WRITE);
+}
+
+int psb_buffer_map_access(psb_buffer_p buf, unsigned char **address /* out */, int access)
 {
     int ret;
 
     ASSERT(buf);
     ASSERT(buf->driver_data);
 
+    if (psb_buffer_is_persistent(buf)) {
+        if (buf->gpu_busy) {
+            ret = wsbmBOSyncForCpu(buf->drm_buf, psb_buffer_synccpu_flag(access));
+            if (ret) {
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "faild to sync bo for cpu\n");
+                return ret;
+            }
+            (void) wsbmBOReleaseFromCpu(buf->drm_buf, psb_buffer_synccpu_flag(access));
+            buf->gpu_busy = 0;
+        }
+
+        if (buf->map_addr == NULL)
+            buf->map_addr = wsbmBOMap(buf->drm_buf, WSBM_ACCESS_READ | WSBM_ACCESS_WRITE);
+
+        *address = buf->map_addr;
+        if (*address == NULL) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to map buffer\n");
+            return -1;
+        }
+
+        buf->wsbm_synccpu_flag = psb_buffer_synccpu_flag(access);
+        return 0;
+    }
+
     /* multiple mapping not allowed */
     if (buf->wsbm_synccpu_flag) {
         drv_debug_msg(VIDEO_DEBUG_GENERAL, "Multiple mapping request detected, unmap previous mapping\n");
@@ -419,7 +496,7 @@ int psb_buffer_map(psb_buffer_p buf, unsigned char **address /* out */)
     }
 
     /* don't think TG deal with READ/WRITE differently */
-    buf->wsbm_synccpu_flag = WSBM_SYNCCPU_READ | WSBM_SYNCCPU_WRITE;
+    buf->wsbm_synccpu_flag = psb_buffer_synccpu_flag(access);
     if (psb_video_trace_fp) {
         wsbmBOWaitIdle(buf->drm_buf, 0);
     } else {
@@ -453,6 +530,12 @@ int psb_buffer_unmap(psb_buffer_p buf)
     ASSERT(buf);
     ASSERT(buf->driver_data);
 
+    /* mapping is kept, the buffer goes back to the GPU when a submission validates it */
+    if (psb_buffer_is_persistent(buf)) {
+        buf->wsbm_synccpu_flag = 0;
+        return 0;
+    }
+
     if (buf->wsbm_synccpu_flag)
         (void) wsbmBOReleaseFromCpu(buf->drm_buf, buf->wsbm_synccpu_flag);
 
@@ -489,9 +572,14 @@ static void psb__trace_coded(VACodedBufferSegment *vaCodedBufSeg)
 }
 #endif
 
+/* older libva headers lack the status for a coded buffer too small for the frame */
+#ifndef VA_STATUS_ERROR_NOT_ENOUGH_BUFFER
+#define VA_STATUS_ERROR_NOT_ENOUGH_BUFFER       0x00000025
+#endif
+
 #define PROFILE_H264(profile) ((profile>=VAProfileH264Baseline && profile <=VAProfileH264High) || \
                                (profile == VAProfileH264ConstrainedBaseline))
-static void tng_get_coded_data(
+static VAStatus tng_get_coded_data(
     object_buffer_p obj_buffer,
     unsigned char *raw_codedbuf
 )
@@ -502,6 +590,8 @@ static void tng_get_coded_data(
     unsigned int uiPipeNum = tng_get_pipe_number(obj_context);
     unsigned int uiBufOffset = tng_align_KB(obj_buffer->size >> 1);
     unsigned long *ptmp = NULL;
+    unsigned int uiSegCapacity, uiSegMax;
+    IMG_BOOL bOverflow = IMG_FALSE;
     int tmp;
 
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s pipenum = 0x%x\n", __FUNCTION__, uiPipeNum);
@@ -522,10 +612,28 @@ static void tng_get_coded_data(
 	vaCodedBufSeg[iPipeIndex].size  = tmp;
     }
 
+    /*
+     * A frame larger than its part of the coded buffer is incomplete. The
+     * segment keeps the size the encoder needed and the overflow status bit,
+     * and the map fails with VA_STATUS_ERROR_NOT_ENOUGH_BUFFER, so the
+     * application re-encodes the frame into a bigger coded buffer instead
+     * of taking a truncated frame.
+     */
+    uiSegCapacity = ((uiPipeNum == 2) ? uiBufOffset : obj_buffer->size) - TNG_CODEDBUF_HEADER_SIZE;
+    if (vaCodedBufSeg[iPipeIndex].size > uiSegCapacity) {
+        drv_debug_msg(VIDEO_DEBUG_WARNING, "%s: coded data %d exceeds coded buffer space %d\n",
+                      __FUNCTION__, vaCodedBufSeg[iPipeIndex].size, uiSegCapacity);
+        vaCodedBufSeg[iPipeIndex].status |= VA_CODED_BUF_STATUS_FRAME_SIZE_OVERFLOW;
+        bOverflow = IMG_TRUE;
+    }
+    uiSegMax = vaCodedBufSeg[iPipeIndex].size;
+
     vaCodedBufSeg[iPipeIndex].buf = (unsigned char *)(((unsigned long *)((unsigned long)raw_codedbuf)) + 16); /* skip 4DWs */
 
     ptmp = (unsigned long *)((unsigned long)raw_codedbuf); 
     vaCodedBufSeg[iPipeIndex].reserved = (ptmp[1] >> 6) & 0xf;
+    vaCodedBufSeg[iPipeIndex].reserved |=
+        GET_CODEDBUF_INFO(TEMPORAL_ID, obj_buffer->codedbuf_aux_info) << PSB_CODEDBUF_SEG_TEMPORAL_ID_SHIFT;
     vaCodedBufSeg[iPipeIndex].next = NULL;
 
 
@@ -551,16 +659,79 @@ static void tng_get_coded_data(
             vaCodedBufSeg[iPipeIndex].size  = tmp;
         }
 
+        uiSegCapacity = obj_buffer->size - uiBufOffset - TNG_CODEDBUF_HEADER_SIZE;
+        if (vaCodedBufSeg[iPipeIndex].size > uiSegCapacity) {
+            drv_debug_msg(VIDEO_DEBUG_WARNING, "%s: coded data %d exceeds coded buffer space %d\n",
+                          __FUNCTION__, vaCodedBufSeg[iPipeIndex].size, uiSegCapacity);
+            bOverflow = IMG_TRUE;
+        }
+        if (vaCodedBufSeg[iPipeIndex].size > uiSegMax)
+            uiSegMax = vaCodedBufSeg[iPipeIndex].size;
+
         vaCodedBufSeg[iPipeIndex].buf = (unsigned char *)(((unsigned long *)((unsigned long)raw_codedbuf + uiBufOffset)) + 16); /* skip 4DWs */
         vaCodedBufSeg[iPipeIndex].reserved = vaCodedBufSeg[iPipeIndex - 1].reserved;
         vaCodedBufSeg[iPipeIndex].next = NULL;
+
+        /* the status of a frame is read from its first segment */
+        if (bOverflow)
+            vaCodedBufSeg[0].status |= VA_CODED_BUF_STATUS_FRAME_SIZE_OVERFLOW;
+        vaCodedBufSeg[iPipeIndex].status = vaCodedBufSeg[0].status;
+    }
+
+    /* feed the observed size back to the rate control and the coded buffer size, once per frame */
+    if (!GET_CODEDBUF_INFO(MAPPED, obj_buffer->codedbuf_aux_info)) {
+        tng_update_codedbuf_stats(obj_context, (P_CODED_DATA_HDR)raw_codedbuf,
+                                  uiSegMax * uiPipeNum, bOverflow);
+        tng_update_complexity_drift(obj_context, vaCodedBufSeg[0].size +
+                                    ((uiPipeNum == 2) ? vaCodedBufSeg[1].size : 0));
+        SET_CODEDBUF_INFO(MAX_FRAME_SIZE, obj_buffer->codedbuf_aux_info,
+                          tng_check_max_frame_size(obj_context, (P_CODED_DATA_HDR)raw_codedbuf,
+                                                   vaCodedBufSeg[0].size +
+                                                   ((uiPipeNum == 2) ? vaCodedBufSeg[1].size : 0)));
+        SET_CODEDBUF_INFO(MAPPED, obj_buffer->codedbuf_aux_info, 1);
+    }
+
+    /* a frame over the max frame size is reported like an overflowing one, on every map */
+    if (GET_CODEDBUF_INFO(MAX_FRAME_SIZE, obj_buffer->codedbuf_aux_info)) {
+        vaCodedBufSeg[0].status |= VA_CODED_BUF_STATUS_FRAME_SIZE_OVERFLOW;
+        if (uiPipeNum == 2)
+            vaCodedBufSeg[1].status = vaCodedBufSeg[0].status;
     }
 
 #ifdef _MRFL_DEBUG_CODED_
     psb__trace_coded(vaCodedBufSeg);
 #endif
 
-    return ;
+    return bOverflow ? VA_STATUS_ERROR_NOT_ENOUGH_BUFFER : VA_STATUS_SUCCESS;
+}
+
+/*
+ * JPEG encoders write every scan into its own part of the coded buffer. Each
+ * part starts with a 4 DW header holding the bytes used in DW0 and the offset
+ * of the next part in DW3, 0 for the last one. Move the scan data of every
+ * part down behind the JPEG headers in the first part, so the application
+ * gets the whole JFIF stream as a single coded segment.
+ */
+void psb_codedbuf_compact_jpeg(unsigned char *raw_codedbuf)
+{
+    uint32_t *first_header = (uint32_t *)raw_codedbuf;
+    uint32_t *part_header;
+    unsigned char *dst = raw_codedbuf + 4 * sizeof(uint32_t) + first_header[0];
+    uint32_t next_offset = first_header[3];
+    uint32_t bytes_used;
+
+    while (next_offset != 0) {
+        part_header = (uint32_t *)(raw_codedbuf + next_offset);
+        /* the move may overwrite this part's header, so read it first */
+        next_offset = part_header[3];
+        bytes_used = part_header[0];
+
+        memmove(dst, part_header + 4, bytes_used);
+        dst += bytes_used;
+        first_header[0] += bytes_used;
+    }
+
+    first_header[3] = 0;
 }
 
 /*
@@ -631,7 +802,15 @@ int psb_codedbuf_map_mangle(
             case VAProfileH264ConstrainedBaseline:
             case VAProfileH263Baseline:
                 /* 1st segment */
-                tng_get_coded_data(obj_buffer, raw_codedbuf);
+                vaStatus = tng_get_coded_data(obj_buffer, raw_codedbuf);
+                if (vaStatus == VA_STATUS_ERROR_NOT_ENOUGH_BUFFER) {
+                    /* only the size and status of the segments are left for the application */
+                    for (; p; p = p->next)
+                        p->buf = NULL;
+
+                    psb_buffer_unmap(obj_buffer->psb_buffer);
+                    obj_buffer->buffer_data = NULL;
+                }
 #if 0
                 p->size = *((unsigned long *) raw_codedbuf);
                 p->buf = (unsigned char *)((unsigned long *) raw_codedbuf + 16); /* skip 16DWs */
@@ -682,8 +861,12 @@ int psb_codedbuf_map_mangle(
 		break;
             }
             case VAProfileJPEGBaseline:
-                /* 3~6 segment */
-                tng_jpeg_AppendMarkers(obj_context, raw_codedbuf);
+                /* 3~6 segments, or one with VA_PSB_JPEG_OUTPUT_CONTIGUOUS */
+                /* markers and compaction rewrite the parts, only run them on the first map */
+                if (!GET_CODEDBUF_INFO(MAPPED, obj_buffer->codedbuf_aux_info)) {
+                    tng_jpeg_AppendMarkers(obj_context, raw_codedbuf);
+                    SET_CODEDBUF_INFO(MAPPED, obj_buffer->codedbuf_aux_info, 1);
+                }
                 next_buf_off = 0;
                 /*Max resolution 4096x4096 use 6 segments*/
                 for (i = 0; i < PTG_JPEG_MAX_SCAN_NUM + 1; i++) {
@@ -795,9 +978,13 @@ int psb_codedbuf_map_mangle(
             break;
 
         case VAProfileJPEGBaseline:
-            /* 3~6 segment
+            /* 3~6 segments, or one with VA_PSB_JPEG_OUTPUT_CONTIGUOUS
                  */
-            pnw_jpeg_AppendMarkers(obj_context, raw_codedbuf);
+            /* markers and compaction rewrite the parts, only run them on the first map */
+            if (!GET_CODEDBUF_INFO(MAPPED, obj_buffer->codedbuf_aux_info)) {
+                pnw_jpeg_AppendMarkers(obj_context, raw_codedbuf);
+                SET_CODEDBUF_INFO(MAPPED, obj_buffer->codedbuf_aux_info, 1);
+            }
             next_buf_off = 0;
             /*Max resolution 4096x4096 use 6 segments*/
             for (i = 0; i < PNW_JPEG_MAX_SCAN_NUM + 1; i++) {
@@ -827,6 +1014,94 @@ int psb_codedbuf_map_mangle(
     }
 #endif
 
+    return vaStatus;
+}
+
+#define PSB_BUFFER_REF_SET_MIN_SIZE 32
+
+static inline unsigned int psb_buffer_ref_hash(uint32_t handle, unsigned int size)
+{
+    /* handles are small sequential integers, spread them over the table */
+    return (handle * 2654435761u) & (size - 1);
+}
+
+int psb_buffer_ref_set_find(psb_buffer_ref_set_t *set, uint32_t handle)
+{
+    unsigned int i;
+
+    if (0 == set->size)
+        return -1;
+
+    for (i = psb_buffer_ref_hash(handle, set->size);
+         set->slots[i].gen == set->gen;
+         i = (i + 1) & (set->size - 1)) {
+        if (set->slots[i].handle == handle)
+            return set->slots[i].index;
+    }
+    return -1;
+}
+
+static void psb_buffer_ref_set_insert(psb_buffer_ref_set_t *set, uint32_t handle, int index)
+{
+    unsigned int i = psb_buffer_ref_hash(handle, set->size);
+
+    while (set->slots[i].gen == set->gen)
+        i = (i + 1) & (set->size - 1);
+
+    set->slots[i].handle = handle;
+    set->slots[i].gen = set->gen;
+    set->slots[i].index = index;
+    set->count++;
+}
+
+int psb_buffer_ref_set_add(psb_buffer_ref_set_t *set, uint32_t handle, int index)
+{
+    /* keep the load under one half so probe chains stay short */
+    if ((set->count + 1) * 2 > set->size) {
+        struct psb_buffer_ref_slot_s *old_slots = set->slots;
+        unsigned int old_size = set->size;
+        uint32_t old_gen = set->gen;
+        unsigned int new_size = old_size ? old_size * 2 : PSB_BUFFER_REF_SET_MIN_SIZE;
+        unsigned int i;
+
+        set->slots = (struct psb_buffer_ref_slot_s *) calloc(new_size, sizeof(*set->slots));
+        if (NULL == set->slots) {
+            set->slots = old_slots;
+            return -1;
+        }
+        set->size = new_size;
+        set->count = 0;
+        set->gen = 1;
+
+        for (i = 0; i < old_size; i++) {
+            if (old_slots[i].gen == old_gen)
+                psb_buffer_ref_set_insert(set, old_slots[i].handle, old_slots[i].index);
+        }
+        free(old_slots);
+    }
+
+    psb_buffer_ref_set_insert(set, handle, index);
     return 0;
 }
 
+void psb_buffer_ref_set_reset(psb_buffer_ref_set_t *set)
+{
+    set->count = 0;
+    if (0 == set->size)
+        return;
+
+    /* calloc'ed slots have gen 0, which must never be the live generation */
+    if (0 == ++set->gen) {
+        memset(set->slots, 0, set->size * sizeof(*set->slots));
+        set->gen = 1;
+    }
+}
+
+void psb_buffer_ref_set_destroy(psb_buffer_ref_set_t *set)
+{
+    free(set->slots);
+    set->slots = NULL;
+    set->size = 0;
+    set->count = 0;
+    set->gen = 0;
+}
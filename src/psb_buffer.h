@@ -37,6 +37,15 @@
 /* For TopazSC, it indicates the next frame should be skipped */
 #define SKIP_NEXT_FRAME   0x800
 
+/* Older libva has no status bit for a frame that did not fit its coded buffer */
+#ifndef VA_CODED_BUF_STATUS_FRAME_SIZE_OVERFLOW
+#define VA_CODED_BUF_STATUS_FRAME_SIZE_OVERFLOW 0x1000
+#endif
+
+/* Temporal layer of an H.264 frame, in VACodedBufferSegment.reserved */
+#define PSB_CODEDBUF_SEG_TEMPORAL_ID_SHIFT  8
+#define PSB_CODEDBUF_SEG_TEMPORAL_ID_MASK   (0x7 << PSB_CODEDBUF_SEG_TEMPORAL_ID_SHIFT)
+
 typedef struct psb_buffer_s *psb_buffer_p;
 
 /* VPU = MSVDX */
@@ -82,8 +91,43 @@ struct psb_buffer_s {
     void *handle;
 	unsigned char *virtual_addr;
     int unfence_flag;
+    unsigned char *map_addr; /* CPU mapping kept until the buffer is destroyed */
+    int gpu_busy; /* handed to the GPU since the CPU last synced it */
+};
+
+/*
+ * Set of buffers referenced by one command buffer, keyed by the kernel BO
+ * handle so a BO is reserved only once per submission. Open addressing with a
+ * generation stamp: a slot is live only if its gen matches, so reset is O(1)
+ * and the table is kept across command buffer reuse.
+ */
+struct psb_buffer_ref_slot_s {
+    uint32_t handle;
+    uint32_t gen;
+    int index; /* into the command buffer's buffer_refs */
 };
 
+typedef struct psb_buffer_ref_set_s {
+    struct psb_buffer_ref_slot_s *slots;
+    unsigned int size; /* power of two, 0 until first insert */
+    unsigned int count;
+    uint32_t gen;
+} psb_buffer_ref_set_t;
+
+/*
+ * Returns the buffer_refs index recorded for "handle", -1 if not referenced
+ */
+int psb_buffer_ref_set_find(psb_buffer_ref_set_t *set, uint32_t handle);
+
+/*
+ * Records "index" for "handle"
+ * Returns 0 on success, -1 on allocation failure
+ */
+int psb_buffer_ref_set_add(psb_buffer_ref_set_t *set, uint32_t handle, int index);
+
+void psb_buffer_ref_set_reset(psb_buffer_ref_set_t *set);
+void psb_buffer_ref_set_destroy(psb_buffer_ref_set_t *set);
+
 /*
  * Create buffer
  */
@@ -137,6 +181,10 @@ void psb__suspend_buffer(psb_driver_data_p driver_data, object_buffer_p obj_buff
  */
 void psb_buffer_destroy(psb_buffer_p buf);
 
+/* CPU access intent of a mapping */
+#define PSB_BUFFER_MAP_READ     (0x1)
+#define PSB_BUFFER_MAP_WRITE    (0x1<<1)
+
 /*
  * Map buffer
  *
@@ -144,12 +192,30 @@ void psb_buffer_destroy(psb_buffer_p buf);
  */
 int psb_buffer_map(psb_buffer_p buf, unsigned char **address /* out */);
 
+/*
+ * Map buffer for PSB_BUFFER_MAP_READ and/or PSB_BUFFER_MAP_WRITE access
+ *
+ * Returns 0 on success
+ */
+int psb_buffer_map_access(psb_buffer_p buf, unsigned char **address /* out */, int access);
+
+/*
+ * Note that a command buffer hands the buffer to the GPU, called for every
+ * buffer validated by a submission
+ */
+void psb_buffer_gpu_access(psb_buffer_p buf);
+
 int psb_codedbuf_map_mangle(
     VADriverContextP ctx,
     object_buffer_p obj_buffer,
     void **pbuf /* out */
 );
 
+/*
+ * Move the scan parts of a JPEG coded buffer behind its headers
+ */
+void psb_codedbuf_compact_jpeg(unsigned char *raw_codedbuf);
+
 
 /*
  * Unmap buffer
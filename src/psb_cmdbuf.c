@@ -121,6 +121,7 @@ VAStatus psb_cmdbuf_create(object_context_p obj_context, psb_driver_data_p drive
     cmdbuf->skip_block_start = NULL;
     cmdbuf->last_next_segment_cmd = NULL;
     cmdbuf->buffer_refs_count = 0;
+    memset(&cmdbuf->buffer_ref_set, 0, sizeof(cmdbuf->buffer_ref_set));
     cmdbuf->buffer_refs_allocated = 10;
     cmdbuf->buffer_refs = (psb_buffer_p *) calloc(1, sizeof(psb_buffer_p) * cmdbuf->buffer_refs_allocated);
     if (NULL == cmdbuf->buffer_refs) {
@@ -163,6 +164,7 @@ void psb_cmdbuf_destroy(psb_cmdbuf_p cmdbuf)
         psb_buffer_destroy(&cmdbuf->regio_buf);
         cmdbuf->regio_size = 0;
     }
+    psb_buffer_ref_set_destroy(&cmdbuf->buffer_ref_set);
     if (cmdbuf->buffer_refs_allocated) {
         free(cmdbuf->buffer_refs);
         cmdbuf->buffer_refs = NULL;
@@ -190,6 +192,7 @@ int psb_cmdbuf_reset(psb_cmdbuf_p cmdbuf)
     cmdbuf->last_next_segment_cmd = NULL;
 
     cmdbuf->buffer_refs_count = 0;
+    psb_buffer_ref_set_reset(&cmdbuf->buffer_ref_set);
     cmdbuf->cmd_count = 0;
     cmdbuf->deblock_count = 0;
     cmdbuf->oold_count = 0;
@@ -253,20 +256,17 @@ int psb_cmdbuf_unmap(psb_cmdbuf_p cmdbuf)
  */
 int psb_cmdbuf_buffer_ref(psb_cmdbuf_p cmdbuf, psb_buffer_p buf)
 {
-    int item_loc = 0;
+    uint32_t handle = wsbmKBufHandle(wsbmKBuf(buf->drm_buf));
+    int item_loc = psb_buffer_ref_set_find(&cmdbuf->buffer_ref_set, handle);
 
     // buf->next = NULL; /* buf->next only used for buffer list validation */
     buf->unfence_flag = 0;
-    while ((item_loc < cmdbuf->buffer_refs_count)
-           && (wsbmKBufHandle(wsbmKBuf(cmdbuf->buffer_refs[item_loc]->drm_buf))
-               != wsbmKBufHandle(wsbmKBuf(buf->drm_buf)))) {
-        item_loc++;
-    }
-    if (item_loc == cmdbuf->buffer_refs_count) {
+    if (item_loc < 0) {
         /* Add new entry */
+        item_loc = cmdbuf->buffer_refs_count;
         if (item_loc >= cmdbuf->buffer_refs_allocated) {
             /* Allocate more entries */
-            int new_size = cmdbuf->buffer_refs_allocated + 10;
+            int new_size = cmdbuf->buffer_refs_allocated ? cmdbuf->buffer_refs_allocated * 2 : 10;
             psb_buffer_p *new_array;
             new_array = (psb_buffer_p *) calloc(1, sizeof(psb_buffer_p) * new_size);
             if (NULL == new_array) {
@@ -277,6 +277,9 @@ int psb_cmdbuf_buffer_ref(psb_cmdbuf_p cmdbuf, psb_buffer_p buf)
             cmdbuf->buffer_refs_allocated = new_size;
             cmdbuf->buffer_refs = new_array;
         }
+        if (psb_buffer_ref_set_add(&cmdbuf->buffer_ref_set, handle, item_loc)) {
+            return -1; /* Allocation failure */
+        }
         cmdbuf->buffer_refs[item_loc] = buf;
         cmdbuf->buffer_refs_count++;
         buf->status = psb_bs_queued;
@@ -448,6 +451,7 @@ psbDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
         req->next = (unsigned long) & (arg_list[i+1]);
 
         req->buffer_handle = wsbmKBufHandle(wsbmKBuf(buffer_list[i]->drm_buf));
+        psb_buffer_gpu_access(buffer_list[i]);
         //req->group = 0;
         req->set_flags = (PSB_GPU_ACCESS_READ | PSB_GPU_ACCESS_WRITE) & mask;
         req->clear_flags = (~(PSB_GPU_ACCESS_READ | PSB_GPU_ACCESS_WRITE)) & mask;
@@ -492,6 +496,7 @@ psbDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
      * X server Signals will clobber the kernel time out mechanism.
      * we need a user-space timeout as well.
      */
+    wsbmWriteLockKernelBO();
     do {
         ret = drmCommandWrite(fd, ioctl_offset, &ca, sizeof(ca));
         if (ret == EAGAIN) {
@@ -508,12 +513,15 @@ psbDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
                 break;
             }
 
+            /* this engine's queue is full, let other engines submit meanwhile */
+            wsbmWriteUnlockKernelBO();
+            wsbmWriteLockKernelBO();
         }
     } while ((ret == EAGAIN) && (psbTimeDiff(&now, &then) < PSB_TIMEOUT_USEC));
 
     if (ret) {
         drv_debug_msg(VIDEO_DEBUG_GENERAL, "command write return is %d\n", ret);
-        goto out;
+        goto out_unlock;
     }
 
     for (i = 0; i < buffer_count; i++) {
@@ -527,16 +535,17 @@ psbDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
 
         if (!arg->handled) {
             ret = -EFAULT;
-            goto out;
+            goto out_unlock;
         }
         if (arg->ret != 0) {
             ret = arg->ret;
-            goto out;
+            goto out_unlock;
         }
         wsbmUpdateKBuf(wsbmKBuf(buffer_list[i]->drm_buf),
                        rep->gpu_offset, rep->placement, rep->fence_type_mask);
     }
-
+out_unlock:
+    wsbmWriteUnlockKernelBO();
 out:
     free(arg_list);
     for (i = 0; i < buffer_count; i++) {
@@ -847,9 +856,9 @@ int psb_context_flush_cmdbuf(object_context_p obj_context)
     int i;
 
     /* LOCK */
-    ret = LOCK_HARDWARE(driver_data);
+    ret = LOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_MSVDX);
     if (ret) {
-        UNLOCK_HARDWARE(driver_data);
+        UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_MSVDX);
         DEBUG_FAILURE_RET;
         return ret;
     }
@@ -937,7 +946,6 @@ int psb_context_flush_cmdbuf(object_context_p obj_context)
 #endif
     /* cmdbuf will be validated as part of the buffer list */
     /* Submit */
-    wsbmWriteLockKernelBO();
     ret = psbDRMCmdBuf(driver_data->drm_fd, driver_data->execIoctlOffset, cmdbuf->buffer_refs,
                        cmdbuf->buffer_refs_count,
                        wsbmKBufHandle(wsbmKBuf(cmdbuf->reloc_buf.drm_buf)),
@@ -945,8 +953,7 @@ int psb_context_flush_cmdbuf(object_context_p obj_context)
                        wsbmKBufHandle(wsbmKBuf(cmdbuf->reloc_buf.drm_buf)),
                        reloc_offset, num_relocs,
                        0, PSB_ENGINE_DECODE, fence_flags, &fence_rep);
-    wsbmWriteUnlockKernelBO();
-    UNLOCK_HARDWARE(driver_data);
+    UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_MSVDX);
 
     if (ret) {
         obj_context->cmdbuf = NULL;
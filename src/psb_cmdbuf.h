@@ -87,6 +87,7 @@ struct psb_cmdbuf_s {
 
     int buffer_refs_count;
     int buffer_refs_allocated;
+    psb_buffer_ref_set_t buffer_ref_set;
     /* Pointer for Register commands */
     uint32_t *reg_start;
     uint32_t *reg_wt_p;
@@ -40,6 +40,7 @@
 #include <va/va_android.h>
 
 #include "psb_drv_video.h"
+#include "psb_va_ext.h"
 #include "psb_texture.h"
 #include "psb_cmdbuf.h"
 #ifndef BAYTRAIL
@@ -70,6 +71,7 @@
 #include "tng_H263ES.h"
 #include "tng_MPEG4ES.h"
 #include "tng_jpegES.h"
+#include "tng_hostcode.h"
 #endif
 #ifdef PSBVIDEO_MRFL_VPP
 #include "vsp_VPP.h"
@@ -87,6 +89,9 @@
 #include <wsbm/wsbm_fencemgr.h>
 #include <linux/videodev2.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "psb_def.h"
 #include "psb_drv_debug.h"
@@ -111,6 +116,9 @@
 
 #define MAX_UNUSED_BUFFERS      16
 
+/* smaller slice data is cheaper to copy than to import */
+#define PSB_SLICE_DATA_IMPORT_MIN   (64 * 1024)
+
 #define PSB_MAX_FLIP_DELAY (1000/30/10)
 
 #include <signal.h>
@@ -141,9 +149,6 @@
 static int psb_get_device_info(VADriverContextP ctx);
 
 
-void psb_init_surface_pvr2dbuf(psb_driver_data_p driver_data);
-void psb_free_surface_pvr2dbuf(psb_driver_data_p driver_data);
-
 VAStatus psb_QueryConfigProfiles(
     VADriverContextP ctx,
     VAProfile *profile_list,    /* out */
@@ -469,7 +474,9 @@ VAStatus psb_CreateConfig(
     obj_config->attrib_count = 1;
 
     for (i = 0; i < num_attribs; i++) {
-        if (attrib_list[i].type > VAConfigAttribTypeMax)
+        /* driver specific types from psb_va_ext.h are checked by the format */
+        if (attrib_list[i].type > VAConfigAttribTypeMax &&
+            attrib_list[i].type != VAConfigAttribPSBJPEGOutput)
             return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
 
         vaStatus = psb__update_attribute(obj_config, &(attrib_list[i]));
@@ -578,6 +585,9 @@ void psb__destroy_surface(psb_driver_data_p driver_data, object_surface_p obj_su
         /* delete subpicture association */
         psb_SurfaceDeassociateSubpict(driver_data, obj_surface);
 
+        /* the id may come back for other memory */
+        psb_release_surface_pvr2dbuf(driver_data, obj_surface->surface_id);
+
 	obj_surface->is_ref_surface = 0;
 
 	psb_surface_sync(obj_surface->psb_surface);
@@ -592,6 +602,10 @@ void psb__destroy_surface(psb_driver_data_p driver_data, object_surface_p obj_su
         }
 
         free(obj_surface->psb_surface);
+
+        if (obj_surface->import)
+            psb_surface_import_release(driver_data, obj_surface);
+
         object_heap_free(&driver_data->surface_heap, (object_base_p) obj_surface);
     }
 }
@@ -1383,6 +1397,52 @@ static VAStatus psb__allocate_malloc_buffer(object_buffer_p obj_buffer, int size
 
 static VAStatus psb__unmap_buffer(object_buffer_p obj_buffer);
 
+/*
+ * With PSB_VIDEO_SLICE_DATA_IMPORT set, large page aligned slice data is
+ * imported as a user buffer and decoded in place. The application then has
+ * to keep the memory unchanged until the picture is decoded.
+ */
+static int psb__slice_data_importable(psb_driver_data_p driver_data, unsigned char *data, unsigned int size)
+{
+    return driver_data->slice_data_import && data &&
+           (((unsigned long)data & 0xfff) == 0) && (size >= PSB_SLICE_DATA_IMPORT_MIN);
+}
+
+/*
+ * Bitstream is written once and only read by the decoder, stream it past
+ * the cache rather than evict the working set for it.
+ */
+static void psb__copy_slice_data(unsigned char *dst, const unsigned char *src, unsigned int size)
+{
+#ifdef __SSE2__
+    unsigned int head = (16 - ((unsigned long)dst & 15)) & 15;
+    __m128i r0, r1, r2, r3;
+
+    if (size < head + 64) {
+        memcpy(dst, src, size);
+        return;
+    }
+
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, dst += 64, src += 64) {
+        r0 = _mm_loadu_si128((const __m128i *)src);
+        r1 = _mm_loadu_si128((const __m128i *)(src + 16));
+        r2 = _mm_loadu_si128((const __m128i *)(src + 32));
+        r3 = _mm_loadu_si128((const __m128i *)(src + 48));
+        _mm_stream_si128((__m128i *)dst, r0);
+        _mm_stream_si128((__m128i *)(dst + 16), r1);
+        _mm_stream_si128((__m128i *)(dst + 32), r2);
+        _mm_stream_si128((__m128i *)(dst + 48), r3);
+    }
+    _mm_sfence();
+#endif
+    memcpy(dst, src, size);
+}
+
 static VAStatus psb__allocate_BO_buffer(psb_driver_data_p driver_data, object_context_p obj_context, object_buffer_p obj_buffer, int size, unsigned char *data, VABufferType type)
 {
     VAStatus vaStatus = VA_STATUS_SUCCESS;
@@ -1399,6 +1459,42 @@ static VAStatus psb__allocate_BO_buffer(psb_driver_data_p driver_data, object_co
         obj_buffer->alloc_size = 0;
     }
 
+    /* imported application memory only ever holds that application data */
+    if (obj_buffer->psb_buffer && (psb_bt_user_buffer == obj_buffer->psb_buffer->type)) {
+        if (obj_buffer->buffer_data)
+            psb__unmap_buffer(obj_buffer);
+        psb_buffer_destroy(obj_buffer->psb_buffer);
+        memset(obj_buffer->psb_buffer, 0, sizeof(struct psb_buffer_s));
+        obj_buffer->alloc_size = 0;
+    }
+
+    if ((type == VASliceDataBufferType) && psb__slice_data_importable(driver_data, data, size)) {
+        if (obj_buffer->psb_buffer) {
+            if (obj_buffer->buffer_data)
+                psb__unmap_buffer(obj_buffer);
+            psb_buffer_destroy(obj_buffer->psb_buffer);
+            memset(obj_buffer->psb_buffer, 0, sizeof(struct psb_buffer_s));
+        } else {
+            obj_buffer->psb_buffer = (psb_buffer_p) calloc(1, sizeof(struct psb_buffer_s));
+            if (NULL == obj_buffer->psb_buffer) {
+                vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+                DEBUG_FAILURE;
+                return vaStatus;
+            }
+        }
+        obj_buffer->alloc_size = 0;
+
+        if (psb_buffer_create_from_ub(driver_data, (size + 0xfff) & ~0xfff, psb_bt_user_buffer,
+                                      obj_buffer->psb_buffer, data, 0) == VA_STATUS_SUCCESS) {
+            obj_buffer->alloc_size = size;
+            return VA_STATUS_SUCCESS;
+        }
+
+        /* fall back to a copy */
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Failed to import slice data %p, copy it\n", data);
+        memset(obj_buffer->psb_buffer, 0, sizeof(struct psb_buffer_s));
+    }
+
     if (type == VAProtectedSliceDataBufferType) {
         if (obj_buffer->psb_buffer) {
             drv_debug_msg(VIDEO_DEBUG_GENERAL, "RAR: old RAR slice buffer with RAR handle 0%08x, current RAR handle 0x%08x\n",
@@ -1632,6 +1728,12 @@ VAStatus psb_DestroyContext(
     object_context_p obj_context = CONTEXT(context);
     CHECK_CONTEXT(obj_context);
 
+#ifdef PSBVIDEO_MRFL
+    /* submit the images still batched, the context is destroyed either way */
+    if (obj_context->format_vtable == &tng_JPEGES_vtable)
+        vaStatus = tng_jpeg_FlushBatch(obj_context);
+#endif
+
     psb__destroy_context(driver_data, obj_context);
 
     DEBUG_FUNC_EXIT
@@ -1790,10 +1892,14 @@ VAStatus psb__CreateBuffer(
         obj_buffer->size = size;
         obj_buffer->max_num_elements = num_elements;
         obj_buffer->num_elements = num_elements;
-        if (data && (obj_buffer->type != VAProtectedSliceDataBufferType)) {
+        if (data && (obj_buffer->type != VAProtectedSliceDataBufferType) &&
+            !(obj_buffer->psb_buffer && (psb_bt_user_buffer == obj_buffer->psb_buffer->type))) {
             vaStatus = psb__map_buffer(obj_buffer);
             if (VA_STATUS_SUCCESS == vaStatus) {
-                memcpy(obj_buffer->buffer_data, data, size * num_elements);
+                if (obj_buffer->type == VASliceDataBufferType)
+                    psb__copy_slice_data(obj_buffer->buffer_data, data, size * num_elements);
+                else
+                    memcpy(obj_buffer->buffer_data, data, size * num_elements);
 
                 psb__unmap_buffer(obj_buffer);
             }
@@ -1864,6 +1970,21 @@ VAStatus psb_CreateBuffer(
     CHECK_CONTEXT(obj_context);
     CHECK_INVALID_PARAM(buf_desc == NULL);
 
+#ifdef PSBVIDEO_MRFL
+    /* coded buffers grow to what the frames of the Topaz stream have needed so far */
+    if (type == VAEncCodedBufferType && num_elements == 1 && IS_MRFL(driver_data) &&
+        obj_context->entry_point == VAEntrypointEncSlice &&
+        obj_context->profile != VAProfileVP8Version0_3) {
+        unsigned int recommended_size = tng_get_codedbuf_recommended_size(obj_context);
+
+        if (recommended_size > size) {
+            drv_debug_msg(VIDEO_DEBUG_INIT, "Grow coded buffer from %d to recommended %d bytes\n",
+                          size, recommended_size);
+            size = recommended_size;
+        }
+    }
+#endif
+
     vaStatus = psb__CreateBuffer(driver_data, obj_context, type, size, num_elements, data, buf_desc);
 
     DEBUG_FUNC_EXIT
@@ -1931,6 +2052,15 @@ VAStatus psb_MapBuffer(
 
     CHECK_INVALID_PARAM(pbuf == NULL);
 
+#ifdef PSBVIDEO_MRFL
+    /* a batched JPEG image is only submitted once its coded buffer is needed */
+    if (obj_buffer->type == VAEncCodedBufferType && obj_buffer->context &&
+        obj_buffer->context->format_vtable == &tng_JPEGES_vtable) {
+        vaStatus = tng_jpeg_FlushBatch(obj_buffer->context);
+        CHECK_VASTATUS();
+    }
+#endif
+
     vaStatus = psb__map_buffer(obj_buffer);
     CHECK_VASTATUS();
 
@@ -1941,7 +2071,7 @@ VAStatus psb_MapBuffer(
          * write validate coded data offset in CodedBuffer
          */
         if (obj_buffer->type == VAEncCodedBufferType)
-            psb_codedbuf_map_mangle(ctx, obj_buffer, pbuf);
+            vaStatus = psb_codedbuf_map_mangle(ctx, obj_buffer, pbuf);
         /* *(IMG_UINT32 *)((unsigned char *)obj_buffer->buffer_data + 4) = 16; */
     } else {
         vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
@@ -2292,6 +2422,12 @@ VAStatus psb_SyncSurface(
     obj_context = CONTEXT(obj_surface->context_id);
     if (obj_context) {
         obj_config = CONFIG(obj_context->config_id);
+#ifdef PSBVIDEO_MRFL
+        if (obj_context->format_vtable == &tng_JPEGES_vtable) {
+            vaStatus = tng_jpeg_FlushBatch(obj_context);
+            CHECK_VASTATUS();
+        }
+#endif
     }
 
     /* The cur_displaying_surface indicates the surface being displayed by overlay.
@@ -2388,6 +2524,15 @@ VAStatus psb_QuerySurfaceStatus(
 
     CHECK_INVALID_PARAM(status == NULL);
 
+#ifdef PSBVIDEO_MRFL
+    /* a surface of a pending JPEG batch would never leave VASurfaceRendering */
+    obj_context = CONTEXT(obj_surface->context_id);
+    if (obj_context && obj_context->format_vtable == &tng_JPEGES_vtable) {
+        vaStatus = tng_jpeg_FlushBatch(obj_context);
+        CHECK_VASTATUS();
+    }
+#endif
+
     psb__surface_usage(driver_data, obj_surface, &decode, &encode, &rc_enable, &proc);
 #ifdef PSBVIDEO_MRFL_VPP_ROTATE
     /* For VPP 1080P, will query the rotated buffer */
@@ -2817,6 +2962,49 @@ int UNLOCK_HARDWARE(psb_driver_data_p driver_data)
     return 0;
 }
 
+/*
+ * Command submission only needs to be ordered against other submissions to
+ * the same engine, so decode, encode and VSP contexts don't wait for each
+ * other. The DRI1 hardware lock covers every engine, keep using it there.
+ * The wsbm kernel BO lock is shared by all engines, the *DRMCmdBuf() helpers
+ * only hold it around the submit ioctl and the BO placement update.
+ */
+int LOCK_HARDWARE_ENGINE(psb_driver_data_p driver_data, int engine)
+{
+    if (!driver_data->dri2 && !driver_data->dri_dummy)
+        return LOCK_HARDWARE(driver_data);
+
+    pthread_mutex_lock(&driver_data->engine_mutex[engine]);
+    return 0;
+}
+
+int UNLOCK_HARDWARE_ENGINE(psb_driver_data_p driver_data, int engine)
+{
+    if (!driver_data->dri2 && !driver_data->dri_dummy)
+        return UNLOCK_HARDWARE(driver_data);
+
+    pthread_mutex_unlock(&driver_data->engine_mutex[engine]);
+    return 0;
+}
+
+static void psb__init_locks(psb_driver_data_p driver_data)
+{
+    int i;
+
+    pthread_mutex_init(&driver_data->drm_mutex, NULL);
+    for (i = 0; i < PSB_LOCK_ENGINE_NUM; i++)
+        pthread_mutex_init(&driver_data->engine_mutex[i], NULL);
+}
+
+static void psb__destroy_locks(psb_driver_data_p driver_data)
+{
+    int i;
+
+    pthread_mutex_destroy(&driver_data->drm_mutex);
+    for (i = 0; i < PSB_LOCK_ENGINE_NUM; i++)
+        pthread_mutex_destroy(&driver_data->engine_mutex[i]);
+}
+
 
 static void psb__deinitDRM(VADriverContextP ctx)
 {
@@ -3008,6 +3196,9 @@ VAStatus psb_Terminate(VADriverContextP ctx)
         obj_surface = (object_surface_p) object_heap_next(&driver_data->surface_heap, &iter);
     }
     object_heap_destroy(&driver_data->surface_heap);
+#ifdef ANDROID
+    psb_surface_import_ion_close(driver_data);
+#endif
 
     /* Clean up configIDs */
     obj_config = (object_config_p) object_heap_first(&driver_data->config_heap, &iter);
@@ -3050,7 +3241,7 @@ VAStatus psb_Terminate(VADriverContextP ctx)
     if (driver_data->surface_mb_error)
         free(driver_data->surface_mb_error);
 
-    pthread_mutex_destroy(&driver_data->drm_mutex);
+    psb__destroy_locks(driver_data);
     free(ctx->pDriverData);
     free(ctx->vtable_egl);
     free(ctx->vtable_tpi);
@@ -3069,6 +3260,7 @@ EXPORT VAStatus __vaDriverInit_0_31(VADriverContextP ctx)
     struct VADriverVTableTPI *tpi;
     struct VADriverVTableEGL *va_egl;
     int result;
+    char env_value[1024];
     if (psb_video_trace_fp) {
         /* make gdb always stop here */
         signal(SIGUSR1, SIG_IGN);
@@ -3175,6 +3367,7 @@ EXPORT VAStatus __vaDriverInit_0_31(VADriverContextP ctx)
             free(ctx->vtable_egl);
         return VA_STATUS_ERROR_ALLOCATION_FAILED;
     }
+    driver_data->ion_fd = -1;
 
     if (VA_STATUS_SUCCESS != psb__initDRM(ctx)) {
         free(ctx->pDriverData);
@@ -3182,7 +3375,7 @@ EXPORT VAStatus __vaDriverInit_0_31(VADriverContextP ctx)
         return VA_STATUS_ERROR_UNKNOWN;
     }
 
-    pthread_mutex_init(&driver_data->drm_mutex, NULL);
+    psb__init_locks(driver_data);
 
     /*
      * To read PBO.MSR.CCF Mode and Status Register C-Spec -p112
@@ -3218,6 +3411,12 @@ EXPORT VAStatus __vaDriverInit_0_31(VADriverContextP ctx)
     }
 #endif
 
+    if (psb_parse_config("PSB_VIDEO_SLICE_DATA_IMPORT", &env_value[0]) == 0) {
+        driver_data->slice_data_import = atoi(env_value);
+        drv_debug_msg(VIDEO_DEBUG_INIT, "Import slice data from application memory: %d\n",
+                      driver_data->slice_data_import);
+    }
+
     if (0 != psb_get_device_info(ctx)) {
         drv_debug_msg(VIDEO_DEBUG_ERROR, "ERROR: failed to get video device info\n");
         driver_data->encode_supported = 1;
@@ -3231,7 +3430,7 @@ EXPORT VAStatus __vaDriverInit_0_31(VADriverContextP ctx)
 #endif
 
     if (VA_STATUS_SUCCESS != psb_initOutput(ctx)) {
-        pthread_mutex_destroy(&driver_data->drm_mutex);
+        psb__destroy_locks(driver_data);
         psb__deinitDRM(ctx);
         free(ctx->pDriverData);
         ctx->pDriverData = NULL;
@@ -3369,12 +3568,12 @@ EXPORT VAStatus __vaDriverInit_0_31(VADriverContextP ctx)
 
     driver_data->msvdx_decode_status = calloc(1, sizeof(drm_psb_msvdx_decode_status_t));
     if (NULL == driver_data->msvdx_decode_status) {
-        pthread_mutex_destroy(&driver_data->drm_mutex);
+        psb__destroy_locks(driver_data);
         return VA_STATUS_ERROR_ALLOCATION_FAILED;
     }
     driver_data->surface_mb_error = calloc(MAX_MB_ERRORS, sizeof(VASurfaceDecodeMBErrors));
     if (NULL == driver_data->surface_mb_error) {
-        pthread_mutex_destroy(&driver_data->drm_mutex);
+        psb__destroy_locks(driver_data);
         return VA_STATUS_ERROR_ALLOCATION_FAILED;
     }
 
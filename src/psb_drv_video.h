@@ -156,6 +156,14 @@ enum psb_output_method_t {
     PSB_PUTSURFACE_FORCE_TEXSTREAMING,/* force texstreaming */
 };
 
+/* engines with independent submission queues, see LOCK_HARDWARE_ENGINE */
+enum psb_lock_engine_t {
+    PSB_LOCK_ENGINE_MSVDX = 0,  /* decode */
+    PSB_LOCK_ENGINE_TOPAZ,      /* encode */
+    PSB_LOCK_ENGINE_VSP,        /* VPP and VP8 encode */
+    PSB_LOCK_ENGINE_NUM
+};
+
 typedef struct psb_decode_info {
     uint32_t num_surface;
     uint32_t surface_id;
@@ -165,6 +173,20 @@ typedef struct msvdx_decode_info *psb_decode_info_p;
 #define CSC_MATRIX_X  (3)
 #define CSC_MATRIX_Y  (3)
 
+#define PVR2D_WRAP_HASH_SIZE    32      /* power of two */
+
+#define PSB_SURFACE_IMPORT_HASH_SIZE    32  /* power of two, see psb_surface_import.c */
+
+/* PVR2D wrappings of surface/subpicture memory, see psb_texture.c */
+struct psb_pvr2d_wrap_cache_s {
+    VAGenericID id[VIDEO_BUFFER_NUM];       /* dropped before the id goes away or changes memory */
+    PVR2DMEMINFO *meminfo[VIDEO_BUFFER_NUM];
+    unsigned int last_use[VIDEO_BUFFER_NUM];
+    int next[VIDEO_BUFFER_NUM];             /* hash chain, -1 terminated */
+    int hash[PVR2D_WRAP_HASH_SIZE];
+    unsigned int clock;
+};
+
 struct psb_driver_data_s {
     struct object_heap_s        config_heap;
     struct object_heap_s        context_heap;
@@ -172,6 +194,8 @@ struct psb_driver_data_s {
     struct object_heap_s        buffer_heap;
     struct object_heap_s        image_heap;
     struct object_heap_s        subpic_heap;
+    struct psb_surface_import_s *surface_import_hash[PSB_SURFACE_IMPORT_HASH_SIZE];
+    int                         ion_fd;  /* ION client of the imports, -1 until the first one */
     char *                      bus_id;
     uint32_t                    dev_id;
     int                         drm_fd;
@@ -186,6 +210,7 @@ struct psb_driver_data_s {
     drmLock                     *drm_lock;
     int                         contended_lock;
     pthread_mutex_t             drm_mutex;
+    pthread_mutex_t             engine_mutex[PSB_LOCK_ENGINE_NUM];
     format_vtable_p             profile2Format[PSB_MAX_PROFILES][PSB_MAX_ENTRYPOINTS];
 #ifdef PSBVIDEO_MRFL_VPP
     format_vtable_p             vpp_profile;
@@ -298,6 +323,8 @@ struct psb_driver_data_s {
     uint32_t xrandr_update;
     /*only VAProfileH264ConstrainedBaseline profile enable error concealment*/
     uint32_t ec_enabled;
+    /* decode from application slice data in place, see PSB_VIDEO_SLICE_DATA_IMPORT */
+    int slice_data_import;
     uint32_t ved_vpp;
 
     /* vpp is on or off */
@@ -310,10 +337,8 @@ struct psb_driver_data_s {
 
     unsigned char *hPVR2DContext;
 
-    VAGenericID wrapped_surface_id[VIDEO_BUFFER_NUM];
-    VAGenericID wrapped_subpic_id[VIDEO_BUFFER_NUM];
-    PVR2DMEMINFO *videoBuf[VIDEO_BUFFER_NUM];
-    PVR2DMEMINFO *subpicBuf[VIDEO_BUFFER_NUM];
+    struct psb_pvr2d_wrap_cache_s surface_wrap_cache;
+    struct psb_pvr2d_wrap_cache_s subpic_wrap_cache;
     void *native_window;
     int is_android;
     /* VA_RT_FORMAT_PROTECTED is set to protected for Widevine case */
@@ -505,6 +530,7 @@ struct object_surface_s {
     void *rotate_vaddr;
     struct psb_surface_share_info_s *share_info;
     int is_ref_surface; /* If true, vaDeriveImage returns error */
+    struct psb_surface_import_s *import; /* shared imported memory, NULL if not imported */
 };
 
 #define PSB_CODEDBUF_SLICE_NUM_MASK (0xff)
@@ -513,6 +539,17 @@ struct object_surface_s {
 #define PSB_CODEDBUF_NONE_VCL_NUM_MASK (0xff)
 #define PSB_CODEDBUF_NONE_VCL_NUM_SHIFT (8)
 
+#define PSB_CODEDBUF_TEMPORAL_ID_MASK (0x7)
+#define PSB_CODEDBUF_TEMPORAL_ID_SHIFT (16)
+
+/* set once the frame in the coded buffer went through a map, cleared when it is reused */
+#define PSB_CODEDBUF_MAPPED_MASK (0x1)
+#define PSB_CODEDBUF_MAPPED_SHIFT (19)
+
+/* the frame went over VAEncMiscParameterTypeMaxFrameSize, found on its first map */
+#define PSB_CODEDBUF_MAX_FRAME_SIZE_MASK (0x1)
+#define PSB_CODEDBUF_MAX_FRAME_SIZE_SHIFT (20)
+
 #define SET_CODEDBUF_INFO(flag, aux_info, slice_num) \
     do {\
 	(aux_info) &= ~(PSB_CODEDBUF_##flag##_MASK<<PSB_CODEDBUF_##flag##_SHIFT);\
@@ -707,8 +744,15 @@ int psb_parse_config(char *env, char *env_value);
 void psb__destroy_surface(psb_driver_data_p driver_data, object_surface_p obj_surface);
 unsigned long psb_tile_stride_mode(int w);
 
+void psb_init_surface_pvr2dbuf(psb_driver_data_p driver_data);
+void psb_free_surface_pvr2dbuf(psb_driver_data_p driver_data);
+void psb_release_surface_pvr2dbuf(psb_driver_data_p driver_data, VASurfaceID surface);
+void psb_release_subpic_pvr2dbuf(psb_driver_data_p driver_data, VASubpictureID subpicture);
+
 int LOCK_HARDWARE(psb_driver_data_p driver_data);
 int UNLOCK_HARDWARE(psb_driver_data_p driver_data);
+int LOCK_HARDWARE_ENGINE(psb_driver_data_p driver_data, int engine);
+int UNLOCK_HARDWARE_ENGINE(psb_driver_data_p driver_data, int engine);
 
 #define CHECK_SURFACE(obj_surface) \
     do { \
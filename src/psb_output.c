@@ -1544,6 +1544,7 @@ VAStatus psb__destroy_subpicture(psb_driver_data_p driver_data, object_subpic_p
         } while (subpic_surface);
     }
 
+    psb_release_subpic_pvr2dbuf(driver_data, subpicture);
     object_heap_free(&driver_data->subpic_heap, (object_base_p) obj_subpic);
     return VA_STATUS_SUCCESS;
 }
@@ -1596,6 +1597,7 @@ VAStatus psb_SetSubpictureImage(
     /* reset the image */
     obj_subpic->image_id = obj_image->image.image_id;
     obj_image->subpic_ref ++;
+    psb_release_subpic_pvr2dbuf(driver_data, subpicture);
 
     /* relink again */
     if (obj_subpic->surfaces != NULL) {
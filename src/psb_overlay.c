@@ -407,6 +407,59 @@ UpdateCoeff(int taps, double fCutoff, Bool isHoriz, Bool isY, coeffPtr pCoeff)
     }
 }
 
+/*
+ * Packed coefficient sets depend only on the tap count, the cutoff and the
+ * register format, so they are computed once and shared by all overlay
+ * instances. Scaling changes (e.g. animated window resizes) then turn into
+ * a table lookup instead of a sinc/Hamming evaluation per frame.
+ */
+#define COEFF_CACHE_SIZE        128
+
+typedef struct {
+    int valid;
+    int taps;
+    int cutoff;                 /* cutoff frequency as a multiple of 4096 */
+    Bool isHoriz;
+    Bool isY;
+    uint16_t packed[MAX_TAPS * N_PHASES];
+} coeffCacheRec;
+
+static coeffCacheRec coeffCache[COEFF_CACHE_SIZE];
+static pthread_mutex_t coeffCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+GetCachedCoeff(int taps, int scaleFract, Bool isHoriz, Bool isY, uint16_t *pRegs)
+{
+    coeffRec coeff[MAX_TAPS * N_PHASES];
+    coeffCacheRec *entry;
+    int i, cutoff;
+
+    /* Limit to between 1.0 and 3.0. */
+    cutoff = scaleFract;
+    if (cutoff < (int)(MIN_CUTOFF_FREQ * 4096))
+        cutoff = (int)(MIN_CUTOFF_FREQ * 4096);
+    if (cutoff > (int)(MAX_CUTOFF_FREQ * 4096))
+        cutoff = (int)(MAX_CUTOFF_FREQ * 4096);
+
+    pthread_mutex_lock(&coeffCacheMutex);
+    entry = &coeffCache[((unsigned int)cutoff * 31 + taps * 2 + (isHoriz ? 1 : 0) + (isY ? 4 : 0)) % COEFF_CACHE_SIZE];
+    if (!entry->valid || entry->taps != taps || entry->cutoff != cutoff ||
+        entry->isHoriz != isHoriz || entry->isY != isY) {
+        UpdateCoeff(taps, cutoff / 4096.0, isHoriz, isY, coeff);
+        for (i = 0; i < taps * N_PHASES; i++)
+            entry->packed[i] = (coeff[i].sign << 15 |
+                                coeff[i].exponent << 12 |
+                                coeff[i].mantissa);
+        entry->taps = taps;
+        entry->cutoff = cutoff;
+        entry->isHoriz = isHoriz;
+        entry->isY = isY;
+        entry->valid = 1;
+    }
+    memcpy(pRegs, entry->packed, taps * N_PHASES * sizeof(uint16_t));
+    pthread_mutex_unlock(&coeffCacheMutex);
+}
+
 static void
 i830_display_video(
     VADriverContextP ctx, PsbPortPrivPtr pPriv, VASurfaceID surface,
@@ -593,9 +646,6 @@ i830_display_video(
         /* UV is half the size of Y -- YUV420 */
         int uvratio = 2;
         uint32_t newval;
-        coeffRec xcoeffY[N_HORIZ_Y_TAPS * N_PHASES];
-        coeffRec xcoeffUV[N_HORIZ_UV_TAPS * N_PHASES];
-        int i, j, pos;
         int deinterlace_factor;
 
         /*
@@ -679,41 +729,8 @@ i830_display_video(
          * Only Horizontal coefficients so far.
          */
         if (scaleChanged) {
-            double fCutoffY;
-            double fCutoffUV;
-
-            fCutoffY = xscaleFract / 4096.0;
-            fCutoffUV = xscaleFractUV / 4096.0;
-
-            /* Limit to between 1.0 and 3.0. */
-            if (fCutoffY < MIN_CUTOFF_FREQ)
-                fCutoffY = MIN_CUTOFF_FREQ;
-            if (fCutoffY > MAX_CUTOFF_FREQ)
-                fCutoffY = MAX_CUTOFF_FREQ;
-            if (fCutoffUV < MIN_CUTOFF_FREQ)
-                fCutoffUV = MIN_CUTOFF_FREQ;
-            if (fCutoffUV > MAX_CUTOFF_FREQ)
-                fCutoffUV = MAX_CUTOFF_FREQ;
-
-            UpdateCoeff(N_HORIZ_Y_TAPS, fCutoffY, TRUE, TRUE, xcoeffY);
-            UpdateCoeff(N_HORIZ_UV_TAPS, fCutoffUV, TRUE, FALSE, xcoeffUV);
-
-            for (i = 0; i < N_PHASES; i++) {
-                for (j = 0; j < N_HORIZ_Y_TAPS; j++) {
-                    pos = i * N_HORIZ_Y_TAPS + j;
-                    overlay->Y_HCOEFS[pos] = (xcoeffY[pos].sign << 15 |
-                                              xcoeffY[pos].exponent << 12 |
-                                              xcoeffY[pos].mantissa);
-                }
-            }
-            for (i = 0; i < N_PHASES; i++) {
-                for (j = 0; j < N_HORIZ_UV_TAPS; j++) {
-                    pos = i * N_HORIZ_UV_TAPS + j;
-                    overlay->UV_HCOEFS[pos] = (xcoeffUV[pos].sign << 15 |
-                                               xcoeffUV[pos].exponent << 12 |
-                                               xcoeffUV[pos].mantissa);
-                }
-            }
+            GetCachedCoeff(N_HORIZ_Y_TAPS, xscaleFract, TRUE, TRUE, overlay->Y_HCOEFS);
+            GetCachedCoeff(N_HORIZ_UV_TAPS, xscaleFractUV, TRUE, FALSE, overlay->UV_HCOEFS);
         }
     }
 
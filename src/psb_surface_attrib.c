@@ -45,7 +45,6 @@
 #define SURFACE(id)    ((object_surface_p) object_heap_lookup( &driver_data->surface_heap, id ))
 #define BUFFER(id)  ((object_buffer_p) object_heap_lookup( &driver_data->buffer_heap, id ))
 
-
 /*
  * Create surface
  */
@@ -459,6 +458,24 @@ VAStatus  psb_CreateSurfaceFromKBuf(
     int surfaceID;
     object_surface_p obj_surface;
     psb_surface_p psb_surface;
+    struct psb_surface_import_key_s import_key;
+    struct psb_surface_import_s *import;
+
+    memset(&import_key, 0, sizeof(import_key));
+    import_key.type = VAExternalMemoryKernelDRMBufffer;
+    import_key.handle = kbuf_handle;
+    import_key.size = size;
+    import_key.width = width;
+    import_key.height = height;
+    import_key.fourcc = kBuf_fourcc;
+    import_key.luma_stride = luma_stride;
+    import_key.chroma_u_stride = chroma_u_stride;
+    import_key.chroma_v_stride = chroma_v_stride;
+    import_key.luma_offset = luma_offset;
+    import_key.chroma_u_offset = chroma_u_offset;
+    import_key.chroma_v_offset = chroma_v_offset;
+    import_key.tiling = tiling;
+    import = psb_surface_import_lookup(driver_data, &import_key);
 
     surfaceID = object_heap_allocate(&driver_data->surface_heap);
     obj_surface = SURFACE(surfaceID);
@@ -487,17 +504,20 @@ VAStatus  psb_CreateSurfaceFromKBuf(
         return vaStatus;
     }
 
-    vaStatus = psb_surface_create_from_kbuf(driver_data, width, height,
-                                            size,
-                                            kBuf_fourcc,
-                                            kbuf_handle,
-                                            luma_stride,
-                                            chroma_u_stride,
-                                            chroma_v_stride,
-                                            luma_offset,
-                                            chroma_u_offset,
-                                            chroma_v_offset,
-                                            psb_surface);
+    if (import)
+        vaStatus = psb_surface_import_share(driver_data, import, psb_surface);
+    else
+        vaStatus = psb_surface_create_from_kbuf(driver_data, width, height,
+                                                size,
+                                                kBuf_fourcc,
+                                                kbuf_handle,
+                                                luma_stride,
+                                                chroma_u_stride,
+                                                chroma_v_stride,
+                                                luma_offset,
+                                                chroma_u_offset,
+                                                chroma_v_offset,
+                                                psb_surface);
 
     if (VA_STATUS_SUCCESS != vaStatus) {
         free(psb_surface);
@@ -515,6 +535,7 @@ VAStatus  psb_CreateSurfaceFromKBuf(
     psb_surface->extra_info[7] = tiling;
 #endif
     obj_surface->psb_surface = psb_surface;
+    psb_surface_import_record(driver_data, obj_surface, import, &import_key);
 
     /* Error recovery */
     if (VA_STATUS_SUCCESS != vaStatus) {
@@ -544,6 +565,9 @@ VAStatus  psb_CreateSurfaceFromUserspace(
     int surfaceID;
     object_surface_p obj_surface;
     psb_surface_p psb_surface;
+    struct psb_surface_import_key_s import_key;
+    struct psb_surface_import_s *import;
+    unsigned int ub_flags;
     int i;
 
     switch (format) {
@@ -556,8 +580,16 @@ VAStatus  psb_CreateSurfaceFromUserspace(
         break;
     }
 
+    ub_flags = (attribute_tpi->type == VAExternalMemoryNoneCacheUserPointer) ?
+               PSB_USER_BUFFER_UNCACHED : 0;
+
     for (i=0; i < num_surfaces; i++) {
         vaddr = attribute_tpi->buffers[i];
+
+        psb_surface_import_key(&import_key, attribute_tpi, (unsigned long)vaddr,
+                               fourcc, ub_flags);
+        import = psb_surface_import_lookup(driver_data, &import_key);
+
         surfaceID = object_heap_allocate(&driver_data->surface_heap);
         obj_surface = SURFACE(surfaceID);
         if (NULL == obj_surface) {
@@ -585,12 +617,11 @@ VAStatus  psb_CreateSurfaceFromUserspace(
             break;
         }
 
-        if (attribute_tpi->type == VAExternalMemoryNoneCacheUserPointer)
-            vaStatus = psb_surface_create_from_ub(driver_data, width, height, fourcc,
-                    attribute_tpi, psb_surface, vaddr, PSB_USER_BUFFER_UNCACHED);
+        if (import)
+            vaStatus = psb_surface_import_share(driver_data, import, psb_surface);
         else
             vaStatus = psb_surface_create_from_ub(driver_data, width, height, fourcc,
-                    attribute_tpi, psb_surface, vaddr, 0);
+                    attribute_tpi, psb_surface, vaddr, ub_flags);
         obj_surface->psb_surface = psb_surface;
 
         if (VA_STATUS_SUCCESS != vaStatus) {
@@ -604,6 +635,7 @@ VAStatus  psb_CreateSurfaceFromUserspace(
         memset(psb_surface->extra_info, 0, sizeof(psb_surface->extra_info));
         psb_surface->extra_info[4] = fourcc;
         obj_surface->psb_surface = psb_surface;
+        psb_surface_import_record(driver_data, obj_surface, import, &import_key);
 
         /* Error recovery */
         if (VA_STATUS_SUCCESS != vaStatus) {
@@ -635,9 +667,8 @@ VAStatus  psb_CreateSurfaceFromION(
     psb_surface_p psb_surface;
     int i;
     unsigned int source_size = 0;
-    int ion_fd = 0;
-    int ion_ret = 0;
-    struct ion_fd_data ion_source_share;
+    struct psb_surface_import_key_s import_key;
+    struct psb_surface_import_s *import;
 
     switch (format) {
     case VA_RT_FORMAT_YUV422:
@@ -649,38 +680,33 @@ VAStatus  psb_CreateSurfaceFromION(
         break;
     }
 
-    ion_fd = open("/dev/ion", O_RDWR);
-    if (ion_fd < 0) {
-        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Fail to open the ion device!\n", __FUNCTION__);
-        return VA_STATUS_ERROR_UNKNOWN;
-    }
-
     for (i=0; i < num_surfaces; i++) {
-        ion_source_share.handle = NULL;
-        ion_source_share.fd = (int)(attribute_tpi->buffers[i]);
-        ion_ret = ioctl(ion_fd, ION_IOC_IMPORT, &ion_source_share);
-            if ((ion_ret < 0) || (NULL == ion_source_share.handle)) {
-            close(ion_fd);
-            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Fail to import the ion fd!\n", __FUNCTION__);
-            return VA_STATUS_ERROR_UNKNOWN;
-        }
-
-        if (VA_FOURCC_NV12 == fourcc)
-            source_size = attribute_tpi->width * attribute_tpi->height * 1.5;
-        else
-            source_size = attribute_tpi->width * attribute_tpi->height * 2;
-
-        vaddr = mmap(NULL, source_size, PROT_READ|PROT_WRITE, MAP_SHARED, ion_source_share.fd, 0);
-        if (MAP_FAILED == vaddr) {
-            close(ion_fd);
-            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Fail to mmap the ion buffer!\n", __FUNCTION__);
-            return VA_STATUS_ERROR_UNKNOWN;
+        /* fd numbers get recycled, the ION handle identifies the buffer */
+        vaStatus = psb_surface_import_ion(driver_data, (int)(attribute_tpi->buffers[i]),
+                                          attribute_tpi, fourcc, &import_key, &import);
+        if (VA_STATUS_SUCCESS != vaStatus)
+            return vaStatus;
+
+        if (NULL == import) {
+            if (VA_FOURCC_NV12 == fourcc)
+                source_size = attribute_tpi->width * attribute_tpi->height * 1.5;
+            else
+                source_size = attribute_tpi->width * attribute_tpi->height * 2;
+
+            vaddr = mmap(NULL, source_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+                         (int)(attribute_tpi->buffers[i]), 0);
+            if (MAP_FAILED == vaddr) {
+                psb_surface_import_ion_put(driver_data, &import_key);
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Fail to mmap the ion buffer!\n", __FUNCTION__);
+                return VA_STATUS_ERROR_UNKNOWN;
+            }
         }
 
         surfaceID = object_heap_allocate(&driver_data->surface_heap);
         obj_surface = SURFACE(surfaceID);
         if (NULL == obj_surface) {
-            close(ion_fd);
+            if (NULL == import)
+                psb_surface_import_ion_put(driver_data, &import_key);
             vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
             DEBUG_FAILURE;
             break;
@@ -700,21 +726,26 @@ VAStatus  psb_CreateSurfaceFromION(
         if (NULL == psb_surface) {
             object_heap_free(&driver_data->surface_heap, (object_base_p) obj_surface);
             obj_surface->surface_id = VA_INVALID_SURFACE;
-            close(ion_fd);
+            if (NULL == import)
+                psb_surface_import_ion_put(driver_data, &import_key);
             vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
             DEBUG_FAILURE;
             break;
         }
 
-        vaStatus = psb_surface_create_from_ub(driver_data, width, height, fourcc,
-                attribute_tpi, psb_surface, vaddr, 0);
+        if (import)
+            vaStatus = psb_surface_import_share(driver_data, import, psb_surface);
+        else
+            vaStatus = psb_surface_create_from_ub(driver_data, width, height, fourcc,
+                    attribute_tpi, psb_surface, vaddr, 0);
         obj_surface->psb_surface = psb_surface;
 
         if (VA_STATUS_SUCCESS != vaStatus) {
             free(psb_surface);
             object_heap_free(&driver_data->surface_heap, (object_base_p) obj_surface);
             obj_surface->surface_id = VA_INVALID_SURFACE;
-            close(ion_fd);
+            if (NULL == import)
+                psb_surface_import_ion_put(driver_data, &import_key);
             DEBUG_FAILURE;
             break;
         }
@@ -722,18 +753,16 @@ VAStatus  psb_CreateSurfaceFromION(
         memset(psb_surface->extra_info, 0, sizeof(psb_surface->extra_info));
         psb_surface->extra_info[4] = fourcc;
         obj_surface->psb_surface = psb_surface;
+        psb_surface_import_record(driver_data, obj_surface, import, &import_key);
 
         /* Error recovery */
         if (VA_STATUS_SUCCESS != vaStatus) {
             object_surface_p obj_surface = SURFACE(surfaceID);
             psb__destroy_surface(driver_data, obj_surface);
-            close(ion_fd);
         }
 
         vaddr = NULL;
     }
-
-    close(ion_fd);
 #endif
     return vaStatus;
 }
@@ -29,6 +29,7 @@
 #include <va/va_tpi.h>
 #include "psb_drv_video.h"
 #include "psb_surface.h"
+#include "psb_surface_import.h"
 
 /*
  * Create surface from virtual address
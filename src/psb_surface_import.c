@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Import table: camera and zero-copy clients keep re-importing the same ring
+ * of external buffers. Memory already wrapped by a live surface with the same
+ * layout is not pinned again, the new surface gets its own reference to the
+ * buffer object of the first import. Every import still gets its own surface
+ * and state; the entry and its reference go away with the last surface, so
+ * it never outlives memory the client has freed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#ifdef ANDROID
+#include <linux/ion.h>
+#endif
+#include "psb_drv_video.h"
+#include "psb_drv_debug.h"
+#include "psb_surface_import.h"
+
+void psb_surface_import_key(
+    struct psb_surface_import_key_s *key,
+    VASurfaceAttributeTPI *attribute_tpi,
+    unsigned long handle,
+    unsigned int fourcc,
+    unsigned int flags
+)
+{
+    memset(key, 0, sizeof(*key));
+    key->type = attribute_tpi->type;
+    key->handle = handle;
+    key->size = attribute_tpi->size;
+    key->width = attribute_tpi->width;
+    key->height = attribute_tpi->height;
+    key->fourcc = fourcc;
+    key->luma_stride = attribute_tpi->luma_stride;
+    key->chroma_u_stride = attribute_tpi->chroma_u_stride;
+    key->chroma_v_stride = attribute_tpi->chroma_v_stride;
+    key->luma_offset = attribute_tpi->luma_offset;
+    key->chroma_u_offset = attribute_tpi->chroma_u_offset;
+    key->chroma_v_offset = attribute_tpi->chroma_v_offset;
+    key->tiling = attribute_tpi->tiling;
+    key->flags = flags;
+}
+
+static struct psb_surface_import_s **psb__surface_import_bucket(
+    psb_driver_data_p driver_data,
+    struct psb_surface_import_key_s *key
+)
+{
+    /* user pointers are page aligned, drop the offset bits */
+    unsigned long hash = (key->handle >> 12) ^ key->handle;
+
+    return &driver_data->surface_import_hash[hash & (PSB_SURFACE_IMPORT_HASH_SIZE - 1)];
+}
+
+struct psb_surface_import_s *psb_surface_import_lookup(
+    psb_driver_data_p driver_data,
+    struct psb_surface_import_key_s *key
+)
+{
+    struct psb_surface_import_s *import;
+
+    for (import = *psb__surface_import_bucket(driver_data, key); import; import = import->next) {
+        if (!memcmp(&import->key, key, sizeof(*key)))
+            return import;
+    }
+
+    return NULL;
+}
+
+/*
+ * Wrap memory that is already imported: copy the layout of the first import
+ * and take another reference to its buffer object
+ */
+VAStatus psb_surface_import_share(
+    psb_driver_data_p driver_data,
+    struct psb_surface_import_s *import,
+    psb_surface_p psb_surface /* out */
+)
+{
+    *psb_surface = *import->surface;
+
+    return psb_buffer_reference(driver_data, &psb_surface->buf, &import->surface->buf);
+}
+
+/*
+ * Attach a newly created surface to the table, adding an entry for memory
+ * seen for the first time
+ */
+void psb_surface_import_record(
+    psb_driver_data_p driver_data,
+    object_surface_p obj_surface,
+    struct psb_surface_import_s *import,
+    struct psb_surface_import_key_s *key
+)
+{
+    struct psb_surface_import_s **bucket;
+
+    if (NULL == import) {
+        /* not shared if this fails, the surface works on its own */
+        import = (struct psb_surface_import_s *) calloc(1, sizeof(*import));
+        if (NULL == import)
+            goto not_shared;
+        import->surface = (psb_surface_p) calloc(1, sizeof(struct psb_surface_s));
+        if (NULL == import->surface) {
+            free(import);
+            goto not_shared;
+        }
+        *import->surface = *obj_surface->psb_surface;
+        if (psb_buffer_reference(driver_data, &import->surface->buf,
+                                 &obj_surface->psb_surface->buf) != VA_STATUS_SUCCESS) {
+            free(import->surface);
+            free(import);
+            goto not_shared;
+        }
+
+        import->key = *key;
+        bucket = psb__surface_import_bucket(driver_data, key);
+        import->next = *bucket;
+        *bucket = import;
+    } else
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Surface 0x%08x shares imported memory, %d users\n",
+                      obj_surface->surface_id, import->refcnt + 1);
+
+    import->refcnt++;
+    obj_surface->import = import;
+    return;
+
+not_shared:
+#ifdef ANDROID
+    /* the entry owns the ION handle, nothing else would drop it */
+    if (VAExternalMemoryIONSharedFD == key->type)
+        psb_surface_import_ion_put(driver_data, key);
+#endif
+    return;
+}
+
+/*
+ * Drop the surface from the import table, the last one frees the entry
+ */
+void psb_surface_import_release(
+    psb_driver_data_p driver_data,
+    object_surface_p obj_surface
+)
+{
+    struct psb_surface_import_s *import = obj_surface->import;
+    struct psb_surface_import_s **link;
+
+    obj_surface->import = NULL;
+    if (--import->refcnt)
+        return;
+
+    for (link = psb__surface_import_bucket(driver_data, &import->key); *link; link = &(*link)->next) {
+        if (*link == import) {
+            *link = import->next;
+            break;
+        }
+    }
+
+#ifdef ANDROID
+    if (VAExternalMemoryIONSharedFD == import->key.type)
+        psb_surface_import_ion_put(driver_data, &import->key);
+#endif
+
+    psb_buffer_destroy(&import->surface->buf);
+    free(import->surface);
+    free(import);
+}
+
+#ifdef ANDROID
+/*
+ * fds and their dma-buf inodes say nothing about the buffer behind them.
+ * ION gives a client the same handle for every import of one buffer and
+ * keeps it while a reference is held, so the handles of one long lived
+ * client identify the buffers. The table entry holds one reference.
+ */
+VAStatus psb_surface_import_ion(
+    psb_driver_data_p driver_data,
+    int buffer_fd,
+    VASurfaceAttributeTPI *attribute_tpi,
+    unsigned int fourcc,
+    struct psb_surface_import_key_s *key, /* out */
+    struct psb_surface_import_s **import /* out */
+)
+{
+    struct ion_fd_data ion_source_share;
+
+    if (driver_data->ion_fd < 0) {
+        driver_data->ion_fd = open("/dev/ion", O_RDWR);
+        if (driver_data->ion_fd < 0) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Fail to open the ion device!\n", __FUNCTION__);
+            return VA_STATUS_ERROR_UNKNOWN;
+        }
+    }
+
+    ion_source_share.handle = NULL;
+    ion_source_share.fd = buffer_fd;
+    if ((ioctl(driver_data->ion_fd, ION_IOC_IMPORT, &ion_source_share) < 0) ||
+        (NULL == ion_source_share.handle)) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Fail to import the ion fd!\n", __FUNCTION__);
+        return VA_STATUS_ERROR_UNKNOWN;
+    }
+
+    psb_surface_import_key(key, attribute_tpi, (unsigned long)ion_source_share.handle, fourcc, 0);
+    *import = psb_surface_import_lookup(driver_data, key);
+
+    /* the entry already holds a reference to the handle */
+    if (*import)
+        psb_surface_import_ion_put(driver_data, key);
+
+    return VA_STATUS_SUCCESS;
+}
+
+void psb_surface_import_ion_put(
+    psb_driver_data_p driver_data,
+    struct psb_surface_import_key_s *key
+)
+{
+    struct ion_handle_data ion_handle;
+
+    ion_handle.handle = (struct ion_handle *)key->handle;
+    if (ioctl(driver_data->ion_fd, ION_IOC_FREE, &ion_handle) < 0)
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Fail to free the ion handle!\n", __FUNCTION__);
+}
+
+void psb_surface_import_ion_close(psb_driver_data_p driver_data)
+{
+    if (driver_data->ion_fd >= 0) {
+        close(driver_data->ion_fd);
+        driver_data->ion_fd = -1;
+    }
+}
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _PSB_SURFACE_IMPORT_H_
+#define _PSB_SURFACE_IMPORT_H_
+
+#include <va/va_tpi.h>
+#include "psb_drv_video.h"
+#include "psb_surface.h"
+
+/* Identity of the external memory a surface was wrapped from, see
+ * psb_surface_import.c. Imports with the same key share one buffer object.
+ */
+struct psb_surface_import_key_s {
+    int type;                   /* VAExternalMemory* type */
+    unsigned long handle;       /* user pointer, kernel buffer handle or ION handle */
+    unsigned int size;
+    unsigned int width;
+    unsigned int height;
+    unsigned int fourcc;
+    unsigned int luma_stride;
+    unsigned int chroma_u_stride;
+    unsigned int chroma_v_stride;
+    unsigned int luma_offset;
+    unsigned int chroma_u_offset;
+    unsigned int chroma_v_offset;
+    unsigned int tiling;
+    unsigned int flags;
+};
+
+/* Imported memory shared by every surface wrapping it */
+struct psb_surface_import_s {
+    struct psb_surface_import_key_s key;
+    struct psb_surface_s *surface;      /* layout and a reference to the buffer object */
+    unsigned int refcnt;                /* surfaces wrapping the memory */
+    struct psb_surface_import_s *next;  /* hash chain */
+};
+
+void psb_surface_import_key(
+    struct psb_surface_import_key_s *key,
+    VASurfaceAttributeTPI *attribute_tpi,
+    unsigned long handle,
+    unsigned int fourcc,
+    unsigned int flags
+);
+
+struct psb_surface_import_s *psb_surface_import_lookup(
+    psb_driver_data_p driver_data,
+    struct psb_surface_import_key_s *key
+);
+
+VAStatus psb_surface_import_share(
+    psb_driver_data_p driver_data,
+    struct psb_surface_import_s *import,
+    psb_surface_p psb_surface /* out */
+);
+
+void psb_surface_import_record(
+    psb_driver_data_p driver_data,
+    object_surface_p obj_surface,
+    struct psb_surface_import_s *import,
+    struct psb_surface_import_key_s *key
+);
+
+/*
+ * Drop an imported surface's use of the shared memory
+ */
+void psb_surface_import_release(
+    psb_driver_data_p driver_data,
+    object_surface_p obj_surface
+);
+
+#ifdef ANDROID
+/*
+ * Import an ION buffer fd on the driver's ION client and key it on the ION
+ * handle. *import is the live entry for the same buffer and layout, or NULL
+ * when the caller has to wrap the memory itself and hand the key to
+ * psb_surface_import_record(), or drop it with psb_surface_import_ion_put().
+ */
+VAStatus psb_surface_import_ion(
+    psb_driver_data_p driver_data,
+    int buffer_fd,
+    VASurfaceAttributeTPI *attribute_tpi,
+    unsigned int fourcc,
+    struct psb_surface_import_key_s *key, /* out */
+    struct psb_surface_import_s **import /* out */
+);
+
+void psb_surface_import_ion_put(
+    psb_driver_data_p driver_data,
+    struct psb_surface_import_key_s *key
+);
+
+void psb_surface_import_ion_close(psb_driver_data_p driver_data);
+#endif
+
+#endif /* _PSB_SURFACE_IMPORT_H_ */
@@ -326,6 +326,9 @@ void psb_ctexture_deinit(VADriverContextP ctx)
         }
     }
 
+    /* wrappings left over from surfaces and subpictures still alive */
+    psb_free_surface_pvr2dbuf(driver_data);
+
     if (driver_data->hPVR2DContext) {
         ePVR2DStatus = PVR2DDestroyDeviceContext(driver_data->hPVR2DContext);
         if (ePVR2DStatus != PVR2D_OK)
@@ -367,157 +370,185 @@ static void psb_calculate_subpic_size(int surf_width, int surf_height, int dst_w
     }
 }
 
-static PPVR2DMEMINFO psb_check_subpic_buffer(psb_driver_data_p driver_data, PsbVASurfaceRec* surface_subpic)
+/*
+ * Wrap caches map a surface or subpicture id to its PVR2D wrapping. Lookups
+ * go through a small hash, and when every slot is taken the least recently
+ * used wrapping is released, so having more surfaces than VIDEO_BUFFER_NUM
+ * costs a re-wrap instead of a failed blit. A wrapping is released before
+ * its id is destroyed or bound to other memory, so an id always names the
+ * memory it was wrapped from, even once the object heap hands it out again
+ * and the allocator reuses the old buffer object's address.
+ */
+static void psb_wrap_cache_init(struct psb_pvr2d_wrap_cache_s *cache)
+{
+    int i;
+
+    for (i = 0; i < VIDEO_BUFFER_NUM; i++) {
+        cache->id[i] = VA_INVALID_ID;
+        cache->meminfo[i] = NULL;
+        cache->last_use[i] = 0;
+        cache->next[i] = -1;
+    }
+    for (i = 0; i < PVR2D_WRAP_HASH_SIZE; i++)
+        cache->hash[i] = -1;
+    cache->clock = 0;
+}
+
+static void psb_wrap_cache_release(psb_driver_data_p driver_data, struct psb_pvr2d_wrap_cache_s *cache, int slot)
+{
+    int *link = &cache->hash[cache->id[slot] & (PVR2D_WRAP_HASH_SIZE - 1)];
+    PVR2DERROR ePVR2DStatus;
+
+    while (*link != -1 && *link != slot)
+        link = &cache->next[*link];
+    if (*link == slot)
+        *link = cache->next[slot];
+
+    if (cache->meminfo[slot]) {
+        ePVR2DStatus = PVR2DMemFree(driver_data->hPVR2DContext, cache->meminfo[slot]);
+        if (ePVR2DStatus != PVR2D_OK)
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: PVR2DMemFree error %d\n", __FUNCTION__, ePVR2DStatus);
+    }
+
+    cache->id[slot] = VA_INVALID_ID;
+    cache->meminfo[slot] = NULL;
+    cache->next[slot] = -1;
+}
+
+static void psb_wrap_cache_evict(psb_driver_data_p driver_data, struct psb_pvr2d_wrap_cache_s *cache, VAGenericID id)
 {
-    unsigned int i, j;
+    int i;
+
+    for (i = cache->hash[id & (PVR2D_WRAP_HASH_SIZE - 1)]; i != -1; i = cache->next[i]) {
+        if (cache->id[i] == id) {
+            psb_wrap_cache_release(driver_data, cache, i);
+            return;
+        }
+    }
+}
+
+static PPVR2DMEMINFO psb_wrap_cache_lookup(
+    psb_driver_data_p driver_data,
+    struct psb_pvr2d_wrap_cache_s *cache,
+    VAGenericID id,
+    struct _WsbmBufferObject *bo,
+    unsigned int size)
+{
+    int i, slot = -1;
+    unsigned int j;
     unsigned char* tmp_buffer;
     unsigned char tmp;
     PVR2DERROR ePVR2DStatus;
 
-    /* Find and return the wrapped buffer index */
-    for (i = 0; i < VIDEO_BUFFER_NUM; i++) {
-        if (driver_data->wrapped_subpic_id[i] == surface_subpic->subpic_id && driver_data->subpicBuf[i]) {
-            return driver_data->subpicBuf[i];
+    for (i = cache->hash[id & (PVR2D_WRAP_HASH_SIZE - 1)]; i != -1; i = cache->next[i]) {
+        if (cache->id[i] == id) {
+            cache->last_use[i] = ++cache->clock;
+            return cache->meminfo[i];
         }
     }
 
-    /* Wrap a un-wrapped buffer and return */
     for (i = 0; i < VIDEO_BUFFER_NUM; i++) {
-        if (driver_data->wrapped_subpic_id[i] == VA_INVALID_ID) {
-            tmp_buffer = NULL;
-            tmp_buffer = wsbmBOMap(surface_subpic->bo, WSBM_ACCESS_READ | WSBM_ACCESS_WRITE);
-            if (NULL == tmp_buffer) {
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s L%d: wsbmBOMap failed!",
-                        __FUNCTION__, __LINE__);
-                return NULL;
-            }
-            for (j = 0; j < surface_subpic->size; j = j + 4096) {
-                tmp = *(tmp_buffer + j);
-                if (tmp == 0)
-                    *(tmp_buffer + j) = 0;
-            }
+        if (cache->id[i] == VA_INVALID_ID) {
+            slot = i;
+            break;
+        }
+        if (slot == -1 || cache->last_use[i] < cache->last_use[slot])
+            slot = i;
+    }
+    if (cache->id[slot] != VA_INVALID_ID) {
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: evict wrapped buffer of 0x%08x\n", __FUNCTION__, cache->id[slot]);
+        psb_wrap_cache_release(driver_data, cache, slot);
+    }
 
-            ePVR2DStatus = PVR2DMemWrap(driver_data->hPVR2DContext,
-                                        tmp_buffer,
-                                        0,
-                                        surface_subpic->size,
-                                        NULL,
-                                        &driver_data->subpicBuf[i]);
-            if (ePVR2DStatus != PVR2D_OK) {
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: PVR2DMemWrap error %d\n", __FUNCTION__, ePVR2DStatus);
-                return NULL;
-            }
+    tmp_buffer = wsbmBOMap(bo, WSBM_ACCESS_READ | WSBM_ACCESS_WRITE);
+    if (NULL == tmp_buffer) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s L%d: wsbmBOMap failed!",
+                __FUNCTION__, __LINE__);
+        return NULL;
+    }
 
-            driver_data->wrapped_subpic_id[i] = surface_subpic->subpic_id;
-            return driver_data->subpicBuf[i];
+    ePVR2DStatus = PVR2DMemWrap(driver_data->hPVR2DContext,
+                                tmp_buffer,
+                                0,
+                                size,
+                                NULL,
+                                &cache->meminfo[slot]);
+    if (ePVR2DStatus != PVR2D_OK) {
+        /* the mapping may not be populated yet, fault it in and retry once */
+        for (j = 0; j < size; j = j + 4096) {
+            tmp = *(tmp_buffer + j);
+            if (tmp == 0)
+                *(tmp_buffer + j) = 0;
         }
+        ePVR2DStatus = PVR2DMemWrap(driver_data->hPVR2DContext,
+                                    tmp_buffer,
+                                    0,
+                                    size,
+                                    NULL,
+                                    &cache->meminfo[slot]);
     }
-
-    if (i == VIDEO_BUFFER_NUM - 1) {
-        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Out of warpped subpic buffer memory\n", __FUNCTION__);
+    if (ePVR2DStatus != PVR2D_OK) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: PVR2DMemWrap error %d\n", __FUNCTION__, ePVR2DStatus);
+        cache->meminfo[slot] = NULL;
         return NULL;
     }
 
-    return NULL;
+    cache->id[slot] = id;
+    cache->last_use[slot] = ++cache->clock;
+    cache->next[slot] = cache->hash[id & (PVR2D_WRAP_HASH_SIZE - 1)];
+    cache->hash[id & (PVR2D_WRAP_HASH_SIZE - 1)] = slot;
+
+    return cache->meminfo[slot];
+}
+
+static PPVR2DMEMINFO psb_check_subpic_buffer(psb_driver_data_p driver_data, PsbVASurfaceRec* surface_subpic)
+{
+    return psb_wrap_cache_lookup(driver_data, &driver_data->subpic_wrap_cache,
+                                 surface_subpic->subpic_id, surface_subpic->bo, surface_subpic->size);
 }
 
 
 void psb_init_surface_pvr2dbuf(psb_driver_data_p driver_data)
 {
-    int i;
-    for (i = 0; i < VIDEO_BUFFER_NUM; i++) {
-        driver_data->videoBuf[i] = NULL;
-        driver_data->subpicBuf[i] = NULL;
-        driver_data->wrapped_surface_id[i] = VA_INVALID_ID;
-        driver_data->wrapped_subpic_id[i] = VA_INVALID_ID;
-    }
-
+    psb_wrap_cache_init(&driver_data->surface_wrap_cache);
+    psb_wrap_cache_init(&driver_data->subpic_wrap_cache);
 }
 
 void psb_free_surface_pvr2dbuf(psb_driver_data_p driver_data)
 {
     int i;
-    PVR2DERROR ePVR2DStatus;
 
     for (i = 0; i < VIDEO_BUFFER_NUM; i++) {
-        if ((driver_data->wrapped_surface_id[i] != VA_INVALID_ID) && driver_data->videoBuf[i]) {
-            ePVR2DStatus = PVR2DMemFree(driver_data->hPVR2DContext, driver_data->videoBuf[i]);
-            if (ePVR2DStatus != PVR2D_OK)
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: PVR2DMemFree error %d\n", __FUNCTION__, ePVR2DStatus);
-        }
-
-        if ((driver_data->wrapped_subpic_id[i] != VA_INVALID_ID) && driver_data->subpicBuf[i]) {
-            ePVR2DStatus = PVR2DMemFree(driver_data->hPVR2DContext, driver_data->subpicBuf[i]);
-            if (ePVR2DStatus != PVR2D_OK)
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: PVR2DMemFree error %d\n", __FUNCTION__, ePVR2DStatus);
-        }
+        if (driver_data->surface_wrap_cache.id[i] != VA_INVALID_ID)
+            psb_wrap_cache_release(driver_data, &driver_data->surface_wrap_cache, i);
+        if (driver_data->subpic_wrap_cache.id[i] != VA_INVALID_ID)
+            psb_wrap_cache_release(driver_data, &driver_data->subpic_wrap_cache, i);
+    }
+    psb_init_surface_pvr2dbuf(driver_data);
+}
 
-        driver_data->wrapped_surface_id[i] = VA_INVALID_ID;
-        driver_data->wrapped_subpic_id[i] = -1;
+void psb_release_surface_pvr2dbuf(psb_driver_data_p driver_data, VASurfaceID surface)
+{
+    psb_wrap_cache_evict(driver_data, &driver_data->surface_wrap_cache, surface);
+}
 
-        driver_data->videoBuf[i] = NULL;
-        driver_data->subpicBuf[i] = NULL;
-    }
+void psb_release_subpic_pvr2dbuf(psb_driver_data_p driver_data, VASubpictureID subpicture)
+{
+    psb_wrap_cache_evict(driver_data, &driver_data->subpic_wrap_cache, subpicture);
 }
 
 
 static PPVR2DMEMINFO psb_wrap_surface_pvr2dbuf(psb_driver_data_p driver_data, VASurfaceID surface)
 {
-    int i, j;
-    unsigned char* tmp_buffer;
-    unsigned char tmp;
     object_surface_p obj_surface = SURFACE(surface);
     psb_surface_p psb_surface;
     VAStatus vaStatus = VA_STATUS_SUCCESS;
-    PVR2DERROR ePVR2DStatus;
 
     CHECK_SURFACE(obj_surface);
     psb_surface = obj_surface->psb_surface;
 
-    /* Find and return the wrapped buffer index */
-    for (i = 0; i < VIDEO_BUFFER_NUM; i++) {
-        if (driver_data->wrapped_surface_id[i] == surface && driver_data->videoBuf[i]) {
-            return driver_data->videoBuf[i];
-        }
-    }
-
-    /* Wrap a un-wrapped buffer and return */
-    for (i = 0; i < VIDEO_BUFFER_NUM; i++) {
-        if (driver_data->wrapped_surface_id[i] == VA_INVALID_ID) {
-            tmp_buffer = NULL;
-            tmp_buffer = wsbmBOMap(psb_surface->buf.drm_buf, WSBM_ACCESS_READ | WSBM_ACCESS_WRITE);
-            if (NULL == tmp_buffer) {
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s L%d: wsbmBOMap failed!",
-                        __FUNCTION__, __LINE__);
-                return NULL;
-            }
-            for (j = 0; j < psb_surface->size; j = j + 4096) {
-                tmp = *(tmp_buffer + j);
-                if (tmp == 0)
-                    *(tmp_buffer + j) = 0;
-            }
-
-            ePVR2DStatus = PVR2DMemWrap(driver_data->hPVR2DContext,
-                                        tmp_buffer,
-                                        0,
-                                        psb_surface->size,
-                                        NULL,
-                                        &driver_data->videoBuf[i]);
-            if (ePVR2DStatus != PVR2D_OK) {
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: PVR2DMemWrap error %d\n", __FUNCTION__, ePVR2DStatus);
-            }
-
-            driver_data->wrapped_surface_id[i] = surface;
-            return driver_data->videoBuf[i];
-        }
-    }
-
-    if (i == VIDEO_BUFFER_NUM - 1) {
-        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Out of warpped buffer memory\n", __FUNCTION__);
-        return NULL;
-    }
-
-    return NULL;
+    return psb_wrap_cache_lookup(driver_data, &driver_data->surface_wrap_cache,
+                                 surface, psb_surface->buf.drm_buf, psb_surface->size);
 }
 
 #if 0
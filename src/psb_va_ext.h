@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * VA extensions of the psb/pnw/tng driver, installed for applications.
+ *
+ * The driver specific types take values from 0x7f000000 up, above every
+ * type libva defines, and are only understood by this driver.
+ */
+
+#ifndef _PSB_VA_EXT_H_
+#define _PSB_VA_EXT_H_
+
+#include <va/va.h>
+
+/*
+ * VAEncMiscParameterBuffer type of the tng H.264 encoder, no payload beyond
+ * the type. Sent with a frame it asks the encoder to stop predicting from
+ * the most recent reference frame, e.g. after the receiver reported it lost:
+ * the next reference frame is coded as a non-IDR intra frame. With B frames
+ * that is the anchor closing the current mini GOP.
+ */
+#define VAEncMiscParameterTypeTNGRefInvalidate  ((VAEncMiscParameterType)0x7f000001)
+
+/*
+ * Config attribute of the JPEG encoders (VAEntrypointEncPicture), a mask of
+ * VA_PSB_JPEG_OUTPUT_*. vaGetConfigAttributes() reports the supported
+ * layouts, vaCreateConfig() takes the one to use. Without it the coded
+ * buffer holds one VACodedBufferSegment per scan.
+ */
+#define VAConfigAttribPSBJPEGOutput             ((VAConfigAttribType)0x7f000002)
+
+#define VA_PSB_JPEG_OUTPUT_SEGMENTS             0x00000001 /* one coded segment per scan (default) */
+#define VA_PSB_JPEG_OUTPUT_CONTIGUOUS           0x00000002 /* the whole JFIF stream in one coded segment */
+
+#endif /* _PSB_VA_EXT_H_ */
@@ -45,12 +45,14 @@
 #include "psb_def.h"
 #include "psb_drv_debug.h"
 #include "psb_surface.h"
+#include "psb_va_ext.h"
 #include "tng_cmdbuf.h"
 #include "tng_hostcode.h"
 #include "tng_hostheader.h"
 #include "tng_picmgmt.h"
 #include "tng_slotorder.h"
 #include "tng_hostair.h"
+#include "tng_hostrc.h"
 #include "tng_H264ES.h"
 #ifdef _TOPAZHP_PDUMP_
 #include "tng_trace.h"
@@ -185,9 +187,59 @@ static void tng__H264ES_init_context(object_context_p obj_context,
     ctx->bArbitrarySO = IMG_FALSE;
     ctx->ui32BasicUnit = 0;
     ctx->idr_force_flag = 0;
+    ctx->ref_invalidate_flag = 0;
     ctx->bVPAdaptiveRoundingDisable = IMG_FALSE;
 }
 
+/*
+ * Layer bitrates are cumulative, a layer includes all the layers below it.
+ * The firmware rate control has no per level targets, so the top layer is
+ * the stream bitrate and can not go below what the lower layers were given.
+ */
+static void tng__H264ES_update_layer_bitrate(context_ENC_p ctx)
+{
+    IMG_UINT32 *pui32Bitrate = ctx->aui32LayerBitrate;
+    IMG_UINT32 ui32Top = ctx->ui8TemporalLayers - 1;
+    IMG_UINT32 i;
+
+    for (i = 1; i <= ui32Top; i++) {
+        if (pui32Bitrate[i] && pui32Bitrate[i] < pui32Bitrate[i - 1]) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: layer %d bitrate %d below layer %d (%d), clamped\n",
+                __FUNCTION__, i, pui32Bitrate[i], i - 1, pui32Bitrate[i - 1]);
+            pui32Bitrate[i] = pui32Bitrate[i - 1];
+        }
+    }
+
+    if (pui32Bitrate[ui32Top] == 0)
+        return;
+
+    if (pui32Bitrate[ui32Top] != ctx->sRCParams.ui32BitsPerSecond) {
+        ctx->sRCParams.ui32BitsPerSecond = pui32Bitrate[ui32Top];
+        ctx->rc_update_flag |= RC_MASK_bits_per_second;
+    }
+}
+
+static void tng__H264ES_alloc_frame_order(context_ENC_p ctx)
+{
+    FRAME_ORDER_INFO *psFrameInfo = &(ctx->sFrameOrderInfo);
+
+    if (psFrameInfo->slot_consume_dpy_order != NULL)
+        free(psFrameInfo->slot_consume_dpy_order);
+    if (psFrameInfo->slot_consume_enc_order != NULL)
+        free(psFrameInfo->slot_consume_enc_order);
+    memset(psFrameInfo, 0, sizeof(FRAME_ORDER_INFO));
+
+    if (ctx->sRCParams.ui16BFrames != 0) {
+        psFrameInfo->slot_consume_dpy_order = (int *)malloc(ctx->ui8SlotsInUse * sizeof(int));
+        psFrameInfo->slot_consume_enc_order = (int *)malloc(ctx->ui8SlotsInUse * sizeof(int));
+
+        if ((psFrameInfo->slot_consume_dpy_order == NULL) || 
+            (psFrameInfo->slot_consume_enc_order == NULL)) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: error malloc slot order array\n", __FUNCTION__);
+        }
+    }
+}
+
 static VAStatus tng__H264ES_process_misc_framerate_param(context_ENC_p ctx, object_buffer_p obj_buffer)
 {
     VAEncMiscParameterBuffer *pBuffer = (VAEncMiscParameterBuffer *) obj_buffer->buffer_data;
@@ -205,6 +257,19 @@ static VAStatus tng__H264ES_process_misc_framerate_param(context_ENC_p ctx, obje
     if (psMiscFrameRateParam->framerate < 1 || psMiscFrameRateParam->framerate > 65535)
         return VA_STATUS_ERROR_INVALID_PARAMETER;
 
+    if (psMiscFrameRateParam->framerate_flags.bits.temporal_id >= ctx->ui8TemporalLayers) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: temporal_id %d of frame rate should be 0 - %d\n",
+            __FUNCTION__, psMiscFrameRateParam->framerate_flags.bits.temporal_id, ctx->ui8TemporalLayers - 1);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    /* each layer doubles the rate of the one below, only the full rate is set */
+    if (psMiscFrameRateParam->framerate_flags.bits.temporal_id != ctx->ui8TemporalLayers - 1) {
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: frame rate %d of layer %d follows the top layer\n",
+            __FUNCTION__, psMiscFrameRateParam->framerate, psMiscFrameRateParam->framerate_flags.bits.temporal_id);
+        return VA_STATUS_SUCCESS;
+    }
+
 
     if (psRCParams->ui32FrameRate == 0)
         psRCParams->ui32FrameRate = psMiscFrameRateParam->framerate;
@@ -249,6 +314,21 @@ static VAStatus tng__H264ES_process_misc_ratecontrol_param(context_ENC_p ctx, ob
         psMiscRcParams->bits_per_second = TOPAZ_H264_MAX_BITRATE;
     }
 
+    if (psMiscRcParams->rc_flags.bits.temporal_id >= ctx->ui8TemporalLayers) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: temporal_id %d of rate control should be 0 - %d\n",
+            __FUNCTION__, psMiscRcParams->rc_flags.bits.temporal_id, ctx->ui8TemporalLayers - 1);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (ctx->ui8TemporalLayers > 1) {
+        ctx->aui32LayerBitrate[psMiscRcParams->rc_flags.bits.temporal_id] = psMiscRcParams->bits_per_second;
+        tng__H264ES_update_layer_bitrate(ctx);
+        /* the top layer carries the whole stream and drives the rate control */
+        if (psMiscRcParams->rc_flags.bits.temporal_id != ctx->ui8TemporalLayers - 1)
+            return VA_STATUS_SUCCESS;
+        psMiscRcParams->bits_per_second = ctx->aui32LayerBitrate[ctx->ui8TemporalLayers - 1];
+    }
+
     if ((psRCParams->ui32BitsPerSecond != psMiscRcParams->bits_per_second) && 
         psMiscRcParams->bits_per_second != 0) {
         psRCParams->ui32BitsPerSecond = psMiscRcParams->bits_per_second;
@@ -288,14 +368,7 @@ static VAStatus tng__H264ES_process_misc_ratecontrol_param(context_ENC_p ctx, ob
 	psRCParams->ui32BitsPerSecond = max_bps;
     }
 
-    if (ctx->uiCbrBufferTenths) {
-        psRCParams->ui32BufferSize = (IMG_UINT32)(psRCParams->ui32BitsPerSecond * ctx->uiCbrBufferTenths / 10.0);
-    } else {
-        if (psRCParams->ui32BitsPerSecond < 256000)
-            psRCParams->ui32BufferSize = ((9 * psRCParams->ui32BitsPerSecond) >> 1);
-        else
-            psRCParams->ui32BufferSize = ((5 * psRCParams->ui32BitsPerSecond) >> 1);
-    }
+    psRCParams->ui32BufferSize = tng__rc_buffer_size(psRCParams->ui32BitsPerSecond, ctx->uiCbrBufferTenths);
 
     drv_debug_msg(VIDEO_DEBUG_GENERAL,
         "%s ctx->uiCbrBufferTenths = %d, psRCParams->ui32BufferSize = %d\n",
@@ -305,13 +378,8 @@ static VAStatus tng__H264ES_process_misc_ratecontrol_param(context_ENC_p ctx, ob
         __FUNCTION__, psRCParams->ui32BitsPerSecond, psMiscRcParams->bits_per_second);
 
     //psRCParams->ui32BUSize = psMiscRcParams->basic_unit_size;
-    psRCParams->i32InitialDelay = (13 * psRCParams->ui32BufferSize) >> 4;
-    psRCParams->i32InitialLevel = (3 * psRCParams->ui32BufferSize) >> 4;
-
     ui32BitsPerFrame = psRCParams->ui32BitsPerSecond / psRCParams->ui32FrameRate;
-    /* in order to minimise mismatches between firmware and external world InitialLevel should be a multiple of ui32BitsPerFrame */
-    psRCParams->i32InitialLevel = ((psRCParams->i32InitialLevel + ui32BitsPerFrame / 2) / ui32BitsPerFrame) * ui32BitsPerFrame;
-    psRCParams->i32InitialLevel = tng__max(psRCParams->i32InitialLevel, ui32BitsPerFrame);
+    psRCParams->i32InitialLevel = tng__rc_initial_level(psRCParams->ui32BufferSize, ui32BitsPerFrame);
     psRCParams->i32InitialDelay = psRCParams->ui32BufferSize - psRCParams->i32InitialLevel;
 
     //free(psMiscRcParams);
@@ -372,7 +440,7 @@ static VAStatus tng__H264ES_process_misc_hrd_param(context_ENC_p ctx, object_buf
 	return vaStatus;
     }
 
-    if (ctx->initial_buffer_fullness > ctx->buffer_size) {
+    if (psMiscHrdParams->initial_buffer_fullness > psMiscHrdParams->buffer_size) {
 	drv_debug_msg(VIDEO_DEBUG_ERROR, "initial_buffer_fullnessi(%d) shouldn't be"
 		" larger that buffer_size(%d)!\n",
 		psMiscHrdParams->initial_buffer_fullness,
@@ -497,6 +565,100 @@ static VAStatus tng__H264ES_process_misc_cir_param(context_ENC_p ctx, object_buf
     return VA_STATUS_SUCCESS;
 }
 
+#ifdef PSBVIDEO_VA_ENC_ROI
+/*
+ * roi_value is taken as a QP delta from the constant QP, limited by
+ * min_delta_qp/max_delta_qp. The regions are turned into per-MB QPs in the
+ * input control buffer, see tng__fill_roi_inp_ctrl_buf(). Host QPs replace
+ * the firmware rate control's QP, which has no per-MB offset, so regions are
+ * only taken without rate control. The MB host control is part of the first
+ * SETVIDEO, so they have to be given before the first frame too.
+ */
+static VAStatus tng__H264ES_process_misc_roi_param(context_ENC_p ctx, object_buffer_p obj_buffer)
+{
+    VAEncMiscParameterBuffer *pBuffer = (VAEncMiscParameterBuffer *)obj_buffer->buffer_data;
+    VAEncMiscParameterBufferROI *psMiscRoiParams = NULL;
+    IMG_ROI_REGION *psROI;
+    IMG_INT32 i32Delta;
+    IMG_UINT32 i;
+
+    psMiscRoiParams = (VAEncMiscParameterBufferROI *)pBuffer->data;
+
+    if (psMiscRoiParams->num_roi && ctx->sRCParams.bRCEnable) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR,
+            "%s: ERROR: regions of interest need rate control off\n", __FUNCTION__);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (psMiscRoiParams->num_roi && !ctx->bEnableROI &&
+        ctx->ui32FrameCount[ctx->ui32StreamID] > 0) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR,
+            "%s: ERROR: regions of interest have to be set before the first frame\n", __FUNCTION__);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (psMiscRoiParams->num_roi > TNG_MAX_ROI_NUM) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR,
+            "%s: ERROR: num_roi(%d) should not be bigger than %d\n",
+            __FUNCTION__, psMiscRoiParams->num_roi, TNG_MAX_ROI_NUM);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (psMiscRoiParams->num_roi && psMiscRoiParams->roi == NULL) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: ERROR: roi list is NULL\n", __FUNCTION__);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (psMiscRoiParams->min_delta_qp > psMiscRoiParams->max_delta_qp) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR,
+            "%s: ERROR: min_delta_qp(%d) is bigger than max_delta_qp(%d)\n",
+            __FUNCTION__, psMiscRoiParams->min_delta_qp, psMiscRoiParams->max_delta_qp);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    for (i = 0; i < psMiscRoiParams->num_roi; i++) {
+        VAEncROI *psVaROI = &(psMiscRoiParams->roi[i]);
+
+        if (psVaROI->roi_rectangle.x < 0 || psVaROI->roi_rectangle.y < 0 ||
+            psVaROI->roi_rectangle.width == 0 || psVaROI->roi_rectangle.height == 0) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: ERROR: roi %d (%d,%d %dx%d) is invalid\n",
+                __FUNCTION__, i, psVaROI->roi_rectangle.x, psVaROI->roi_rectangle.y,
+                psVaROI->roi_rectangle.width, psVaROI->roi_rectangle.height);
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+        }
+
+        i32Delta = psVaROI->roi_value;
+        if (psMiscRoiParams->min_delta_qp || psMiscRoiParams->max_delta_qp) {
+            if (i32Delta > psMiscRoiParams->max_delta_qp)
+                i32Delta = psMiscRoiParams->max_delta_qp;
+            if (i32Delta < psMiscRoiParams->min_delta_qp)
+                i32Delta = psMiscRoiParams->min_delta_qp;
+        }
+
+        psROI = &(ctx->sROI[i]);
+        psROI->ui16X = psVaROI->roi_rectangle.x;
+        psROI->ui16Y = psVaROI->roi_rectangle.y;
+        psROI->ui16Width = psVaROI->roi_rectangle.width;
+        psROI->ui16Height = psVaROI->roi_rectangle.height;
+        psROI->i8QPDelta = (IMG_INT8)i32Delta;
+
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: roi %d (%d,%d %dx%d) qp delta %d\n",
+            __FUNCTION__, i, psROI->ui16X, psROI->ui16Y,
+            psROI->ui16Width, psROI->ui16Height, psROI->i8QPDelta);
+    }
+    ctx->ui8ROINum = psMiscRoiParams->num_roi;
+
+    /* once host QP is on, keep filling the buffer even with no region left */
+    if (ctx->ui8ROINum) {
+        ctx->bEnableROI = 1;
+        ctx->bEnableInpCtrl = 1;
+        ctx->bEnableHostQP = 1;
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+#endif
+
 static IMG_UINT8 tng__H264ES_calculate_level(context_ENC_p ctx)
 {
     IMG_RC_PARAMS *psRCParams = &(ctx->sRCParams);
@@ -598,13 +760,122 @@ static IMG_UINT8 tng__H264ES_calculate_level(context_ENC_p ctx)
     return (IMG_UINT8)ui32Level;
 }
 
+static void tng__H264ES_set_level(context_ENC_p ctx)
+{
+    ctx->ui32VertMVLimit = 255 ;//(63.75 in qpel increments)
+    ctx->bLimitNumVectors = IMG_FALSE;
+
+    ctx->ui8LevelIdc = tng__H264ES_calculate_level(ctx);
+
+    /*Setting VertMVLimit and LimitNumVectors only for H264*/
+    if (ctx->ui8LevelIdc >= SH_LEVEL_30)
+        ctx->bLimitNumVectors = IMG_TRUE;
+    else
+        ctx->bLimitNumVectors = IMG_FALSE;
+
+    if (ctx->ui8LevelIdc >= SH_LEVEL_31)
+        ctx->ui32VertMVLimit = 2047 ;//(511.75 in qpel increments)
+    else if (ctx->ui8LevelIdc >= SH_LEVEL_21)
+        ctx->ui32VertMVLimit = 1023 ;//(255.75 in qpel increments)
+    else if (ctx->ui8LevelIdc >= SH_LEVEL_11)
+        ctx->ui32VertMVLimit = 511 ;//(127.75 in qpel increments)
+}
+
+static IMG_BOOL tng__H264ES_minigop_closed(context_ENC_p ctx)
+{
+    return isMiniGopClosed(ctx->ui32FrameCount[ctx->ui32StreamID],
+        ctx->sRCParams.ui16BFrames, ctx->ui32IntraCnt, ctx->ui32IdrPeriod);
+}
+
+/* same IDR positions as getFrameDpyOrder() and tng__provide_buffer_PFrames() */
+static IMG_BOOL tng__H264ES_idr_scheduled(context_ENC_p ctx)
+{
+    IMG_UINT64 ui64IdrCnt = (IMG_UINT64)ctx->ui32IntraCnt * ctx->ui32IdrPeriod;
+
+    if (ctx->sRCParams.ui16BFrames > 0)
+        ++ui64IdrCnt;
+
+    return (ui64IdrCnt == 0 ||
+            (ctx->ui32FrameCount[ctx->ui32StreamID] % ui64IdrCnt) == 0);
+}
+
+/*
+ * Restarts the sequence in place at the new size: tng_EndPicture() sets the
+ * templates and the MTX video context up again without a new codec
+ * handshake, and the next frame is an IDR.
+ */
+static VAStatus tng__H264ES_apply_resolution(context_ENC_p ctx, IMG_UINT16 ui16Width, IMG_UINT16 ui16Height)
+{
+    drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: resolution changed from %dx%d to %dx%d\n",
+        __FUNCTION__, ctx->ui16Width, ctx->ui16FrameHeight, ui16Width, ui16Height);
+
+    ctx->ui16Width = ui16Width;
+    ctx->ui16FrameHeight = ui16Height;
+    ctx->ui16PictureHeight = ui16Height;
+    /* basic unit is derived from the picture width again */
+    ctx->ui32BasicUnit = 0;
+
+    if (ctx->sAirInfo.pi8AIR_Table != NULL) {
+        free(ctx->sAirInfo.pi8AIR_Table);
+        ctx->sAirInfo.pi8AIR_Table = NULL;
+        if (tng_air_buf_create(ctx) != VA_STATUS_SUCCESS)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    if (ctx->ui32FrameCount[ctx->ui32StreamID] > 0) {
+        ctx->ui32FrameCount[ctx->ui32StreamID] = 0;
+        ctx->idr_force_flag = 0;
+        ctx->ref_invalidate_flag = 0;
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+/*
+ * The context buffers are sized for the picture the context was created
+ * with, a sequence can code any size up to that. A new size mid stream
+ * restarts the sequence and the next frame is an IDR. With B frames that is
+ * only possible once the current mini GOP is closed, the B frames still
+ * owed to its coded anchor would be lost otherwise: a new size sent in the
+ * middle of a mini GOP fails with VA_STATUS_ERROR_OPERATION_FAILED and
+ * leaves the sequence untouched, the application sends it again with the
+ * next anchor frame.
+ */
+static VAStatus tng__H264ES_update_resolution(context_ENC_p ctx, VAEncSequenceParameterBufferH264 *psSeqParams)
+{
+    object_context_p obj_context = ctx->obj_context;
+    IMG_UINT16 ui16Width = (IMG_UINT16)(psSeqParams->picture_width_in_mbs << 4);
+    IMG_UINT16 ui16Height = (IMG_UINT16)(psSeqParams->picture_height_in_mbs << 4);
+
+    if (ui16Width == 0 || ui16Height == 0)
+        return VA_STATUS_SUCCESS;
+
+    if (ui16Width == ctx->ui16Width && ui16Height == ctx->ui16FrameHeight)
+        return VA_STATUS_SUCCESS;
+
+    if (ui16Width > (unsigned short)(~0xf & (obj_context->picture_width + 0xf)) ||
+        ui16Height > (unsigned short)(~0xf & (obj_context->picture_height + 0xf))) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: %dx%d is larger than the context size %dx%d\n",
+            __FUNCTION__, ui16Width, ui16Height, obj_context->picture_width, obj_context->picture_height);
+        return VA_STATUS_ERROR_RESOLUTION_NOT_SUPPORTED;
+    }
+
+    if (!tng__H264ES_minigop_closed(ctx)) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: %dx%d at frame %d is inside a mini GOP, "
+            "change the size on an anchor frame\n",
+            __FUNCTION__, ui16Width, ui16Height, ctx->ui32FrameCount[ctx->ui32StreamID]);
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+
+    return tng__H264ES_apply_resolution(ctx, ui16Width, ui16Height);
+}
+
 static VAStatus tng__H264ES_process_sequence_param(context_ENC_p ctx, object_buffer_p obj_buffer)
 {
     VAStatus vaStatus = VA_STATUS_SUCCESS;
     VAEncSequenceParameterBufferH264 *psSeqParams;
     H264_CROP_PARAMS* psCropParams = &(ctx->sCropParams);
     IMG_RC_PARAMS *psRCParams = &(ctx->sRCParams);
-    FRAME_ORDER_INFO *psFrameInfo = &(ctx->sFrameOrderInfo);
     H264_VUI_PARAMS *psVuiParams = &(ctx->sVuiParams);
     IMG_UINT32 ui32MaxUnit32 = (IMG_UINT32)0x7ffa;
     IMG_UINT32 ui32IPCount = 0;
@@ -618,8 +889,13 @@ static VAStatus tng__H264ES_process_sequence_param(context_ENC_p ctx, object_buf
         goto out1;
     }
 
-    ctx->obj_context->frame_count = 0;
     psSeqParams = (VAEncSequenceParameterBufferH264 *) obj_buffer->buffer_data;
+
+    vaStatus = tng__H264ES_update_resolution(ctx, psSeqParams);
+    if (vaStatus != VA_STATUS_SUCCESS)
+        goto out1;
+
+    ctx->obj_context->frame_count = 0;
     obj_buffer->buffer_data = NULL;
     obj_buffer->size = 0;
 
@@ -642,6 +918,10 @@ static VAStatus tng__H264ES_process_sequence_param(context_ENC_p ctx, object_buf
         goto out1;
     }
 
+    /* the temporal layer structure fixes the mini GOP, ip_period is ignored */
+    if (ctx->ui8TemporalLayers > 1)
+        ui32IPCount = 1 << (ctx->ui8TemporalLayers - 1);
+
     if (ctx->ui32IntraCnt == 0) {
         if (ui32IPCount == 1)
             ctx->ui32IntraCnt = INT_MAX;
@@ -663,12 +943,7 @@ static VAStatus tng__H264ES_process_sequence_param(context_ENC_p ctx, object_buf
             }
         }
 
-        if ((ctx->ui32IntraCnt % ui32IPCount) != 0) {
-            if (ctx->ui32IntraCnt > INT_MAX - ui32IPCount + (ctx->ui32IntraCnt % ui32IPCount))
-                ctx->ui32IntraCnt = INT_MAX - ui32IPCount + (ctx->ui32IntraCnt % ui32IPCount);
-            else
-                ctx->ui32IntraCnt += ui32IPCount - (ctx->ui32IntraCnt % ui32IPCount);
-        }
+        ctx->ui32IntraCnt = tng__rc_intra_period(ctx->ui32IntraCnt, ui32IPCount);
     }
 
     if (ctx->ui32FrameCount[ctx->ui32StreamID] > 0) {
@@ -721,21 +996,11 @@ static VAStatus tng__H264ES_process_sequence_param(context_ENC_p ctx, object_buf
         ctx->ui8ProfileIdc = H264ES_PROFILE_MAIN;
     }
 
-    if (psFrameInfo->slot_consume_dpy_order != NULL)
-        free(psFrameInfo->slot_consume_dpy_order);
-    if (psFrameInfo->slot_consume_enc_order != NULL)
-        free(psFrameInfo->slot_consume_enc_order);
-
-    if (psRCParams->ui16BFrames != 0) {
-        memset(psFrameInfo, 0, sizeof(FRAME_ORDER_INFO));
-        psFrameInfo->slot_consume_dpy_order = (int *)malloc(ctx->ui8SlotsInUse * sizeof(int));
-        psFrameInfo->slot_consume_enc_order = (int *)malloc(ctx->ui8SlotsInUse * sizeof(int));
+    /* temporal layers are the levels of a hierarchical B mini GOP */
+    psRCParams->b16Hierarchical = (ctx->ui8TemporalLayers > 1 && psRCParams->ui16BFrames > 0);
+    ctx->b_is_mv_setting_hierar = psRCParams->b16Hierarchical;
 
-        if ((psFrameInfo->slot_consume_dpy_order == NULL) || 
-            (psFrameInfo->slot_consume_enc_order == NULL)) {
-            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: error malloc slot order array\n", __FUNCTION__);
-        }
-    }
+    tng__H264ES_alloc_frame_order(ctx);
 
     //set the crop parameters
     psCropParams->bClip = psSeqParams->frame_cropping_flag;
@@ -745,26 +1010,10 @@ static VAStatus tng__H264ES_process_sequence_param(context_ENC_p ctx, object_buf
     psCropParams->ui16BottomCropOffset = psSeqParams->frame_crop_bottom_offset;
 
     //set level idc parameter
-    ctx->ui32VertMVLimit = 255 ;//(63.75 in qpel increments)
-    ctx->bLimitNumVectors = IMG_FALSE;
-
     if (ctx->ui8LevelIdc == 111)
         ctx->ui8LevelIdc = SH_LEVEL_1B;
 
-    ctx->ui8LevelIdc = tng__H264ES_calculate_level(ctx);
-
-    /*Setting VertMVLimit and LimitNumVectors only for H264*/
-    if (ctx->ui8LevelIdc >= SH_LEVEL_30)
-        ctx->bLimitNumVectors = IMG_TRUE;
-    else
-        ctx->bLimitNumVectors = IMG_FALSE;
-
-    if (ctx->ui8LevelIdc >= SH_LEVEL_31)
-        ctx->ui32VertMVLimit = 2047 ;//(511.75 in qpel increments)
-    else if (ctx->ui8LevelIdc >= SH_LEVEL_21)
-        ctx->ui32VertMVLimit = 1023 ;//(255.75 in qpel increments)
-    else if (ctx->ui8LevelIdc >= SH_LEVEL_11)
-        ctx->ui32VertMVLimit = 511 ;//(127.75 in qpel increments)
+    tng__H264ES_set_level(ctx);
 
     //set VUI info
     memset(psVuiParams, 0, sizeof(H264_VUI_PARAMS));
@@ -935,6 +1184,14 @@ static VAStatus tng__H264ES_process_picture_param_base(context_ENC_p ctx, unsign
 
     ctx->ui32LastPicture = psPicParams->last_picture;
 
+    /*
+     * Applications that follow the driver's GOP set idr_pic_flag on the
+     * frames it codes as IDR anyway. Only a flag off that schedule asks for
+     * an extra IDR, tng_EndPicture() applies it.
+     */
+    if (psPicParams->pic_fields.bits.idr_pic_flag && !tng__H264ES_idr_scheduled(ctx))
+        ctx->idr_force_flag = 1;
+
     return vaStatus;
 }
 
@@ -1083,6 +1340,126 @@ static VAStatus tng__H264ES_process_misc_max_slice_size_param(context_ENC_p ctx,
     return VA_STATUS_SUCCESS;
 }
 
+static VAStatus tng__H264ES_process_misc_max_frame_size_param(context_ENC_p ctx, object_buffer_p obj_buffer)
+{
+    VAEncMiscParameterBuffer *pBuffer = (VAEncMiscParameterBuffer *) obj_buffer->buffer_data;
+    VAEncMiscParameterBufferMaxFrameSize *psMiscMaxFrameSizeParams = NULL;
+    MAX_FRAME_SIZE_STATE *psState = &(ctx->sMaxFrameSize);
+
+    psMiscMaxFrameSizeParams = (VAEncMiscParameterBufferMaxFrameSize *)pBuffer->data;
+
+    /* max_frame_size is in bits, 0 turns the limit off */
+    psState->ui32MaxFrameBits = psMiscMaxFrameSizeParams->max_frame_size;
+    drv_debug_msg(VIDEO_DEBUG_GENERAL,
+        "Max frame size is %d bits\n", psState->ui32MaxFrameBits);
+
+    return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Selects the motion search preset. The search setup is part of the slice
+ * templates, so a new level applies from the next sequence on.
+ */
+static VAStatus tng__H264ES_process_misc_quality_level_param(context_ENC_p ctx, object_buffer_p obj_buffer)
+{
+    VAEncMiscParameterBuffer *pBuffer = (VAEncMiscParameterBuffer *) obj_buffer->buffer_data;
+    VAEncMiscParameterBufferQualityLevel *psMiscQualityLevel = NULL;
+
+    psMiscQualityLevel = (VAEncMiscParameterBufferQualityLevel *)pBuffer->data;
+
+    if (psMiscQualityLevel->quality_level > TNG_QUALITY_LEVELS) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: quality_level %d should be 0 - %d\n",
+            __FUNCTION__, psMiscQualityLevel->quality_level, TNG_QUALITY_LEVELS);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    ctx->ui8QualityLevel = psMiscQualityLevel->quality_level ? psMiscQualityLevel->quality_level : 1;
+    drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: quality level %d\n", __FUNCTION__, ctx->ui8QualityLevel);
+
+    return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Temporal layers are coded as a dyadic hierarchical B mini GOP of
+ * 2^(layers - 1) frames: the P closing it is layer 0, every split of the
+ * mini GOP adds a layer and the frames of the top layer are not referenced,
+ * so dropping layers from the top halves the frame rate each time.
+ */
+static VAStatus tng__H264ES_process_misc_temporal_layer_param(context_ENC_p ctx, object_buffer_p obj_buffer)
+{
+    VAEncMiscParameterBuffer *pBuffer = (VAEncMiscParameterBuffer *) obj_buffer->buffer_data;
+    VAEncMiscParameterTemporalLayerStructure *psMiscLayerParams = NULL;
+    IMG_RC_PARAMS *psRCParams = &(ctx->sRCParams);
+    IMG_UINT32 ui32Layers, ui32GopSize, ui32Expected, i;
+
+    psMiscLayerParams = (VAEncMiscParameterTemporalLayerStructure *)pBuffer->data;
+    ui32Layers = psMiscLayerParams->number_of_layers;
+
+    if (ui32Layers < 1 || ui32Layers > TNG_MAX_TEMPORAL_LAYERS) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: number_of_layers %d should be 1 - %d\n",
+            __FUNCTION__, ui32Layers, TNG_MAX_TEMPORAL_LAYERS);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    ui32GopSize = 1 << (ui32Layers - 1);
+    if (ui32Layers > 1) {
+        if (psMiscLayerParams->periodicity != ui32GopSize) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: periodicity %d should be %d for %d layers\n",
+                __FUNCTION__, psMiscLayerParams->periodicity, ui32GopSize, ui32Layers);
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+        }
+
+        /* layer_id[] is in display order, starting with the layer 0 anchor */
+        for (i = 0; i < ui32GopSize; i++) {
+            ui32Expected = 0;
+            if (i != 0) {
+                ui32Expected = ui32Layers - 1;
+                while (!((i >> (ui32Layers - 1 - ui32Expected)) & 1))
+                    ui32Expected--;
+            }
+            if (psMiscLayerParams->layer_id[i] != ui32Expected) {
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: layer_id[%d] %d, only the dyadic pattern is supported\n",
+                    __FUNCTION__, i, psMiscLayerParams->layer_id[i]);
+                return VA_STATUS_ERROR_INVALID_PARAMETER;
+            }
+        }
+    }
+
+    if (ui32Layers == ctx->ui8TemporalLayers)
+        return VA_STATUS_SUCCESS;
+
+    /* the mini GOP shapes the context buffers, set up on the first frame */
+    if (ctx->ui32FrameCount[ctx->ui32StreamID] > 0) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: temporal layers can only change before the first frame\n",
+            __FUNCTION__);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    ctx->ui8TemporalLayers = (IMG_UINT8)ui32Layers;
+    memset(ctx->aui32LayerBitrate, 0, sizeof(ctx->aui32LayerBitrate));
+
+    /* sequence parameters already seen, reshape the GOP they set up */
+    if (ctx->ui8SlotsInUse != 0 && ctx->ui32IntraCnt > 1 && psRCParams->eRCMode != IMG_RCMODE_VCM) {
+        ctx->ui32IntraCnt = tng__rc_intra_period(ctx->ui32IntraCnt, ui32GopSize);
+        ctx->ui32IntraCntSave = ctx->ui32IntraCnt;
+        psRCParams->ui32IntraFreq = ctx->ui32IntraCnt;
+        ctx->ui8SlotsInUse = ui32GopSize + 1;
+        psRCParams->ui16BFrames = ui32GopSize - 1;
+        psRCParams->b16Hierarchical = (ui32Layers > 1);
+        ctx->b_is_mv_setting_hierar = psRCParams->b16Hierarchical;
+
+        if ((psRCParams->ui16BFrames > 0) && (ctx->ui8ProfileIdc == H264ES_PROFILE_BASELINE))
+            ctx->ui8ProfileIdc = H264ES_PROFILE_MAIN;
+
+        tng__H264ES_alloc_frame_order(ctx);
+    }
+
+    drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: %d temporal layers, %d B frames\n",
+        __FUNCTION__, ui32Layers, psRCParams->ui16BFrames);
+
+    return VA_STATUS_SUCCESS;
+}
+
 static VAStatus tng__H264ES_process_slice_param(context_ENC_p ctx, object_buffer_p obj_buffer)
 {
     VAStatus vaStatus = VA_STATUS_SUCCESS;
@@ -1108,6 +1485,22 @@ static VAStatus tng__H264ES_process_slice_param(context_ENC_p ctx, object_buffer
     return vaStatus;
 }
 
+/*
+ * The firmware picks the references itself and has no long term ones, so
+ * it can not be told to predict from an older reference. Dropping the most
+ * recent one is honoured by coding the next reference frame as a non-IDR
+ * intra frame, see tng_EndPicture().
+ */
+static VAStatus tng__H264ES_process_misc_ref_invalidate_param(context_ENC_p ctx, object_buffer_p obj_buffer)
+{
+    ASSERT(obj_buffer->type == VAEncMiscParameterBufferType);
+
+    if (ctx->ui32FrameCount[ctx->ui32StreamID] > 0)
+        ctx->ref_invalidate_flag = 1;
+
+    return VA_STATUS_SUCCESS;
+}
+
 static VAStatus tng__H264ES_process_misc_param(context_ENC_p ctx, object_buffer_p obj_buffer)
 {
     VAStatus vaStatus = VA_STATUS_SUCCESS;
@@ -1138,6 +1531,23 @@ static VAStatus tng__H264ES_process_misc_param(context_ENC_p ctx, object_buffer_
 	case VAEncMiscParameterTypeMaxSliceSize:
 	    vaStatus = tng__H264ES_process_misc_max_slice_size_param(ctx, obj_buffer);
             break;
+        case VAEncMiscParameterTypeMaxFrameSize:
+            vaStatus = tng__H264ES_process_misc_max_frame_size_param(ctx, obj_buffer);
+            break;
+        case VAEncMiscParameterTypeTemporalLayerStructure:
+            vaStatus = tng__H264ES_process_misc_temporal_layer_param(ctx, obj_buffer);
+            break;
+        case VAEncMiscParameterTypeQualityLevel:
+            vaStatus = tng__H264ES_process_misc_quality_level_param(ctx, obj_buffer);
+            break;
+#ifdef PSBVIDEO_VA_ENC_ROI
+        case VAEncMiscParameterTypeROI:
+            vaStatus = tng__H264ES_process_misc_roi_param(ctx, obj_buffer);
+            break;
+#endif
+        case VAEncMiscParameterTypeTNGRefInvalidate:
+            vaStatus = tng__H264ES_process_misc_ref_invalidate_param(ctx, obj_buffer);
+            break;
         default:
             break;
     }
@@ -1173,6 +1583,16 @@ static void tng_H264ES_QueryConfigAttributes(
             attrib_list[i].value = 4;
             break;
 
+        case VAConfigAttribEncQualityRange:
+            attrib_list[i].value = TNG_QUALITY_LEVELS;
+            break;
+
+#ifdef PSBVIDEO_VA_ENC_ROI
+        case VAConfigAttribEncROI:
+            attrib_list[i].value = TNG_MAX_ROI_NUM;
+            break;
+#endif
+
         default:
             attrib_list[i].value = VA_ATTRIB_NOT_SUPPORTED;
             break;
@@ -1197,6 +1617,12 @@ static VAStatus tng_H264ES_ValidateConfig(
                 break;
             case VAConfigAttribEncMaxRefFrames:
                 break;
+            case VAConfigAttribEncQualityRange:
+                break;
+#ifdef PSBVIDEO_VA_ENC_ROI
+            case VAConfigAttribEncROI:
+                break;
+#endif
             default:
                 return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
         }
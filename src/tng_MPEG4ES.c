@@ -42,6 +42,7 @@
 #include "tng_cmdbuf.h"
 #include "tng_hostcode.h"
 #include "tng_hostheader.h"
+#include "tng_hostrc.h"
 #include "tng_MPEG4ES.h"
 #include "psb_drv_debug.h"
 
@@ -270,14 +271,7 @@ static VAStatus tng__MPEG4ES_process_sequence_param(context_ENC_p ctx, object_bu
     if (!ctx->uiCbrBufferTenths)
 	ctx->uiCbrBufferTenths = TOPAZHP_DEFAULT_uiCbrBufferTenths;
 
-    if (ctx->uiCbrBufferTenths) {
-        psRCParams->ui32BufferSize      = (IMG_UINT32)(psRCParams->ui32BitsPerSecond * ctx->uiCbrBufferTenths / 10.0);
-    } else {
-        if (psRCParams->ui32BitsPerSecond < 256000)
-            psRCParams->ui32BufferSize = ((9 * psRCParams->ui32BitsPerSecond) >> 1);
-        else
-            psRCParams->ui32BufferSize = ((5 * psRCParams->ui32BitsPerSecond) >> 1);
-    }
+    psRCParams->ui32BufferSize = tng__rc_buffer_size(psRCParams->ui32BitsPerSecond, ctx->uiCbrBufferTenths);
 
     psRCParams->i32InitialDelay = (13 * psRCParams->ui32BufferSize) >> 4;
     psRCParams->i32InitialLevel = (3 * psRCParams->ui32BufferSize) >> 4;
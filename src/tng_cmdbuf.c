@@ -107,6 +107,7 @@ static void tng_cmdbuf_clear(tng_cmdbuf_p cmdbuf, int flag)
         psb_buffer_destroy(&cmdbuf->buf);
         cmdbuf->size = 0;
     }
+    psb_buffer_ref_set_destroy(&cmdbuf->buffer_ref_set);
     if (cmdbuf->buffer_refs_allocated) {
         free(cmdbuf->buffer_refs);
         cmdbuf->buffer_refs = NULL;
@@ -135,6 +136,7 @@ VAStatus tng_cmdbuf_create(
     cmdbuf->reloc_base = NULL;
     cmdbuf->reloc_idx = NULL;
     cmdbuf->buffer_refs_count = 0;
+    memset(&cmdbuf->buffer_ref_set, 0, sizeof(cmdbuf->buffer_ref_set));
     cmdbuf->buffer_refs_allocated = 10;
     cmdbuf->buffer_refs = (psb_buffer_p *) calloc(1, sizeof(psb_buffer_p) * cmdbuf->buffer_refs_allocated);
     if (NULL == cmdbuf->buffer_refs) {
@@ -175,6 +177,7 @@ VAStatus tng_cmdbuf_create(
      */
 
     /* create JPEG quantization buffer */
+    cmdbuf->jpeg_setup_valid = 0;
     vaStatus = psb_buffer_create(driver_data, ctx->jpeg_pic_params_size, psb_bt_cpu_vpu, &cmdbuf->jpeg_pic_params);
     if (VA_STATUS_SUCCESS != vaStatus) {
         drv_debug_msg(VIDEO_DEBUG_ERROR, "psb buffer create 1 \n", __FUNCTION__);
@@ -215,6 +218,7 @@ void tng_cmdbuf_destroy(tng_cmdbuf_p cmdbuf)
         psb_buffer_destroy(&cmdbuf->buf);
         cmdbuf->size = 0;
     }
+    psb_buffer_ref_set_destroy(&cmdbuf->buffer_ref_set);
     if (cmdbuf->buffer_refs_allocated) {
         free(cmdbuf->buffer_refs);
         cmdbuf->buffer_refs = NULL;
@@ -237,6 +241,7 @@ int tng_cmdbuf_reset(tng_cmdbuf_p cmdbuf)
     cmdbuf->reloc_idx = NULL;
 
     cmdbuf->buffer_refs_count = 0;
+    psb_buffer_ref_set_reset(&cmdbuf->buffer_ref_set);
     cmdbuf->frame_mem_index = 0;
     cmdbuf->cmd_count = 0;
     cmdbuf->mem_size = tng_align_KB(TNG_HEADER_SIZE);
@@ -282,21 +287,16 @@ int tng_cmdbuf_unmap(tng_cmdbuf_p cmdbuf)
  */
 int tng_cmdbuf_buffer_ref(tng_cmdbuf_p cmdbuf, psb_buffer_p buf)
 {
-    int item_loc = 0;
+    uint32_t handle = wsbmKBufHandle(wsbmKBuf(buf->drm_buf));
+    int item_loc = psb_buffer_ref_set_find(&cmdbuf->buffer_ref_set, handle);
 
     /*Reserve the same TTM BO twice will cause kernel lock up*/
-    while ((item_loc < cmdbuf->buffer_refs_count)
-           && (wsbmKBufHandle(wsbmKBuf(cmdbuf->buffer_refs[item_loc]->drm_buf))
-               != wsbmKBufHandle(wsbmKBuf(buf->drm_buf))))
-        //while( (item_loc < cmdbuf->buffer_refs_count) && (cmdbuf->buffer_refs[item_loc] != buf) )
-    {
-        item_loc++;
-    }
-    if (item_loc == cmdbuf->buffer_refs_count) {
+    if (item_loc < 0) {
         /* Add new entry */
+        item_loc = cmdbuf->buffer_refs_count;
         if (item_loc >= cmdbuf->buffer_refs_allocated) {
             /* Allocate more entries */
-            int new_size = cmdbuf->buffer_refs_allocated + 10;
+            int new_size = cmdbuf->buffer_refs_allocated ? cmdbuf->buffer_refs_allocated * 2 : 10;
             psb_buffer_p *new_array;
             new_array = (psb_buffer_p *) calloc(1, sizeof(psb_buffer_p) * new_size);
             if (NULL == new_array) {
@@ -307,6 +307,9 @@ int tng_cmdbuf_buffer_ref(tng_cmdbuf_p cmdbuf, psb_buffer_p buf)
             cmdbuf->buffer_refs_allocated = new_size;
             cmdbuf->buffer_refs = new_array;
         }
+        if (psb_buffer_ref_set_add(&cmdbuf->buffer_ref_set, handle, item_loc)) {
+            return -1; /* Allocation failure */
+        }
         cmdbuf->buffer_refs[item_loc] = buf;
         cmdbuf->buffer_refs_count++;
         buf->status = psb_bs_queued;
@@ -551,6 +554,7 @@ ptgDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
         req->next = (unsigned long) & (arg_list[i+1]);
 
         req->buffer_handle = wsbmKBufHandle(wsbmKBuf(buffer_list[i]->drm_buf));
+        psb_buffer_gpu_access(buffer_list[i]);
         //req->group = 0;
         req->set_flags = (PSB_GPU_ACCESS_READ | PSB_GPU_ACCESS_WRITE) & mask;
         req->clear_flags = (~(PSB_GPU_ACCESS_READ | PSB_GPU_ACCESS_WRITE)) & mask;
@@ -579,12 +583,16 @@ ptgDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
     //ca.damage = damage;
 
 
+    wsbmWriteLockKernelBO();
     do {
         ret = drmCommandWrite(fd, ioctl_offset, &ca, sizeof(ca));
         if (ret == -EAGAIN || ret == -EBUSY) {
             drv_debug_msg(VIDEO_DEBUG_ERROR, "drmCommandWrite returns with %s, retry\n",
                           ret==-EAGAIN?"EAGAIN":"EBUSY");
             retry++;
+            /* this engine's queue is full, let other engines submit meanwhile */
+            wsbmWriteUnlockKernelBO();
+            wsbmWriteLockKernelBO();
         }
     } while (ret == -EAGAIN || ret == -EBUSY);
 
@@ -593,7 +601,7 @@ ptgDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
                       retry, ret==0?"okay":"failed!", ret);
 
     if (ret)
-        goto out;
+        goto out_unlock;
 
     for (i = 0; i < buffer_count; i++) {
         struct psb_validate_arg *arg = &(arg_list[i]);
@@ -601,15 +609,17 @@ ptgDRMCmdBuf(int fd, int ioctl_offset, psb_buffer_p *buffer_list, int buffer_cou
 
         if (!arg->handled) {
             ret = -EFAULT;
-            goto out;
+            goto out_unlock;
         }
         if (arg->ret != 0) {
             ret = arg->ret;
-            goto out;
+            goto out_unlock;
         }
         wsbmUpdateKBuf(wsbmKBuf(buffer_list[i]->drm_buf),
                        rep->gpu_offset, rep->placement, rep->fence_type_mask);
     }
+out_unlock:
+    wsbmWriteUnlockKernelBO();
 out:
     free(arg_list);
     for (i = 0; i < buffer_count; i++) {
@@ -732,9 +742,9 @@ int tng_context_flush_cmdbuf(object_context_p obj_context)
     ASSERT(cmdbuffer_size < CMD_SIZE);
     ASSERT((void *) cmdbuf->cmd_idx < CMD_END(cmdbuf));
     /* LOCK */
-    ret = LOCK_HARDWARE(driver_data);
+    ret = LOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
     if (ret) {
-        UNLOCK_HARDWARE(driver_data);
+        UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
         DEBUG_FAILURE_RET;
         return ret;
     }
@@ -754,7 +764,6 @@ int tng_context_flush_cmdbuf(object_context_p obj_context)
 #endif
 
 
-    wsbmWriteLockKernelBO();
 #if 1 //_PO_DEBUG_
     ret = ptgDRMCmdBuf(driver_data->drm_fd, driver_data->execIoctlOffset, /* FIXME Still use ioctl cmd? */
                        cmdbuf->buffer_refs, cmdbuf->buffer_refs_count, wsbmKBufHandle(wsbmKBuf(cmdbuf->buf.drm_buf)),
@@ -762,9 +771,8 @@ int tng_context_flush_cmdbuf(object_context_p obj_context)
                        wsbmKBufHandle(wsbmKBuf(cmdbuf->buf.drm_buf)), reloc_offset, num_relocs,
                        0, LNC_ENGINE_ENCODE, fence_flags, &fence_rep); /* FIXME use LNC_ENGINE_ENCODE */
 #endif
-    wsbmWriteUnlockKernelBO();
 
-    UNLOCK_HARDWARE(driver_data);
+    UNLOCK_HARDWARE_ENGINE(driver_data, PSB_LOCK_ENGINE_TOPAZ);
 
     if (ret) {
         obj_context->tng_cmdbuf = NULL;
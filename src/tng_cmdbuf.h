@@ -98,6 +98,9 @@ struct tng_cmdbuf_s {
     struct psb_buffer_s jpeg_header_interface_mem;
     void *jpeg_header_interface_mem_p;
 
+    /* Bit per JPEG batch slot whose setup blocks already hold the context's static state */
+    IMG_UINT32 jpeg_setup_valid;
+
 
     /*buffer information g_apsCmdDataInfo */
     struct psb_buffer_s frame_mem;
@@ -137,6 +140,7 @@ struct tng_cmdbuf_s {
     psb_buffer_p *buffer_refs;
     int buffer_refs_count;
     int buffer_refs_allocated;
+    psb_buffer_ref_set_t buffer_ref_set;
 };
 
 typedef struct tng_cmdbuf_s *tng_cmdbuf_p;
@@ -372,6 +372,76 @@ static void tng__fill_inp_ctrl_buf(
     return ;
 }
 
+/*
+ * Set the QP field of every macroblock to the constant QP, without the
+ * jitter tng__fill_inp_ctrl_buf adds, then to the QP of the region of
+ * interest covering it. The intra/bias bits set for CIR are kept. Regions
+ * are applied from last to first so the first one wins where they overlap,
+ * and the resulting QP stays within the min/max QP.
+ */
+static void tng__fill_roi_inp_ctrl_buf(
+    context_ENC_p ctx,
+    IMG_UINT8 *pInpCtrlBuf,
+    IMG_UINT32 ui32HalfWayBU)
+{
+    IMG_UINT16 *pui16MBParam = (IMG_UINT16 *)pInpCtrlBuf;
+    IMG_UINT32 ui32MBFrameWidth = ctx->ui16Width / 16;
+    IMG_UINT32 ui32MBPictureHeight = ctx->ui16PictureHeight / 16;
+    IMG_UINT32 ui32MBLeft, ui32MBTop, ui32MBRight, ui32MBBottom;
+    IMG_UINT32 ui32MBx, ui32MBy, ui32Index;
+    IMG_INT32 i32QP, i32MaxQP, i32MinQP;
+    IMG_ROI_REGION *psROI;
+    IMG_INT32 i;
+#ifdef BRN_30324
+    IMG_UINT32 ui32HalfWayMB = ui32HalfWayBU * ctx->sRCParams.ui32BUSize;
+    IMG_BOOL bSplit = (ui32HalfWayMB && ctx->ui8SlicesPerPicture > 1 && ctx->i32NumPipes > 1);
+#endif
+
+    i32MaxQP = (ctx->eStandard == IMG_STANDARD_H264) ? 51 : 31;
+    if (ctx->max_qp > 0 && ctx->max_qp < i32MaxQP)
+        i32MaxQP = ctx->max_qp;
+    i32MinQP = ctx->sRCParams.iMinQP;
+
+    /* i == ui8ROINum is the whole picture at the constant QP, written first */
+    for (i = ctx->ui8ROINum; i >= 0; i--) {
+        if (i < ctx->ui8ROINum) {
+            psROI = &(ctx->sROI[i]);
+            ui32MBLeft = psROI->ui16X / 16;
+            ui32MBTop = psROI->ui16Y / 16;
+            ui32MBRight = (psROI->ui16X + psROI->ui16Width + 15) / 16;
+            ui32MBBottom = (psROI->ui16Y + psROI->ui16Height + 15) / 16;
+            i32QP = (IMG_INT32)ctx->sRCParams.ui32InitialQp + psROI->i8QPDelta;
+        } else {
+            ui32MBLeft = 0;
+            ui32MBTop = 0;
+            ui32MBRight = ui32MBFrameWidth;
+            ui32MBBottom = ui32MBPictureHeight;
+            i32QP = (IMG_INT32)ctx->sRCParams.ui32InitialQp;
+        }
+        if (ui32MBRight > ui32MBFrameWidth)
+            ui32MBRight = ui32MBFrameWidth;
+        if (ui32MBBottom > ui32MBPictureHeight)
+            ui32MBBottom = ui32MBPictureHeight;
+
+        if (i32QP > i32MaxQP)
+            i32QP = i32MaxQP;
+        if (i32QP < i32MinQP)
+            i32QP = i32MinQP;
+
+        for (ui32MBy = ui32MBTop; ui32MBy < ui32MBBottom; ui32MBy++) {
+            for (ui32MBx = ui32MBLeft; ui32MBx < ui32MBRight; ui32MBx++) {
+                ui32Index = ui32MBy * ui32MBFrameWidth + ui32MBx;
+#ifdef BRN_30324
+                /* same gap tng__fill_inp_ctrl_buf leaves at the half way MB */
+                if (bSplit && ui32Index >= ui32HalfWayMB)
+                    ui32Index = ((ui32HalfWayMB + 31) & ~31) + (ui32Index - ui32HalfWayMB);
+#endif
+                pui16MBParam[ui32Index] = (pui16MBParam[ui32Index] & ~(0xFF << 10)) | (i32QP << 10);
+            }
+        }
+    }
+}
+
 /***********************************************************************************
  * Function Name     : APP_FillInputControl
  * Inputs                   : psContext
@@ -384,6 +454,20 @@ static void tng__fill_input_control(
 {
     IMG_UINT8 * pInpCtrlBuf = NULL;
     IMG_INT8 i8InitialQp = ctx->sRCParams.ui32InitialQp;
+
+    /* the firmware CIR setup would overwrite the region QPs, fill on the host instead */
+    if (ctx->bEnableROI) {
+        tng__map_inp_ctrl_buf(ctx, ui8SlotNum, &pInpCtrlBuf);
+        if (pInpCtrlBuf != IMG_NULL) {
+            /* for the CIR intra and bias bits, the QPs are all rewritten */
+            tng__fill_inp_ctrl_buf(ctx, pInpCtrlBuf,
+                ctx->bEnableCIR ? (IMG_INT16)(ctx->ui16IntraRefresh) : 0, &i8InitialQp, ui32HalfWayBU);
+            tng__fill_roi_inp_ctrl_buf(ctx, pInpCtrlBuf, ui32HalfWayBU);
+        }
+        tng__unmap_inp_ctrl_buf(ctx, ui8SlotNum, &pInpCtrlBuf);
+        return ;
+    }
+
     // Get pointer to MB Control buffer for current source buffer (if input control is enabled, otherwise buffer is NULL)
     // Please refer to kernel tng_setup_cir_buf()
     /*
@@ -41,6 +41,7 @@
 #include "tng_picmgmt.h"
 #include "tng_hostbias.h"
 #include "tng_hostair.h"
+#include "tng_hostrc.h"
 #ifdef _TOPAZHP_PDUMP_
 #include "tng_trace.h"
 #endif
@@ -132,7 +133,7 @@ VAStatus tng__alloc_init_buffer(
         return vaStatus;
     }
 
-    vaStatus = psb_buffer_map(buf, &pch_virt_addr);
+    vaStatus = psb_buffer_map_access(buf, &pch_virt_addr, PSB_BUFFER_MAP_WRITE);
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: phy addr 0x%08x, vir addr 0x%08x\n", __FUNCTION__, buf->drm_buf, pch_virt_addr);
     if ((vaStatus) || (pch_virt_addr == NULL)) {
         drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: map buf 0x%08x\n", __FUNCTION__, (IMG_UINT32)pch_virt_addr);
@@ -537,6 +538,36 @@ static void tng__trace_cmdbuf(tng_cmdbuf_p cmdbuf, int idx)
 }
 #endif
 
+static IMG_UINT32 tng__codedbuf_bin_limit(IMG_UINT32 ui32Bin);
+
+/* Log the coded buffer size histogram, one line per non empty bin */
+static void tng__dump_codedbuf_stats(CODEDBUF_SIZE_STATS *psStats)
+{
+    static const char acType[TNG_CODEDBUF_STATS_TYPES] = { 'I', 'P', 'B' };
+    IMG_UINT32 ui32Type, i;
+
+    if (psStats->aui32Frames[TNG_CODEDBUF_STATS_I] +
+        psStats->aui32Frames[TNG_CODEDBUF_STATS_P] +
+        psStats->aui32Frames[TNG_CODEDBUF_STATS_B] == 0)
+        return;
+
+    drv_debug_msg(VIDEO_DEBUG_INIT, "%s: coded buffer peak I/P/B %d/%d/%d bytes, "
+        "%d overflows, recommended coded buffer size %d\n", __FUNCTION__,
+        psStats->aui32PeakSize[TNG_CODEDBUF_STATS_I],
+        psStats->aui32PeakSize[TNG_CODEDBUF_STATS_P],
+        psStats->aui32PeakSize[TNG_CODEDBUF_STATS_B],
+        psStats->ui32Overflows, psStats->ui32RecommendedSize);
+
+    for (ui32Type = 0; ui32Type < TNG_CODEDBUF_STATS_TYPES; ui32Type++) {
+        for (i = 0; i < TNG_CODEDBUF_HIST_BINS; i++) {
+            if (psStats->aui32Hist[ui32Type][i] == 0)
+                continue;
+            drv_debug_msg(VIDEO_DEBUG_INIT, "%s: %c frames below %d bytes: %d\n", __FUNCTION__,
+                acType[ui32Type], tng__codedbuf_bin_limit(i), psStats->aui32Hist[ui32Type][i]);
+        }
+    }
+}
+
 void tng_DestroyContext(object_context_p obj_context, unsigned char is_JPEG)
 {
     context_ENC_p ctx;
@@ -551,6 +582,12 @@ void tng_DestroyContext(object_context_p obj_context, unsigned char is_JPEG)
 
     tng_air_buf_free(ctx);
 
+    if (ctx->sComplexityRC.pui8Samples != NULL)
+        free(ctx->sComplexityRC.pui8Samples);
+
+    if (!is_JPEG)
+        tng__dump_codedbuf_stats(&(ctx->sCodedBufStats));
+
     tng__free_context_buffer(ctx, is_JPEG, 0);
 
     if (ctx->bEnableMVC)
@@ -560,6 +597,209 @@ void tng_DestroyContext(object_context_p obj_context, unsigned char is_JPEG)
     obj_context->format_data = NULL;
 }
 
+/* Bins 0-3 are 1KB wide, then every octave of KB is split into four bins */
+static IMG_UINT32 tng__codedbuf_size_to_bin(IMG_UINT32 ui32Size)
+{
+    IMG_UINT32 ui32KB = ui32Size >> 10;
+    IMG_UINT32 ui32Octave = 0;
+    IMG_UINT32 ui32Bin;
+
+    if (ui32KB < 4)
+        return ui32KB;
+
+    while ((ui32KB >> ui32Octave) >= 8)
+        ui32Octave++;
+
+    ui32Bin = 4 + (ui32Octave * 4) + ((ui32KB >> ui32Octave) - 4);
+    if (ui32Bin >= TNG_CODEDBUF_HIST_BINS)
+        ui32Bin = TNG_CODEDBUF_HIST_BINS - 1;
+
+    return ui32Bin;
+}
+
+/* Exclusive upper bound of a bin, in bytes */
+static IMG_UINT32 tng__codedbuf_bin_limit(IMG_UINT32 ui32Bin)
+{
+    IMG_UINT32 ui32Octave, ui32Sub;
+
+    if (ui32Bin < 4)
+        return (ui32Bin + 1) << 10;
+
+    ui32Octave = (ui32Bin - 4) / 4;
+    ui32Sub = (ui32Bin - 4) % 4;
+
+    return (5 + ui32Sub) << (ui32Octave + 10);
+}
+
+/* Smallest size holding 99% of the frames of one type, never above the peak */
+static IMG_UINT32 tng__codedbuf_type_size(CODEDBUF_SIZE_STATS *psStats, IMG_UINT32 ui32Type)
+{
+    IMG_UINT32 ui32Frames = psStats->aui32Frames[ui32Type];
+    IMG_UINT32 ui32Acc = 0;
+    IMG_UINT32 ui32Limit;
+    IMG_UINT32 i;
+
+    if (ui32Frames == 0)
+        return 0;
+
+    for (i = 0; i < TNG_CODEDBUF_HIST_BINS - 1; i++) {
+        ui32Acc += psStats->aui32Hist[ui32Type][i];
+        if (ui32Acc * 100 >= ui32Frames * 99)
+            break;
+    }
+
+    ui32Limit = tng__codedbuf_bin_limit(i);
+    if (i == TNG_CODEDBUF_HIST_BINS - 1 || ui32Limit > psStats->aui32PeakSize[ui32Type])
+        ui32Limit = psStats->aui32PeakSize[ui32Type];
+
+    return ui32Limit;
+}
+
+/*
+ * Called from the coded buffer map path with the space a frame took in the
+ * coded buffer (largest pipe segment times the number of pipes). Old frames
+ * age out by halving a type's histogram once it holds a full window.
+ */
+void tng_update_codedbuf_stats(
+    object_context_p obj_context,
+    P_CODED_DATA_HDR psCodedHdr,
+    IMG_UINT32 ui32FrameSize,
+    IMG_BOOL bOverflow)
+{
+    context_ENC_p ctx = (context_ENC_p)(obj_context->format_data);
+    CODEDBUF_SIZE_STATS *psStats;
+    IMG_UINT32 ui32Type, ui32Size, ui32Pipes, i;
+
+    if (ctx == NULL || psCodedHdr == NULL)
+        return;
+
+    psStats = &(ctx->sCodedBufStats);
+
+    if (psCodedHdr->ui16_B_MbCnt)
+        ui32Type = TNG_CODEDBUF_STATS_B;
+    else if (psCodedHdr->ui16_P_MbCnt || psCodedHdr->ui16_Skip_MbCnt)
+        ui32Type = TNG_CODEDBUF_STATS_P;
+    else
+        ui32Type = TNG_CODEDBUF_STATS_I;
+
+    if (psStats->aui32Frames[ui32Type] >= TNG_CODEDBUF_HIST_WINDOW) {
+        psStats->aui32Frames[ui32Type] = 0;
+        for (i = 0; i < TNG_CODEDBUF_HIST_BINS; i++) {
+            psStats->aui32Hist[ui32Type][i] >>= 1;
+            psStats->aui32Frames[ui32Type] += psStats->aui32Hist[ui32Type][i];
+        }
+    }
+
+    psStats->aui32Hist[ui32Type][tng__codedbuf_size_to_bin(ui32FrameSize)]++;
+    psStats->aui32Frames[ui32Type]++;
+    if (ui32FrameSize > psStats->aui32PeakSize[ui32Type])
+        psStats->aui32PeakSize[ui32Type] = ui32FrameSize;
+    if (bOverflow)
+        psStats->ui32Overflows++;
+
+    if (psStats->aui32Frames[TNG_CODEDBUF_STATS_I] +
+        psStats->aui32Frames[TNG_CODEDBUF_STATS_P] +
+        psStats->aui32Frames[TNG_CODEDBUF_STATS_B] < TNG_CODEDBUF_HIST_MIN_FRAMES)
+        return;
+
+    ui32Size = 0;
+    for (i = 0; i < TNG_CODEDBUF_STATS_TYPES; i++) {
+        IMG_UINT32 ui32TypeSize = tng__codedbuf_type_size(psStats, i);
+        if (ui32TypeSize > ui32Size)
+            ui32Size = ui32TypeSize;
+    }
+
+    /* 1/8 headroom on top of the observed sizes, plus the firmware header of every pipe */
+    ui32Pipes = ctx->ui8PipesToUse ? ctx->ui8PipesToUse : 1;
+    ui32Size += ui32Size >> 3;
+    ui32Size += ui32Pipes * TNG_CODEDBUF_HEADER_SIZE;
+    ui32Size = tng_align_KB(ui32Size);
+
+    if (ui32Size != psStats->ui32RecommendedSize) {
+        drv_debug_msg(VIDEO_DEBUG_INIT, "%s: recommended coded buffer size %d -> %d bytes\n",
+                      __FUNCTION__, psStats->ui32RecommendedSize, ui32Size);
+        psStats->ui32RecommendedSize = ui32Size;
+    }
+}
+
+IMG_UINT32 tng_get_codedbuf_recommended_size(object_context_p obj_context)
+{
+    context_ENC_p ctx = (context_ENC_p)(obj_context->format_data);
+
+    if (ctx == NULL)
+        return 0;
+
+    return ctx->sCodedBufStats.ui32RecommendedSize;
+}
+
+/*
+ * Bits a coded frame spent over the configured rate, read back once per
+ * frame from the coded buffer, so the complexity based VBR allocation
+ * comes back to the configured rate. See tng__update_complexity_bitrate().
+ */
+void tng_update_complexity_drift(
+    object_context_p obj_context,
+    IMG_UINT32 ui32FrameBytes)
+{
+    context_ENC_p ctx = (context_ENC_p)(obj_context->format_data);
+    IMG_RC_PARAMS *psRCParams;
+
+    if (ctx == NULL || !ctx->sComplexityRC.bEnable)
+        return;
+
+    psRCParams = &(ctx->sRCParams);
+    if (psRCParams->ui32FrameRate == 0)
+        return;
+
+    ctx->sComplexityRC.i64DriftBits += (IMG_INT64)ui32FrameBytes * 8 -
+        (IMG_INT64)(psRCParams->ui32BitsPerSecond / psRCParams->ui32FrameRate);
+}
+
+/*
+ * Called from the coded buffer map path with the bytes a frame produced.
+ * Keeps the size and average QP of the last intra and inter frame for
+ * tng__update_max_frame_size_qp() and returns IMG_TRUE if the frame went
+ * over the max frame size.
+ */
+IMG_BOOL tng_check_max_frame_size(
+    object_context_p obj_context,
+    P_CODED_DATA_HDR psCodedHdr,
+    IMG_UINT32 ui32FrameBytes)
+{
+    context_ENC_p ctx = (context_ENC_p)(obj_context->format_data);
+    MAX_FRAME_SIZE_STATE *psState;
+    IMG_UINT32 ui32Type, ui32MbCnt, ui32Bits;
+
+    if (ctx == NULL || psCodedHdr == NULL)
+        return IMG_FALSE;
+
+    psState = &(ctx->sMaxFrameSize);
+    if (psState->ui32MaxFrameBits == 0)
+        return IMG_FALSE;
+
+    if (psCodedHdr->ui16_P_MbCnt || psCodedHdr->ui16_B_MbCnt || psCodedHdr->ui16_Skip_MbCnt)
+        ui32Type = TNG_MAX_FRAME_SIZE_INTER;
+    else
+        ui32Type = TNG_MAX_FRAME_SIZE_INTRA;
+
+    ui32Bits = ui32FrameBytes * 8;
+    psState->aui32LastBits[ui32Type] = ui32Bits;
+
+    ui32MbCnt = psCodedHdr->ui16_I_MbCnt + psCodedHdr->ui16_P_MbCnt + psCodedHdr->ui16_B_MbCnt;
+    if (ui32MbCnt)
+        psState->aui8LastQP[ui32Type] =
+            (psCodedHdr->ui32_QpyInter + psCodedHdr->ui32_QpyIntra + ui32MbCnt / 2) / ui32MbCnt;
+
+    if (ui32Bits <= psState->ui32MaxFrameBits)
+        return IMG_FALSE;
+
+    psState->ui32Overshoots++;
+    drv_debug_msg(VIDEO_DEBUG_WARNING, "%s: %s frame of %d bits exceeds max frame size %d (QP %d)\n",
+                  __FUNCTION__, ui32Type == TNG_MAX_FRAME_SIZE_INTRA ? "intra" : "inter",
+                  ui32Bits, psState->ui32MaxFrameBits, psState->aui8LastQP[ui32Type]);
+    return IMG_TRUE;
+}
+
 static VAStatus tng__init_rc_params(context_ENC_p ctx, object_config_p obj_config)
 {
     IMG_RC_PARAMS *psRCParams = &(ctx->sRCParams);
@@ -718,6 +958,10 @@ static VAStatus tng__init_context(context_ENC_p ctx)
     ctx->bEnableInpCtrl     = IMG_FALSE;//This parameter need not be exposed
     ctx->bEnableAIR = 0;
     ctx->bEnableCIR = 0;
+    ctx->bEnableROI = 0;
+    ctx->ui8ROINum = 0;
+    ctx->ui8TemporalLayers = 1;
+    ctx->ui8QualityLevel = 1;
     ctx->bEnableHostBias = (ctx->bEnableAIR != 0);//This parameter need not be exposed
     ctx->bEnableHostQP = IMG_FALSE; //This parameter need not be exposed
     ctx->ui8CodedSkippedIndex = 3;//This parameter need not be exposed
@@ -781,6 +1025,7 @@ VAStatus tng_CreateContext(
     VAStatus vaStatus = 0;
     unsigned short ui16Width, ui16Height;
     context_ENC_p ctx;
+    char env_value[1024];
 
     ui16Width = obj_context->picture_width;
     ui16Height = obj_context->picture_height;
@@ -809,6 +1054,13 @@ VAStatus tng_CreateContext(
         if (vaStatus != VA_STATUS_SUCCESS) {
             drv_debug_msg(VIDEO_DEBUG_ERROR, "init rc params");
         } 
+
+        /* opt-in: VBR steers its rate by the complexity of each source, no look ahead */
+        if (ctx->sRCParams.eRCMode == IMG_RCMODE_VBR &&
+            psb_parse_config("PSB_VIDEO_ENC_COMPLEXITY_RC", &env_value[0]) == 0 && atoi(env_value)) {
+            drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: complexity based VBR bit allocation\n", __FUNCTION__);
+            ctx->sComplexityRC.bEnable = IMG_TRUE;
+        }
     } else {
         /*JPEG only require them are even*/
         ctx->ui16Width = (unsigned short)(~0x1 & (ui16Width + 0x1));
@@ -881,7 +1133,7 @@ static VAStatus tng__provide_buffer_BFrames(context_ENC_p ctx, IMG_UINT32 ui32St
     IMG_UINT32 ui32FrameIdx = ctx->ui32FrameCount[ui32StreamIndex];
 
     if (ui32StreamIndex == 0)
-        getFrameDpyOrder(ui32FrameIdx, psRCParams->ui16BFrames, ctx->ui32IntraCnt,
+        getFrameDpyOrder(ui32FrameIdx, psRCParams->ui16BFrames, psRCParams->b16Hierarchical, ctx->ui32IntraCnt,
              ctx->ui32IdrPeriod, psFrameInfo, &display_order);
 
     slot_index = psFrameInfo->last_slot;
@@ -1085,6 +1337,27 @@ static void tng__generate_scale_tables(IMG_MTX_VIDEO_CONTEXT* psMtxEncCtx)
         how far away (temporally) the reference pictures are
 ******************************************************************************/
 
+/*
+ * Motion search effort per quality level. Higher levels cap the jitter of
+ * the candidate vectors, drop duplicate candidates, restrict the vectors
+ * per MB and search fewer partitions, which trades quality on busy content
+ * for encoder throughput. Low motion content such as screen capture loses
+ * little from it.
+ */
+static const struct {
+    IMG_UINT8            ui8MaxJitter;          //!< cap on the IPE jitter factors, 1 - 4
+    IMG_BOOL             bSkipDuplicateVectors;
+    IMG_BOOL             bLimitNumVectors;
+    IMG_INT              iFineYSearchSize;
+    IMG_IPE_MINBLOCKSIZE eMinBlkSz;             //!< smallest partition searched, BLK_SZ_DEFAULT = the codec's
+} tng_mv_search_presets[TNG_QUALITY_LEVELS] = {
+    { 4, IMG_FALSE, IMG_FALSE, 2, BLK_SZ_DEFAULT },
+    { 2, IMG_TRUE,  IMG_TRUE,  2, BLK_SZ_8x8 },
+    { 1, IMG_TRUE,  IMG_TRUE,  1, BLK_SZ_16x16 },
+};
+
+#define TNG_MV_SEARCH_PRESET(ctx)   (&tng_mv_search_presets[(ctx)->ui8QualityLevel - 1])
+
 static IMG_INT tng__abs(IMG_INT a)
 {
     if (a < 0)
@@ -1107,6 +1380,7 @@ void tng_update_driver_mv_scaling(
     IMG_UINT32 uRef1Num,
     IMG_UINT32 ui32PicFlags,
     IMG_BOOL   bSkipDuplicateVectors,
+    IMG_UINT8  ui8MaxJitter,
     IMG_UINT32 * pui32MVCalc_Below,
     IMG_UINT32 * pui32MVCalc_Colocated,
     IMG_UINT32 * pui32MVCalc_Config)
@@ -1182,8 +1456,8 @@ void tng_update_driver_mv_scaling(
         }
 
         //Hardware can only cope with 1 - 4 jitter factors
-        jitter0 = (jitter0 > 4) ? 4 : (jitter0 < 1) ? 1 : jitter0;
-        jitter1 = (jitter1 > 4) ? 4 : (jitter1 < 1) ? 1 : jitter1;
+        jitter0 = (jitter0 > ui8MaxJitter) ? ui8MaxJitter : (jitter0 < 1) ? 1 : jitter0;
+        jitter1 = (jitter1 > ui8MaxJitter) ? ui8MaxJitter : (jitter1 < 1) ? 1 : jitter1;
 
         //Hardware can only cope with 1 - 4 jitter factors
         assert(jitter0 > 0 && jitter0 <= 4 && jitter1 > 0 && jitter1 <= 4);
@@ -1211,6 +1485,8 @@ static void tng__prepare_mv_estimates(context_ENC_p ctx, IMG_UINT32 ui32StreamIn
     context_ENC_mem* ps_mem = &(ctx->ctx_mem[ui32StreamIndex]);
     IMG_MTX_VIDEO_CONTEXT* psMtxEncCtx = NULL;
     IMG_UINT32 ui32Distance;
+    IMG_BOOL bSkipDuplicateVectors = TNG_MV_SEARCH_PRESET(ctx)->bSkipDuplicateVectors || ctx->bSkipDuplicateVectors;
+    IMG_UINT8 ui8MaxJitter = TNG_MV_SEARCH_PRESET(ctx)->ui8MaxJitter;
 
     psb_buffer_map(&(ps_mem->bufs_mtx_context), &(ps_mem->bufs_mtx_context.virtual_addr));
     if (ps_mem->bufs_mtx_context.virtual_addr == NULL) {
@@ -1226,7 +1502,7 @@ static void tng__prepare_mv_estimates(context_ENC_p ctx, IMG_UINT32 ui32StreamIn
     psMtxEncCtx->sMVSettingsIdr.ui32MVCalc_Below = 0x01000100;      // default based on TRM
 
     tng_update_driver_mv_scaling(
-        0, 0, 0, 0, IMG_FALSE, //psMtxEncCtx->bSkipDuplicateVectors, //By default false Newly Added
+        0, 0, 0, 0, bSkipDuplicateVectors, ui8MaxJitter,
         &psMtxEncCtx->sMVSettingsIdr.ui32MVCalc_Below,
         &psMtxEncCtx->sMVSettingsIdr.ui32MVCalc_Colocated,
         &psMtxEncCtx->sMVSettingsIdr.ui32MVCalc_Config);
@@ -1238,7 +1514,7 @@ static void tng__prepare_mv_estimates(context_ENC_p ctx, IMG_UINT32 ui32StreamIn
         psMtxEncCtx->sMVSettingsNonB[ui32Distance - 1].ui32MVCalc_Below = 0x01000100;   // default based on TRM
 
 
-        tng_update_driver_mv_scaling(ui32Distance, 0, 0, 0, IMG_FALSE, //psMtxEncCtx->bSkipDuplicateVectors,
+        tng_update_driver_mv_scaling(ui32Distance, 0, 0, 0, bSkipDuplicateVectors, ui8MaxJitter,
                                      &psMtxEncCtx->sMVSettingsNonB[ui32Distance - 1].ui32MVCalc_Below,
                                      &psMtxEncCtx->sMVSettingsNonB[ui32Distance - 1].ui32MVCalc_Colocated,
                                      &psMtxEncCtx->sMVSettingsNonB[ui32Distance - 1].ui32MVCalc_Config);
@@ -1268,7 +1544,7 @@ static void tng__prepare_mv_estimates(context_ENC_p ctx, IMG_UINT32 ui32StreamIn
                 pMvElement->ui32MVCalc_Below=0x01000100;	// default based on TRM
 
                 tng_update_driver_mv_scaling(
-                    ui32Position, ui32DistanceB + 2, 0, ISINTERB_FLAGS, IMG_FALSE,
+                    ui32Position, ui32DistanceB + 2, 0, ISINTERB_FLAGS, bSkipDuplicateVectors, ui8MaxJitter,
                     &pMvElement->ui32MVCalc_Below,
                     &pMvElement->ui32MVCalc_Colocated,
                     &pMvElement->ui32MVCalc_Config);
@@ -1276,6 +1552,13 @@ static void tng__prepare_mv_estimates(context_ENC_p ctx, IMG_UINT32 ui32StreamIn
         }
 
         if (ctx->b_is_mv_setting_hierar){
+            psb_buffer_map(&(ps_mem->bufs_mv_setting_hierar), &(ps_mem->bufs_mv_setting_hierar.virtual_addr));
+            if (ps_mem->bufs_mv_setting_hierar.virtual_addr == NULL) {
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s error: mapping mv setting hierar\n", __FUNCTION__);
+                psb_buffer_unmap(&(ps_mem->bufs_mv_setting_btable));
+                psb_buffer_unmap(&(ps_mem->bufs_mtx_context));
+                return ;
+            }
             pHostMVSettingsHierarchical = (IMG_MV_SETTINGS *)(ps_mem->bufs_mv_setting_hierar.virtual_addr);
 
             for (ui32DistanceB = 0; ui32DistanceB < MAX_BFRAMES; ui32DistanceB++) {
@@ -1285,6 +1568,7 @@ static void tng__prepare_mv_estimates(context_ENC_p ctx, IMG_UINT32 ui32StreamIn
                 pHostMVSettingsHierarchical[ui32DistanceB].ui32MVCalc_Colocated = pMvElement->ui32MVCalc_Colocated;
                 pHostMVSettingsHierarchical[ui32DistanceB].ui32MVCalc_Below     = pMvElement->ui32MVCalc_Below;
             }
+            psb_buffer_unmap(&(ps_mem->bufs_mv_setting_hierar));
         }
         psb_buffer_unmap(&(ps_mem->bufs_mv_setting_btable));
     }
@@ -1335,7 +1619,8 @@ static void tng__setup_rcdata(context_ENC_p ctx)
     PIC_PARAMS    *psPicParams = &(ctx->sPicParams);
     
     IMG_INT32 i32FrameRate, i32TmpQp;
-    double        L1, L2, L3,L4, L5, L6, flBpp;
+    IMG_UINT32 ui32MBPerFrm;
+    double        flBpp;
     IMG_INT32 i32BufferSizeInFrames;
 
     if (ctx->bInsertHRDParams &&
@@ -1350,9 +1635,8 @@ static void tng__setup_rcdata(context_ENC_p ctx)
         psRCParams->ui32BitsPerSecond = 640000;     // kbps
     }
     
-    if (!psRCParams->ui32BUSize) {
-        psRCParams->ui32BUSize = (ctx->ui16PictureHeight>>4) * (ctx->ui16Width>>4);		// BU = 1 Frame
-    }
+    ui32MBPerFrm = (ctx->ui16PictureHeight>>4) * (ctx->ui16Width>>4);
+    psRCParams->ui32BUSize = tng__rc_bu_size(psRCParams->ui32BUSize, ui32MBPerFrm);
 
     if (!psRCParams->ui32FrameRate) {
         psRCParams->ui32FrameRate = 30;		// fps
@@ -1365,7 +1649,7 @@ static void tng__setup_rcdata(context_ENC_p ctx)
         i32FrameRate	= psRCParams->ui32FrameRate;
     }
 
-    flBpp = 1.0 * psRCParams->ui32BitsPerSecond / (i32FrameRate * ctx->ui16Width * ctx->ui16FrameHeight);
+    flBpp = tng__rc_bits_per_pixel(psRCParams->ui32BitsPerSecond, i32FrameRate, ctx->ui16Width, ctx->ui16FrameHeight);
 
     psPicParams->sInParams.ui8SeInitQP          = psRCParams->ui32InitialQp;
     psPicParams->sInParams.ui8MBPerRow      = (ctx->ui16Width>>4);
@@ -1392,46 +1676,24 @@ static void tng__setup_rcdata(context_ENC_p ctx)
     }
 
     
-    if (psPicParams->sInParams.i32BitsPerFrm) {
-        i32BufferSizeInFrames = (psRCParams->ui32BufferSize + (psPicParams->sInParams.i32BitsPerFrm/2))/psPicParams->sInParams.i32BitsPerFrm;
-    } else {
-        IMG_ASSERT(ctx->bEnableMvc && "Can happen only in MVC mode");
-        /* Asigning more or less `normal` value. To be overriden by MVC RC module */
-        i32BufferSizeInFrames = 30;
-    }
+    /* Without bits per frame, only in MVC mode, the MVC RC module overrides this */
+    IMG_ASSERT(psPicParams->sInParams.i32BitsPerFrm || ctx->bEnableMVC);
+    i32BufferSizeInFrames = tng__rc_buffer_size_in_frames(psRCParams->ui32BufferSize,
+                                                          psPicParams->sInParams.i32BitsPerFrm);
 
     // select thresholds and initial Qps etc that are codec dependent 
     switch (ctx->eStandard) {
         case IMG_STANDARD_H264:
-            L1 = 0.1;	L2 = 0.15;	L3 = 0.2;
             psPicParams->sInParams.ui8MaxQPVal = 51;
             ctx->ui32KickSize = psPicParams->sInParams.ui16MBPerBU;
 
             // Setup MAX and MIN Quant Values
-            if (psRCParams->iMinQP == 0) {
-                if (flBpp >= 0.50)
-                    i32TmpQp = 4;
-                else if (flBpp > 0.133)
-                    i32TmpQp = (IMG_INT32)(22 - (40*flBpp));
-                else
-                    i32TmpQp = (IMG_INT32)(30 - (100 * flBpp));
-
-                /* Adjust minQp up for small buffer size and down for large buffer size */
-                if (i32BufferSizeInFrames < 5) {
-                    i32TmpQp += 2;
-                }
+            if (psRCParams->iMinQP == 0)
+                i32TmpQp = tng__rc_h264_min_qp(flBpp, i32BufferSizeInFrames,
+                                               psPicParams->sInParams.ui16MBPerFrm);
+            else
+                i32TmpQp = psRCParams->iMinQP;
 
-                if (i32BufferSizeInFrames > 40) {
-                    if(i32TmpQp>=1)
-                        i32TmpQp -= 1;
-                }
-                /* for HD content allow a lower minQp as bitrate is more easily controlled in this case */
-                if (psPicParams->sInParams.ui16MBPerFrm > 2000) {
-                        i32TmpQp -= 6;
-                }
-            } else
-                i32TmpQp = psRCParams->iMinQP;				
-			
             if (i32TmpQp < 2) {
                 psPicParams->sInParams.ui8MinQPVal = 2;
             } else {
@@ -1439,60 +1701,12 @@ static void tng__setup_rcdata(context_ENC_p ctx)
             }
 
             // Calculate Initial QP if it has not been specified
-            i32TmpQp = psPicParams->sInParams.ui8SeInitQP;
-            if (psPicParams->sInParams.ui8SeInitQP==0) {
-                L1 = 0.050568;
-                L2 = 0.202272;
-                L3 = 0.40454321;
-                L4 = 0.80908642;
-                L5 = 1.011358025;
-
-                if (flBpp < L1)
-                    i32TmpQp = (IMG_INT32)(45 - 78.10*flBpp);
-                else if (flBpp>=L1 && flBpp<L2)
-                    i32TmpQp = (IMG_INT32)(44 - 72.51*flBpp);
-                else if (flBpp>=L2 && flBpp<L3)
-                    i32TmpQp = (IMG_INT32)(34 - 24.72*flBpp);
-                else if (flBpp>=L3 && flBpp<L4)
-                    i32TmpQp = (IMG_INT32)(32 - 19.78*flBpp);
-                else if (flBpp>=L4 && flBpp<L5)
-                    i32TmpQp = (IMG_INT32)(25 - 9.89*flBpp);
-                else if (flBpp>=L5)
-                    i32TmpQp = (IMG_INT32)(18 - 4.95*flBpp);
-
-                /* Adjust ui8SeInitQP up for small buffer size or small fps */
-                /* Adjust ui8SeInitQP up for small gop size */
-                if ((i32BufferSizeInFrames < 20) || (psRCParams->ui32IntraFreq < 20)) {
-                    i32TmpQp += 2;
-                }
-
-		/* for very small buffers increase initial Qp even more */
-		if(i32BufferSizeInFrames < 5)
-		{
-			i32TmpQp += 8;
-		}
-
-                /* start on a lower initial Qp for HD content as the coding is more efficient */
-                if (psPicParams->sInParams.ui16MBPerFrm > 2000) {
-                    i32TmpQp -= 2;
-                }
-
-		if(psPicParams->sInParams.ui16IntraPeriod ==1)
-		{
-		    /* for very small GOPS start with a much higher initial Qp */
-		    i32TmpQp += 12;
-		} else if (psPicParams->sInParams.ui16IntraPeriod<5) {
-		    /* for very small GOPS start with a much higher initial Qp */
-		    i32TmpQp += 6;
-		}
-            }
-            if (i32TmpQp>49) {
-                i32TmpQp = 49;
-            }
-            if (i32TmpQp < psPicParams->sInParams.ui8MinQPVal) {
-                i32TmpQp = psPicParams->sInParams.ui8MinQPVal;
-            }
-            psPicParams->sInParams.ui8SeInitQP = i32TmpQp;
+            psPicParams->sInParams.ui8SeInitQP =
+                tng__rc_h264_initial_qp(flBpp, i32BufferSizeInFrames,
+                                        psRCParams->ui32IntraFreq,
+                                        psPicParams->sInParams.ui16MBPerFrm,
+                                        psPicParams->sInParams.ui8SeInitQP,
+                                        psPicParams->sInParams.ui8MinQPVal);
 
             if(flBpp <= 0.3)
                 psPicParams->ui32Flags |= ISRC_I16BIAS;
@@ -1503,39 +1717,11 @@ static void tng__setup_rcdata(context_ENC_p ctx)
         case IMG_STANDARD_MPEG2:
         case IMG_STANDARD_H263:
             psPicParams->sInParams.ui8MaxQPVal	 = 31;
-            if (ctx->ui16Width == 176) {
-                L1 = 0.042;    L2 = 0.084;    L3 = 0.126;    L4 = 0.168;    L5 = 0.336;    L6=0.505;
-            } else if (ctx->ui16Width == 352) {	
-                L1 = 0.064;    L2 = 0.084;    L3 = 0.106;    L4 = 0.126;    L5 = 0.168;    L6=0.210;
-            } else {
-                L1 = 0.050;    L2 = 0.0760;    L3 = 0.096;   L4 = 0.145;    L5 = 0.193;    L6=0.289;
-            }
 
             if (psPicParams->sInParams.ui8SeInitQP==0) {
-                if (flBpp < L1)
-                    psPicParams->sInParams.ui8SeInitQP = 31;
-                else if (flBpp>=L1 && flBpp<L2)
-                    psPicParams->sInParams.ui8SeInitQP = 26;
-                else if (flBpp>=L2 && flBpp<L3)
-                    psPicParams->sInParams.ui8SeInitQP = 22;
-                else if (flBpp>=L3 && flBpp<L4)
-                    psPicParams->sInParams.ui8SeInitQP = 18;
-                else if (flBpp>=L4 && flBpp<L5)
-                    psPicParams->sInParams.ui8SeInitQP = 14;
-                else if (flBpp>=L5 && flBpp<L6)
-                    psPicParams->sInParams.ui8SeInitQP = 10;
-                else
-                    psPicParams->sInParams.ui8SeInitQP = 8;
-
-                /* Adjust ui8SeInitQP up for small buffer size or small fps */
-                /* Adjust ui8SeInitQP up for small gop size */
-                if ((i32BufferSizeInFrames < 20) || (psRCParams->ui32IntraFreq < 20)) {
-                    psPicParams->sInParams.ui8SeInitQP += 2;
-                }
-
-                if (psPicParams->sInParams.ui8SeInitQP > psPicParams->sInParams.ui8MaxQPVal) {
-                    psPicParams->sInParams.ui8SeInitQP = psPicParams->sInParams.ui8MaxQPVal;
-                }
+                psPicParams->sInParams.ui8SeInitQP =
+                    tng__rc_other_initial_qp(flBpp, ctx->ui16Width,
+                                             i32BufferSizeInFrames, psRCParams->ui32IntraFreq);
                 psPicParams->sInParams.mode.other.ui16AvQPVal =  psPicParams->sInParams.ui8SeInitQP;
             }
             psPicParams->sInParams.ui8MinQPVal = 2;
@@ -1559,20 +1745,7 @@ static void tng__setup_rcdata(context_ENC_p ctx)
         psPicParams->sInParams.i32BufferSize   = psRCParams->ui32BufferSize;
 
 
-        // These scale factor are used only for rate control to avoid overflow
-        // in fixed-point calculation these scale factors are decided by bit rate
-        if (psRCParams->ui32BitsPerSecond < 640000) {
-            psPicParams->sInParams.ui8ScaleFactor  = 2;						// related to complexity
-        }
-        else if (psRCParams->ui32BitsPerSecond < 2000000) {
-            // 2 Mbits
-            psPicParams->sInParams.ui8ScaleFactor  = 4;
-        }
-        else if(psRCParams->ui32BitsPerSecond < 8000000) {
-            // 8 Mbits
-            psPicParams->sInParams.ui8ScaleFactor  = 6;
-        } else
-            psPicParams->sInParams.ui8ScaleFactor  = 8;
+        psPicParams->sInParams.ui8ScaleFactor = tng__rc_scale_factor(psRCParams->ui32BitsPerSecond, IMG_TRUE);
     } else {
         // Set up Input Parameters that are mode dependent
         switch (ctx->eStandard) {
@@ -1581,22 +1754,7 @@ static void tng__setup_rcdata(context_ENC_p ctx)
                 // Initialize the parameters of fluid flow traffic model.
                 psPicParams->sInParams.i32BufferSize = psRCParams->ui32BufferSize;
 
-                // HRD consideration - These values are used by H.264 reference code.
-                if (psRCParams->ui32BitsPerSecond < 1000000) {
-                // 1 Mbits/s 
-                    psPicParams->sInParams.ui8ScaleFactor = 0;
-                } else if (psRCParams->ui32BitsPerSecond < 2000000) {
-                // 2 Mbits/s
-                    psPicParams->sInParams.ui8ScaleFactor = 1;
-                } else if (psRCParams->ui32BitsPerSecond < 4000000) {
-                // 4 Mbits/s 
-                    psPicParams->sInParams.ui8ScaleFactor = 2;
-                } else if (psRCParams->ui32BitsPerSecond < 8000000) {
-                // 8 Mbits/s
-                    psPicParams->sInParams.ui8ScaleFactor = 3;
-                } else  {
-                    psPicParams->sInParams.ui8ScaleFactor = 4; 
-                }
+                psPicParams->sInParams.ui8ScaleFactor = tng__rc_scale_factor(psRCParams->ui32BitsPerSecond, IMG_FALSE);
 
                 if (ctx->sRCParams.eRCMode == IMG_RCMODE_VCM) {
                     psPicParams->sInParams.i32BufferSize = i32BufferSizeInFrames;
@@ -1605,13 +1763,10 @@ static void tng__setup_rcdata(context_ENC_p ctx)
             case IMG_STANDARD_MPEG4:
             case IMG_STANDARD_MPEG2:
             case IMG_STANDARD_H263:
-                flBpp  = 256 * (psRCParams->ui32BitsPerSecond/ctx->ui16Width);
-                flBpp /= (ctx->ui16FrameHeight * psRCParams->ui32FrameRate);
-
-                if ((psPicParams->sInParams.ui16MBPerFrm > 1024 && flBpp < 16) || (psPicParams->sInParams.ui16MBPerFrm <= 1024 && flBpp < 24))
-                    psPicParams->sInParams.mode.other.ui8HalfFrameRate = 1;
-                else
-                    psPicParams->sInParams.mode.other.ui8HalfFrameRate = 0;
+                psPicParams->sInParams.mode.other.ui8HalfFrameRate =
+                    tng__rc_half_frame_rate(psRCParams->ui32BitsPerSecond, psRCParams->ui32FrameRate,
+                                            ctx->ui16Width, ctx->ui16FrameHeight,
+                                            psPicParams->sInParams.ui16MBPerFrm);
 
                 if (psPicParams->sInParams.mode.other.ui8HalfFrameRate >= 1) {
                     psPicParams->sInParams.ui8SeInitQP = 31;
@@ -1635,13 +1790,10 @@ static void tng__setup_rcdata(context_ENC_p ctx)
 
     /* The rate control uses this value to adjust the reaction rate to larger than expected frames */
     if (ctx->eStandard == IMG_STANDARD_H264) {
-        if (psPicParams->sInParams.i32BitsPerFrm) {
-            const IMG_INT32 bitsPerGop = (psRCParams->ui32BitsPerSecond / psRCParams->ui32FrameRate) * psRCParams->ui32IntraFreq;
-            psPicParams->sInParams.mode.h264.ui32RCScaleFactor = (bitsPerGop * 256) /
-                (psPicParams->sInParams.i32BufferSize - psPicParams->sInParams.i32InitialLevel);
-        } else {
-            psPicParams->sInParams.mode.h264.ui32RCScaleFactor = 0;
-        }
+        psPicParams->sInParams.mode.h264.ui32RCScaleFactor =
+            tng__rc_h264_scale_factor(psRCParams->ui32BitsPerSecond, psRCParams->ui32FrameRate,
+                                      psRCParams->ui32IntraFreq, psPicParams->sInParams.i32BufferSize,
+                                      psPicParams->sInParams.i32InitialLevel);
     } else {
         psPicParams->sInParams.mode.other.ui16MyInitQP		= psPicParams->sInParams.ui8SeInitQP;
     }
@@ -1711,12 +1863,17 @@ static IMG_UINT32 tng__prepare_encode_sliceparams(
     IMG_BOOL bIsBPicture = IMG_FALSE;
     IMG_BOOL bIsIDR = IMG_FALSE;
     IMG_IPE_MINBLOCKSIZE blkSz;
+    IMG_BOOL bLimitNumVectors;
     IMG_FRAME_TEMPLATE_TYPE eSliceType = (IMG_FRAME_TEMPLATE_TYPE)ui32SliceType;
 
     if (!ctx) {
         return VA_STATUS_ERROR_INVALID_CONTEXT;
     }
 
+    bLimitNumVectors = ctx->bLimitNumVectors || TNG_MV_SEARCH_PRESET(ctx)->bLimitNumVectors;
+    if (iFineYSearchSize > TNG_MV_SEARCH_PRESET(ctx)->iFineYSearchSize)
+        iFineYSearchSize = TNG_MV_SEARCH_PRESET(ctx)->iFineYSearchSize;
+
     /* We want multiple ones of these so we can submit multiple slices without having to wait for the next*/
     ui32IPEControl = ctx->ui32IPEControl;
     bIsIntra = ((eSliceType == IMG_FRAME_IDR) || (eSliceType == IMG_FRAME_INTRA));
@@ -1730,6 +1887,16 @@ static IMG_UINT32 tng__prepare_encode_sliceparams(
     blkSz = F_EXTRACT(ui32IPEControl, TOPAZHP_CR_IPE_BLOCKSIZE);
     /* mask-out the block size bits from ui32IPEControl */
     ui32IPEControl &= ~(F_MASK(TOPAZHP_CR_IPE_BLOCKSIZE));
+
+    /*
+     * faster presets stop the search at bigger partitions, before the
+     * per standard limits so the BRN workarounds below still have the
+     * last word
+     */
+    if (TNG_MV_SEARCH_PRESET(ctx)->eMinBlkSz != BLK_SZ_DEFAULT &&
+        blkSz > TNG_MV_SEARCH_PRESET(ctx)->eMinBlkSz)
+        blkSz = TNG_MV_SEARCH_PRESET(ctx)->eMinBlkSz;
+
     switch (ctx->eStandard) {
     case IMG_STANDARD_NONE:
     case IMG_STANDARD_JPEG:
@@ -1758,7 +1925,7 @@ static IMG_UINT32 tng__prepare_encode_sliceparams(
                               F_ENCODE(iFineYSearchSize, TOPAZHP_CR_IPE_Y_FINE_SEARCH);
 
         }
-        if (ctx->bLimitNumVectors)
+        if (bLimitNumVectors)
             ui32IPEControl |= F_ENCODE(1, TOPAZHP_CR_IPE_MV_NUMBER_RESTRICTION);
         break;
 
@@ -1804,7 +1971,7 @@ static IMG_UINT32 tng__prepare_encode_sliceparams(
         /* Minium sub block size to calculate motion vectors for. 0=16x16, 1=8x8, 2=4x4 */
         ui32IPEControl = F_INSERT(ui32IPEControl, blkSz, TOPAZHP_CR_IPE_BLOCKSIZE);
         ui32IPEControl = F_INSERT(ui32IPEControl, iFineYSearchSize, TOPAZHP_CR_IPE_Y_FINE_SEARCH);
-        ui32IPEControl = F_INSERT(ui32IPEControl, ctx->bLimitNumVectors, TOPAZHP_CR_IPE_MV_NUMBER_RESTRICTION);
+        ui32IPEControl = F_INSERT(ui32IPEControl, bLimitNumVectors, TOPAZHP_CR_IPE_MV_NUMBER_RESTRICTION);
 
         ui32IPEControl = F_INSERT(ui32IPEControl, uLritcBoundary, TOPAZHP_CR_IPE_LRITC_BOUNDARY);  // 8x8 search
         ui32IPEControl = F_INSERT(ui32IPEControl, bRestrict4x4SearchSize ? 0 : 1, TOPAZHP_CR_IPE_4X4_SEARCH);
@@ -3416,15 +3583,21 @@ static VAStatus tng__update_ratecontrol(context_ENC_p ctx, IMG_UINT32 ui32Stream
     if (ctx->rc_update_flag & RC_MASK_frame_rate) {
 	tng__rc_update(ctx, psRCParams->ui32BitsPerSecond, -1, -1, -1, -1);
 	ctx->rc_update_flag &= ~RC_MASK_frame_rate;
+	ctx->sComplexityRC.i32Steps = 0;
+	ctx->sComplexityRC.i64DriftBits = 0;
     }
 
     if (ctx->rc_update_flag & RC_MASK_bits_per_second) {
 	tng__rc_update(ctx, psRCParams->ui32BitsPerSecond, -1, -1, -1, -1);
 	ctx->rc_update_flag &= ~RC_MASK_bits_per_second;
+	ctx->sComplexityRC.i32Steps = 0;
+	ctx->sComplexityRC.i64DriftBits = 0;
     }
 
     if (ctx->rc_update_flag & RC_MASK_min_qp) {
-	tng__rc_update(ctx, -1, -1, psRCParams->iMinQP, -1, -1);
+	/* a max frame size clamp in force stays the floor */
+	tng__rc_update(ctx, -1, -1,
+	               tng__max(psRCParams->iMinQP, ctx->sMaxFrameSize.ui8MinQP), -1, -1);
 	ctx->rc_update_flag &= ~RC_MASK_min_qp;
     }
 
@@ -3446,6 +3619,157 @@ static VAStatus tng__update_ratecontrol(context_ENC_p ctx, IMG_UINT32 ui32Stream
     return vaStatus;
 }
 
+/*
+ * The firmware rate control has no per-frame size limit, so the ceiling is
+ * enforced through its min QP: the last frame of the type about to be coded
+ * is scaled to the QP that brings it under the limit, taking one QP step as
+ * roughly 12% of the frame size. Scene cut spikes on P frames are caught one
+ * frame late; intra frames, the usual offenders, are predicted ahead.
+ */
+static void tng__update_max_frame_size_qp(context_ENC_p ctx)
+{
+    MAX_FRAME_SIZE_STATE *psState = &(ctx->sMaxFrameSize);
+    IMG_UINT32 ui32Type, ui32Bits, ui32Target;
+    IMG_INT32 i32QP, i32BaseQP, i32MaxQP;
+    IMG_BOOL bIntra;
+
+    if (psState->ui32MaxFrameBits == 0 && psState->ui8MinQP == 0)
+        return;
+
+    i32BaseQP = ctx->sPicParams.sInParams.ui8MinQPVal;
+    i32MaxQP = (ctx->max_qp > 0) ? ctx->max_qp : 51;
+
+    /* frame types are only known ahead without B frame reordering */
+    bIntra = (ctx->sRCParams.ui16BFrames == 0) &&
+             (ctx->idr_force_flag || ctx->ref_invalidate_flag || ctx->ui32IntraCnt == 0 ||
+              (ctx->ui32FrameCount[ctx->ui32StreamID] % ctx->ui32IntraCnt) == 0);
+    ui32Type = bIntra ? TNG_MAX_FRAME_SIZE_INTRA : TNG_MAX_FRAME_SIZE_INTER;
+
+    i32QP = i32BaseQP;
+    ui32Bits = psState->aui32LastBits[ui32Type];
+    if (psState->ui32MaxFrameBits && ui32Bits) {
+        /* aim a little under the ceiling to absorb the estimate's error */
+        ui32Target = psState->ui32MaxFrameBits - (psState->ui32MaxFrameBits >> 4);
+        i32QP = psState->aui8LastQP[ui32Type];
+        while (ui32Bits > ui32Target && i32QP < i32MaxQP) {
+            ui32Bits = ui32Bits / 9 * 8;
+            i32QP++;
+        }
+        while (ui32Bits / 8 * 9 <= ui32Target && i32QP > i32BaseQP) {
+            ui32Bits = ui32Bits / 8 * 9;
+            i32QP--;
+        }
+    }
+
+    if (i32QP <= i32BaseQP) {
+        if (psState->ui8MinQP) {
+            tng__rc_update(ctx, -1, -1, i32BaseQP, -1, -1);
+            psState->ui8MinQP = 0;
+        }
+        return;
+    }
+
+    if (psState->ui8MinQP != i32QP) {
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: %s frame %d min QP %d for max frame size %d\n",
+                      __FUNCTION__, bIntra ? "intra" : "inter", ctx->ui32FrameCount[ctx->ui32StreamID],
+                      i32QP, psState->ui32MaxFrameBits);
+        tng__rc_update(ctx, -1, -1, i32QP, -1, -1);
+        psState->ui8MinQP = i32QP;
+    }
+}
+
+/*
+ * Complexity based VBR bit allocation, an opt-in heuristic enabled with
+ * PSB_VIDEO_ENC_COMPLEXITY_RC. It does no look ahead and no second pass:
+ * the frame about to be coded is compared with a running average of the
+ * frames before it, and its bitrate steps (see tng__complexity_steps())
+ * move the rate the firmware VBR aims at for this frame. Bits actually
+ * spent are fed back from the coded buffers the application reads,
+ * tng_update_complexity_drift(), and pull the steps back so the average
+ * stays at the configured rate.
+ *
+ * Only B frame streams hold sources ahead of the frame being coded, the
+ * slots getFrameDpyOrder() fills for one mini GOP. The heuristic is off
+ * for those, so there is nothing queued to look at.
+ *
+ * A new rate is only sent when the steps change, a one step wobble has to
+ * hold for two frames first. The source is only sampled when the surface
+ * is idle; a surface still being written is skipped rather than waited
+ * for, and keeps the rate in effect.
+ */
+static void tng__update_complexity_bitrate(context_ENC_p ctx)
+{
+    COMPLEXITY_RC_STATE *psState = &(ctx->sComplexityRC);
+    IMG_RC_PARAMS *psRCParams = &(ctx->sRCParams);
+    psb_surface_p psb_surface = ctx->ctx_frame_buf.src_surface->psb_surface;
+    IMG_UINT32 ui32SampleCnt, ui32Cost, ui32BitsPerSecond, ui32BitsPerFrame;
+    IMG_INT32 i32Steps;
+    IMG_BOOL bHavePrevious = IMG_TRUE;
+    VASurfaceStatus eStatus;
+    unsigned char *pui8Surface;
+
+    if (!psState->bEnable || psRCParams->ui16BFrames)
+        return;
+
+    ui32SampleCnt = ((ctx->ui16FrameHeight + TNG_COMPLEXITY_STEP_Y / 2 - 1) / TNG_COMPLEXITY_STEP_Y) *
+                    ((ctx->ui16Width - 1) / TNG_COMPLEXITY_STEP_X);
+    if (ui32SampleCnt != psState->ui32SampleCnt) {
+        /* first frame or a new resolution */
+        if (psState->pui8Samples != NULL)
+            free(psState->pui8Samples);
+        psState->pui8Samples = (IMG_UINT8 *)calloc(1, ui32SampleCnt);
+        psState->ui32SampleCnt = psState->pui8Samples ? ui32SampleCnt : 0;
+        psState->ui32AvgCost = 0;
+        bHavePrevious = IMG_FALSE;
+    }
+    if (psState->pui8Samples == NULL)
+        return;
+
+    if (psb_surface_query_status(psb_surface, &eStatus) != VA_STATUS_SUCCESS ||
+        eStatus != VASurfaceReady)
+        return;
+
+    if (psb_buffer_map_access(&psb_surface->buf, &pui8Surface, PSB_BUFFER_MAP_READ)) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: failed to map source surface\n", __FUNCTION__);
+        return;
+    }
+    ui32Cost = tng__frame_complexity(pui8Surface + psb_surface->buf.buffer_ofs, psb_surface->stride,
+                                     ctx->ui16Width, ctx->ui16FrameHeight,
+                                     psState->pui8Samples, bHavePrevious);
+    psb_buffer_unmap(&psb_surface->buf);
+
+    ui32BitsPerFrame = psRCParams->ui32FrameRate ? psRCParams->ui32BitsPerSecond / psRCParams->ui32FrameRate : 0;
+    i32Steps = tng__complexity_steps(ui32Cost, psState->ui32AvgCost, psState->i64DriftBits, ui32BitsPerFrame);
+
+    if (psState->ui32AvgCost)
+        psState->ui32AvgCost = (psState->ui32AvgCost * 7 + ui32Cost + 4) / 8;
+    else
+        psState->ui32AvgCost = ui32Cost;
+
+    if (i32Steps == psState->i32Steps) {
+        psState->i32PendingSteps = i32Steps;
+        return;
+    }
+    if ((i32Steps == psState->i32Steps + 1 || i32Steps == psState->i32Steps - 1) &&
+        i32Steps != psState->i32PendingSteps) {
+        psState->i32PendingSteps = i32Steps;
+        return;
+    }
+    psState->i32PendingSteps = i32Steps;
+    psState->i32Steps = i32Steps;
+
+    ui32BitsPerSecond = psRCParams->ui32BitsPerSecond;
+    for (; i32Steps > 0; i32Steps--)
+        ui32BitsPerSecond = ui32BitsPerSecond / 8 * 9;
+    for (; i32Steps < 0; i32Steps++)
+        ui32BitsPerSecond = ui32BitsPerSecond / 9 * 8;
+
+    drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: frame %d cost %d (average %d), drift %lld bits, bitrate %d\n",
+                  __FUNCTION__, ctx->ui32FrameCount[ctx->ui32StreamID], ui32Cost, psState->ui32AvgCost,
+                  (long long)psState->i64DriftBits, ui32BitsPerSecond);
+    tng__rc_update(ctx, ui32BitsPerSecond, -1, -1, -1, -1);
+}
+
 static VAStatus tng__update_frametype(context_ENC_p ctx, IMG_FRAME_TYPE eFrameType)
 {
     VAStatus vaStatus = VA_STATUS_SUCCESS;
@@ -3512,6 +3836,14 @@ static VAStatus tng__cmdbuf_provide_buffer(context_ENC_p ctx, IMG_UINT32 ui32Str
     tng_send_ref_frames(ctx, 1, 0);
 #endif
 
+    /* layer of the frame coded into this buffer, reported by tng_get_coded_data() */
+    if (ctx->ctx_frame_buf.coded_buf) {
+        SET_CODEDBUF_INFO(TEMPORAL_ID, ctx->ctx_frame_buf.coded_buf->codedbuf_aux_info,
+            (ctx->ui8TemporalLayers > 1 && ctx->sRCParams.ui16BFrames > 0) ?
+            ctx->sFrameOrderInfo.last_temporal_id : 0);
+        CLEAR_CODEDBUF_INFO(MAPPED, ctx->ctx_frame_buf.coded_buf->codedbuf_aux_info);
+    }
+
     ctx->ui8SlotsCoded = (ctx->ui8SlotsCoded + 1) & 1;
 
     return vaStatus;
@@ -3530,6 +3862,11 @@ VAStatus tng__set_ctx_buf(context_ENC_p ctx, IMG_UINT32 ui32StreamID)
     if (vaStatus != VA_STATUS_SUCCESS) {
         drv_debug_msg(VIDEO_DEBUG_ERROR, "validate busize");
     }
+
+    /* a sequence restarted mid stream keeps the buffers sized for the context */
+    if (ctx->ui32RawFrameCount != 0)
+        return VA_STATUS_SUCCESS;
+
     ctx->ctx_cmdbuf[0].ui32LowCmdCount = 0xa5a5a5a5 %  MAX_TOPAZ_CMD_COUNT;
     ctx->ctx_cmdbuf[0].ui32HighCmdCount = 0;
     ctx->ctx_cmdbuf[0].ui32HighWBReceived = 0;
@@ -3561,9 +3898,13 @@ static VAStatus tng__set_headers (context_ENC_p ctx, IMG_UINT32 ui32StreamID)
 static VAStatus tng__set_cmd_buf(context_ENC_p ctx, IMG_UINT32 ui32StreamID)
 {
     VAStatus vaStatus = VA_STATUS_SUCCESS;
-    vaStatus = tng__cmdbuf_new_codec(ctx);
-    if (vaStatus != VA_STATUS_SUCCESS) {
-        drv_debug_msg(VIDEO_DEBUG_ERROR, "cmdbuf new codec\n");
+
+    /* the firmware keeps the codec of a sequence restarted mid stream */
+    if (ctx->ui32RawFrameCount == 0) {
+        vaStatus = tng__cmdbuf_new_codec(ctx);
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "cmdbuf new codec\n");
+        }
     }
     
     vaStatus = tng__cmdbuf_lowpower(ctx);
@@ -3619,7 +3960,29 @@ VAStatus tng_EndPicture(context_ENC_p ctx)
     drv_debug_msg(VIDEO_DEBUG_GENERAL,"%s: ctx->ui8SlicesPerPicture = %d, ctx->ui32FrameCount[0] = %d\n",
          __FUNCTION__, ctx->ui8SlicesPerPicture, ctx->ui32FrameCount[0]);
 
+    /*
+     * With B frames the firmware codes each anchor ahead of the B frames
+     * displayed before it, so the frame in flight can not become an IDR.
+     * A forced IDR restarts the sequence the same way a new resolution
+     * does, but only once the current mini GOP is closed: the B frames
+     * still owed to its coded anchor are coded first, the request waits.
+     */
+    if (ctx->idr_force_flag == 1 && ctx->sRCParams.ui16BFrames > 0 &&
+        ctx->ui32FrameCount[ctx->ui32StreamID] > 0 &&
+        isMiniGopClosed(ctx->ui32FrameCount[ctx->ui32StreamID], ctx->sRCParams.ui16BFrames,
+                        ctx->ui32IntraCnt, ctx->ui32IdrPeriod)) {
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "%s: forced IDR restarts the sequence at frame %d\n",
+            __FUNCTION__, ctx->ui32RawFrameCount);
+        ctx->ui32FrameCount[ctx->ui32StreamID] = 0;
+        ctx->idr_force_flag = 0;
+        ctx->ref_invalidate_flag = 0;
+    }
+
+    /* first frame of the stream, or of a restarted sequence */
     if (ctx->ui32FrameCount[0] == 0) {
+        /* SETVIDEO puts the firmware back on the application's min QP */
+        ctx->sMaxFrameSize.ui8MinQP = 0;
+
         vaStatus = tng__set_ctx_buf(ctx, 0);
         if (vaStatus != VA_STATUS_SUCCESS) {
             drv_debug_msg(VIDEO_DEBUG_ERROR, "set ctx buf \n");
@@ -3652,8 +4015,12 @@ VAStatus tng_EndPicture(context_ENC_p ctx)
         }
     }
 
+    tng__update_max_frame_size_qp(ctx);
+    tng__update_complexity_bitrate(ctx);
+
     if (ctx->bEnableAIR == IMG_TRUE ||
-	ctx->bEnableCIR == IMG_TRUE) {
+	ctx->bEnableCIR == IMG_TRUE ||
+	ctx->bEnableROI == IMG_TRUE) {
 	tng_air_set_input_control(ctx, 0);
 
 	if (ctx->bEnableAIR == IMG_TRUE)
@@ -3666,6 +4033,24 @@ VAStatus tng_EndPicture(context_ENC_p ctx)
             drv_debug_msg(VIDEO_DEBUG_ERROR, "send picmgmt IDR");
         }
         ctx->idr_force_flag =0;
+        ctx->ref_invalidate_flag = 0;
+    }
+
+    /*
+     * VAEncMiscParameterTypeTNGRefInvalidate: the next reference frame is
+     * coded as a non-IDR intra frame. No new sequence and no parameter sets;
+     * a max frame size bounds it like any intra frame. With B frames only an
+     * anchor that closes the mini GOP can be made intra, like a forced IDR
+     * the request waits for it.
+     */
+    if (ctx->ref_invalidate_flag == 1 &&
+        isMiniGopClosed(ctx->ui32FrameCount[ctx->ui32StreamID], ctx->sRCParams.ui16BFrames,
+                        ctx->ui32IntraCnt, ctx->ui32IdrPeriod)) {
+        vaStatus = tng__update_frametype(ctx, IMG_FRAME_INTRA);
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "send picmgmt intra");
+        }
+        ctx->ref_invalidate_flag = 0;
     }
 
     vaStatus = tng__cmdbuf_provide_buffer(ctx, ctx->ui32StreamID);
@@ -223,6 +223,52 @@ typedef struct _H264_PICMGMT_UP_PARAMS {
     IMG_INT8 quant;
 } H264_PICMGMT_UP_PARAMS;
 
+/*
+ * Coded size statistics, gathered per frame type (I/P/B) when the
+ * application maps a coded buffer. Sizes are binned on a log scale with
+ * four sub-bins per octave of KB, so the recommended coded buffer size
+ * tracks the real stream instead of the worst case.
+ */
+#define TNG_CODEDBUF_STATS_I            0
+#define TNG_CODEDBUF_STATS_P            1
+#define TNG_CODEDBUF_STATS_B            2
+#define TNG_CODEDBUF_STATS_TYPES        3
+#define TNG_CODEDBUF_HIST_BINS          64
+#define TNG_CODEDBUF_HIST_WINDOW        1024    /* halve a type's histogram when it holds this many frames */
+#define TNG_CODEDBUF_HIST_MIN_FRAMES    16      /* frames needed before a size is recommended */
+#define TNG_CODEDBUF_HEADER_SIZE        (16 * sizeof(unsigned long)) /* firmware header ahead of each pipe's data */
+
+typedef struct _CODEDBUF_SIZE_STATS {
+    IMG_UINT32 aui32Hist[TNG_CODEDBUF_STATS_TYPES][TNG_CODEDBUF_HIST_BINS];
+    IMG_UINT32 aui32Frames[TNG_CODEDBUF_STATS_TYPES];   //!< frames currently in the histogram
+    IMG_UINT32 aui32PeakSize[TNG_CODEDBUF_STATS_TYPES]; //!< largest frame seen, in bytes
+    IMG_UINT32 ui32Overflows;                           //!< frames that did not fit their coded buffer
+    IMG_UINT32 ui32RecommendedSize;                     //!< coded buffer size covering the observed frames, 0 if unknown
+} CODEDBUF_SIZE_STATS;
+
+#define TNG_MAX_FRAME_SIZE_INTRA        0
+#define TNG_MAX_FRAME_SIZE_INTER        1
+
+typedef struct _MAX_FRAME_SIZE_STATE {
+    IMG_UINT32 ui32MaxFrameBits;        //!< per-frame ceiling from VAEncMiscParameterTypeMaxFrameSize, 0 = off
+    IMG_UINT32 aui32LastBits[2];        //!< size of the last intra/inter frame
+    IMG_UINT8  aui8LastQP[2];           //!< average QP of the last intra/inter frame
+    IMG_UINT8  ui8MinQP;                //!< floor forced on the firmware min QP, 0 = none; the application's min_qp stays in sRCParams.iMinQP
+    IMG_UINT32 ui32Overshoots;          //!< frames that still exceeded the ceiling
+} MAX_FRAME_SIZE_STATE;
+
+#define TNG_QUALITY_LEVELS              3       /* VA quality levels, 1 is the best and the default */
+
+typedef struct _COMPLEXITY_RC_STATE {
+    IMG_BOOL   bEnable;                 //!< PSB_VIDEO_ENC_COMPLEXITY_RC, VBR without B frames only
+    IMG_UINT8 *pui8Samples;             //!< luma samples of the previous source frame
+    IMG_UINT32 ui32SampleCnt;
+    IMG_UINT32 ui32AvgCost;             //!< running average of the frame cost, 0 = no frame yet
+    IMG_INT32  i32Steps;                //!< 9/8 bitrate steps sent to the firmware, 0 = the configured rate
+    IMG_INT32  i32PendingSteps;         //!< one step change seen on the last frame, not sent yet
+    IMG_INT64  i64DriftBits;            //!< bits of the read back frames over the configured rate
+} COMPLEXITY_RC_STATE;
+
 /*! 
  *    \ADAPTIVE_INTRA_REFRESH_INFO_TYPE
  *    \brief Structure for parameters requierd for Adaptive intra refresh.
@@ -236,6 +282,23 @@ typedef struct
     IMG_INT32   i32SAD_Threshold;
 } ADAPTIVE_INTRA_REFRESH_INFO_TYPE;
 
+#define TNG_MAX_ROI_NUM                 8
+#define TNG_MAX_TEMPORAL_LAYERS         4
+
+/*!
+ *    \IMG_ROI_REGION
+ *    \brief Region of interest in pixels, and the QP offset from the
+ *    initial QP applied to the macroblocks it covers.
+ */
+typedef struct
+{
+    IMG_UINT16  ui16X;
+    IMG_UINT16  ui16Y;
+    IMG_UINT16  ui16Width;
+    IMG_UINT16  ui16Height;
+    IMG_INT8    i8QPDelta;
+} IMG_ROI_REGION;
+
 
 struct context_ENC_s {
     object_context_p obj_context; /* back reference */
@@ -405,6 +468,12 @@ struct context_ENC_s {
     IMG_BOOL   bEnableInpCtrl;  //!< Enable Macro-block input control
     IMG_BOOL   bEnableAIR;      //!< Enable Adaptive Intra Refresh
     IMG_BOOL   bEnableCIR;	//!< Enable Cyclic Intra Refresh
+    IMG_BOOL   bEnableROI;      //!< Fill input control on the host with per-MB QP from regions of interest
+    IMG_UINT8  ui8ROINum;       //!< Number of valid entries in sROI, 0 = uniform QP
+    IMG_ROI_REGION sROI[TNG_MAX_ROI_NUM]; //!< Regions in priority order, first one wins where they overlap
+    IMG_UINT8  ui8TemporalLayers; //!< H.264 temporal layers coded as a hierarchical B mini GOP, 1 = off
+    IMG_UINT8  ui8QualityLevel;   //!< motion search preset, 1 = best quality .. TNG_QUALITY_LEVELS = fastest
+    IMG_UINT32 aui32LayerBitrate[TNG_MAX_TEMPORAL_LAYERS]; //!< Cumulative bitrate of each layer, 0 = unset
     IMG_INT32  i32NumAIRMBs;    //!< n = Max number of AIR MBs per frame, 0 = _ALL_ MBs over threshold will be marked as AIR Intras, -1 = Auto 10%
     IMG_INT32  i32AIRThreshold; //!< n = SAD Threshold above which a MB is a AIR MB candidate,  -1 = Auto adjusting threshold
     IMG_INT16  i16AIRSkipCnt;   //?!< n = Number of MBs to skip in AIR Table between frames, -1 = Random (0 - NumAIRMbs) skip between frames in AIR table
@@ -451,6 +520,7 @@ struct context_ENC_s {
     IMG_BOOL   bSkipDuplicateVectors;
     IMG_BOOL   bNoOffscreenMv;
     IMG_BOOL   idr_force_flag;
+    IMG_BOOL   ref_invalidate_flag;
 
     IMG_BOOL   bNoSequenceHeaders;
     IMG_BOOL   bUseFirmwareALLRC; //!< Defines if aLL RC firmware to be loaded
@@ -474,6 +544,10 @@ struct context_ENC_s {
     /* qp/maxqp/minqp/bitrate/intra_period */
     uint32_t rc_update_flag;
     IMG_INT16 max_qp;
+
+    CODEDBUF_SIZE_STATS sCodedBufStats;
+    MAX_FRAME_SIZE_STATE sMaxFrameSize;
+    COMPLEXITY_RC_STATE sComplexityRC;
 };
 
 typedef struct context_ENC_s *context_ENC_p;
@@ -518,6 +592,19 @@ unsigned int tng__get_ipe_control(IMG_CODEC  eEncodingFormat);
 void tng__UpdateRCBitsTransmitted(context_ENC_p ctx);
 void tng__trace_in_params(IMG_MTX_VIDEO_CONTEXT* psMtxEncCtx);
 void tng__trace_mtx_context(IMG_MTX_VIDEO_CONTEXT* psMtxEncCtx);
+void tng_update_codedbuf_stats(
+    object_context_p obj_context,
+    P_CODED_DATA_HDR psCodedHdr,
+    IMG_UINT32 ui32FrameSize,
+    IMG_BOOL bOverflow);
+IMG_UINT32 tng_get_codedbuf_recommended_size(object_context_p obj_context);
+void tng_update_complexity_drift(
+    object_context_p obj_context,
+    IMG_UINT32 ui32FrameBytes);
+IMG_BOOL tng_check_max_frame_size(
+    object_context_p obj_context,
+    P_CODED_DATA_HDR psCodedHdr,
+    IMG_UINT32 ui32FrameBytes);
 VAStatus tng__alloc_init_buffer(
     psb_driver_data_p driver_data,
     unsigned int size,
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tng_hostrc.h"
+
+static IMG_INT32 tng__rc_abs(IMG_INT32 a)
+{
+    return (a < 0) ? -a : a;
+}
+
+/*
+ * Rate control heuristics below only depend on their arguments, so the
+ * values they give can be checked for any stream setup without a context.
+ */
+double tng__rc_bits_per_pixel(
+    IMG_UINT32 ui32BitsPerSecond,
+    IMG_UINT32 ui32FrameRate,
+    IMG_UINT16 ui16Width,
+    IMG_UINT16 ui16Height)
+{
+    /* high frame rates at large sizes overflow an integer product */
+    return 1.0 * ui32BitsPerSecond / ((double)ui32FrameRate * ui16Width * ui16Height);
+}
+
+IMG_UINT8 tng__rc_h264_min_qp(
+    double flBpp,
+    IMG_INT32 i32BufferSizeInFrames,
+    IMG_UINT16 ui16MBPerFrm)
+{
+    IMG_INT32 i32TmpQp;
+
+    if (flBpp >= 0.50)
+        i32TmpQp = 4;
+    else if (flBpp > 0.133)
+        i32TmpQp = (IMG_INT32)(22 - (40*flBpp));
+    else
+        i32TmpQp = (IMG_INT32)(30 - (100 * flBpp));
+
+    /* Adjust minQp up for small buffer size and down for large buffer size */
+    if (i32BufferSizeInFrames < 5) {
+        i32TmpQp += 2;
+    }
+
+    if (i32BufferSizeInFrames > 40) {
+        if(i32TmpQp>=1)
+            i32TmpQp -= 1;
+    }
+    /* for HD content allow a lower minQp as bitrate is more easily controlled in this case */
+    if (ui16MBPerFrm > 2000) {
+        i32TmpQp -= 6;
+    }
+
+    if (i32TmpQp < 2)
+        i32TmpQp = 2;
+
+    return i32TmpQp;
+}
+
+static IMG_INT32 tng__rc_h264_qp_estimate(
+    double flBpp,
+    IMG_INT32 i32BufferSizeInFrames,
+    IMG_UINT32 ui32IntraFreq,
+    IMG_UINT16 ui16MBPerFrm)
+{
+    const double L1 = 0.050568;
+    const double L2 = 0.202272;
+    const double L3 = 0.40454321;
+    const double L4 = 0.80908642;
+    const double L5 = 1.011358025;
+    IMG_INT32 i32TmpQp;
+
+    if (flBpp < L1)
+        i32TmpQp = (IMG_INT32)(45 - 78.10*flBpp);
+    else if (flBpp>=L1 && flBpp<L2)
+        i32TmpQp = (IMG_INT32)(44 - 72.51*flBpp);
+    else if (flBpp>=L2 && flBpp<L3)
+        i32TmpQp = (IMG_INT32)(34 - 24.72*flBpp);
+    else if (flBpp>=L3 && flBpp<L4)
+        i32TmpQp = (IMG_INT32)(32 - 19.78*flBpp);
+    else if (flBpp>=L4 && flBpp<L5)
+        i32TmpQp = (IMG_INT32)(25 - 9.89*flBpp);
+    else
+        i32TmpQp = (IMG_INT32)(18 - 4.95*flBpp);
+
+    /* Adjust ui8SeInitQP up for small buffer size or small fps */
+    /* Adjust ui8SeInitQP up for small gop size */
+    if ((i32BufferSizeInFrames < 20) || (ui32IntraFreq < 20)) {
+        i32TmpQp += 2;
+    }
+
+    /* for very small buffers increase initial Qp even more */
+    if(i32BufferSizeInFrames < 5)
+    {
+        i32TmpQp += 8;
+    }
+
+    /* start on a lower initial Qp for HD content as the coding is more efficient */
+    if (ui16MBPerFrm > 2000) {
+        i32TmpQp -= 2;
+    }
+
+    if(ui32IntraFreq ==1)
+    {
+        /* for very small GOPS start with a much higher initial Qp */
+        i32TmpQp += 12;
+    } else if (ui32IntraFreq<5) {
+        /* for very small GOPS start with a much higher initial Qp */
+        i32TmpQp += 6;
+    }
+
+    return i32TmpQp;
+}
+
+/*
+ * Initial QP of an H.264 sequence: the application's, or the estimate from
+ * the bits per pixel when it gave none, kept within [ui8MinQP, 49]. The
+ * estimate goes below 0 at very high rates. A min QP above 49 wins.
+ */
+IMG_UINT8 tng__rc_h264_initial_qp(
+    double flBpp,
+    IMG_INT32 i32BufferSizeInFrames,
+    IMG_UINT32 ui32IntraFreq,
+    IMG_UINT16 ui16MBPerFrm,
+    IMG_UINT8 ui8InitialQp,
+    IMG_UINT8 ui8MinQP)
+{
+    IMG_INT32 i32TmpQp = ui8InitialQp;
+
+    if (i32TmpQp == 0)
+        i32TmpQp = tng__rc_h264_qp_estimate(flBpp, i32BufferSizeInFrames,
+                                            ui32IntraFreq, ui16MBPerFrm);
+    if (i32TmpQp > 49)
+        i32TmpQp = 49;
+    if (i32TmpQp < ui8MinQP)
+        i32TmpQp = ui8MinQP;
+
+    return (IMG_UINT8)i32TmpQp;
+}
+
+IMG_UINT8 tng__rc_other_initial_qp(
+    double flBpp,
+    IMG_UINT16 ui16Width,
+    IMG_INT32 i32BufferSizeInFrames,
+    IMG_UINT32 ui32IntraFreq)
+{
+    double L1, L2, L3, L4, L5, L6;
+    IMG_UINT8 ui8Qp;
+
+    if (ui16Width == 176) {
+        L1 = 0.042;    L2 = 0.084;    L3 = 0.126;    L4 = 0.168;    L5 = 0.336;    L6=0.505;
+    } else if (ui16Width == 352) {
+        L1 = 0.064;    L2 = 0.084;    L3 = 0.106;    L4 = 0.126;    L5 = 0.168;    L6=0.210;
+    } else {
+        L1 = 0.050;    L2 = 0.0760;    L3 = 0.096;   L4 = 0.145;    L5 = 0.193;    L6=0.289;
+    }
+
+    if (flBpp < L1)
+        ui8Qp = 31;
+    else if (flBpp>=L1 && flBpp<L2)
+        ui8Qp = 26;
+    else if (flBpp>=L2 && flBpp<L3)
+        ui8Qp = 22;
+    else if (flBpp>=L3 && flBpp<L4)
+        ui8Qp = 18;
+    else if (flBpp>=L4 && flBpp<L5)
+        ui8Qp = 14;
+    else if (flBpp>=L5 && flBpp<L6)
+        ui8Qp = 10;
+    else
+        ui8Qp = 8;
+
+    /* Adjust ui8SeInitQP up for small buffer size or small fps */
+    /* Adjust ui8SeInitQP up for small gop size */
+    if ((i32BufferSizeInFrames < 20) || (ui32IntraFreq < 20)) {
+        ui8Qp += 2;
+    }
+
+    if (ui8Qp > 31)
+        ui8Qp = 31;
+
+    return ui8Qp;
+}
+
+IMG_UINT8 tng__rc_scale_factor(IMG_UINT32 ui32BitsPerSecond, IMG_BOOL bVBR)
+{
+    if (bVBR) {
+        // These scale factor are used only for rate control to avoid overflow
+        // in fixed-point calculation these scale factors are decided by bit rate
+        if (ui32BitsPerSecond < 640000)
+            return 2;                       // related to complexity
+        else if (ui32BitsPerSecond < 2000000)
+            return 4;                       // 2 Mbits
+        else if (ui32BitsPerSecond < 8000000)
+            return 6;                       // 8 Mbits
+        return 8;
+    }
+
+    // HRD consideration - These values are used by H.264 reference code.
+    if (ui32BitsPerSecond < 1000000)
+        return 0;                           // 1 Mbits/s
+    else if (ui32BitsPerSecond < 2000000)
+        return 1;                           // 2 Mbits/s
+    else if (ui32BitsPerSecond < 4000000)
+        return 2;                           // 4 Mbits/s
+    else if (ui32BitsPerSecond < 8000000)
+        return 3;                           // 8 Mbits/s
+    return 4;
+}
+
+IMG_UINT8 tng__rc_half_frame_rate(
+    IMG_UINT32 ui32BitsPerSecond,
+    IMG_UINT32 ui32FrameRate,
+    IMG_UINT16 ui16Width,
+    IMG_UINT16 ui16Height,
+    IMG_UINT16 ui16MBPerFrm)
+{
+    double flBpp;
+
+    flBpp  = 256 * (ui32BitsPerSecond/ui16Width);
+    flBpp /= ((double)ui16Height * ui32FrameRate);
+
+    if ((ui16MBPerFrm > 1024 && flBpp < 16) || (ui16MBPerFrm <= 1024 && flBpp < 24))
+        return 1;
+    return 0;
+}
+
+/*
+ * Default rate control buffer: ui32BufferTenths tenths of a second of bits,
+ * or 4.5 s below 256 kbps and 2.5 s above when the application gave no
+ * window. The firmware takes a signed 32 bit size.
+ */
+IMG_UINT32 tng__rc_buffer_size(IMG_UINT32 ui32BitsPerSecond, IMG_UINT32 ui32BufferTenths)
+{
+    IMG_UINT64 ui64BufferSize;
+
+    if (ui32BufferTenths)
+        ui64BufferSize = (IMG_UINT64)ui32BitsPerSecond * ui32BufferTenths / 10;
+    else if (ui32BitsPerSecond < 256000)
+        ui64BufferSize = ((IMG_UINT64)9 * ui32BitsPerSecond) >> 1;
+    else
+        ui64BufferSize = ((IMG_UINT64)5 * ui32BitsPerSecond) >> 1;
+
+    if (ui64BufferSize > 0x7fffffff)
+        return 0x7fffffff;
+    return (IMG_UINT32)ui64BufferSize;
+}
+
+/*
+ * Initial buffer level: 3/16 of the buffer, rounded to whole frames so the
+ * firmware and the HRD timing agree, at least one frame and never more than
+ * the buffer holds.
+ */
+IMG_INT32 tng__rc_initial_level(IMG_UINT32 ui32BufferSize, IMG_UINT32 ui32BitsPerFrame)
+{
+    IMG_UINT64 ui64Level = ((IMG_UINT64)3 * ui32BufferSize) >> 4;
+
+    if (ui32BitsPerFrame) {
+        ui64Level = ((ui64Level + ui32BitsPerFrame / 2) / ui32BitsPerFrame) * ui32BitsPerFrame;
+        if (ui64Level < ui32BitsPerFrame)
+            ui64Level = ui32BitsPerFrame;
+    }
+
+    if (ui64Level > ui32BufferSize)
+        ui64Level = ui32BufferSize;
+    if (ui64Level > 0x7fffffff)
+        ui64Level = 0x7fffffff;
+
+    return (IMG_INT32)ui64Level;
+}
+
+/* buffer size in frames, 30 when the bits per frame are not known (MVC) */
+IMG_INT32 tng__rc_buffer_size_in_frames(IMG_UINT32 ui32BufferSize, IMG_INT32 i32BitsPerFrm)
+{
+    if (i32BitsPerFrm <= 0)
+        return 30;
+    return (IMG_INT32)(((IMG_UINT64)ui32BufferSize + i32BitsPerFrm / 2) / i32BitsPerFrm);
+}
+
+/*
+ * Intra period of a stream with B frames: a whole number of mini GOPs of
+ * ui32GopSize frames, rounded up, or down where that would pass INT_MAX.
+ */
+IMG_UINT32 tng__rc_intra_period(IMG_UINT32 ui32IntraCnt, IMG_UINT32 ui32GopSize)
+{
+    IMG_UINT32 ui32Rem;
+
+    if (ui32GopSize <= 1 || (ui32IntraCnt % ui32GopSize) == 0)
+        return ui32IntraCnt;
+
+    ui32Rem = ui32IntraCnt % ui32GopSize;
+    if (ui32IntraCnt > 0x7fffffff - ui32GopSize + ui32Rem)
+        return ui32IntraCnt - ui32Rem;
+    return ui32IntraCnt + ui32GopSize - ui32Rem;
+}
+
+/* a BU bigger than the frame, e.g. after a resolution change, leaves no BU per frame */
+IMG_UINT32 tng__rc_bu_size(IMG_UINT32 ui32BUSize, IMG_UINT32 ui32MBPerFrm)
+{
+    if (!ui32BUSize || ui32BUSize > ui32MBPerFrm)
+        return ui32MBPerFrm;		// BU = 1 Frame
+    return ui32BUSize;
+}
+
+/*
+ * The H.264 rate control uses this value to adjust the reaction rate to
+ * larger than expected frames: the bits of a GOP over the room the buffer
+ * has above its initial level, in 1/256. 0 when there is no such room.
+ */
+IMG_UINT32 tng__rc_h264_scale_factor(
+    IMG_UINT32 ui32BitsPerSecond,
+    IMG_UINT32 ui32FrameRate,
+    IMG_UINT32 ui32IntraFreq,
+    IMG_INT32 i32BufferSize,
+    IMG_INT32 i32InitialLevel)
+{
+    IMG_UINT64 ui64BitsPerGop, ui64Room, ui64Factor;
+
+    if (ui32FrameRate == 0 || ui32BitsPerSecond < ui32FrameRate ||
+        i32BufferSize <= i32InitialLevel)
+        return 0;
+
+    /* the intra period is INT_MAX without I frames, widen before the product */
+    ui64BitsPerGop = (IMG_UINT64)(ui32BitsPerSecond / ui32FrameRate) * ui32IntraFreq;
+    ui64Room = (IMG_UINT64)((IMG_INT64)i32BufferSize - i32InitialLevel);
+
+    /* split the division so the 256 scale can not overflow 64 bits either */
+    ui64Factor = (ui64BitsPerGop / ui64Room) * 256 + (ui64BitsPerGop % ui64Room) * 256 / ui64Room;
+    if (ui64Factor > 0xffffffff)
+        return 0xffffffff;
+
+    return (IMG_UINT32)ui64Factor;
+}
+
+/*
+ * Cost of coding a source frame, estimated on a sparse grid of luma samples:
+ * each sample costs the smaller of its temporal difference to the previous
+ * frame's sample and its spatial gradient, so a scene cut is priced like an
+ * intra frame. The samples are left in pui8Samples for the next frame.
+ */
+IMG_UINT32 tng__frame_complexity(
+    const IMG_UINT8 *pui8Luma,
+    IMG_UINT32 ui32Stride,
+    IMG_UINT16 ui16Width,
+    IMG_UINT16 ui16Height,
+    IMG_UINT8 *pui8Samples,
+    IMG_BOOL bHavePrevious)
+{
+    const IMG_UINT8 *pui8Row, *pui8Above;
+    IMG_UINT32 ui32Cost = 0;
+    IMG_INT32 i32Spatial, i32Temporal, i32Pel;
+    IMG_UINT32 x, y;
+
+    for (y = TNG_COMPLEXITY_STEP_Y / 2; y < ui16Height; y += TNG_COMPLEXITY_STEP_Y) {
+        pui8Row = pui8Luma + y * ui32Stride;
+        pui8Above = pui8Row - ui32Stride;
+        for (x = TNG_COMPLEXITY_STEP_X; x < ui16Width; x += TNG_COMPLEXITY_STEP_X) {
+            i32Pel = pui8Row[x];
+            i32Spatial = tng__rc_abs(i32Pel - pui8Row[x - 1]) + tng__rc_abs(i32Pel - pui8Above[x]);
+            if (bHavePrevious) {
+                i32Temporal = 2 * tng__rc_abs(i32Pel - *pui8Samples);
+                if (i32Temporal < i32Spatial)
+                    i32Spatial = i32Temporal;
+            }
+            ui32Cost += i32Spatial;
+            *pui8Samples++ = i32Pel;
+        }
+    }
+
+    return ui32Cost;
+}
+
+/*
+ * Bitrate steps of 9/8 for the frame about to be coded: one per 4/3 of its
+ * cost above or below the running average (bits ~ complexity ^ 0.4), less
+ * one per TNG_COMPLEXITY_DRIFT_FRAMES frames worth of bits already spent
+ * over the configured rate, more when under it.
+ */
+IMG_INT32 tng__complexity_steps(
+    IMG_UINT32 ui32Cost,
+    IMG_UINT32 ui32AvgCost,
+    IMG_INT64 i64DriftBits,
+    IMG_UINT32 ui32BitsPerFrame)
+{
+    IMG_INT32 i32Steps = 0;
+    IMG_INT64 i64DriftSteps;
+    IMG_UINT32 ui32Ref;
+
+    if (ui32AvgCost) {
+        ui32Ref = ui32AvgCost;
+        while (ui32Cost > ui32Ref / 3 * 4 && i32Steps < TNG_COMPLEXITY_MAX_STEPS) {
+            ui32Ref = ui32Ref / 3 * 4;
+            i32Steps++;
+        }
+        ui32Ref = ui32AvgCost;
+        while (ui32Cost < ui32Ref / 4 * 3 && i32Steps > -TNG_COMPLEXITY_MAX_STEPS) {
+            ui32Ref = ui32Ref / 4 * 3;
+            i32Steps--;
+        }
+    }
+
+    if (ui32BitsPerFrame) {
+        i64DriftSteps = i64DriftBits / ((IMG_INT64)ui32BitsPerFrame * TNG_COMPLEXITY_DRIFT_FRAMES);
+        if (i64DriftSteps > 2 * TNG_COMPLEXITY_MAX_STEPS)
+            i64DriftSteps = 2 * TNG_COMPLEXITY_MAX_STEPS;
+        if (i64DriftSteps < -2 * TNG_COMPLEXITY_MAX_STEPS)
+            i64DriftSteps = -2 * TNG_COMPLEXITY_MAX_STEPS;
+        i32Steps -= (IMG_INT32)i64DriftSteps;
+    }
+
+    if (i32Steps > TNG_COMPLEXITY_MAX_STEPS)
+        i32Steps = TNG_COMPLEXITY_MAX_STEPS;
+    if (i32Steps < -TNG_COMPLEXITY_MAX_STEPS)
+        i32Steps = -TNG_COMPLEXITY_MAX_STEPS;
+
+    return i32Steps;
+}
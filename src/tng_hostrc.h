@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _TNG_HOSTRC_H_
+#define _TNG_HOSTRC_H_
+
+#include "img_types.h"
+
+#define TNG_COMPLEXITY_STEP_X           8       /* source luma is sampled every 8th pixel */
+#define TNG_COMPLEXITY_STEP_Y           16      /* of every 16th line */
+#define TNG_COMPLEXITY_MAX_STEPS        6       /* bitrate moves at most 9/8 ^ 6, about 2x */
+#define TNG_COMPLEXITY_DRIFT_FRAMES     8       /* one step back per 8 frames of bits over or under */
+
+double tng__rc_bits_per_pixel(
+    IMG_UINT32 ui32BitsPerSecond,
+    IMG_UINT32 ui32FrameRate,
+    IMG_UINT16 ui16Width,
+    IMG_UINT16 ui16Height);
+IMG_UINT8 tng__rc_h264_min_qp(
+    double flBpp,
+    IMG_INT32 i32BufferSizeInFrames,
+    IMG_UINT16 ui16MBPerFrm);
+IMG_UINT8 tng__rc_h264_initial_qp(
+    double flBpp,
+    IMG_INT32 i32BufferSizeInFrames,
+    IMG_UINT32 ui32IntraFreq,
+    IMG_UINT16 ui16MBPerFrm,
+    IMG_UINT8 ui8InitialQp,
+    IMG_UINT8 ui8MinQP);
+IMG_UINT8 tng__rc_other_initial_qp(
+    double flBpp,
+    IMG_UINT16 ui16Width,
+    IMG_INT32 i32BufferSizeInFrames,
+    IMG_UINT32 ui32IntraFreq);
+IMG_UINT8 tng__rc_scale_factor(IMG_UINT32 ui32BitsPerSecond, IMG_BOOL bVBR);
+IMG_UINT8 tng__rc_half_frame_rate(
+    IMG_UINT32 ui32BitsPerSecond,
+    IMG_UINT32 ui32FrameRate,
+    IMG_UINT16 ui16Width,
+    IMG_UINT16 ui16Height,
+    IMG_UINT16 ui16MBPerFrm);
+IMG_UINT32 tng__rc_buffer_size(IMG_UINT32 ui32BitsPerSecond, IMG_UINT32 ui32BufferTenths);
+IMG_INT32 tng__rc_initial_level(IMG_UINT32 ui32BufferSize, IMG_UINT32 ui32BitsPerFrame);
+IMG_INT32 tng__rc_buffer_size_in_frames(IMG_UINT32 ui32BufferSize, IMG_INT32 i32BitsPerFrm);
+IMG_UINT32 tng__rc_intra_period(IMG_UINT32 ui32IntraCnt, IMG_UINT32 ui32GopSize);
+IMG_UINT32 tng__rc_bu_size(IMG_UINT32 ui32BUSize, IMG_UINT32 ui32MBPerFrm);
+IMG_UINT32 tng__rc_h264_scale_factor(
+    IMG_UINT32 ui32BitsPerSecond,
+    IMG_UINT32 ui32FrameRate,
+    IMG_UINT32 ui32IntraFreq,
+    IMG_INT32 i32BufferSize,
+    IMG_INT32 i32InitialLevel);
+IMG_UINT32 tng__frame_complexity(
+    const IMG_UINT8 *pui8Luma,
+    IMG_UINT32 ui32Stride,
+    IMG_UINT16 ui16Width,
+    IMG_UINT16 ui16Height,
+    IMG_UINT8 *pui8Samples,
+    IMG_BOOL bHavePrevious);
+IMG_INT32 tng__complexity_steps(
+    IMG_UINT32 ui32Cost,
+    IMG_UINT32 ui32AvgCost,
+    IMG_INT64 i64DriftBits,
+    IMG_UINT32 ui32BitsPerFrame);
+
+#endif //_TNG_HOSTRC_H_
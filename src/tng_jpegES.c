@@ -38,6 +38,7 @@
 #include "tng_hostcode.h"
 #include "tng_hostheader.h"
 #include "tng_jpegES.h"
+#include "psb_va_ext.h"
 #ifdef _TOPAZHP_PDUMP_
 #include "tng_trace.h"
 #endif
@@ -312,9 +313,8 @@ static int CustomizeQuantizationTables(unsigned char *luma_matrix,
     return 0;
 }
 
-static void SetDefaultQmatix(void *pMemInfoTableBlock)
+static void SetDefaultQmatix(JPEG_MTX_QUANT_TABLE *pQTable)
 {
-    JPEG_MTX_QUANT_TABLE *pQTable =  pMemInfoTableBlock;
     memcpy(pQTable->aui8LumaQuantParams, gQuantLuma, QUANT_TABLE_SIZE_BYTES);
     memcpy(pQTable->aui8ChromaQuantParams, gQuantChroma, QUANT_TABLE_SIZE_BYTES);
     return;
@@ -325,11 +325,13 @@ static void IssueQmatix(TOPAZHP_JPEG_ENCODER_CONTEXT *pJPEGContext)
 {
     int i;
     context_ENC_p ctx = (context_ENC_p)pJPEGContext->ctx;
+    unsigned char *pTables;
 
     /* Dump MTX setup data for debug */
     ASSERT(NULL != pJPEGContext->pMemInfoTableBlock);
 
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "Issue Quantization Table data\n");
+    pTables = (unsigned char *)pJPEGContext->pMemInfoTableBlock;
     for (i=0; i<128; i+=8) {
         if (0 == i) {
             drv_debug_msg(VIDEO_DEBUG_GENERAL, "Table 0:\n");
@@ -338,14 +340,8 @@ static void IssueQmatix(TOPAZHP_JPEG_ENCODER_CONTEXT *pJPEGContext)
             drv_debug_msg(VIDEO_DEBUG_GENERAL, "Table 1:\n");
         }
         drv_debug_msg(VIDEO_DEBUG_GENERAL, "%d %d %d %d %d %d %d %d\n", 
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i),
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i+1),
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i+2),
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i+3),
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i+4),
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i+5),
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i+6),
-                      *((unsigned char *)ctx->obj_context->tng_cmdbuf->jpeg_pic_params_p+i+7));
+                      pTables[i], pTables[i+1], pTables[i+2], pTables[i+3],
+                      pTables[i+4], pTables[i+5], pTables[i+6], pTables[i+7]);
     }
 
     tng_cmdbuf_insert_command(ctx->obj_context,
@@ -353,7 +349,7 @@ static void IssueQmatix(TOPAZHP_JPEG_ENCODER_CONTEXT *pJPEGContext)
                                       MTX_CMDID_SETQUANT,
                                       0,
                                       &(ctx->obj_context->tng_cmdbuf->jpeg_pic_params),
-                                      0);
+                                      pJPEGContext->ui8BatchCount * pJPEGContext->ui32QuantSlotSize);
 }
 
 static void InitializeJpegEncode(TOPAZHP_JPEG_ENCODER_CONTEXT *pJPEGContext)
@@ -526,9 +522,14 @@ static void IssueSetupInterface(TOPAZHP_JPEG_ENCODER_CONTEXT *pJPEGContext)
                                       0);
 }
 
+/*
+ * Only the surface stride and addresses change between pictures, the rest of
+ * the MTX setup block is written once per command buffer (bStaticValid).
+ */
 static IMG_ERRORCODE SetMTXSetup(
     TOPAZHP_JPEG_ENCODER_CONTEXT *pJPEGContext,
-    object_surface_p pTFrame)
+    object_surface_p pTFrame,
+    IMG_BOOL bStaticValid)
 {
     IMG_UINT32 srf_buf_offset;
     context_ENC_p ctx = (context_ENC_p)pJPEGContext->ctx;
@@ -536,8 +537,6 @@ static IMG_ERRORCODE SetMTXSetup(
     context_ENC_mem *ps_mem = &(ctx->ctx_mem[ctx->ui32StreamID]);
     context_ENC_mem_size *ps_mem_size = &(ctx->ctx_mem_size);
 
-    pJPEGContext->pMTXSetup->ui32ComponentsInScan = MTX_MAX_COMPONENTS;
-
     switch (pJPEGContext->eFormat) {
     case IMG_CODEC_PL12:
         if (pTFrame->psb_surface->stride % 64) {
@@ -548,10 +547,6 @@ static IMG_ERRORCODE SetMTXSetup(
         pJPEGContext->pMTXSetup->ComponentPlane[0].ui32Stride = pTFrame->psb_surface->stride;
         pJPEGContext->pMTXSetup->ComponentPlane[1].ui32Stride = pTFrame->psb_surface->stride;
         pJPEGContext->pMTXSetup->ComponentPlane[2].ui32Stride = pTFrame->psb_surface->stride;
-
-        pJPEGContext->pMTXSetup->ComponentPlane[0].ui32Height = pJPEGContext->MCUComponent[0].ui32YLimit;
-        pJPEGContext->pMTXSetup->ComponentPlane[1].ui32Height = pJPEGContext->MCUComponent[0].ui32YLimit / 2;
-        pJPEGContext->pMTXSetup->ComponentPlane[2].ui32Height = pJPEGContext->MCUComponent[0].ui32YLimit / 2;
         break;
     default:
         drv_debug_msg(VIDEO_DEBUG_ERROR, "Not supported FOURCC: %x!\n", pJPEGContext->eFormat);
@@ -577,6 +572,15 @@ static IMG_ERRORCODE SetMTXSetup(
         return IMG_ERR_INVALID_CONTEXT;
     }
 
+    if (bStaticValid)
+        return IMG_ERR_OK;
+
+    pJPEGContext->pMTXSetup->ui32ComponentsInScan = MTX_MAX_COMPONENTS;
+
+    pJPEGContext->pMTXSetup->ComponentPlane[0].ui32Height = pJPEGContext->MCUComponent[0].ui32YLimit;
+    pJPEGContext->pMTXSetup->ComponentPlane[1].ui32Height = pJPEGContext->MCUComponent[0].ui32YLimit / 2;
+    pJPEGContext->pMTXSetup->ComponentPlane[2].ui32Height = pJPEGContext->MCUComponent[0].ui32YLimit / 2;
+
     memcpy((void *)pJPEGContext->pMTXSetup->MCUComponent,
            (void *)pJPEGContext->MCUComponent,
            sizeof(pJPEGContext->MCUComponent));
@@ -619,7 +623,7 @@ static void IssueMTXSetup(TOPAZHP_JPEG_ENCODER_CONTEXT *pJPEGContext)
                                       MTX_CMDID_SETUP,
                                       0,
                                       &(ctx->obj_context->tng_cmdbuf->jpeg_header_mem),
-                                      0);
+                                      pJPEGContext->ui8BatchCount * pJPEGContext->ui32SetupSlotSize);
 
     return;
 }
@@ -998,6 +1002,9 @@ static void tng_jpeg_QueryConfigAttributes(
                and a surface of that source size is allocatable. */
             attrib_list[i].value = 0; /* No pure limitation */
             break;
+        case VAConfigAttribPSBJPEGOutput:
+            attrib_list[i].value = VA_PSB_JPEG_OUTPUT_SEGMENTS | VA_PSB_JPEG_OUTPUT_CONTIGUOUS;
+            break;
         default:
             attrib_list[i].value = VA_ATTRIB_NOT_SUPPORTED;
             break;
@@ -1021,6 +1028,11 @@ static VAStatus tng_jpeg_ValidateConfig(
             break;
         case VAConfigAttribRateControl:
             break;
+        case VAConfigAttribPSBJPEGOutput:
+            if (obj_config->attrib_list[i].value != VA_PSB_JPEG_OUTPUT_SEGMENTS &&
+                obj_config->attrib_list[i].value != VA_PSB_JPEG_OUTPUT_CONTIGUOUS)
+                return VA_STATUS_ERROR_INVALID_VALUE;
+            break;
         default:
             return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
         }
@@ -1081,6 +1093,30 @@ static VAStatus tng_jpeg_CreateContext(
 
     InitializeJpegEncode(jpeg_ctx_p);
 
+    for (i = 0; i < obj_config->attrib_count; i++) {
+        if (VAConfigAttribPSBJPEGOutput == obj_config->attrib_list[i].type &&
+            VA_PSB_JPEG_OUTPUT_CONTIGUOUS == obj_config->attrib_list[i].value) {
+            drv_debug_msg(VIDEO_DEBUG_GENERAL, "JPEG encoding: output the JFIF stream as one coded segment\n");
+            jpeg_ctx_p->bContiguousOutput = IMG_TRUE;
+        }
+    }
+
+    /* Each image of a batch gets its own slot in the setup buffers of the
+     * command buffer, which are created after this function returns */
+    jpeg_ctx_p->ui8BatchSize = 1;
+    if (psb_parse_config("PSB_VIDEO_JPEG_BATCH", &env_value[0]) == 0) {
+        i = atoi(env_value);
+        if (i > PTG_JPEG_MAX_BATCH)
+            i = PTG_JPEG_MAX_BATCH;
+        if (i > 1)
+            jpeg_ctx_p->ui8BatchSize = i;
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "JPEG encoding: %d images per submission\n", jpeg_ctx_p->ui8BatchSize);
+    }
+    jpeg_ctx_p->ui32QuantSlotSize = ctx->jpeg_pic_params_size;
+    jpeg_ctx_p->ui32SetupSlotSize = ctx->jpeg_header_mem_size;
+    ctx->jpeg_pic_params_size *= jpeg_ctx_p->ui8BatchSize;
+    ctx->jpeg_header_mem_size *= jpeg_ctx_p->ui8BatchSize;
+
     if ((jpeg_ctx_p->sScan_Encode_Info.ui16ScansInImage < 1) ||
         (jpeg_ctx_p->sScan_Encode_Info.ui16ScansInImage > PTG_JPEG_MAX_SCAN_NUM)) {
         drv_debug_msg(VIDEO_DEBUG_ERROR, "JPEG MCU scanning number(%d) is wrong!\n", jpeg_ctx_p->sScan_Encode_Info.ui16ScansInImage);
@@ -1108,6 +1144,8 @@ static void tng_jpeg_DestroyContext(
     ctx = (context_ENC_p)(obj_context->format_data);
 
     if (ctx->jpeg_ctx) {
+        tng_jpeg_FlushBatch(obj_context);
+
         if (ctx->jpeg_ctx->sScan_Encode_Info.aBufferTable) {
             free(ctx->jpeg_ctx->sScan_Encode_Info.aBufferTable);
             ctx->jpeg_ctx->sScan_Encode_Info.aBufferTable = NULL;
@@ -1141,6 +1179,7 @@ static VAStatus tng_jpeg_BeginPicture(
     VAStatus vaStatus = VA_STATUS_SUCCESS;
     int ret;
     tng_cmdbuf_p cmdbuf;
+    IMG_UINT32 ui32SlotMask;
 
     context_ENC_p ctx = (context_ENC_p) obj_context->format_data;
     TOPAZHP_JPEG_ENCODER_CONTEXT *jpeg_ctx_p = ctx->jpeg_ctx;
@@ -1180,9 +1219,9 @@ static VAStatus tng_jpeg_BeginPicture(
         drv_debug_msg(VIDEO_DEBUG_ERROR, "Fail to map MTX setup buffer\n");
         return vaStatus;
     }
-    jpeg_ctx_p->pMemInfoMTXSetup = cmdbuf->jpeg_header_mem_p;
+    jpeg_ctx_p->pMemInfoMTXSetup = (unsigned char *)cmdbuf->jpeg_header_mem_p +
+                                   jpeg_ctx_p->ui8BatchCount * jpeg_ctx_p->ui32SetupSlotSize;
     jpeg_ctx_p->pMTXSetup = (JPEG_MTX_DMA_SETUP*)jpeg_ctx_p->pMemInfoMTXSetup;
-    memset(jpeg_ctx_p->pMemInfoMTXSetup, 0x0, ctx->jpeg_header_mem_size);
 
 
     /* Map MTX setup interface buffer */
@@ -1194,7 +1233,6 @@ static VAStatus tng_jpeg_BeginPicture(
     }
     jpeg_ctx_p->pMemInfoWritebackMemory = cmdbuf->jpeg_header_interface_mem_p;
     jpeg_ctx_p->pMTXWritebackMemory = (JPEG_MTX_WRITEBACK_MEMORY*)jpeg_ctx_p->pMemInfoWritebackMemory;
-    memset(jpeg_ctx_p->pMemInfoWritebackMemory, 0x0, ctx->jpeg_header_interface_mem_size);
 
 
     /* Map quantization table buffer */
@@ -1205,9 +1243,19 @@ static VAStatus tng_jpeg_BeginPicture(
         psb_buffer_unmap(&cmdbuf->jpeg_header_interface_mem);
         return vaStatus;
     }
-    jpeg_ctx_p->pMemInfoTableBlock = cmdbuf->jpeg_pic_params_p;
-    jpeg_ctx_p->psTablesBlock = (JPEG_MTX_QUANT_TABLE *)jpeg_ctx_p->pMemInfoTableBlock;
-    memset(jpeg_ctx_p->pMemInfoTableBlock, 0x0, ctx->jpeg_pic_params_size);
+    jpeg_ctx_p->pMemInfoTableBlock = (unsigned char *)cmdbuf->jpeg_pic_params_p +
+                                     jpeg_ctx_p->ui8BatchCount * jpeg_ctx_p->ui32QuantSlotSize;
+    /* Tables are built in host memory and copied to the HW buffer at EndPicture */
+    jpeg_ctx_p->psTablesBlock = &jpeg_ctx_p->sQuantTables;
+
+    /* A command buffer is set up once, later pictures only rewrite the per-picture fields */
+    if (!cmdbuf->jpeg_setup_valid) {
+        memset(cmdbuf->jpeg_header_mem_p, 0x0, ctx->jpeg_header_mem_size);
+        memset(jpeg_ctx_p->pMemInfoWritebackMemory, 0x0, ctx->jpeg_header_interface_mem_size);
+        memset(cmdbuf->jpeg_pic_params_p, 0x0, ctx->jpeg_pic_params_size);
+        SetSetupInterface(jpeg_ctx_p);
+    }
+    ui32SlotMask = 1 << jpeg_ctx_p->ui8BatchCount;
 
     vaStatus = tng__cmdbuf_lowpower(ctx);
     if (vaStatus != VA_STATUS_SUCCESS) {
@@ -1215,17 +1263,17 @@ static VAStatus tng_jpeg_BeginPicture(
     }
 
     /* Set SetupInterface*/
-    SetSetupInterface(jpeg_ctx_p);
     IssueSetupInterface(jpeg_ctx_p);
 
     /* Set MTX setup struture */
-    ret = SetMTXSetup(jpeg_ctx_p, ps_buf->src_surface);
+    ret = SetMTXSetup(jpeg_ctx_p, ps_buf->src_surface, (cmdbuf->jpeg_setup_valid & ui32SlotMask) != 0);
     if (ret != IMG_ERR_OK)
         return ret;
     IssueMTXSetup(jpeg_ctx_p);
+    cmdbuf->jpeg_setup_valid |= ui32SlotMask;
 
     /* Initialize the default quantization tables */
-    SetDefaultQmatix(jpeg_ctx_p->pMemInfoTableBlock);
+    SetDefaultQmatix(jpeg_ctx_p->psTablesBlock);
 
     /* Initialize scan counters */
     InitializeScanCounter(jpeg_ctx_p);
@@ -1269,9 +1317,9 @@ static VAStatus ProcessPictureParam(context_ENC_p ctx, object_buffer_p obj_buffe
     VAEncPictureParameterBufferJPEG *pBuffer = NULL;
     BUFFER_HEADER *pBufHeader = NULL;
     TOPAZHP_JPEG_ENCODER_CONTEXT *jpeg_ctx = ctx->jpeg_ctx;
-    JPEG_MTX_QUANT_TABLE* pQMatrix = (JPEG_MTX_QUANT_TABLE *)
-                                     (ctx->jpeg_ctx->pMemInfoTableBlock);
+    JPEG_MTX_QUANT_TABLE* pQMatrix = ctx->jpeg_ctx->psTablesBlock;
     context_ENC_frame_buf *ps_buf = &(ctx->ctx_frame_buf);
+    IMG_CODED_BUFFER sHeaderBuf;
     IMG_ERRORCODE rc;
     
     /* Check the input buffer */
@@ -1298,11 +1346,15 @@ static VAStatus ProcessPictureParam(context_ENC_p ctx, object_buffer_p obj_buffe
        (pBuffer->quality > 100))
         return VA_STATUS_ERROR_INVALID_PARAMETER;
 
-    /* Set quality */
+    /* Set quality, the tables are only recomputed when it changes */
     if (pBuffer->quality != 0) { /* Quality value is set */
-        CustomizeQuantizationTables(pQMatrix->aui8LumaQuantParams, 
-                                    pQMatrix->aui8ChromaQuantParams,
-                                    pBuffer->quality);
+        if (jpeg_ctx->ui16Quality != pBuffer->quality) {
+            CustomizeQuantizationTables(jpeg_ctx->sQualityTables.aui8LumaQuantParams,
+                                        jpeg_ctx->sQualityTables.aui8ChromaQuantParams,
+                                        pBuffer->quality);
+            jpeg_ctx->ui16Quality = pBuffer->quality;
+        }
+        memcpy(pQMatrix, &jpeg_ctx->sQualityTables, sizeof(JPEG_MTX_QUANT_TABLE));
     }
 
     ASSERT(ctx->ui16Width == pBuffer->picture_width);
@@ -1319,6 +1371,9 @@ static VAStatus ProcessPictureParam(context_ENC_p ctx, object_buffer_p obj_buffe
         return VA_STATUS_ERROR_INVALID_BUFFER;
     }
 
+    /* a new image, markers get appended again on its first map */
+    CLEAR_CODEDBUF_INFO(MAPPED, ps_buf->coded_buf->codedbuf_aux_info);
+
     /* Map coded buffer */
     vaStatus = psb_buffer_map(ps_buf->coded_buf->psb_buffer, &jpeg_ctx->jpeg_coded_buf.pMemInfo);
     if (vaStatus) {
@@ -1349,9 +1404,22 @@ static VAStatus ProcessPictureParam(context_ENC_p ctx, object_buffer_p obj_buffe
     pBufHeader = (BUFFER_HEADER *)jpeg_ctx->jpeg_coded_buf.pMemInfo;
     pBufHeader->ui32BytesUsed = 0; /* Not include BUFFER_HEADER*/
 
-    rc = PrepareHeader(jpeg_ctx, &jpeg_ctx->jpeg_coded_buf, sizeof(BUFFER_HEADER), IMG_TRUE);
-    if (rc != IMG_ERR_OK)
-        return VA_STATUS_ERROR_UNKNOWN;
+    /* The headers only depend on the quantization tables once the geometry is fixed */
+    if (jpeg_ctx->ui32HeaderCacheBytes == 0 ||
+        memcmp(&jpeg_ctx->sHeaderQuantTables, pQMatrix, sizeof(JPEG_MTX_QUANT_TABLE))) {
+        sHeaderBuf.pMemInfo = jpeg_ctx->aui8HeaderCache;
+        rc = PrepareHeader(jpeg_ctx, &sHeaderBuf, 0, IMG_TRUE);
+        if (rc != IMG_ERR_OK) {
+            jpeg_ctx->ui32HeaderCacheBytes = 0;
+            return VA_STATUS_ERROR_UNKNOWN;
+        }
+        jpeg_ctx->ui32HeaderCacheBytes = sHeaderBuf.ui32BytesWritten;
+        memcpy(&jpeg_ctx->sHeaderQuantTables, pQMatrix, sizeof(JPEG_MTX_QUANT_TABLE));
+    }
+
+    memcpy((IMG_UINT8 *)jpeg_ctx->jpeg_coded_buf.pMemInfo + sizeof(BUFFER_HEADER),
+           jpeg_ctx->aui8HeaderCache, jpeg_ctx->ui32HeaderCacheBytes);
+    jpeg_ctx->jpeg_coded_buf.ui32BytesWritten = sizeof(BUFFER_HEADER) + jpeg_ctx->ui32HeaderCacheBytes;
 
     pBufHeader->ui32Reserved3 = PTG_JPEG_HEADER_MAX_SIZE;//Next coded buffer offset
     pBufHeader->ui32BytesUsed = jpeg_ctx->jpeg_coded_buf.ui32BytesWritten - sizeof(BUFFER_HEADER);
@@ -1418,6 +1486,7 @@ static VAStatus tng_jpeg_EndPicture(
 
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "tng_jpeg_EndPicture\n");
 
+    memcpy(jpeg_ctx_p->pMemInfoTableBlock, jpeg_ctx_p->psTablesBlock, sizeof(JPEG_MTX_QUANT_TABLE));
     IssueQmatix(jpeg_ctx_p);
 
     /* Compute the next scan to be sent */
@@ -1466,12 +1535,28 @@ static VAStatus tng_jpeg_EndPicture(
 
     //tng__trace_cmdbuf(cmdbuf);
 
-    if (tng_context_flush_cmdbuf(ctx->obj_context)) {
-        vaStatus = VA_STATUS_ERROR_UNKNOWN;
-        return vaStatus;
-    }
-
     ctx->obj_context->frame_count++;
+
+    /* Leave the command buffer open for the next image of the batch, it is
+     * submitted when full or when a coded buffer or surface of it is waited on */
+    if (++jpeg_ctx_p->ui8BatchCount < jpeg_ctx_p->ui8BatchSize)
+        return VA_STATUS_SUCCESS;
+
+    return tng_jpeg_FlushBatch(obj_context);
+}
+
+VAStatus tng_jpeg_FlushBatch(object_context_p obj_context)
+{
+    context_ENC_p ctx = (context_ENC_p) obj_context->format_data;
+
+    if (NULL == ctx || NULL == ctx->jpeg_ctx || 0 == ctx->jpeg_ctx->ui8BatchCount)
+        return VA_STATUS_SUCCESS;
+
+    ctx->jpeg_ctx->ui8BatchCount = 0;
+
+    if (tng_context_flush_cmdbuf(obj_context))
+        return VA_STATUS_ERROR_UNKNOWN;
+
     return VA_STATUS_SUCCESS;
 }
 
@@ -1559,6 +1644,10 @@ VAStatus tng_jpeg_AppendMarkers(object_context_p obj_context, void *raw_coded_bu
 
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "Add two bytes to last part of coded buffer,"
                              " total: %d\n", jpeg_ctx_p->jpeg_coded_buf.ui32BytesWritten);
+
+    if (jpeg_ctx_p->bContiguousOutput)
+        psb_codedbuf_compact_jpeg((unsigned char *)raw_coded_buf);
+
     return VA_STATUS_SUCCESS;
 }
 
@@ -151,6 +151,8 @@ typedef struct {
     IMG_UINT8 ui8NumberOfCodedBuffers;
 } TOPAZHP_SCAN_ENCODE_INFO;
 
+#define JPEG_HEADER_CACHE_SIZE 1024
+
 typedef struct {
     IMG_UINT32 eFormat;
     IMG_UINT16 ui16Quality;
@@ -178,10 +180,26 @@ typedef struct {
     IMG_CODED_BUFFER jpeg_coded_buf;
     IMG_UINT32 ui32SizePerCodedBuffer;
     MCUCOMPONENT MCUComponent[MTX_MAX_COMPONENTS];
+    IMG_BOOL bContiguousOutput;  /* hand out the JFIF stream as one coded segment, VA_PSB_JPEG_OUTPUT_CONTIGUOUS */
+
+    /* Kept across pictures, the geometry and format of a context never change */
+    JPEG_MTX_QUANT_TABLE sQuantTables;        /* tables of the current picture, copied to HW at EndPicture */
+    JPEG_MTX_QUANT_TABLE sQualityTables;      /* tables computed for ui16Quality */
+    JPEG_MTX_QUANT_TABLE sHeaderQuantTables;  /* tables aui8HeaderCache was written with */
+    IMG_UINT8  aui8HeaderCache[JPEG_HEADER_CACHE_SIZE];
+    IMG_UINT32 ui32HeaderCacheBytes;          /* 0 if aui8HeaderCache is not valid */
+
+    /* Batched submission: several images share one command buffer and one kernel submission */
+    IMG_UINT8  ui8BatchSize;                  /* images per submission, 1 without batching */
+    IMG_UINT8  ui8BatchCount;                 /* images queued in the open command buffer */
+    IMG_UINT32 ui32QuantSlotSize;             /* per-image part of the quantization table buffer */
+    IMG_UINT32 ui32SetupSlotSize;             /* per-image part of the MTX setup buffer */
 } TOPAZHP_JPEG_ENCODER_CONTEXT;
 
 #define PTG_JPEG_MAX_SCAN_NUM 7
+#define PTG_JPEG_MAX_BATCH 8
 extern struct format_vtable_s tng_JPEGES_vtable;
 extern VAStatus tng_jpeg_AppendMarkers(object_context_p obj_context, void *raw_coded_buf);
+extern VAStatus tng_jpeg_FlushBatch(object_context_p obj_context);
 
 #endif //_PTG_JPEG_H_
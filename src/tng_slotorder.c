@@ -34,13 +34,65 @@
 #include "tng_hostheader.h"
 #include "tng_slotorder.h"
 
+/*
+ * Encoding order of the B frames of a hierarchical mini GOP, walked the same
+ * way tng__gop_split() lays out the firmware GOP structure: the middle frame
+ * first, then the left and the right half. order[] gets the B positions
+ * (1 .. bframes) in the order they are coded and level[] the temporal layer
+ * of each, the P closing the mini GOP being layer 0.
+ */
+static void getHierarchicalOrder(int ref0, int ref1, int depth,
+    int *order, int *level, int *count)
+{
+    int distance = ref1 - ref0;
+    int position = ref0 + (distance >> 1);
+
+    if (distance == 1)
+        return;
+
+    order[*count] = position + 1;
+    level[*count] = depth;
+    (*count)++;
+
+    if (distance >= 4)
+        getHierarchicalOrder(ref0, position, depth + 1, order, level, count);
+    if (distance >= 3)
+        getHierarchicalOrder(position, ref1, depth + 1, order, level, count);
+}
+
+/*
+ * Coding rank (1 .. bframes) of the B frame at display position pos in its
+ * mini GOP, or with rank_in set the display position of the B frame coded
+ * at that rank. Flat mini GOPs code B frames in display order.
+ */
+static int getBFrameOrder(int bframes, int hierarchical, int pos, int rank_in, int *temporal_id)
+{
+    int order[MAX_BFRAMES], level[MAX_BFRAMES];
+    int i, count = 0;
+
+    *temporal_id = 1;
+    if (!hierarchical || bframes > MAX_BFRAMES)
+        return pos;
+
+    getHierarchicalOrder(-1, bframes, 1, order, level, &count);
+    for (i = 0; i < count; i++) {
+        if ((rank_in ? i + 1 : order[i]) == pos) {
+            *temporal_id = level[i];
+            return rank_in ? order[i] : i + 1;
+        }
+    }
+
+    return pos;
+}
+
 static unsigned long long displayingOrder2EncodingOrder(
     unsigned long long displaying_order,
     int bframes,
+    int hierarchical,
     int intracnt,
     int idrcnt)
 {
-    int poc;
+    int poc, temporal_id;
     if (idrcnt != 0) 
         poc = displaying_order % (intracnt * idrcnt + 1);
     else
@@ -50,13 +102,14 @@ static unsigned long long displayingOrder2EncodingOrder(
         return displaying_order;
     else if ((poc % (bframes + 1)) == 0) //I or P 
         return (displaying_order - bframes);
-    else 
-        return (displaying_order + 1); //B
+    else //B, coded after the P closing its mini GOP
+        return (displaying_order - (poc % (bframes + 1)) + 1 +
+                getBFrameOrder(bframes, hierarchical, poc % (bframes + 1), 0, &temporal_id));
 }
 
 
 static int getSlotIndex(
-    int bframes, int intracnt, int idrcnt,
+    int bframes, int hierarchical, int intracnt, int idrcnt,
     int displaying_order, int encoding_count,
     FRAME_ORDER_INFO *last_info)
 {
@@ -66,14 +119,13 @@ static int getSlotIndex(
             //encoding order
             if (i == 0)
                 last_info->slot_consume_enc_order[0] = 0;
-            else if (i == 1)
-                last_info->slot_consume_enc_order[bframes + 2 - 1] = 1;
             else
-                last_info->slot_consume_enc_order[i - 1] = i;
+                last_info->slot_consume_enc_order[i] =
+                    displayingOrder2EncodingOrder(i, bframes, hierarchical, intracnt, idrcnt);
             last_info->slot_consume_dpy_order[i] = i; //displaying order
 	}
         last_info->slot_consume_dpy_order[0] = bframes + 2;
-        last_info->slot_consume_enc_order[0] = displayingOrder2EncodingOrder(bframes + 2, bframes, intracnt, idrcnt);
+        last_info->slot_consume_enc_order[0] = displayingOrder2EncodingOrder(bframes + 2, bframes, hierarchical, intracnt, idrcnt);
         last_info->max_dpy_num = bframes + 2;
     } else {
         for (i = 0; i < (bframes + 2); i++) {
@@ -86,7 +138,7 @@ static int getSlotIndex(
         last_info->slot_consume_dpy_order[slot_idx] = last_info->max_dpy_num;
         last_info->slot_consume_enc_order[slot_idx] =
         displayingOrder2EncodingOrder(last_info->max_dpy_num,
-            bframes, intracnt, idrcnt);
+            bframes, hierarchical, intracnt, idrcnt);
     }
     
     return slot_idx;
@@ -95,6 +147,7 @@ static int getSlotIndex(
 int getFrameDpyOrder(
     unsigned long long encoding_count, /*Input, the encoding order, start from 0*/ 
     int bframes, /*Input, The number of B frames between P and I */
+    int hierarchical, /*Input, B frames coded as a hierarchical mini GOP */
     int intracnt, /*Input, Intra period*/
     int idrcnt, /*INput, IDR period. 0: only one IDR; */
     FRAME_ORDER_INFO *p_last_info, /*Input & Output. Reset to 0 on first call*/
@@ -102,6 +155,7 @@ int getFrameDpyOrder(
 {
     IMG_FRAME_TYPE frame_type; /*Output. Frame type. 0: I frame. 1: P frame. 2: B frame*/
     int slot; /*Output. The corresponding slot index */
+    int rank, temporal_id = 0;
 
     // int i;
     unsigned long long disp_index;
@@ -117,7 +171,9 @@ int getFrameDpyOrder(
         disp_index = encoding_count;
     } else if (((val - 1) % (bframes + 1)) != 0) {
         frame_type = IMG_INTER_B;
-        disp_index = encoding_count - 1;
+        rank = (val - 1) % (bframes + 1);
+        disp_index = encoding_count - rank - 1 +
+            getBFrameOrder(bframes, hierarchical, rank, 1, &temporal_id);
     } else if (p_last_info->last_frame_type == IMG_INTRA_IDR ||
         ((val - 1) / (bframes + 1) % (intracnt / (bframes + 1))) != 0) {
         frame_type = IMG_INTER_P;
@@ -128,14 +184,37 @@ int getFrameDpyOrder(
     }
 
     *displaying_order = disp_index;
-    slot = getSlotIndex(bframes, intracnt, idrcnt,
+    slot = getSlotIndex(bframes, hierarchical, intracnt, idrcnt,
                  disp_index, encoding_count, p_last_info);
 
     p_last_info->last_frame_type = frame_type;
     p_last_info->last_slot = slot;
+    p_last_info->last_temporal_id = temporal_id;
     return 0;
 }
 
+/*
+ * A mini GOP is closed once its anchor and the B frames displayed before it
+ * have all been coded, that is when the frame at encoding_count is an anchor
+ * again. Only then can the sequence restart without dropping a frame.
+ */
+int isMiniGopClosed(
+    unsigned long long encoding_count, /*Input, the encoding order, start from 0*/
+    int bframes, /*Input, The number of B frames between P and I */
+    int intracnt, /*Input, Intra period*/
+    int idrcnt) /*Input, IDR period. 0: only one IDR; */
+{
+    unsigned long long val;
+
+    if (bframes == 0 || encoding_count == 0)
+        return 1;
+
+    val = ((idrcnt == 0) ? encoding_count :
+        encoding_count % ((unsigned long long)intracnt * idrcnt + 1));
+
+    return (val == 0 || ((val - 1) % (bframes + 1)) == 0);
+}
+
 #if 0
 int main(int argc, char **argv) {
     int bframes, intracnt, frame_num;
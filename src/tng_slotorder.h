@@ -42,6 +42,7 @@ typedef struct _FRAME_ORDER_INFO {
     int *slot_consume_enc_order;
     IMG_FRAME_TYPE last_frame_type;
     short last_slot;
+    int last_temporal_id; /* 0 for I/P, layer of the B frame in its mini GOP */
 } FRAME_ORDER_INFO;
 
 /* Input, the encoding order, start from 0
@@ -56,8 +57,15 @@ typedef struct _FRAME_ORDER_INFO {
 int getFrameDpyOrder(
     unsigned long long encoding_count, /*Input, the encoding order, start from 0*/ 
     int bframes, /*Input, The number of B frames between P and I */
+    int hierarchical, /*Input, B frames coded as a hierarchical mini GOP */
     int intracnt, /*Input, Intra period*/
     int idrcnt, /*INput, IDR period. 0: only one IDR; */
     FRAME_ORDER_INFO *p_last_info, /*Input & Output. Reset to 0 on first call*/
     unsigned long long *displaying_order); /* Output. The displaying order */
+
+int isMiniGopClosed(
+    unsigned long long encoding_count, /*Input, the encoding order, start from 0*/
+    int bframes, /*Input, The number of B frames between P and I */
+    int intracnt, /*Input, Intra period*/
+    int idrcnt); /*Input, IDR period. 0: only one IDR; */
 #endif  //_TNG_SLOTORDER_H_
@@ -39,6 +39,8 @@
 #define GET_SURFACE_INFO_colocated_index(psb_surface) ((int) (psb_surface->extra_info[3]))
 #define SET_SURFACE_INFO_colocated_index(psb_surface, val) psb_surface->extra_info[3] = (uint32_t) val;
 
+#define SURFACE(id) ((object_surface_p) object_heap_lookup(&driver_data->surface_heap, id))
+
 /* Set MSVDX Front end register */
 void vld_dec_FE_state(object_context_p obj_context, psb_buffer_p buf)
 {
@@ -335,49 +337,154 @@ VAStatus vld_dec_process_slice(context_DEC_p ctx,
     return vaStatus;
 }
 
+/* Four size classes per power of two, so a regrown buffer keeps some headroom */
+static uint32_t vld_dec_colocated_size_class(uint32_t size)
+{
+    uint32_t step = 0x1000;
+
+    while ((step << 3) <= size)
+        step <<= 1;
+
+    return (size + step - 1) & ~(step - 1);
+}
+
+/* Pool entry currently assigned to surface, or -1 */
+static int vld_dec_colocated_find(context_DEC_p ctx, psb_surface_p surface)
+{
+    int index = GET_SURFACE_INFO_colocated_index(surface);
+
+    /* 0 means unset, index is offset by 1. The index is kept in the surface,
+     * so it may have been set by another context or left over from an entry
+     * that was reclaimed since.
+     */
+    if (index <= 0 || index > ctx->colocated_buffers_idx)
+        return -1;
+    if (ctx->colocated_buffers[index - 1]->surface != surface)
+        return -1;
+
+    return index - 1;
+}
+
+/* Whether the surface owning a pool entry is still alive and still using it */
+static int vld_dec_colocated_in_use(context_DEC_p ctx, int index)
+{
+    psb_driver_data_p driver_data = ctx->obj_context->driver_data;
+    vld_dec_colocated_p entry = ctx->colocated_buffers[index];
+    object_surface_p obj_surface;
+
+    if (entry->surface_id == VA_INVALID_SURFACE)
+        return 0;
+
+    obj_surface = SURFACE(entry->surface_id);
+    if ((obj_surface == NULL) || (obj_surface->psb_surface != entry->surface))
+        return 0;
+
+    return GET_SURFACE_INFO_colocated_index(entry->surface) == index + 1;
+}
+
+/* Pick an entry whose surface has left the context, preferring one that is already big enough */
+static int vld_dec_colocated_reclaim(context_DEC_p ctx, uint32_t size)
+{
+    int i, index = -1;
+
+    for (i = 0; i < ctx->colocated_buffers_idx; ++i) {
+        if (vld_dec_colocated_in_use(ctx, i))
+            continue;
+        if (ctx->colocated_buffers[i]->valid && ctx->colocated_buffers[i]->buf.size >= size)
+            return i;
+        if (index < 0)
+            index = i;
+    }
+
+    return index;
+}
+
+static int vld_dec_colocated_new_entry(context_DEC_p ctx)
+{
+    vld_dec_colocated_p *entries;
+    int size;
+
+    if (ctx->colocated_buffers_idx >= ctx->colocated_buffers_size) {
+        size = ctx->colocated_buffers_size * 2;
+        entries = (vld_dec_colocated_p *) realloc(ctx->colocated_buffers, sizeof(vld_dec_colocated_p) * size);
+        if (NULL == entries)
+            return -1;
+        ctx->colocated_buffers = entries;
+        ctx->colocated_buffers_size = size;
+    }
+
+    /* entries are allocated separately so the buffers never move */
+    ctx->colocated_buffers[ctx->colocated_buffers_idx] = (vld_dec_colocated_p) calloc(1, sizeof(struct vld_dec_colocated_s));
+    if (NULL == ctx->colocated_buffers[ctx->colocated_buffers_idx])
+        return -1;
+
+    return ctx->colocated_buffers_idx++;
+}
+
 VAStatus vld_dec_allocate_colocated_buffer(context_DEC_p ctx, object_surface_p obj_surface, uint32_t size)
 {
-    psb_buffer_p buf;
+    vld_dec_colocated_p entry;
     VAStatus vaStatus;
     psb_surface_p surface = obj_surface->psb_surface;
-    int index = GET_SURFACE_INFO_colocated_index(surface);
+    int index = vld_dec_colocated_find(ctx, surface);
 
-    if (!index) {
-        index = ctx->colocated_buffers_idx;
-        if (index >= ctx->colocated_buffers_size) {
-            return VA_STATUS_ERROR_UNKNOWN;
-        }
+    if (index < 0) {
+        index = vld_dec_colocated_reclaim(ctx, size);
+        if (index < 0)
+            index = vld_dec_colocated_new_entry(ctx);
+        if (index < 0)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
+        entry = ctx->colocated_buffers[index];
+        entry->surface_id = obj_surface->surface_id;
+        entry->surface = surface;
+        SET_SURFACE_INFO_colocated_index(surface, index + 1); /* 0 means unset, index is offset by 1 */
+    }
+
+    entry = ctx->colocated_buffers[index];
+    if (!entry->valid || entry->buf.size < size) {
+        size = vld_dec_colocated_size_class(size);
         drv_debug_msg(VIDEO_DEBUG_GENERAL, "Allocating colocated buffer for surface %08x size = %08x\n", surface, size);
 
-        buf = &(ctx->colocated_buffers[index]);
-        vaStatus = psb_buffer_create(ctx->obj_context->driver_data, size, psb_bt_vpu_only, buf);
+        if (entry->valid) {
+            psb_buffer_destroy(&entry->buf);
+            entry->valid = 0;
+        }
+        vaStatus = psb_buffer_create(ctx->obj_context->driver_data, size, psb_bt_vpu_only, &entry->buf);
         if (VA_STATUS_SUCCESS != vaStatus) {
             return vaStatus;
         }
-        ctx->colocated_buffers_idx++;
-        SET_SURFACE_INFO_colocated_index(surface, index + 1); /* 0 means unset, index is offset by 1 */
-    } else {
-        buf = &(ctx->colocated_buffers[index - 1]);
-        if (buf->size < size) {
-            psb_buffer_destroy(buf);
-            vaStatus = psb_buffer_create(ctx->obj_context->driver_data, size, psb_bt_vpu_only, buf);
-            if (VA_STATUS_SUCCESS != vaStatus) {
-                return vaStatus;
-            }
-            SET_SURFACE_INFO_colocated_index(surface, index); /* replace the original buffer */
-        }
+        entry->valid = 1;
     }
     return VA_STATUS_SUCCESS;
 }
 
+void vld_dec_preallocate_colocated_buffers(context_DEC_p ctx, uint32_t size)
+{
+    psb_driver_data_p driver_data = ctx->obj_context->driver_data;
+    object_surface_p obj_surface;
+    int i;
+
+    for (i = 0; i < ctx->obj_context->num_render_targets; i++) {
+        obj_surface = SURFACE(ctx->obj_context->render_targets[i]);
+        if (NULL == obj_surface)
+            continue;
+        /* not fatal, remaining buffers are allocated on first use */
+        if (VA_STATUS_SUCCESS != vld_dec_allocate_colocated_buffer(ctx, obj_surface, size)) {
+            drv_debug_msg(VIDEO_DEBUG_WARNING, "Failed to preallocate colocated buffers (%d of %d)\n",
+                          i, ctx->obj_context->num_render_targets);
+            break;
+        }
+    }
+}
+
 psb_buffer_p vld_dec_lookup_colocated_buffer(context_DEC_p ctx, psb_surface_p surface)
 {
-    int index = GET_SURFACE_INFO_colocated_index(surface);
-    if (!index) {
+    int index = vld_dec_colocated_find(ctx, surface);
+    if ((index < 0) || !ctx->colocated_buffers[index]->valid) {
         return NULL;
     }
-    return &(ctx->colocated_buffers[index-1]); /* 0 means unset, index is offset by 1 */
+    return &(ctx->colocated_buffers[index]->buf);
 }
 
 VAStatus vld_dec_CreateContext(context_DEC_p ctx, object_context_p obj_context)
@@ -396,9 +503,9 @@ VAStatus vld_dec_CreateContext(context_DEC_p ctx, object_context_p obj_context)
         return vaStatus;
     }
 
-    ctx->colocated_buffers_size = obj_context->num_render_targets;
+    ctx->colocated_buffers_size = obj_context->num_render_targets > 0 ? obj_context->num_render_targets : 1;
     ctx->colocated_buffers_idx = 0;
-    ctx->colocated_buffers = (psb_buffer_p) calloc(1, sizeof(struct psb_buffer_s) * ctx->colocated_buffers_size);
+    ctx->colocated_buffers = (vld_dec_colocated_p *) calloc(1, sizeof(vld_dec_colocated_p) * ctx->colocated_buffers_size);
     if (NULL == ctx->colocated_buffers) {
         vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
         DEBUG_FAILURE;
@@ -429,8 +536,11 @@ void vld_dec_DestroyContext(context_DEC_p ctx)
     }
 
     if (ctx->colocated_buffers) {
-        for (i = 0; i < ctx->colocated_buffers_idx; ++i)
-            psb_buffer_destroy(&(ctx->colocated_buffers[i]));
+        for (i = 0; i < ctx->colocated_buffers_idx; ++i) {
+            if (ctx->colocated_buffers[i]->valid)
+                psb_buffer_destroy(&(ctx->colocated_buffers[i]->buf));
+            free(ctx->colocated_buffers[i]);
+        }
 
         free(ctx->colocated_buffers);
         ctx->colocated_buffers = NULL;
@@ -32,6 +32,16 @@
 #include "tng_yuv_processor.h"
 #include "tng_ved_scaling.h"
 
+/* colocated MV buffer and the surface it is currently assigned to */
+struct vld_dec_colocated_s {
+    struct psb_buffer_s buf;
+    int valid;                  /* buf has been created */
+    VASurfaceID surface_id;
+    psb_surface_p surface;
+};
+
+typedef struct vld_dec_colocated_s *vld_dec_colocated_p;
+
 struct context_DEC_s {
     object_context_p obj_context; /* back reference */
 
@@ -63,7 +73,8 @@ struct context_DEC_s {
     void (*end_slice)(struct context_DEC_s *);
     VAStatus (*process_buffer)(struct context_DEC_s *, object_buffer_p);
 
-    struct psb_buffer_s *colocated_buffers;
+    /* colocated MV buffer pool, one entry per surface decoded in this context */
+    vld_dec_colocated_p *colocated_buffers;
     int colocated_buffers_size;
     int colocated_buffers_idx;
     context_yuv_processor_p yuv_ctx;
@@ -84,6 +95,7 @@ void vld_dec_setup_alternative_frame(object_context_p);
 VAStatus vld_dec_process_slice_data(context_DEC_p, object_buffer_p);
 VAStatus vld_dec_add_slice_param(context_DEC_p, object_buffer_p);
 VAStatus vld_dec_allocate_colocated_buffer(context_DEC_p, object_surface_p, uint32_t);
+void vld_dec_preallocate_colocated_buffers(context_DEC_p, uint32_t);
 VAStatus vld_dec_CreateContext(context_DEC_p, object_context_p);
 void vld_dec_DestroyContext(context_DEC_p);
 psb_buffer_p vld_dec_lookup_colocated_buffer(context_DEC_p, psb_surface_p);
@@ -32,6 +32,10 @@
 #include "vsp_cmdbuf.h"
 #include "psb_drv_debug.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define INIT_DRIVER_DATA    psb_driver_data_p driver_data = (psb_driver_data_p) ctx->pDriverData;
 #define INIT_CONTEXT_VPP    context_VPP_p ctx = (context_VPP_p) obj_context->format_data;
 #define CONFIG(id)  ((object_config_p) object_heap_lookup( &driver_data->config_heap, id ))
@@ -207,6 +211,7 @@ struct filter_strength vpp_strength[STRENGTH_NUM] = {
 };
 
 static void vsp_VPP_DestroyContext(object_context_p obj_context);
+static void vsp__VPP_free_scale_surfaces(context_VPP_p ctx);
 static VAStatus vsp_set_pipeline(context_VPP_p ctx);
 static VAStatus vsp_set_filter_param(context_VPP_p ctx);
 static VAStatus vsp__VPP_check_legal_picture(object_context_p obj_context, object_config_p obj_config);
@@ -378,10 +383,327 @@ static void vsp_VPP_DestroyContext(
 		ctx->num_filters = 0;
 	}
 
+	vsp__VPP_free_scale_surfaces(ctx);
+
 	free(obj_context->format_data);
 	obj_context->format_data = NULL;
 }
 
+static void vsp__VPP_free_scale_surfaces(context_VPP_p ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < VSP_SCALE_SURFACE_NUM; ++i) {
+		if (ctx->scale_surface[i]) {
+			psb_surface_destroy(ctx->scale_surface[i]);
+			free(ctx->scale_surface[i]);
+			ctx->scale_surface[i] = NULL;
+		}
+	}
+	ctx->scale_surface_idx = 0;
+}
+
+/*
+ * The staging surfaces rotate so that the surface handed to FW for the
+ * previous pictures is not rewritten while it may still be referenced
+ */
+static psb_surface_p vsp__VPP_get_scale_surface(context_VPP_p ctx, int width, int height)
+{
+	psb_driver_data_p driver_data = ctx->obj_context->driver_data;
+	psb_surface_p surface;
+	unsigned int idx = ctx->scale_surface_idx;
+
+	surface = ctx->scale_surface[idx];
+	if (surface != NULL &&
+	    (surface->stride < width || surface->chroma_offset != surface->stride * height)) {
+		/* output size changed, drop the whole ring */
+		vsp__VPP_free_scale_surfaces(ctx);
+		idx = 0;
+		surface = NULL;
+	}
+
+	if (surface == NULL) {
+		surface = (psb_surface_p) calloc(1, sizeof(struct psb_surface_s));
+		if (surface == NULL)
+			return NULL;
+		if (VA_STATUS_SUCCESS != psb_surface_create(driver_data, width, height, VA_FOURCC_NV12, 0, surface)) {
+			free(surface);
+			return NULL;
+		}
+		ctx->scale_surface[idx] = surface;
+	}
+
+	ctx->scale_surface_idx = (idx + 1) % VSP_SCALE_SURFACE_NUM;
+	return surface;
+}
+
+static int vsp__VPP_check_region(const VARectangle *rect, int width, int height)
+{
+	return rect->x >= 0 && rect->y >= 0 && rect->width > 0 && rect->height > 0 &&
+	       rect->x + rect->width <= width && rect->y + rect->height <= height;
+}
+
+static void vsp__VPP_fill_rect(unsigned char *dst, int stride, int x, int y,
+			       int width, int height, int bpp, const unsigned char *value)
+{
+	int i, j;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	dst += y * stride + x * bpp;
+	for (j = 0; j < height; ++j, dst += stride) {
+		if (bpp == 1) {
+			memset(dst, value[0], width);
+		} else {
+			for (i = 0; i < width; ++i) {
+				dst[2 * i] = value[0];
+				dst[2 * i + 1] = value[1];
+			}
+		}
+	}
+}
+
+/* Horizontal taps of one source row, rounded back to 8 bit */
+static void vsp__VPP_scale_row(const unsigned char *src, unsigned char *dst, int dst_w, int bpp,
+			       const int *x_ofs, const unsigned char *x_wt)
+{
+	int x, c;
+	unsigned int wx;
+
+	for (x = 0; x < dst_w; ++x, dst += bpp) {
+		wx = x_wt[x];
+		for (c = 0; c < bpp; ++c)
+			dst[c] = (src[x_ofs[2 * x] + c] * (256 - wx) + src[x_ofs[2 * x + 1] + c] * wx + 128) >> 8;
+	}
+}
+
+/*
+ * Vertical blend of two horizontally scaled rows. With 8 bit inputs and
+ * weights summing to 256 every term fits 16 bits, so the SSE2 path does 16
+ * pixels per step and gives the same result as the C tail loop.
+ */
+static void vsp__VPP_blend_rows(const unsigned char *r0, const unsigned char *r1,
+				unsigned char *dst, int n, unsigned int wy)
+{
+	int i = 0;
+
+	if (wy == 0) {
+		memcpy(dst, r0, n);
+		return;
+	}
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i w0 = _mm_set1_epi16(256 - wy);
+		const __m128i w1 = _mm_set1_epi16(wy);
+		const __m128i round = _mm_set1_epi16(128);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(r0 + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(r1 + i));
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+						   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+						   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+		}
+	}
+#endif
+	for (; i < n; ++i)
+		dst[i] = (r0[i] * (256 - wy) + r1[i] * wy + 128) >> 8;
+}
+
+/*
+ * Bilinear scale of one plane, bpp 1 for luma and 2 for interleaved NV12
+ * chroma. Positions are 16.16 fixed point with 8 bit weights. Each source
+ * row is scaled horizontally once and kept while the output rows that blend
+ * it are written, the vertical blend is done with SSE2 where available.
+ */
+static int vsp__VPP_scale_plane(const unsigned char *src, int src_stride, int src_w, int src_h,
+				unsigned char *dst, int dst_stride, int dst_w, int dst_h, int bpp)
+{
+	int *x_ofs;
+	unsigned char *x_wt, *row[2], *tmp;
+	int row_y[2] = { -1, -1 };
+	int x, y, step_x, step_y, pos;
+	int row_size = dst_w * bpp;
+
+	x_ofs = (int *) malloc(dst_w * 2 * sizeof(int) + dst_w + 2 * row_size);
+	if (x_ofs == NULL)
+		return -1;
+	x_wt = (unsigned char *)(x_ofs + 2 * dst_w);
+	row[0] = x_wt + dst_w;
+	row[1] = row[0] + row_size;
+
+	step_x = (src_w << 16) / dst_w;
+	step_y = (src_h << 16) / dst_h;
+
+	for (x = 0, pos = step_x / 2 - 0x8000; x < dst_w; ++x, pos += step_x) {
+		int p = pos < 0 ? 0 : pos;
+		int x0 = p >> 16;
+		int x1 = x0 + 1;
+
+		if (x0 >= src_w - 1) {
+			x0 = x1 = src_w - 1;
+			p = 0;
+		}
+		x_ofs[2 * x] = x0 * bpp;
+		x_ofs[2 * x + 1] = x1 * bpp;
+		x_wt[x] = (p >> 8) & 0xff;
+	}
+
+	for (y = 0, pos = step_y / 2 - 0x8000; y < dst_h; ++y, pos += step_y, dst += dst_stride) {
+		int p = pos < 0 ? 0 : pos;
+		int y0 = p >> 16;
+		int y1 = y0 + 1;
+		unsigned int wy;
+
+		if (y0 >= src_h - 1) {
+			y0 = y1 = src_h - 1;
+			p = 0;
+		}
+		wy = (p >> 8) & 0xff;
+
+		/* y0 only moves down, so the last y1 row is usually the next y0 row */
+		if (row_y[0] != y0) {
+			if (row_y[1] == y0) {
+				tmp = row[0];
+				row[0] = row[1];
+				row[1] = tmp;
+				row_y[1] = row_y[0];
+			} else {
+				vsp__VPP_scale_row(src + y0 * src_stride, row[0], dst_w, bpp, x_ofs, x_wt);
+			}
+			row_y[0] = y0;
+		}
+		if (wy != 0 && row_y[1] != y1) {
+			vsp__VPP_scale_row(src + y1 * src_stride, row[1], dst_w, bpp, x_ofs, x_wt);
+			row_y[1] = y1;
+		}
+
+		vsp__VPP_blend_rows(row[0], row[1], dst, row_size, wy);
+	}
+
+	free(x_ofs);
+	return 0;
+}
+
+/*
+ * Crop surface_region out of the input, scale it into output_region of an
+ * output sized staging surface and fill the rest with the background color.
+ * The staging surface then replaces the input surface for the FW pipeline.
+ */
+static VAStatus vsp__VPP_cpu_scale(context_VPP_p ctx, VAProcPipelineParameterBuffer *pipeline_param,
+				   object_surface_p input_surface, object_surface_p output_surface,
+				   psb_surface_p *scaled_surface)
+{
+	VAStatus vaStatus = VA_STATUS_SUCCESS;
+	VARectangle src_rect, dst_rect;
+	psb_surface_p in = input_surface->psb_surface;
+	psb_surface_p out;
+	int out_w = output_surface->width;
+	int out_h = output_surface->height_origin;
+	unsigned char *src_addr = NULL, *dst_addr = NULL;
+	unsigned char bg_y[1], bg_uv[2];
+	unsigned int argb = pipeline_param->output_background_color;
+	int r, g, b;
+
+	*scaled_surface = NULL;
+
+	if (pipeline_param->surface_region) {
+		src_rect = *pipeline_param->surface_region;
+	} else {
+		src_rect.x = src_rect.y = 0;
+		src_rect.width = input_surface->width;
+		src_rect.height = input_surface->height_origin;
+	}
+	if (pipeline_param->output_region) {
+		dst_rect = *pipeline_param->output_region;
+	} else {
+		dst_rect.x = dst_rect.y = 0;
+		dst_rect.width = out_w;
+		dst_rect.height = out_h;
+	}
+
+	/* nothing to crop, scale or letterbox */
+	if (src_rect.x == 0 && src_rect.y == 0 && dst_rect.x == 0 && dst_rect.y == 0 &&
+	    src_rect.width == input_surface->width && src_rect.height == input_surface->height_origin &&
+	    dst_rect.width == out_w && dst_rect.height == out_h &&
+	    out_w == input_surface->width && out_h == input_surface->height_origin)
+		return VA_STATUS_SUCCESS;
+
+	if (!vsp__VPP_check_region(&src_rect, input_surface->width, input_surface->height_origin) ||
+	    !vsp__VPP_check_region(&dst_rect, out_w, out_h)) {
+		drv_debug_msg(VIDEO_DEBUG_ERROR, "invalid surface/output region\n");
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+	}
+
+	/* the CPU can't address tiled surfaces linearly */
+	if (GET_SURFACE_INFO_tiling(in) || ctx->format != VSP_NV12) {
+		drv_debug_msg(VIDEO_DEBUG_ERROR, "Cann't scale tiled or non-NV12 surface\n");
+		return VA_STATUS_ERROR_UNIMPLEMENTED;
+	}
+
+	out = vsp__VPP_get_scale_surface(ctx, out_w, out_h);
+	if (out == NULL) {
+		drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to alloc scale surface\n");
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	}
+
+	/* map waits for the decoder/FW to release both surfaces */
+	if (psb_buffer_map(&in->buf, &src_addr)) {
+		drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to map input surface\n");
+		return VA_STATUS_ERROR_UNKNOWN;
+	}
+	if (psb_buffer_map(&out->buf, &dst_addr)) {
+		drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to map scale surface\n");
+		psb_buffer_unmap(&in->buf);
+		return VA_STATUS_ERROR_UNKNOWN;
+	}
+
+	/* background color is ARGB, convert to limited range BT.601 */
+	r = (argb >> 16) & 0xff;
+	g = (argb >> 8) & 0xff;
+	b = argb & 0xff;
+	bg_y[0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	bg_uv[0] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+	bg_uv[1] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+
+	/* letterbox/pillarbox bands */
+	vsp__VPP_fill_rect(dst_addr, out->stride, 0, 0, out_w, dst_rect.y, 1, bg_y);
+	vsp__VPP_fill_rect(dst_addr, out->stride, 0, dst_rect.y + dst_rect.height,
+			   out_w, out_h - dst_rect.y - dst_rect.height, 1, bg_y);
+	vsp__VPP_fill_rect(dst_addr, out->stride, 0, dst_rect.y, dst_rect.x, dst_rect.height, 1, bg_y);
+	vsp__VPP_fill_rect(dst_addr, out->stride, dst_rect.x + dst_rect.width, dst_rect.y,
+			   out_w - dst_rect.x - dst_rect.width, dst_rect.height, 1, bg_y);
+	vsp__VPP_fill_rect(dst_addr + out->chroma_offset, out->stride, 0, 0, out_w / 2, out_h / 2, 2, bg_uv);
+
+	if (vsp__VPP_scale_plane(src_addr + src_rect.y * in->stride + src_rect.x, in->stride,
+				 src_rect.width, src_rect.height,
+				 dst_addr + dst_rect.y * out->stride + dst_rect.x, out->stride,
+				 dst_rect.width, dst_rect.height, 1) ||
+	    vsp__VPP_scale_plane(src_addr + in->chroma_offset + (src_rect.y / 2) * in->stride + (src_rect.x & ~1), in->stride,
+				 (src_rect.width + 1) / 2, (src_rect.height + 1) / 2,
+				 dst_addr + out->chroma_offset + (dst_rect.y / 2) * out->stride + (dst_rect.x & ~1), out->stride,
+				 (dst_rect.width + 1) / 2, (dst_rect.height + 1) / 2, 2)) {
+		drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to scale surface\n");
+		vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+	}
+
+	psb_buffer_unmap(&out->buf);
+	psb_buffer_unmap(&in->buf);
+
+	if (vaStatus == VA_STATUS_SUCCESS)
+		*scaled_surface = out;
+
+	return vaStatus;
+}
+
 static VAStatus vsp__VPP_process_pipeline_param(context_VPP_p ctx, object_context_p obj_context, object_buffer_p obj_buffer)
 {
 	VAStatus vaStatus = VA_STATUS_SUCCESS;
@@ -397,26 +719,11 @@ static VAStatus vsp__VPP_process_pipeline_param(context_VPP_p ctx, object_contex
 	int tiled = 0, width = 0, height = 0, stride = 0;
 	unsigned char *src_addr, *dest_addr;
 	struct psb_surface_s *output_surface;
+	struct psb_surface_s *input_psb_surface, *scaled_surface = NULL;
+	int input_width, input_height;
+	const VARectangle *output_region;
 	psb_driver_data_p driver_data = obj_context->driver_data;
 
-	if (pipeline_param->surface_region != NULL) {
-		drv_debug_msg(VIDEO_DEBUG_ERROR, "Cann't scale\n");
-		vaStatus = VA_STATUS_ERROR_UNKNOWN;
-		goto out;
-	}
-		
-	if (pipeline_param->output_region != NULL) {
-		drv_debug_msg(VIDEO_DEBUG_ERROR, "Cann't scale\n");
-		vaStatus = VA_STATUS_ERROR_UNKNOWN;
-		goto out;
-	}
-	
-	if (pipeline_param->output_background_color != 0) {
-		drv_debug_msg(VIDEO_DEBUG_ERROR, "Cann't support background color here\n");
-		vaStatus = VA_STATUS_ERROR_INVALID_PARAMETER;
-		goto out;
-	}
-
 	if (pipeline_param->filters == NULL) {
 		drv_debug_msg(VIDEO_DEBUG_ERROR, "invalid filter setting filters = %p\n", pipeline_param->filters);
 		vaStatus = VA_STATUS_ERROR_UNKNOWN;
@@ -523,24 +830,57 @@ static VAStatus vsp__VPP_process_pipeline_param(context_VPP_p ctx, object_contex
 		goto out;
 	}
 
+	/*
+	 * crop, scale and letterbox on the CPU, FW then processes the staging
+	 * surface. A plain size change stays with the FW scaler, the background
+	 * color only shows around an output_region.
+	 */
+	output_region = pipeline_param->output_region;
+	if (pipeline_param->output_background_color != 0 &&
+	    (output_region == NULL ||
+	     (output_region->x == 0 && output_region->y == 0 &&
+	      output_region->width == ctx->obj_context->current_render_target->width &&
+	      output_region->height == ctx->obj_context->current_render_target->height_origin)))
+		drv_debug_msg(VIDEO_DEBUG_WARNING, "output covers the whole surface, background color 0x%08x has no band to fill\n",
+			      pipeline_param->output_background_color);
+
+	if (pipeline_param->surface_region || pipeline_param->output_region) {
+		vaStatus = vsp__VPP_cpu_scale(ctx, pipeline_param, input_surface,
+					      ctx->obj_context->current_render_target, &scaled_surface);
+		if (vaStatus) {
+			drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to crop/scale input surface\n");
+			goto out;
+		}
+	}
+
+	if (scaled_surface != NULL) {
+		input_psb_surface = scaled_surface;
+		input_width = ctx->obj_context->current_render_target->width;
+		input_height = ctx->obj_context->current_render_target->height_origin;
+	} else {
+		input_psb_surface = input_surface->psb_surface;
+		input_width = input_surface->width;
+		input_height = input_surface->height_origin;
+	}
+
 #ifdef PSBVIDEO_VPP_TILING
 	/* get the tiling flag*/
-	tiled = GET_SURFACE_INFO_tiling(input_surface->psb_surface);
+	tiled = GET_SURFACE_INFO_tiling(input_psb_surface);
 #endif
 	/*  According to VIED's design, the width must be multiple of 16 */
-	width = ALIGN_TO_16(input_surface->width);
-	if (width > input_surface->psb_surface->stride)
-		width = input_surface->psb_surface->stride;
+	width = ALIGN_TO_16(input_width);
+	if (width > input_psb_surface->stride)
+		width = input_psb_surface->stride;
 
 	/* Setup input surface */
 	cell_proc_picture_param->num_input_pictures  = 1;
 	cell_proc_picture_param->input_picture[0].surface_id = pipeline_param->surface;
-	vsp_cmdbuf_reloc_pic_param(&(cell_proc_picture_param->input_picture[0].base), ctx->pic_param_offset, &(input_surface->psb_surface->buf),
+	vsp_cmdbuf_reloc_pic_param(&(cell_proc_picture_param->input_picture[0].base), ctx->pic_param_offset, &(input_psb_surface->buf),
 				   cmdbuf->param_mem_loc, cell_proc_picture_param);
-	cell_proc_picture_param->input_picture[0].height = input_surface->height_origin;
+	cell_proc_picture_param->input_picture[0].height = input_height;
 	cell_proc_picture_param->input_picture[0].width = width;
 	cell_proc_picture_param->input_picture[0].irq = 0;
-	cell_proc_picture_param->input_picture[0].stride = input_surface->psb_surface->stride;
+	cell_proc_picture_param->input_picture[0].stride = input_psb_surface->stride;
 	cell_proc_picture_param->input_picture[0].format = ctx->format;
 	cell_proc_picture_param->input_picture[0].tiled = tiled;
 	cell_proc_picture_param->input_picture[0].rot_angle = 0;
@@ -35,6 +35,9 @@
 #define CONTEXT_VPP_ID 0
 #define CONTEXT_VP8_ID 1
 
+/* staging surfaces used for CPU crop/scale, one more than the FW reference window */
+#define VSP_SCALE_SURFACE_NUM 4
+
 struct context_VPP_s {
 	object_context_p obj_context; /* back reference */
 
@@ -74,12 +77,17 @@ struct context_VPP_s {
 	struct VssProcDenoiseParameterBuffer denoise_deblock_param;
 	struct VssProcColorEnhancementParameterBuffer enhancer_param;
 	struct VssProcSharpenParameterBuffer sharpen_param;
+
+	/* cropped/scaled/letterboxed input, fed to FW instead of the input surface */
+	struct psb_surface_s *scale_surface[VSP_SCALE_SURFACE_NUM];
+	unsigned int scale_surface_idx;
 	//used for vp8 only
        unsigned int max_frame_size;
        unsigned int vp8_seq_cmd_send;
        unsigned int re_send_seq_params;
        unsigned int temporal_layer_number;
        unsigned int frame_rate[3];
+       unsigned int layer_bitrate[3]; /* kbps per temporal layer, 0 = default split */
         struct VssVp8encSequenceParameterBuffer vp8_seq_param;
 };
 
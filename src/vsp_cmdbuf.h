@@ -54,6 +54,7 @@ struct vsp_cmdbuf_s {
 	psb_buffer_p *buffer_refs;
 	int buffer_refs_count;
 	int buffer_refs_allocated;
+	psb_buffer_ref_set_t buffer_ref_set;
 
 	struct psb_buffer_s param_mem;
 	unsigned char *param_mem_p;
@@ -285,6 +285,64 @@ static void vsp_VP8_DestroyContext(
     obj_context->format_data = NULL;
 }
 
+/*
+ * Derive the firmware temporal layer settings from the per-layer bitrate and
+ * framerate the application supplied, falling back to the fixed split for
+ * layers it left alone. Bitrates are cumulative (a layer includes all layers
+ * below it) and the top layer drives rc_target_bitrate and frame_rate.
+ */
+static void vsp_vp8_update_layer_rate_control(context_VPP_p ctx)
+{
+    struct VssVp8encSequenceParameterBuffer *seq = &ctx->vp8_seq_param;
+    unsigned int layers = ctx->temporal_layer_number;
+    unsigned int top = layers - 1;
+    unsigned int i, bitrate, decimator;
+    static const unsigned int default_bitrate_pct[2][3] = {
+        {60, 100},
+        {40, 60, 100}
+    };
+
+    if (layers < 2 || layers > 3)
+        return;
+
+    if (ctx->frame_rate[top])
+        seq->frame_rate = ctx->frame_rate[top];
+    if (ctx->layer_bitrate[top])
+        seq->rc_target_bitrate = ctx->layer_bitrate[top];
+
+    for (i = 0; i < layers; i++) {
+        if (i == top)
+            decimator = 1;
+        else if (ctx->frame_rate[i])
+            decimator = (seq->frame_rate + ctx->frame_rate[i] / 2) / ctx->frame_rate[i];
+        else
+            decimator = 1 << (top - i);
+        if (decimator < 1)
+            decimator = 1;
+
+        if (i == top)
+            bitrate = seq->rc_target_bitrate;
+        else if (ctx->layer_bitrate[i])
+            bitrate = ctx->layer_bitrate[i];
+        else
+            bitrate = seq->rc_target_bitrate * default_bitrate_pct[layers - 2][i] / 100;
+
+        /* a layer can not run at a lower rate than the layers it contains */
+        if (i > 0 && decimator > seq->ts_rate_decimator[i - 1]) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "layer %d framerate below layer %d, clamped\n", i, i - 1);
+            decimator = seq->ts_rate_decimator[i - 1];
+        }
+        if (i > 0 && bitrate < seq->ts_target_bitrate[i - 1]) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "layer %d bitrate %dkbps below layer %d (%dkbps), clamped\n",
+                          i, bitrate, i - 1, seq->ts_target_bitrate[i - 1]);
+            bitrate = seq->ts_target_bitrate[i - 1];
+        }
+
+        seq->ts_rate_decimator[i] = decimator;
+        seq->ts_target_bitrate[i] = bitrate;
+    }
+}
+
 static VAStatus vsp_vp8_process_seqence_param(
     psb_driver_data_p driver_data,
     context_VPP_p ctx,
@@ -317,6 +375,8 @@ static VAStatus vsp_vp8_process_seqence_param(
     seq->error_resilient   = va_seq->error_resilient;
     if( ctx->temporal_layer_number == 1) //work around
         seq->ts_target_bitrate[0] = seq->rc_target_bitrate;
+    else
+        vsp_vp8_update_layer_rate_control(ctx);
 
     ref_frame_width = (seq->frame_width + 2 * 32 + 63) & (~63);
     ref_frame_height = (seq->frame_height + 2 * 32 + 63) & (~63);
@@ -509,7 +569,7 @@ static VAStatus vsp_vp8_process_misc_param(context_VPP_p ctx, object_buffer_p ob
     case VAEncMiscParameterTypeTemporalLayerStructure:
         tslayer_param = (VAEncMiscParameterTemporalLayerStructure *)pBuffer->data;
         //verify parameter
-        if (tslayer_param->number_of_layers < 2 && tslayer_param->number_of_layers > 3) {
+        if (tslayer_param->number_of_layers < 2 || tslayer_param->number_of_layers > 3) {
             drv_debug_msg(VIDEO_DEBUG_ERROR, "Temporal Layer Number should be 2 or 3\n");
             vaStatus = VA_STATUS_ERROR_INVALID_PARAMETER;
             break;
@@ -534,6 +594,12 @@ static VAStatus vsp_vp8_process_misc_param(context_VPP_p ctx, object_buffer_p ob
         if (vaStatus == VA_STATUS_ERROR_INVALID_PARAMETER)
             break;
 
+        /* per-layer settings of a different layout no longer apply */
+        if (ctx->temporal_layer_number != tslayer_param->number_of_layers) {
+            memset(ctx->frame_rate, 0, sizeof(ctx->frame_rate));
+            memset(ctx->layer_bitrate, 0, sizeof(ctx->layer_bitrate));
+        }
+
         seq->ts_number_layers = tslayer_param->number_of_layers;
         ctx->temporal_layer_number = tslayer_param->number_of_layers;
         seq->ts_periodicity = tslayer_param->periodicity;
@@ -541,22 +607,7 @@ static VAStatus vsp_vp8_process_misc_param(context_VPP_p ctx, object_buffer_p ob
         for (i = 0; i < seq->ts_periodicity; i++)
             seq->ts_layer_id[i] = tslayer_param->layer_id[i];
 
-        //set default bitrate and framerate
-        if (seq->ts_number_layers == 2) {
-            seq->ts_target_bitrate[0] = seq->rc_target_bitrate * 6 / 10;
-            seq->ts_target_bitrate[1] = seq->rc_target_bitrate ;
-            seq->ts_rate_decimator[0] = 2;
-            seq->ts_rate_decimator[1] = 1;
-        }
-        if (seq->ts_number_layers == 3) {
-            seq->ts_target_bitrate[0] = seq->rc_target_bitrate * 4 / 10;
-            seq->ts_target_bitrate[1] = seq->rc_target_bitrate * 6 / 10;
-            seq->ts_target_bitrate[2] = seq->rc_target_bitrate ;
-            seq->ts_rate_decimator[0] = 4;
-            seq->ts_rate_decimator[1] = 2;
-            seq->ts_rate_decimator[2] = 1;
-        }
-
+        vsp_vp8_update_layer_rate_control(ctx);
         ctx->re_send_seq_params = 1;
         break;
     case VAEncMiscParameterTypeFrameRate:
@@ -575,14 +626,18 @@ static VAStatus vsp_vp8_process_misc_param(context_VPP_p ctx, object_buffer_p ob
                 ctx->re_send_seq_params = 1;
             }
         } else {
-            layer_id = frame_rate_param->framerate_flags.bits.temporal_id % 3;
+            layer_id = frame_rate_param->framerate_flags.bits.temporal_id;
+            if (layer_id >= ctx->temporal_layer_number) {
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "temporal_id %d of frame rate should be 0 - %d\n",
+                              layer_id, ctx->temporal_layer_number - 1);
+                vaStatus = VA_STATUS_ERROR_INVALID_PARAMETER;
+                break;
+            }
             if (ctx->frame_rate[layer_id] != frame_rate_param->framerate) {
                 drv_debug_msg(VIDEO_DEBUG_GENERAL, "frame rate of layer %d will be changed from %d to %d\n",
                               layer_id, ctx->frame_rate[layer_id], frame_rate_param->framerate);
                 ctx->frame_rate[layer_id] = frame_rate_param->framerate;
-                if (layer_id == ctx->temporal_layer_number - 1) { //top layer
-                    seq->frame_rate = ctx->frame_rate[layer_id];
-                }
+                vsp_vp8_update_layer_rate_control(ctx);
                 ctx->re_send_seq_params = 1 ;
             }
         }
@@ -627,12 +682,19 @@ static VAStatus vsp_vp8_process_misc_param(context_VPP_p ctx, object_buffer_p ob
 
             }
         } else {
-            layer_id = rate_control_param->rc_flags.bits.temporal_id % 3;
-            if (rate_control_param->bits_per_second / 1000 != seq->ts_target_bitrate[layer_id]) {
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "bitrate was changed from %dkbps to %dkbps\n",
-                              seq->ts_target_bitrate[layer_id], rate_control_param->bits_per_second / 1000);
-                seq->ts_target_bitrate[layer_id] = rate_control_param->bits_per_second / 1000;
+            layer_id = rate_control_param->rc_flags.bits.temporal_id;
+            if (layer_id >= ctx->temporal_layer_number) {
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "temporal_id %d of rate control should be 0 - %d\n",
+                              layer_id, ctx->temporal_layer_number - 1);
+                vaStatus = VA_STATUS_ERROR_INVALID_PARAMETER;
+                break;
+            }
+            if (rate_control_param->bits_per_second / 1000 != ctx->layer_bitrate[layer_id]) {
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "bitrate of layer %d was changed from %dkbps to %dkbps\n",
+                              layer_id, seq->ts_target_bitrate[layer_id], rate_control_param->bits_per_second / 1000);
+                ctx->layer_bitrate[layer_id] = rate_control_param->bits_per_second / 1000;
             }
+            vsp_vp8_update_layer_rate_control(ctx);
         }
 
         ctx->re_send_seq_params = 1;
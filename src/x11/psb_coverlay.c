@@ -121,133 +121,193 @@ psb_x11_freeWindowClipBoxList(psb_x11_clip_list_t * pHead)
     }
 }
 
-#define IS_BETWEEN_RANGE(a,b,c) ((a<=b)&&(b<=c))
+/*
+ * The visible part of the window is built as y-bands of sorted x-intervals,
+ * the way X regions store it. The band edges are the top and bottom edges
+ * of the occluders and each band only walks the occluders spanning it, so
+ * the work follows the number of bands instead of re-splitting every piece
+ * of the window against every occluder. Identical neighbouring bands are
+ * merged, the boxes come out top to bottom and left to right.
+ */
+static int
+psb_x11_compareTop(const void * a, const void * b)
+{
+    return ((const psb_x11_win_t *)a)->i32Top - ((const psb_x11_win_t *)b)->i32Top;
+}
+
+static int
+psb_x11_compareEdge(const void * a, const void * b)
+{
+    return *(const int *)a - *(const int *)b;
+}
 
 static psb_x11_clip_list_t *
 psb_x11_substractRects(Display *             display,
                        psb_x11_clip_list_t * psRegion,
                        psb_x11_win_t *       psRect)
 {
-    psb_x11_clip_list_t * psCur, * psPrev, * psFirst, * psNext;
-    psb_x11_win_t sCreateRect;
+    psb_x11_clip_list_t * psFirst = NULL, ** ppsLast = &psFirst, * psNode;
+    psb_x11_clip_list_t ** ppsBand = NULL;   /* boxes of the band above */
+    psb_x11_win_t sWindow = *psRect, * psOcc = NULL, ** ppsActive = NULL;
+    int * pi32Edges = NULL, * pi32Spans = NULL;
+    unsigned int ui32NumOcc = 0, ui32NumEdges = 0, ui32NumActive = 0;
+    unsigned int ui32NumBand = 0, ui32NumSpans, i, j, k, e;
+    int x, x1, y0, y1;
     int display_width  = (int)(DisplayWidth(display, DefaultScreen(display))) - 1;
     int display_height = (int)(DisplayHeight(display, DefaultScreen(display))) - 1;
 
-    psFirst = psb_x11_createClipBoxNode(psRect, NULL);
-
-    if (psFirst->rect.i32Left < 0)
-        psFirst->rect.i32Left = 0;
-    else if (psFirst->rect.i32Left > display_width)
-        psFirst->rect.i32Left = display_width;
-
-    if (psFirst->rect.i32Right < 0)
-        psFirst->rect.i32Right = 0;
-    else if (psFirst->rect.i32Right > display_width)
-        psFirst->rect.i32Right = display_width;
-
-    if (psFirst->rect.i32Top < 0)
-        psFirst->rect.i32Top = 0;
-    else if (psFirst->rect.i32Top > display_height)
-        psFirst->rect.i32Top = display_height;
-
-    if (psFirst->rect.i32Bottom < 0)
-        psFirst->rect.i32Bottom = 0;
-    else if (psFirst->rect.i32Bottom > display_height)
-        psFirst->rect.i32Bottom = display_height;
-
-    while (psRegion) {
-        psCur  = psFirst;
-        psPrev = NULL;
-
-        while (psCur) {
-            psNext = psCur->next;
-
-            if ((psRegion->rect.i32Left > psCur->rect.i32Left) &&
-                (psRegion->rect.i32Left <= psCur->rect.i32Right)) {
-                sCreateRect.i32Right = psRegion->rect.i32Left - 1;
-
-                sCreateRect.i32Left = psCur->rect.i32Left;
-                sCreateRect.i32Top = psCur->rect.i32Top;
-                sCreateRect.i32Bottom = psCur->rect.i32Bottom;
-
-                psFirst = psb_x11_createClipBoxNode(&sCreateRect, psFirst);
+    if (sWindow.i32Left < 0)
+        sWindow.i32Left = 0;
+    else if (sWindow.i32Left > display_width)
+        sWindow.i32Left = display_width;
+
+    if (sWindow.i32Right < 0)
+        sWindow.i32Right = 0;
+    else if (sWindow.i32Right > display_width)
+        sWindow.i32Right = display_width;
+
+    if (sWindow.i32Top < 0)
+        sWindow.i32Top = 0;
+    else if (sWindow.i32Top > display_height)
+        sWindow.i32Top = display_height;
+
+    if (sWindow.i32Bottom < 0)
+        sWindow.i32Bottom = 0;
+    else if (sWindow.i32Bottom > display_height)
+        sWindow.i32Bottom = display_height;
+
+    for (psNode = psRegion; psNode; psNode = psNode->next)
+        ui32NumOcc++;
+
+    psOcc     = (psb_x11_win_t *)calloc(ui32NumOcc + 1, sizeof(psb_x11_win_t));
+    ppsActive = (psb_x11_win_t **)calloc(ui32NumOcc + 1, sizeof(psb_x11_win_t *));
+    ppsBand   = (psb_x11_clip_list_t **)calloc(ui32NumOcc + 1, sizeof(psb_x11_clip_list_t *));
+    pi32Edges = (int *)calloc(2 * ui32NumOcc + 2, sizeof(int));
+    pi32Spans = (int *)calloc(2 * ui32NumOcc + 2, sizeof(int));
+    if (!psOcc || !ppsActive || !ppsBand || !pi32Edges || !pi32Spans) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: out of memory\n", __func__);
+        goto out;
+    }
 
-                if (!psPrev)
-                    psPrev = psFirst;
+    /* occluders clipped to the window, right and bottom exclusive from here on */
+    ui32NumOcc = 0;
+    pi32Edges[ui32NumEdges++] = sWindow.i32Top;
+    pi32Edges[ui32NumEdges++] = sWindow.i32Bottom + 1;
+    for (psNode = psRegion; psNode; psNode = psNode->next) {
+        psb_x11_win_t * psClip = &psOcc[ui32NumOcc];
+
+        *psClip = psNode->rect;
+        if (psClip->i32Left < sWindow.i32Left)
+            psClip->i32Left = sWindow.i32Left;
+        if (psClip->i32Right > sWindow.i32Right)
+            psClip->i32Right = sWindow.i32Right;
+        if (psClip->i32Top < sWindow.i32Top)
+            psClip->i32Top = sWindow.i32Top;
+        if (psClip->i32Bottom > sWindow.i32Bottom)
+            psClip->i32Bottom = sWindow.i32Bottom;
+        psClip->i32Right++;
+        psClip->i32Bottom++;
+        if (psClip->i32Left >= psClip->i32Right || psClip->i32Top >= psClip->i32Bottom)
+            continue;
+
+        pi32Edges[ui32NumEdges++] = psClip->i32Top;
+        pi32Edges[ui32NumEdges++] = psClip->i32Bottom;
+        ui32NumOcc++;
+    }
+    qsort(psOcc, ui32NumOcc, sizeof(psb_x11_win_t), psb_x11_compareTop);
+    qsort(pi32Edges, ui32NumEdges, sizeof(int), psb_x11_compareEdge);
+
+    for (e = 0, k = 0; e + 1 < ui32NumEdges; e++) {
+        y0 = pi32Edges[e];
+        y1 = pi32Edges[e + 1];
+        if (y0 == y1)
+            continue;
+
+        /* every occluder either spans the band or misses it, keep the
+         * spanning ones sorted by their left edge */
+        for (i = 0, j = 0; i < ui32NumActive; i++)
+            if (ppsActive[i]->i32Bottom > y0)
+                ppsActive[j++] = ppsActive[i];
+        ui32NumActive = j;
+        for (; k < ui32NumOcc && psOcc[k].i32Top <= y0; k++) {
+            for (j = ui32NumActive; j > 0 && ppsActive[j - 1]->i32Left > psOcc[k].i32Left; j--)
+                ppsActive[j] = ppsActive[j - 1];
+            ppsActive[j] = &psOcc[k];
+            ui32NumActive++;
+        }
 
-                psCur->rect.i32Left = psRegion->rect.i32Left;
+        /* the gaps between them are visible */
+        ui32NumSpans = 0;
+        x = sWindow.i32Left;
+        for (i = 0; i <= ui32NumActive; i++) {
+            x1 = (i < ui32NumActive) ? ppsActive[i]->i32Left : sWindow.i32Right + 1;
+            if (x1 > x) {
+                pi32Spans[2 * ui32NumSpans] = x;
+                pi32Spans[2 * ui32NumSpans + 1] = x1;
+                ui32NumSpans++;
             }
+            if (i < ui32NumActive && ppsActive[i]->i32Right > x)
+                x = ppsActive[i]->i32Right;
+        }
 
-            if ((psRegion->rect.i32Right >= psCur->rect.i32Left) &&
-                (psRegion->rect.i32Right < psCur->rect.i32Right))
-
-            {
-                sCreateRect.i32Left = psRegion->rect.i32Right + 1;
-
-                sCreateRect.i32Right = psCur->rect.i32Right;
-                sCreateRect.i32Top = psCur->rect.i32Top;
-                sCreateRect.i32Bottom = psCur->rect.i32Bottom;
-
-                psFirst = psb_x11_createClipBoxNode(&sCreateRect, psFirst);
-
-                if (!psPrev)
-                    psPrev = psFirst;
-
-                psCur->rect.i32Right = psRegion->rect.i32Right;
+        /* same spans as the band above, grow its boxes */
+        if (ui32NumSpans && ui32NumSpans == ui32NumBand) {
+            for (i = 0; i < ui32NumSpans; i++)
+                if (ppsBand[i]->rect.i32Left != pi32Spans[2 * i] ||
+                    ppsBand[i]->rect.i32Right != pi32Spans[2 * i + 1] - 1)
+                    break;
+            if (i == ui32NumSpans) {
+                for (i = 0; i < ui32NumSpans; i++) {
+                    ppsBand[i]->rect.i32Bottom = y1 - 1;
+                    ppsBand[i]->rect.ui32Height = y1 - ppsBand[i]->rect.i32Top;
+                }
+                continue;
             }
+        }
 
-            if ((psRegion->rect.i32Top > psCur->rect.i32Top) &&
-                (psRegion->rect.i32Top <= psCur->rect.i32Bottom)) {
-                sCreateRect.i32Bottom = psRegion->rect.i32Top - 1;
-
-                sCreateRect.i32Left   = psCur->rect.i32Left;
-                sCreateRect.i32Right  = psCur->rect.i32Right;
-                sCreateRect.i32Top    = psCur->rect.i32Top;
-
-                psFirst = psb_x11_createClipBoxNode(&sCreateRect, psFirst);
-
-                if (!psPrev)
-                    psPrev = psFirst;
-
-                psCur->rect.i32Top = psRegion->rect.i32Top;
+        for (i = 0; i < ui32NumSpans; i++) {
+            psNode = (psb_x11_clip_list_t *)calloc(1, sizeof(psb_x11_clip_list_t));
+            if (!psNode) {
+                drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: out of memory\n", __func__);
+                psb_x11_freeWindowClipBoxList(psFirst);
+                psFirst = NULL;
+                goto out;
             }
+            psNode->rect.i32Left    = pi32Spans[2 * i];
+            psNode->rect.i32Right   = pi32Spans[2 * i + 1] - 1;
+            psNode->rect.i32Top     = y0;
+            psNode->rect.i32Bottom  = y1 - 1;
+            psNode->rect.ui32Width  = pi32Spans[2 * i + 1] - pi32Spans[2 * i];
+            psNode->rect.ui32Height = y1 - y0;
+            *ppsLast = psNode;
+            ppsLast = &psNode->next;
+            ppsBand[i] = psNode;
+        }
+        ui32NumBand = ui32NumSpans;
+    }
 
-            if ((psRegion->rect.i32Bottom >= psCur->rect.i32Top) &&
-                (psRegion->rect.i32Bottom <  psCur->rect.i32Bottom)) {
-                sCreateRect.i32Top    = psRegion->rect.i32Bottom + 1;
-                sCreateRect.i32Left   = psCur->rect.i32Left;
-                sCreateRect.i32Right  = psCur->rect.i32Right;
-                sCreateRect.i32Bottom = psCur->rect.i32Bottom;
-
-                psFirst = psb_x11_createClipBoxNode(&sCreateRect, psFirst);
+out:
+    free(psOcc);
+    free(ppsActive);
+    free(ppsBand);
+    free(pi32Edges);
+    free(pi32Spans);
 
-                if (!psPrev)
-                    psPrev = psFirst;
+    return psFirst;
+}
 
-                psCur->rect.i32Bottom = psRegion->rect.i32Bottom;
-            }
+static psb_x11_clip_list_t *
+psb_x11_addOccluder(Display * display, Window window,
+                    psb_x11_clip_list_t * psRegions, unsigned int * pui32NumRects)
+{
+    psb_x11_win_t sRect;
+    int bIsVisible = 0;
 
-            if ((IS_BETWEEN_RANGE(psRegion->rect.i32Left, psCur->rect.i32Left,   psRegion->rect.i32Right)) &&
-                (IS_BETWEEN_RANGE(psRegion->rect.i32Left, psCur->rect.i32Right,  psRegion->rect.i32Right)) &&
-                (IS_BETWEEN_RANGE(psRegion->rect.i32Top,  psCur->rect.i32Top,    psRegion->rect.i32Bottom)) &&
-                (IS_BETWEEN_RANGE(psRegion->rect.i32Top,  psCur->rect.i32Bottom, psRegion->rect.i32Bottom))) {
-                if (psPrev) {
-                    psPrev->next = psCur->next;
-                    free(psCur);
-                    psCur = psPrev;
-                } else {
-                    free(psCur);
-                    psCur = NULL;
-                    psFirst = psNext;
-                }
-            }
-            psPrev = psCur;
-            psCur  = psNext;
-        }//while(psCur)
-        psRegion = psRegion->next;
-    }//while(psRegion)
+    if (psb_x11_getWindowCoordinate(display, window, &sRect, &bIsVisible) != 0 || !bIsVisible)
+        return psRegions;
 
-    return psFirst;
+    (*pui32NumRects)++;
+    return psb_x11_createClipBoxNode(&sRect, psRegions);
 }
 
 static int
@@ -278,19 +338,13 @@ psb_x11_createWindowClipBoxList(Display *              display,
     if (XResult == 0)
         return -2;
 
-    if (i32NumChildren) {
-        for (i = 0; i < i32NumChildren; i++) {
-
-            psb_x11_getWindowCoordinate(display, x11_window_id, &sRect, &bIsVisible);
-            if (bIsVisible) {
-                psRegions = psb_x11_createClipBoxNode(&sRect, psRegions);
-                ui32NumRects++;
-            }
-        }
+    /* children of the drawable are drawn on top of it */
+    for (i = 0; i < i32NumChildren; i++)
+        psRegions = psb_x11_addOccluder(display, pChildWindow[i], psRegions, &ui32NumRects);
+    if (i32NumChildren)
         XFree(pChildWindow);
-        i32NumChildren = 0;
-    }
 
+    /* so are the siblings stacked above each ancestor */
     while (CurrentWindow != RootWindow) {
         ChildWindow   = CurrentWindow;
         CurrentWindow = ParentWindow;
@@ -302,9 +356,6 @@ psb_x11_createWindowClipBoxList(Display *              display,
                              &pChildWindow,
                              &i32NumChildren);
         if (XResult == 0) {
-            if (i32NumChildren)
-                XFree(pChildWindow);
-
             psb_x11_freeWindowClipBoxList(psRegions);
             return -3;
         }
@@ -325,39 +376,123 @@ psb_x11_createWindowClipBoxList(Display *              display,
                 return -4;
             }
 
-            for (i = iStartWindow + 1; i < i32NumChildren; i++) {
-                psb_x11_getWindowCoordinate(display, pChildWindow[i], &sRect, &bIsVisible);
-                if (bIsVisible) {
-                    psRegions = psb_x11_createClipBoxNode(&sRect, psRegions);
-                    ui32NumRects++;
-                }
-            }
+            for (i = iStartWindow + 1; i < i32NumChildren; i++)
+                psRegions = psb_x11_addOccluder(display, pChildWindow[i], psRegions, &ui32NumRects);
 
             XFree(pChildWindow);
         }
     }
 
+    /* window clipped to the screen, minus everything above it */
+    memset(&sRect, 0, sizeof(sRect));
+    psb_x11_getWindowCoordinate(display, x11_window_id, &sRect, &bIsVisible);
+    *ppWindowClipBoxList = psb_x11_substractRects(display, psRegions, &sRect);
+    psb_x11_freeWindowClipBoxList(psRegions);
+
     ui32NumRects = 0;
+    for (psRegions = *ppWindowClipBoxList; psRegions; psRegions = psRegions->next)
+        ui32NumRects++;
+
+    *pui32NumClipBoxList = ui32NumRects;
+
+    return 0;
+}
 
-    if (psRegions) {
-        psb_x11_getWindowCoordinate(display, x11_window_id, &sRect, &bIsVisible);
-        *ppWindowClipBoxList = psb_x11_substractRects(display, psRegions, &sRect);
-        psb_x11_freeWindowClipBoxList(psRegions);
+/*
+ * Window tree changes are watched on a private connection so the cached
+ * clip list and window coordinates are only rebuilt after a configure,
+ * map/unmap, restack or expose, without events leaking into the
+ * application's queue. Without that connection fall back to refreshing
+ * every 500 frames.
+ */
+static void
+psb_x11_watchWindowTree(VADriverContextP ctx, Drawable draw)
+{
+    INIT_OUTPUT_PRIV;
+    Window CurrentWindow = draw;
+    Window RootWindow, ParentWindow;
+    Window * pChildWindow;
+    unsigned int i32NumChildren;
+
+    if (output->clip_drawable == draw)
+        return;
 
-        psRegions = *ppWindowClipBoxList;
+    output->clip_drawable = draw;
+    output->clip_dirty = 1;
 
-        while (psRegions) {
-            ui32NumRects++;
-            psRegions = psRegions->next;
+    if (!output->clip_dpy) {
+        output->clip_dpy = XOpenDisplay(DisplayString((Display *)ctx->native_dpy));
+        if (!output->clip_dpy) {
+            drv_debug_msg(VIDEO_DEBUG_WARNING, "%s: no private X connection, poll window clip boxes\n", __func__);
+            return;
         }
-    } else {
-        *ppWindowClipBoxList = psb_x11_substractRects(display, NULL, &sRect);
-        ui32NumRects = 1;
     }
 
-    *pui32NumClipBoxList = ui32NumRects;
+    XSelectInput(output->clip_dpy, draw, ExposureMask | StructureNotifyMask | SubstructureNotifyMask);
+    while (XQueryTree(output->clip_dpy, CurrentWindow, &RootWindow, &ParentWindow,
+                      &pChildWindow, &i32NumChildren)) {
+        if (i32NumChildren)
+            XFree(pChildWindow);
+        if (CurrentWindow == RootWindow)
+            break;
+        /* siblings of each ancestor can cover the drawable */
+        XSelectInput(output->clip_dpy, ParentWindow, SubstructureNotifyMask);
+        CurrentWindow = ParentWindow;
+    }
+    XFlush(output->clip_dpy);
+}
 
-    return 0;
+static int
+psb_x11_windowTreeChanged(VADriverContextP ctx, Drawable draw)
+{
+    INIT_OUTPUT_PRIV;
+    XEvent event;
+
+    psb_x11_watchWindowTree(ctx, draw);
+
+    if (!output->clip_dpy) {
+        if (output->frame_count % 500 == 0)
+            output->clip_dirty = 1;
+        return output->clip_dirty;
+    }
+
+    /* no round trip, only reads what the server already sent */
+    while (XPending(output->clip_dpy)) {
+        XNextEvent(output->clip_dpy, &event);
+        switch (event.type) {
+        case ReparentNotify:
+        case DestroyNotify:
+            /* ancestor chain may have changed, select input again */
+            output->clip_drawable = 0;
+            output->clip_dirty = 1;
+            break;
+        case ConfigureNotify:
+        case MapNotify:
+        case UnmapNotify:
+        case CirculateNotify:
+        case GravityNotify:
+        case Expose:
+            output->clip_dirty = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!output->clip_drawable)
+        psb_x11_watchWindowTree(ctx, draw);
+
+    return output->clip_dirty;
+}
+
+void
+psb_x11_closeWindowTreeWatch(psb_x11_output_p output)
+{
+    if (output->clip_dpy) {
+        XCloseDisplay(output->clip_dpy);
+        output->clip_dpy = NULL;
+    }
+    output->clip_drawable = 0;
 }
 
 static int psb_cleardrawable_stopoverlay(
@@ -532,31 +667,17 @@ static VAStatus psb_repaint_colorkey(
 {
     INIT_DRIVER_DATA;
     INIT_OUTPUT_PRIV;
-    int i, ret;
+    int i;
     psb_x11_clip_list_t *pClipNext = NULL;
     VARectangle *pVaWindowClipRects = NULL;
     object_surface_p obj_surface = SURFACE(surface);
     PsbPortPrivRec *pPriv = (PsbPortPrivPtr)(&driver_data->coverlay_priv);
 
-    if (output->frame_count % 500 == 0 || driver_data->xrandr_update) {
-        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Repaint color key.\n");
-        if (output->pClipBoxList)
-            psb_x11_freeWindowClipBoxList(output->pClipBoxList);
-        /* get window clipbox */
-        ret = psb_x11_createWindowClipBoxList(ctx->native_dpy, draw, &output->pClipBoxList, &output->ui32NumClipBoxList);
-        if (ret != 0) {
-            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: get window clip boxes error # %d\n", __func__, ret);
-            return VA_STATUS_ERROR_UNKNOWN;
-        }
-        if (output->frame_count == 500)
-            output->frame_count = 0;
-
-        driver_data->xrandr_update = 0;
-    }
-
     pVaWindowClipRects = (VARectangle *)calloc(1, sizeof(VARectangle) * output->ui32NumClipBoxList);
     if (!pVaWindowClipRects) {
         psb_x11_freeWindowClipBoxList(output->pClipBoxList);
+        output->pClipBoxList = NULL;
+        output->clip_dirty = 1;
         return VA_STATUS_ERROR_ALLOCATION_FAILED;
     }
 
@@ -915,13 +1036,29 @@ VAStatus psb_putsurface_coverlay(
         return VA_STATUS_SUCCESS;
     }
 
-    if (output->frame_count % 500 == 0 || driver_data->xrandr_update) {
+    if (psb_x11_windowTreeChanged(ctx, draw) || driver_data->xrandr_update) {
         /* get window screen coordination */
         ret = psb_x11_getWindowCoordinate(ctx->native_dpy, draw, &output->winRect, &output->bIsVisible);
         if (ret != 0) {
             drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: Failed to get X11 window coordinates error # %d\n", __func__, ret);
             return VA_STATUS_ERROR_UNKNOWN;
         }
+
+        /* rebuilt with the coordinates, whether or not the color key gets repainted */
+        if (output->pClipBoxList)
+            psb_x11_freeWindowClipBoxList(output->pClipBoxList);
+        output->pClipBoxList = NULL;
+        output->ui32NumClipBoxList = 0;
+        ret = psb_x11_createWindowClipBoxList(ctx->native_dpy, draw, &output->pClipBoxList, &output->ui32NumClipBoxList);
+        if (ret != 0) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "%s: get window clip boxes error # %d\n", __func__, ret);
+            return VA_STATUS_ERROR_UNKNOWN;
+        }
+        if (output->frame_count == 500)
+            output->frame_count = 0;
+
+        output->clip_dirty = 0;
+        driver_data->xrandr_update = 0;
     }
 
     if (!output->bIsVisible) {
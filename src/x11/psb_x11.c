@@ -56,6 +56,7 @@
 
 
 void psb_x11_freeWindowClipBoxList(psb_x11_clip_list_t * pHead);
+void psb_x11_closeWindowTreeWatch(psb_x11_output_p output);
 
 
 //X error trap
@@ -289,6 +290,9 @@ void *psb_x11_output_init(VADriverContextP ctx)
     output->extend_drawable = 0;
     output->pClipBoxList = NULL;
     output->ui32NumClipBoxList = 0;
+    output->clip_dpy = NULL;
+    output->clip_drawable = 0;
+    output->clip_dirty = 1;
     output->frame_count = 0;
     output->bIsVisible = 0;
 
@@ -366,6 +370,7 @@ void psb_x11_output_deinit(VADriverContextP ctx)
 
     psb_x11_freeWindowClipBoxList(output->pClipBoxList);
     output->pClipBoxList = NULL;
+    psb_x11_closeWindowTreeWatch(output);
 
     if (output->extend_drawable) {
         XDestroyWindow(ctx->native_dpy, output->extend_drawable);
@@ -94,6 +94,9 @@ typedef struct _psb_x11_output_s {
     psb_x11_win_t winRect;
     psb_x11_clip_list_t *pClipBoxList;
     unsigned int ui32NumClipBoxList;
+    Display *clip_dpy;          /* private connection watching the window tree */
+    Drawable clip_drawable;     /* drawable whose ancestors clip_dpy listens to */
+    int clip_dirty;             /* pClipBoxList and winRect need a rebuild */
     unsigned int frame_count;
 
     int ignore_dpm;
@@ -28,6 +28,9 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "psb_xrandr.h"
 #include "psb_x11.h"
 #include "psb_drv_debug.h"
@@ -83,16 +86,7 @@ static int RRrotation2VArotation(Rotation rotation)
 
     return 0;
 }
-static psb_xrandr_crtc_p get_crtc_by_id(RRCrtc crtc_id)
-{
-    psb_xrandr_crtc_p p_crtc;
-    for (p_crtc = psb_xrandr_info->crtc_head; p_crtc; p_crtc = p_crtc->next)
-        if (p_crtc->crtc_id == crtc_id)
-            return p_crtc;
-    return NULL;
-}
-
-static void psb_xrandr_hdmi_property(VADriverContextP ctx)
+static void psb_xrandr_hdmi_property(VADriverContextP ctx, Display *dpy)
 {
     INIT_DRIVER_DATA;
     Atom *props;
@@ -104,7 +98,7 @@ static void psb_xrandr_hdmi_property(VADriverContextP ctx)
     unsigned char* prop;
 
     /* Check HDMI properties */
-    props = XRRListOutputProperties(psb_xrandr_info->dpy, psb_xrandr_info->extend_output->output_id, &nprop);
+    props = XRRListOutputProperties(dpy, psb_xrandr_info->extend_output->output_id, &nprop);
     if (!props) {
         drv_debug_msg(VIDEO_DEBUG_ERROR, "Xrandr: XRRListOutputProperties failed\n", psb_xrandr_info->extend_output->output_id);
         return;
@@ -113,17 +107,17 @@ static void psb_xrandr_hdmi_property(VADriverContextP ctx)
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: extend output %08x has %d properties\n", psb_xrandr_info->extend_output->output_id, nprop);
 
     for (i = 0; i < nprop; i++) {
-        XRRGetOutputProperty(psb_xrandr_info->dpy, psb_xrandr_info->extend_output->output_id, props[i],
+        XRRGetOutputProperty(dpy, psb_xrandr_info->extend_output->output_id, props[i],
                              0, 100, False, False, AnyPropertyType, &actual_type, &actual_format,
                              &nitems, &bytes_after, &prop);
 
-        propinfo = XRRQueryOutputProperty(psb_xrandr_info->dpy, psb_xrandr_info->extend_output->output_id, props[i]);
+        propinfo = XRRQueryOutputProperty(dpy, psb_xrandr_info->extend_output->output_id, props[i]);
         if (!propinfo) {
             drv_debug_msg(VIDEO_DEBUG_ERROR, "Xrandr: get output %08x prop %08x failed\n", psb_xrandr_info->extend_output->output_id, props[i]);
             return;
         }
 
-        prop_name = XGetAtomName(psb_xrandr_info->dpy, props[i]);
+        prop_name = XGetAtomName(dpy, props[i]);
 
         /* Currently all properties are XA_INTEGER, 32 */
         if (!strcmp(prop_name, "ExtVideoMode")) {
@@ -252,7 +246,7 @@ static void psb_xrandr_hdmi_location_init(psb_output_device_mode output_device_m
     }
 }
 
-static void psb_xrandr_coordinate_init(VADriverContextP ctx)
+static void psb_xrandr_coordinate_init(VADriverContextP ctx, Display *dpy)
 {
     INIT_DRIVER_DATA;
     psb_xrandr_output_p p_output;
@@ -332,7 +326,7 @@ static void psb_xrandr_coordinate_init(VADriverContextP ctx)
     if (psb_xrandr_info->hdmi_enabled) {
 
         /* Get HDMI properties if it is enabled*/
-        psb_xrandr_hdmi_property(ctx);
+        psb_xrandr_hdmi_property(ctx, dpy);
 
         /* Only HDMI */
         if (!psb_xrandr_info->mipi0_enabled && !psb_xrandr_info->mipi1_enabled)
@@ -367,169 +361,212 @@ static void psb_xrandr_coordinate_init(VADriverContextP ctx)
     }
 }
 
-void psb_xrandr_refresh(VADriverContextP ctx)
+static void psb_xrandr_free_crtcs(psb_xrandr_crtc_p p_crtc)
 {
-    int i;
+    psb_xrandr_crtc_p next;
 
-    XRROutputInfo *output_info;
-    XRRCrtcInfo *crtc_info;
+    for (; p_crtc; p_crtc = next) {
+        next = p_crtc->next;
+        free(p_crtc);
+    }
+}
 
-    psb_xrandr_crtc_p p_crtc;
-    psb_xrandr_output_p p_output;
+static void psb_xrandr_free_outputs(psb_xrandr_output_p p_output)
+{
+    psb_xrandr_output_p next;
 
-    pthread_mutex_lock(&psb_xrandr_info->psb_extvideo_mutex);
+    for (; p_output; p_output = next) {
+        next = p_output->next;
+        free(p_output);
+    }
+}
 
-    //deinit crtc
-    if (psb_xrandr_info->crtc_head) {
-        while (psb_xrandr_info->crtc_head) {
-            psb_xrandr_info->crtc_tail = psb_xrandr_info->crtc_head->next;
+/*
+ * Query crtcs and outputs into new lists without holding the lock, then swap
+ * them in. Readers see either the old or the new configuration, never a
+ * half-built one, and a failed query leaves the published state untouched.
+ * dpy is the connection of the calling thread: Xlib is not locked for the
+ * application's display, so the xrandr thread must query on its own one.
+ */
+void psb_xrandr_refresh(VADriverContextP ctx, Display *dpy)
+{
+    int i;
 
-            free(psb_xrandr_info->crtc_head);
+    XRROutputInfo *output_info;
+    XRRCrtcInfo *crtc_info;
 
-            psb_xrandr_info->crtc_head = psb_xrandr_info->crtc_tail;
-        }
-        psb_xrandr_info->crtc_head = psb_xrandr_info->crtc_tail = NULL;
-    }
+    psb_xrandr_crtc_p p_crtc, crtc_head = NULL, crtc_tail = NULL;
+    psb_xrandr_output_p p_output, output_head = NULL, output_tail = NULL;
 
     for (i = 0; i < psb_xrandr_info->res->ncrtc; i++) {
-        crtc_info = XRRGetCrtcInfo(psb_xrandr_info->dpy, psb_xrandr_info->res, psb_xrandr_info->res->crtcs[i]);
-        if (crtc_info) {
-            p_crtc = (psb_xrandr_crtc_p)calloc(1, sizeof(psb_xrandr_crtc_s));
-            if (!p_crtc) {
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "output of memory\n");
-                return;
-            }
-
-            if (i == 0)
-                psb_xrandr_info->crtc_head = psb_xrandr_info->crtc_tail = p_crtc;
-
-            p_crtc->crtc_id = psb_xrandr_info->res->crtcs[i];
-            p_crtc->x = crtc_info->x;
-            p_crtc->y = crtc_info->y;
-            p_crtc->width = crtc_info->width;
-            p_crtc->height = crtc_info->height;
-            p_crtc->crtc_mode = crtc_info->mode;
-            p_crtc->noutput = crtc_info->noutput;
-            p_crtc->rotation = crtc_info->rotation;
-
-            psb_xrandr_info->crtc_tail->next = p_crtc;
-            p_crtc->next = NULL;
-            psb_xrandr_info->crtc_tail = p_crtc;
-        } else {
+        crtc_info = XRRGetCrtcInfo(dpy, psb_xrandr_info->res, psb_xrandr_info->res->crtcs[i]);
+        if (!crtc_info) {
             drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to get crtc_info\n");
-            pthread_mutex_unlock(&psb_xrandr_info->psb_extvideo_mutex);
+            psb_xrandr_free_crtcs(crtc_head);
             return;
         }
-    }
-
-    //deinit output
-    if (psb_xrandr_info->output_head) {
-        while (psb_xrandr_info->output_head) {
-            psb_xrandr_info->output_tail = psb_xrandr_info->output_head->next;
 
-            free(psb_xrandr_info->output_head);
-
-            psb_xrandr_info->output_head = psb_xrandr_info->output_tail;
-        }
-        psb_xrandr_info->output_head = psb_xrandr_info->output_tail = NULL;
-    }
-#if 0
-    //destroy the full-screen window
-    //FIXME: commited out for X Error message: BadDrawable, need more investigation
-    if (va_output) {
-        if (va_output->extend_drawable) {
-            XDestroyWindow(ctx->native_dpy, va_output->extend_drawable);
-            va_output->extend_drawable = 0;
-            texture_priv->extend_dri_init_flag = 0;
+        p_crtc = (psb_xrandr_crtc_p)calloc(1, sizeof(psb_xrandr_crtc_s));
+        if (!p_crtc) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "output of memory\n");
+            XRRFreeCrtcInfo(crtc_info);
+            psb_xrandr_free_crtcs(crtc_head);
+            return;
         }
-    }
-#endif
-    for (i = 0; i < psb_xrandr_info->res->noutput; i++) {
-        output_info = XRRGetOutputInfo(psb_xrandr_info->dpy, psb_xrandr_info->res, psb_xrandr_info->res->outputs[i]);
-        if (output_info) {
-            p_output = (psb_xrandr_output_p)calloc(1, sizeof(psb_xrandr_output_s));
-            if (!p_output) {
-                drv_debug_msg(VIDEO_DEBUG_ERROR, "output of memory\n");
-                return;
-            }
 
-            if (i == 0)
-                psb_xrandr_info->output_head = psb_xrandr_info->output_tail = p_output;
+        p_crtc->crtc_id = psb_xrandr_info->res->crtcs[i];
+        p_crtc->x = crtc_info->x;
+        p_crtc->y = crtc_info->y;
+        p_crtc->width = crtc_info->width;
+        p_crtc->height = crtc_info->height;
+        p_crtc->crtc_mode = crtc_info->mode;
+        p_crtc->noutput = crtc_info->noutput;
+        p_crtc->rotation = crtc_info->rotation;
+        XRRFreeCrtcInfo(crtc_info);
 
-            p_output->output_id = psb_xrandr_info->res->outputs[i];
+        if (crtc_tail)
+            crtc_tail->next = p_crtc;
+        else
+            crtc_head = p_crtc;
+        crtc_tail = p_crtc;
+    }
 
-            p_output->connection = output_info->connection;
-            if (p_output->connection == RR_Connected)
-                psb_xrandr_info->nconnected_output++;
+    for (i = 0; i < psb_xrandr_info->res->noutput; i++) {
+        output_info = XRRGetOutputInfo(dpy, psb_xrandr_info->res, psb_xrandr_info->res->outputs[i]);
+        if (!output_info) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to get output_info\n");
+            psb_xrandr_free_crtcs(crtc_head);
+            psb_xrandr_free_outputs(output_head);
+            return;
+        }
 
-            strcpy(p_output->name, output_info->name);
+        p_output = (psb_xrandr_output_p)calloc(1, sizeof(psb_xrandr_output_s));
+        if (!p_output) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "output of memory\n");
+            XRRFreeOutputInfo(output_info);
+            psb_xrandr_free_crtcs(crtc_head);
+            psb_xrandr_free_outputs(output_head);
+            return;
+        }
 
-            if (output_info->crtc)
-                p_output->crtc = get_crtc_by_id(output_info->crtc);
-            else
-                p_output->crtc = NULL;
+        p_output->output_id = psb_xrandr_info->res->outputs[i];
+        p_output->connection = output_info->connection;
+        strncpy(p_output->name, output_info->name, sizeof(p_output->name) - 1);
 
-            psb_xrandr_info->output_tail->next = p_output;
-            p_output->next = NULL;
-            psb_xrandr_info->output_tail = p_output;
-        } else {
-            drv_debug_msg(VIDEO_DEBUG_ERROR, "failed to get output_info\n");
-            pthread_mutex_unlock(&psb_xrandr_info->psb_extvideo_mutex);
-            return;
+        p_output->crtc = NULL;
+        for (p_crtc = crtc_head; p_crtc && output_info->crtc; p_crtc = p_crtc->next) {
+            if (p_crtc->crtc_id == output_info->crtc) {
+                p_output->crtc = p_crtc;
+                break;
+            }
         }
+        XRRFreeOutputInfo(output_info);
+
+        if (output_tail)
+            output_tail->next = p_output;
+        else
+            output_head = p_output;
+        output_tail = p_output;
     }
 
-    psb_xrandr_coordinate_init(ctx);
+    pthread_mutex_lock(&psb_xrandr_info->psb_extvideo_mutex);
+
+    psb_xrandr_free_crtcs(psb_xrandr_info->crtc_head);
+    psb_xrandr_free_outputs(psb_xrandr_info->output_head);
+    psb_xrandr_info->crtc_head = crtc_head;
+    psb_xrandr_info->crtc_tail = crtc_tail;
+    psb_xrandr_info->output_head = output_head;
+    psb_xrandr_info->output_tail = output_tail;
+
+    /* everything below pointed into the lists just freed, derive it again */
+    psb_xrandr_info->nconnected_output = 0;
+    for (p_output = output_head; p_output; p_output = p_output->next)
+        if (p_output->connection == RR_Connected)
+            psb_xrandr_info->nconnected_output++;
+    psb_xrandr_info->local_crtc[0] = psb_xrandr_info->local_crtc[1] = NULL;
+    psb_xrandr_info->local_output[0] = psb_xrandr_info->local_output[1] = NULL;
+    psb_xrandr_info->extend_crtc = NULL;
+    psb_xrandr_info->extend_output = NULL;
+    psb_xrandr_info->lvds0_enabled = 0;
+    psb_xrandr_info->mipi0_enabled = 0;
+    psb_xrandr_info->mipi1_enabled = 0;
+    psb_xrandr_info->hdmi_enabled = 0;
+
+    psb_xrandr_coordinate_init(ctx, dpy);
 
     psb_RecalcRotate(ctx);
     pthread_mutex_unlock(&psb_xrandr_info->psb_extvideo_mutex);
 }
 
-static Bool
-outputChangePredicate(Display *display, XEvent *event, char *args)
-{
-    int event_base, error_base;
-
-    XRRQueryExtension(psb_xrandr_info->dpy, &event_base, &error_base);
-    return ((event->type == event_base + RRNotify_OutputChange) ||
-            ((event->type == ClientMessage) &&
-             (((XClientMessageEvent*)event)->message_type == psb_xrandr_info->psb_exit_atom)));
-}
-
+/*
+ * The thread owns a private X connection, so it never competes with the
+ * application for events on ctx->native_dpy and can sleep in poll() on the
+ * connection fd until RandR reports a change or exit_fd is signalled.
+ */
 void psb_xrandr_thread(void* arg)
 {
     VADriverContextP ctx = (VADriverContextP)arg;
     INIT_DRIVER_DATA;
     int event_base, error_base;
+    int changed;
     XEvent event;
-    XRRQueryExtension(psb_xrandr_info->dpy, &event_base, &error_base);
-    XRRSelectInput(psb_xrandr_info->dpy, psb_xrandr_info->root, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask | RROutputPropertyNotifyMask);
+    Display *dpy = psb_xrandr_info->event_dpy;
+    struct pollfd fds[2];
+
+    XRRQueryExtension(dpy, &event_base, &error_base);
+    XRRSelectInput(dpy, psb_xrandr_info->root, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask | RROutputPropertyNotifyMask);
+    XFlush(dpy);
     drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: psb xrandr thread start\n");
 
+    fds[0].fd = ConnectionNumber(dpy);
+    fds[0].events = POLLIN;
+    fds[1].fd = psb_xrandr_info->exit_fd;
+    fds[1].events = POLLIN;
+
     while (1) {
-        if (XCheckIfEvent(psb_xrandr_info->dpy, (XEvent *)&event, outputChangePredicate, NULL)) {
-            if (event.type == ClientMessage) {
-                drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: receive ClientMessage event, thread should exit\n");
-                XClientMessageEvent *evt;
-                evt = (XClientMessageEvent*) & event;
-                if (evt->message_type == psb_xrandr_info->psb_exit_atom) {
-                    drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: xrandr thread exit safely\n");
-                    pthread_exit(NULL);
-                }
-            }
+        /* a hotplug arrives as a burst of notifies, refresh once for all of them */
+        changed = 0;
+        while (XPending(dpy)) {
+            XNextEvent(dpy, &event);
             switch (event.type - event_base) {
-            case RRNotify_OutputChange:
+            case RRScreenChangeNotify:
+            case RRNotify:
                 XRRUpdateConfiguration(&event);
-                drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: receive RRNotify_OutputChange event, refresh output/crtc info\n");
-                driver_data->xrandr_update = 1;
-                psb_xrandr_refresh(ctx);
+                changed = 1;
                 break;
             default:
                 break;
             }
         }
-        usleep(200000);
+
+        if (changed) {
+            drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: receive RandR notify event, refresh output/crtc info\n");
+            psb_xrandr_refresh(ctx, dpy);
+            /* only raised once the new state is published */
+            driver_data->xrandr_update = 1;
+        }
+
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "Xrandr: poll failed (%s), thread exit\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: xrandr thread exit safely\n");
+            break;
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            drv_debug_msg(VIDEO_DEBUG_ERROR, "Xrandr: lost X connection, thread exit\n");
+            break;
+        }
     }
+
+    /* exit_fd stays open, teardown signals it even if the thread left on its own */
+    XCloseDisplay(dpy);
+    psb_xrandr_info->event_dpy = NULL;
 }
 
 Window psb_xrandr_create_full_screen_window(unsigned int destx, unsigned int desty, unsigned int destw, unsigned int desth)
@@ -763,21 +800,18 @@ VAStatus psb_xrandr_extend_crtc_coordinate(psb_output_device *extend_device_enab
 
 VAStatus psb_xrandr_thread_exit()
 {
-    int ret;
+    uint64_t value = 1;
 
-    XSelectInput(psb_xrandr_info->dpy, psb_xrandr_info->root, StructureNotifyMask);
-    XClientMessageEvent xevent;
-    xevent.type = ClientMessage;
-    xevent.message_type = psb_xrandr_info->psb_exit_atom;
-    xevent.window = psb_xrandr_info->root;
-    xevent.format = 32;
-    ret = XSendEvent(psb_xrandr_info->dpy, psb_xrandr_info->root, 0, StructureNotifyMask, (XEvent*) & xevent);
-    XFlush(psb_xrandr_info->dpy);
-    if (!ret) {
-        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: send thread exit event to drawable: failed\n");
+    if (psb_xrandr_info->exit_fd < 0) {
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: no xrandr thread to stop\n");
+        return VA_STATUS_ERROR_UNKNOWN;
+    }
+
+    if (write(psb_xrandr_info->exit_fd, &value, sizeof(value)) != sizeof(value)) {
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: send thread exit event: failed\n");
         return VA_STATUS_ERROR_UNKNOWN;
     } else {
-        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: send thread exit event to drawable: success\n");
+        drv_debug_msg(VIDEO_DEBUG_GENERAL, "Xrandr: send thread exit event: success\n");
         return VA_STATUS_SUCCESS;
     }
 }
@@ -787,8 +821,27 @@ VAStatus psb_xrandr_thread_create(VADriverContextP ctx)
     pthread_t id;
     INIT_DRIVER_DATA;
 
-    psb_xrandr_info->psb_exit_atom = XInternAtom(psb_xrandr_info->dpy, "psb_exit_atom", 0);
-    pthread_create(&id, NULL, (void*)psb_xrandr_thread, ctx);
+    psb_xrandr_info->event_dpy = XOpenDisplay(DisplayString(psb_xrandr_info->dpy));
+    if (!psb_xrandr_info->event_dpy) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "Xrandr: failed to open event display\n");
+        return VA_STATUS_ERROR_UNKNOWN;
+    }
+
+    psb_xrandr_info->exit_fd = eventfd(0, EFD_CLOEXEC);
+    if (psb_xrandr_info->exit_fd < 0) {
+        drv_debug_msg(VIDEO_DEBUG_ERROR, "Xrandr: failed to create exit eventfd\n");
+        XCloseDisplay(psb_xrandr_info->event_dpy);
+        psb_xrandr_info->event_dpy = NULL;
+        return VA_STATUS_ERROR_UNKNOWN;
+    }
+
+    if (pthread_create(&id, NULL, (void*)psb_xrandr_thread, ctx)) {
+        close(psb_xrandr_info->exit_fd);
+        psb_xrandr_info->exit_fd = -1;
+        XCloseDisplay(psb_xrandr_info->event_dpy);
+        psb_xrandr_info->event_dpy = NULL;
+        return VA_STATUS_ERROR_UNKNOWN;
+    }
     driver_data->xrandr_thread_id = id;
     return VA_STATUS_SUCCESS;
 }
@@ -827,6 +880,12 @@ VAStatus psb_xrandr_deinit()
         free(psb_xrandr_info->hdmi_extvideo_prop);
     }
 
+    /* the xrandr thread is joined by now */
+    if (psb_xrandr_info->exit_fd >= 0) {
+        close(psb_xrandr_info->exit_fd);
+        psb_xrandr_info->exit_fd = -1;
+    }
+
     pthread_mutex_unlock(&psb_xrandr_info->psb_extvideo_mutex);
     pthread_mutex_destroy(&psb_xrandr_info->psb_extvideo_mutex);
 
@@ -849,6 +908,7 @@ VAStatus psb_xrandr_init(VADriverContextP ctx)
     psb_xrandr_info->mipi0_rotation = RR_Rotate_0;
     psb_xrandr_info->mipi1_rotation = RR_Rotate_0;
     psb_xrandr_info->hdmi_rotation = RR_Rotate_0;
+    psb_xrandr_info->exit_fd = -1;
 
     psb_xrandr_info->hdmi_extvideo_prop = (psb_extvideo_prop_p)calloc(1, sizeof(psb_extvideo_prop_s));
     if (!psb_xrandr_info->hdmi_extvideo_prop) {
@@ -879,7 +939,7 @@ VAStatus psb_xrandr_init(VADriverContextP ctx)
 
     pthread_mutex_init(&psb_xrandr_info->psb_extvideo_mutex, NULL);
 
-    psb_xrandr_refresh(ctx);
+    psb_xrandr_refresh(ctx, psb_xrandr_info->dpy);
 
     return VA_STATUS_SUCCESS;
 }
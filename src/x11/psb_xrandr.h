@@ -161,7 +161,8 @@ typedef struct _psb_xrandr_info_s {
     XRRScreenResources *res;
     Display *dpy;
     Window root;
-    Atom psb_exit_atom;
+    Display *event_dpy; /* private connection of the xrandr thread */
+    int exit_fd;        /* eventfd to stop the xrandr thread, closed by psb_xrandr_deinit() */
 } psb_xrandr_info_s, *psb_xrandr_info_p;
 
 
@@ -180,7 +181,7 @@ VAStatus psb_xrandr_extvideo_prop(unsigned int *xres, unsigned int *yres, unsign
 VAStatus psb_xrandr_local_crtc_coordinate(psb_output_device *local_device_enabled, int *x, int *y, int *width, int *height, Rotation *rotation);
 VAStatus psb_xrandr_extend_crtc_coordinate(psb_output_device *extend_device_enabled, int *x, int *y, int *width, int *height, psb_xrandr_location *location, Rotation *rotation);
 
-void psb_xrandr_refresh(VADriverContextP ctx);
+void psb_xrandr_refresh(VADriverContextP ctx, Display *dpy);
 void psb_xrandr_thread();
 VAStatus psb_xrandr_thread_create(VADriverContextP ctx);
 VAStatus psb_xrandr_thread_exit();
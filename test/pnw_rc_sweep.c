@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sweeps the host side rate control heuristics of pnw_hostrc.c over stream
+ * setups the way pnw__update_rcdata() and the encoders' sequence setup use
+ * them, and checks QPs within their range and an initial level the buffer
+ * holds. The pnw encoders code no B frames, test/tng_rc_sweep.c has that
+ * axis.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "pnw_hostrc.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const IMG_UINT16 aui16Width[] = { 176, 352, 720, 1280, 1920 };
+static const IMG_UINT16 aui16Height[] = { 144, 288, 480, 720, 1088 };
+static const IMG_UINT32 aui32FrameRate[] = { 1, 15, 30, 60, 240 };
+static const IMG_UINT32 aui32BitsPerSecond[] = { 1, 20, 64000, 256000, 1000000, 8000000,
+                                                 20000000, 135000000, 1000000000, 0xffffffff };
+static const IMG_UINT32 aui32WindowSize[] = { 0, 100, 1000, 2000 };
+
+/* the initial level sits on a frame boundary inside the buffer */
+static void check_initial_level(IMG_UINT32 BufferSize, IMG_UINT32 FrameSize)
+{
+    IMG_UINT32 Level = pnw__rc_initial_level(BufferSize, FrameSize);
+
+    CHECK(Level <= BufferSize);
+    if (FrameSize && Level < BufferSize)
+        CHECK(Level % FrameSize == 0);
+    if (FrameSize == 0)
+        CHECK(Level == (((IMG_UINT64)3 * BufferSize) >> 4));
+}
+
+static void check_qp_tables(void)
+{
+    unsigned int b;
+    IMG_UINT8 LastOther = 0xff, LastMin = 0xff, Qp;
+
+    for (b = 0; b < ARRAY_SIZE(aui32BitsPerSecond); b++) {
+        double flBpp = pnw__rc_bits_per_pixel(aui32BitsPerSecond[b], 30, 352, 288);
+
+        /* more bits never ask for a coarser quantizer */
+        Qp = pnw__rc_h264_min_qp(flBpp);
+        CHECK(Qp >= 4 && Qp <= 26);
+        CHECK(Qp <= LastMin);
+        LastMin = Qp;
+
+        Qp = pnw__rc_other_initial_qp(flBpp, 352);
+        CHECK(Qp >= 8 && Qp <= 31);
+        CHECK(Qp <= LastOther);
+        LastOther = Qp;
+
+        CHECK(pnw__rc_scale_factor(aui32BitsPerSecond[b], IMG_TRUE) <= 6);
+        CHECK(pnw__rc_scale_factor(aui32BitsPerSecond[b], IMG_FALSE) <= 4);
+        if (b > 0) {
+            CHECK(pnw__rc_scale_factor(aui32BitsPerSecond[b], IMG_TRUE) >=
+                  pnw__rc_scale_factor(aui32BitsPerSecond[b - 1], IMG_TRUE));
+            CHECK(pnw__rc_scale_factor(aui32BitsPerSecond[b], IMG_FALSE) >=
+                  pnw__rc_scale_factor(aui32BitsPerSecond[b - 1], IMG_FALSE));
+        }
+    }
+}
+
+/* what the sequence setup and pnw__update_rcdata() derive for one stream */
+static void check_setup(
+    IMG_UINT16 Width,
+    IMG_UINT16 Height,
+    IMG_UINT32 FrameRate,
+    IMG_UINT32 BitsPerSecond,
+    IMG_UINT32 WindowSize)
+{
+    IMG_UINT32 BufferSize, FrameSize;
+    IMG_UINT8 MinQP, InitQP;
+    double flBpp;
+
+    FrameSize = BitsPerSecond / FrameRate;
+
+    /* H.264 keeps one second of bits, or the application's window */
+    BufferSize = WindowSize ? BitsPerSecond / 1000 * WindowSize : BitsPerSecond;
+    check_initial_level(BufferSize, FrameSize);
+    /* MPEG-4 rounds its buffer to the 16384 bit units of the VOL header */
+    check_initial_level(BitsPerSecond / 16384 * 16384, FrameSize);
+
+    flBpp = pnw__rc_bits_per_pixel(BitsPerSecond, FrameRate, Width, Height);
+    if (Width <= 176)
+        flBpp = flBpp / 2.0;
+    CHECK(flBpp > 0.0 && !isinf(flBpp));
+
+    MinQP = pnw__rc_h264_min_qp(flBpp);
+    InitQP = pnw__rc_h264_initial_qp(flBpp, MinQP);
+    CHECK(MinQP >= 4 && MinQP <= 51);
+    CHECK(InitQP >= MinQP && InitQP <= 51);
+
+    InitQP = pnw__rc_other_initial_qp(flBpp, Width);
+    CHECK(InitQP >= 8 && InitQP <= 31);
+}
+
+static void sweep(void)
+{
+    unsigned int r, f, b, w;
+
+    for (r = 0; r < ARRAY_SIZE(aui16Width); r++)
+        for (f = 0; f < ARRAY_SIZE(aui32FrameRate); f++)
+            for (b = 0; b < ARRAY_SIZE(aui32BitsPerSecond); b++)
+                for (w = 0; w < ARRAY_SIZE(aui32WindowSize); w++)
+                    check_setup(aui16Width[r], aui16Height[r], aui32FrameRate[f],
+                                aui32BitsPerSecond[b], aui32WindowSize[w]);
+
+    /* a frame bigger than the buffer */
+    check_initial_level(1000, 5000);
+    check_initial_level(0, 5000);
+    check_initial_level(0xffffffff, 1);
+}
+
+int main(void)
+{
+    check_qp_tables();
+    sweep();
+
+    if (failures)
+        printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
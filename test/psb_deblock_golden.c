@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs the MSVDX H.264 second pass deblock generator of src/mrst/psb_deblock.c
+ * on generated macroblock data and checks the REGIO words bit for bit against
+ * hashes of what the per macroblock generator it replaced wrote for the same
+ * data. Built with and without the command space polls, see test/Makefile.am.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_cmdbuf.h"
+#include "psb_drv_debug.h"
+#include "hwdefs/img_types.h"
+#include "hwdefs/mem_io.h"
+#include "hwdefs/h264_macroblock_mem_io.h"
+
+#ifndef H264_DEBLOCK_POLLn
+#define H264_DEBLOCK_POLLn      1
+#endif
+
+#define H264_MACROBLOCK_DATA_SIZE       0x80
+#define REGIO_WORDS_PER_MB              256
+
+static unsigned char *regio_mem;
+
+int psb_buffer_map(psb_buffer_p buf, unsigned char **address)
+{
+    *address = regio_mem;
+    return 0;
+}
+
+int psb_buffer_unmap(psb_buffer_p buf)
+{
+    return 0;
+}
+
+int psb_cmdbuf_buffer_ref(psb_cmdbuf_p cmdbuf, psb_buffer_p buf)
+{
+    return 0;
+}
+
+static uint32_t rand_state;
+
+static uint32_t next_rand(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+/*
+ * Random MB data with valid block sizes, I, I_PCM, P and B MBs, and slices
+ * that change every few MBs. A slice copies its bytes 0x5C/0x5D to every MB.
+ */
+static void fill_mb_data(uint8_t *MbData, uint32_t NumMbs, uint32_t SliceLen)
+{
+    static const uint32_t mb_types[] = { 0, 0, 1, 1, 1, 2, 3 };
+    uint8_t slice_bytes[2] = { 0, 0 };
+    uint32_t i, j, block, run = 0;
+
+    for (i = 0; i < NumMbs; i++, MbData += H264_MACROBLOCK_DATA_SIZE) {
+        for (j = 0; j < H264_MACROBLOCK_DATA_SIZE; j++)
+            MbData[j] = next_rand();
+
+        if (run == 0) {
+            slice_bytes[0] = next_rand();
+            slice_bytes[1] = next_rand();
+            run = 1 + next_rand() % SliceLen;
+        }
+        run--;
+        MbData[0x5C] = slice_bytes[0];
+        MbData[0x5D] = (MbData[0x5D] & 0xC0) | (slice_bytes[1] & 0x3F);
+
+        MEMIO_WRITE_FIELD(MbData, MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_MBTYPE, mb_types[next_rand() % 7]);
+        block = next_rand() % 7;
+        MEMIO_WRITE_FIELD(MbData, MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_ASO_BLOCK0_PREDICTION_SIZE, block);
+        block = next_rand() % 7;
+        MEMIO_WRITE_FIELD(MbData, MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_ASO_BLOCK1_PREDICTION_SIZE, block);
+        block = next_rand() % 7;
+        MEMIO_WRITE_FIELD(MbData, MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_ASO_BLOCK2_PREDICTION_SIZE, block);
+        block = next_rand() % 7;
+        MEMIO_WRITE_FIELD(MbData, MSVDX_VEC_ENTDEC_VLRIF_H264_MB_UNIT_ASO_BLOCK3_PREDICTION_SIZE, block);
+    }
+}
+
+/* FNV-1a over the words */
+static uint32_t hash_words(const uint32_t *words, uint32_t count)
+{
+    uint32_t hash = 2166136261u, i, b;
+
+    for (i = 0; i < count; i++)
+        for (b = 0; b < 32; b += 8)
+            hash = (hash ^ ((words[i] >> b) & 0xff)) * 16777619u;
+    return hash;
+}
+
+/* golden table: seed, width and height in MBs, max slice length, REGIO size and hash */
+static const struct {
+    uint32_t seed;
+    uint32_t width;
+    uint32_t height;
+    uint32_t slice_len;
+    uint32_t size;
+    uint32_t hash;
+} golden_table[] = {
+#if H264_DEBLOCK_POLLn
+    { 1,   1,  1,   1,     50, 0x1b4a4802 },
+    { 2,   4,  3,   1,    418, 0x0e7d657c },
+    { 3,  11,  9,   5,   3960, 0x65fefddb },
+    { 4,  45, 36,  30,  62706, 0xfd056981 },
+    { 5, 120, 68, 200, 312808, 0x2a7b4dad },
+    { 6,   1, 40,   3,   1680, 0x7d7a21de },
+    { 7,  40,  1,   3,   1056, 0x4ced5e0a },
+#else
+    { 1,   1,  1,   1,     36, 0x2f511a82 },
+    { 2,   4,  3,   1,    266, 0xef3c636d },
+    { 3,  11,  9,   5,   2562, 0x638ec697 },
+    { 4,  45, 36,  30,  40410, 0xfb4e6965 },
+    { 5, 120, 68, 200, 201424, 0x84b537c9 },
+    { 6,   1, 40,   3,   1090, 0xba8be3cb },
+    { 7,  40,  1,   3,    712, 0x115d3688 },
+#endif
+};
+
+int main(void)
+{
+    struct psb_cmdbuf_s cmdbuf;
+    struct object_context_s obj_context;
+    struct psb_buffer_s target;
+    unsigned int i, failures = 0;
+
+    for (i = 0; i < sizeof(golden_table) / sizeof(golden_table[0]); i++) {
+        uint32_t NumMbs = golden_table[i].width * golden_table[i].height;
+        uint8_t *MbData = malloc(NumMbs * H264_MACROBLOCK_DATA_SIZE);
+        uint32_t size, hash;
+
+        regio_mem = calloc(NumMbs * REGIO_WORDS_PER_MB + 64, sizeof(uint32_t));
+        if (!MbData || !regio_mem) {
+            printf("out of memory\n");
+            return 1;
+        }
+
+        rand_state = golden_table[i].seed;
+        fill_mb_data(MbData, NumMbs, golden_table[i].slice_len);
+
+        memset(&cmdbuf, 0, sizeof(cmdbuf));
+        obj_context.cmdbuf = &cmdbuf;
+        target.buffer_ofs = 0x1000;
+        psb_cmdbuf_second_pass(&obj_context, 0, MbData, golden_table[i].width,
+                               golden_table[i].height, &target, 0x800);
+
+        /* the first word is the REGIO size the generator wrote */
+        size = ((uint32_t *)regio_mem)[0];
+        hash = size > NumMbs * REGIO_WORDS_PER_MB ? 0 : hash_words((uint32_t *)regio_mem, size + 1);
+        if (size != golden_table[i].size || hash != golden_table[i].hash) {
+            printf("%s:%d: %ux%u MBs, seed %u: REGIO size %u hash 0x%08x, expected %u 0x%08x\n",
+                   __FILE__, __LINE__, golden_table[i].width, golden_table[i].height, golden_table[i].seed,
+                   size, hash, golden_table[i].size, golden_table[i].hash);
+            failures++;
+        }
+
+        free(regio_mem);
+        free(MbData);
+    }
+
+    if (failures)
+        printf("%u checks failed\n", failures);
+    return failures ? 1 : 0;
+}
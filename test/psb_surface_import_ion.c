@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs the ION imports of the surface import table (src/psb_surface_import.c)
+ * against a fake ION client. Distinct buffers must never share a buffer
+ * object, whatever their fds and dma-buf inodes look like, while a buffer
+ * imported again through another fd does, and every ION handle reference
+ * and buffer object reference taken is dropped again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include <linux/ion.h>
+#include "psb_surface_import.h"
+
+#define MAX_FDS         32
+#define MAX_BUFFERS     8
+#define MAX_BOS         16
+
+#define ION_CLIENT_FD   7
+
+/* ION buffer behind every fd, 0 for none */
+static int fd_buffer[MAX_FDS];
+/* references of the ION client to the handle of every buffer */
+static int handle_refs[MAX_BUFFERS];
+/* references to every buffer object */
+static int bo_refs[MAX_BOS];
+static int next_bo = 1;
+
+static unsigned int failures;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);           \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+/* one client: the same buffer always gets the same handle */
+int ioctl(int fd, unsigned long request, ...)
+{
+    va_list args;
+    void *arg;
+    int buffer;
+
+    va_start(args, request);
+    arg = va_arg(args, void *);
+    va_end(args);
+
+    if (fd != ION_CLIENT_FD)
+        return -1;
+
+    if (request == ION_IOC_IMPORT) {
+        struct ion_fd_data *data = arg;
+
+        if (data->fd < 0 || data->fd >= MAX_FDS || fd_buffer[data->fd] == 0)
+            return -1;
+        buffer = fd_buffer[data->fd];
+        handle_refs[buffer]++;
+        data->handle = (struct ion_handle *)(unsigned long)(buffer << 12);
+        return 0;
+    }
+
+    if (request == ION_IOC_FREE) {
+        struct ion_handle_data *data = arg;
+
+        buffer = (int)((unsigned long)data->handle >> 12);
+        if (buffer <= 0 || buffer >= MAX_BUFFERS || handle_refs[buffer] == 0)
+            return -1;
+        handle_refs[buffer]--;
+        return 0;
+    }
+
+    return -1;
+}
+
+VAStatus psb_buffer_reference(psb_driver_data_p driver_data,
+                              psb_buffer_p buf,
+                              psb_buffer_p reference_buf)
+{
+    buf->bo = reference_buf->bo;
+    bo_refs[buf->bo]++;
+    return VA_STATUS_SUCCESS;
+}
+
+void psb_buffer_destroy(psb_buffer_p buf)
+{
+    bo_refs[buf->bo]--;
+}
+
+static struct psb_driver_data_s driver_data;
+
+/* What psb_CreateSurfaceFromION does for one fd, a new BO stands for the mmap */
+static object_surface_p create_surface(int fd, VASurfaceAttributeTPI *attribute_tpi)
+{
+    struct psb_surface_import_key_s import_key;
+    struct psb_surface_import_s *import;
+    object_surface_p obj_surface;
+
+    if (psb_surface_import_ion(&driver_data, fd, attribute_tpi, 0x3231564e,
+                               &import_key, &import) != VA_STATUS_SUCCESS)
+        return NULL;
+
+    obj_surface = calloc(1, sizeof(*obj_surface));
+    obj_surface->psb_surface = calloc(1, sizeof(struct psb_surface_s));
+    if (import)
+        psb_surface_import_share(&driver_data, import, obj_surface->psb_surface);
+    else {
+        obj_surface->psb_surface->buf.bo = next_bo++;
+        bo_refs[obj_surface->psb_surface->buf.bo]++;
+    }
+    psb_surface_import_record(&driver_data, obj_surface, import, &import_key);
+
+    return obj_surface;
+}
+
+static void destroy_surface(object_surface_p obj_surface)
+{
+    if (obj_surface->import)
+        psb_surface_import_release(&driver_data, obj_surface);
+    psb_buffer_destroy(&obj_surface->psb_surface->buf);
+    free(obj_surface->psb_surface);
+    free(obj_surface);
+}
+
+int main(void)
+{
+    VASurfaceAttributeTPI attribute_tpi, other_layout;
+    object_surface_p a, b, c, d, e;
+    int i;
+
+    memset(&attribute_tpi, 0, sizeof(attribute_tpi));
+    attribute_tpi.type = VAExternalMemoryIONSharedFD;
+    attribute_tpi.width = 640;
+    attribute_tpi.height = 480;
+    attribute_tpi.size = 640 * 480 * 3 / 2;
+    attribute_tpi.luma_stride = 640;
+    attribute_tpi.chroma_u_stride = 640;
+    attribute_tpi.chroma_v_stride = 640;
+    attribute_tpi.chroma_u_offset = 640 * 480;
+    attribute_tpi.chroma_v_offset = 640 * 480;
+    other_layout = attribute_tpi;
+    other_layout.luma_stride = 704;
+
+    driver_data.ion_fd = ION_CLIENT_FD;
+
+    /* fds 20 and 21 are different buffers, 22 is another fd of 20's */
+    fd_buffer[20] = 1;
+    fd_buffer[21] = 2;
+    fd_buffer[22] = 1;
+
+    a = create_surface(20, &attribute_tpi);
+    b = create_surface(21, &attribute_tpi);
+    CHECK(a && b);
+    if (!a || !b)
+        return 1;
+    CHECK(a->psb_surface->buf.bo != b->psb_surface->buf.bo);
+    CHECK(a->import != b->import);
+
+    c = create_surface(22, &attribute_tpi);
+    CHECK(c && c->psb_surface->buf.bo == a->psb_surface->buf.bo);
+    CHECK(c && c->import == a->import && a->import->refcnt == 2);
+    /* the table holds one handle reference per entry, not per surface */
+    CHECK(handle_refs[1] == 1);
+
+    d = create_surface(21, &other_layout);
+    CHECK(d && d->psb_surface->buf.bo != b->psb_surface->buf.bo);
+    CHECK(handle_refs[2] == 2);
+
+    CHECK(create_surface(23, &attribute_tpi) == NULL);
+
+    destroy_surface(a);
+    destroy_surface(b);
+    destroy_surface(c);
+    destroy_surface(d);
+
+    /* fd 20 recycled for a new buffer must not find the old one */
+    fd_buffer[20] = 3;
+    e = create_surface(20, &attribute_tpi);
+    CHECK(e && e->import->refcnt == 1 && bo_refs[e->psb_surface->buf.bo] == 2);
+    if (e)
+        destroy_surface(e);
+
+    for (i = 0; i < MAX_BUFFERS; i++)
+        CHECK(handle_refs[i] == 0);
+    for (i = 0; i < MAX_BOS; i++)
+        CHECK(bo_refs[i] == 0);
+    for (i = 0; i < PSB_SURFACE_IMPORT_HASH_SIZE; i++)
+        CHECK(driver_data.surface_import_hash[i] == NULL);
+
+    if (failures)
+        printf("%u checks failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs the xrandr thread (src/x11/psb_xrandr.c) against a fake X server.
+ * The thread's connection is a socket, every byte the test writes to the
+ * other end is one RandR notify. A burst of notifies must give one refresh,
+ * the application's display must never be used from the thread, and the
+ * driver teardown must work whether the thread was stopped or left on its
+ * own when the connection went away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "psb_xrandr.h"
+#include "psb_x11.h"
+
+#define EVENT_BASE      89
+
+extern psb_xrandr_info_p psb_xrandr_info;
+
+static unsigned int failures;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);           \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static char display_name[] = ":0";
+static Display app_dpy = { -1, display_name };
+static Display event_dpy = { -1, display_name };
+static pthread_t app_thread;
+
+/* the test's end of the event connection */
+static int server_fd = -1;
+static int queued_events;
+
+/* X requests sent on the application's display from another thread */
+static volatile int app_dpy_foreign;
+static volatile int event_dpy_refreshes;
+static volatile int event_dpy_closed;
+static int app_dpy_refreshes;
+
+/* MIPI0 on the first crtc, HDMI extended to the right of it on the second */
+static RRCrtc crtcs[2] = { 1, 2 };
+static RROutput outputs[2] = { 11, 12 };
+static XRRScreenResources resources = { 2, crtcs, 2, outputs };
+
+static void x_request(Display *dpy)
+{
+    if (dpy == &app_dpy && !pthread_equal(pthread_self(), app_thread))
+        app_dpy_foreign++;
+}
+
+Display *XOpenDisplay(const char *name)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        return NULL;
+    event_dpy.fd = fds[0];
+    server_fd = fds[1];
+    event_dpy_closed = 0;
+    queued_events = 0;
+    return &event_dpy;
+}
+
+int XCloseDisplay(Display *dpy)
+{
+    CHECK(dpy == &event_dpy);
+    close(dpy->fd);
+    dpy->fd = -1;
+    event_dpy_closed = 1;
+    return 0;
+}
+
+/* one event per byte received */
+int XPending(Display *dpy)
+{
+    char bytes[64];
+    ssize_t n;
+
+    x_request(dpy);
+    if (dpy == &event_dpy) {
+        while ((n = recv(dpy->fd, bytes, sizeof(bytes), MSG_DONTWAIT)) > 0)
+            queued_events += n;
+    }
+    return queued_events;
+}
+
+int XNextEvent(Display *dpy, XEvent *event)
+{
+    x_request(dpy);
+    CHECK(dpy == &event_dpy && queued_events > 0);
+    queued_events--;
+    memset(event, 0, sizeof(*event));
+    event->type = EVENT_BASE + RRNotify;
+    return 0;
+}
+
+int XFlush(Display *dpy)
+{
+    x_request(dpy);
+    return 0;
+}
+
+char *XGetAtomName(Display *dpy, Atom atom)
+{
+    x_request(dpy);
+    return NULL;
+}
+
+Atom XInternAtom(Display *dpy, const char *atom_name, Bool only_if_exists)
+{
+    x_request(dpy);
+    return 1;
+}
+
+Window XCreateSimpleWindow(Display *dpy, Window parent, int x, int y,
+                           unsigned int width, unsigned int height, unsigned int border_width,
+                           unsigned long border, unsigned long background)
+{
+    x_request(dpy);
+    return 2;
+}
+
+int XChangeProperty(Display *dpy, Window w, Atom property, Atom type, int format,
+                    int mode, const unsigned char *data, int nelements)
+{
+    x_request(dpy);
+    return 0;
+}
+
+int XChangeWindowAttributes(Display *dpy, Window w, unsigned long valuemask,
+                            XSetWindowAttributes *attributes)
+{
+    x_request(dpy);
+    return 0;
+}
+
+int XMapWindow(Display *dpy, Window w)
+{
+    x_request(dpy);
+    return 0;
+}
+
+Bool XRRQueryExtension(Display *dpy, int *event_base, int *error_base)
+{
+    x_request(dpy);
+    *event_base = EVENT_BASE;
+    *error_base = 0;
+    return True;
+}
+
+Status XRRQueryVersion(Display *dpy, int *major, int *minor)
+{
+    x_request(dpy);
+    *major = 1;
+    *minor = 3;
+    return 1;
+}
+
+void XRRSelectInput(Display *dpy, Window window, int mask)
+{
+    x_request(dpy);
+}
+
+int XRRUpdateConfiguration(XEvent *event)
+{
+    return 1;
+}
+
+XRRScreenResources *XRRGetScreenResources(Display *dpy, Window window)
+{
+    x_request(dpy);
+    return &resources;
+}
+
+XRRCrtcInfo *XRRGetCrtcInfo(Display *dpy, XRRScreenResources *res, RRCrtc crtc)
+{
+    XRRCrtcInfo *crtc_info = calloc(1, sizeof(*crtc_info));
+
+    x_request(dpy);
+    /* a refresh starts with the first crtc */
+    if (crtc == crtcs[0]) {
+        if (dpy == &event_dpy)
+            event_dpy_refreshes++;
+        else
+            app_dpy_refreshes++;
+    }
+
+    crtc_info->x = (crtc == crtcs[0]) ? 0 : 1280;
+    crtc_info->width = 1280;
+    crtc_info->height = 720;
+    crtc_info->mode = crtc;
+    crtc_info->rotation = RR_Rotate_0;
+    crtc_info->noutput = 1;
+    return crtc_info;
+}
+
+void XRRFreeCrtcInfo(XRRCrtcInfo *crtc_info)
+{
+    free(crtc_info);
+}
+
+XRROutputInfo *XRRGetOutputInfo(Display *dpy, XRRScreenResources *res, RROutput output)
+{
+    XRROutputInfo *output_info = calloc(1, sizeof(*output_info));
+
+    x_request(dpy);
+    output_info->crtc = (output == outputs[0]) ? crtcs[0] : crtcs[1];
+    output_info->name = (output == outputs[0]) ? "MIPI0" : "TMDS0-1";
+    output_info->connection = RR_Connected;
+    return output_info;
+}
+
+void XRRFreeOutputInfo(XRROutputInfo *output_info)
+{
+    free(output_info);
+}
+
+/* HDMI without properties */
+Atom *XRRListOutputProperties(Display *dpy, RROutput output, int *nprop)
+{
+    x_request(dpy);
+    *nprop = 0;
+    return NULL;
+}
+
+int XRRGetOutputProperty(Display *dpy, RROutput output, Atom property,
+                         long offset, long length, Bool _delete, Bool pending, Atom req_type,
+                         Atom *actual_type, int *actual_format,
+                         unsigned long *nitems, unsigned long *bytes_after, unsigned char **prop)
+{
+    x_request(dpy);
+    return 1;
+}
+
+XRRPropertyInfo *XRRQueryOutputProperty(Display *dpy, RROutput output, Atom property)
+{
+    x_request(dpy);
+    return NULL;
+}
+
+void psb_RecalcRotate(VADriverContextP ctx)
+{
+}
+
+static void wait_for(volatile int *value, int expected)
+{
+    int i;
+
+    for (i = 0; i < 5000 && *value != expected; i++)
+        usleep(1000);
+}
+
+static void start(VADriverContextP ctx, psb_driver_data_p driver_data)
+{
+    memset(driver_data, 0, sizeof(*driver_data));
+    ctx->pDriverData = driver_data;
+    ctx->native_dpy = &app_dpy;
+    app_dpy_refreshes = 0;
+    event_dpy_refreshes = 0;
+    app_dpy_foreign = 0;
+
+    CHECK(psb_xrandr_init(ctx) == VA_STATUS_SUCCESS);
+    CHECK(app_dpy_refreshes == 1);
+    CHECK(psb_xrandr_hdmi_enabled());
+    CHECK(psb_xrandr_thread_create(ctx) == VA_STATUS_SUCCESS);
+}
+
+/* a hotplug: a burst of notifies is one refresh, on the thread's display */
+static void hotplug(psb_driver_data_p driver_data, int refreshes)
+{
+    static const char burst[3] = { 0, 0, 0 };
+
+    driver_data->xrandr_update = 0;
+    CHECK(write(server_fd, burst, sizeof(burst)) == sizeof(burst));
+    wait_for(&event_dpy_refreshes, refreshes);
+    wait_for((volatile int *)&driver_data->xrandr_update, 1);
+    CHECK(event_dpy_refreshes == refreshes);
+    CHECK(driver_data->xrandr_update == 1);
+    CHECK(psb_xrandr_hdmi_enabled());
+}
+
+/* what the X11 output teardown does */
+static void teardown(psb_driver_data_p driver_data, VAStatus exit_status)
+{
+    int exit_fd = psb_xrandr_info->exit_fd;
+
+    CHECK(psb_xrandr_thread_exit() == exit_status);
+    pthread_join(driver_data->xrandr_thread_id, NULL);
+    CHECK(event_dpy_closed);
+    CHECK(psb_xrandr_deinit() == VA_STATUS_SUCCESS);
+    /* the eventfd is closed once, by the teardown */
+    CHECK(exit_fd >= 0 && fcntl(exit_fd, F_GETFD) < 0);
+}
+
+int main(void)
+{
+    struct VADriverContext ctx;
+    struct psb_driver_data_s driver_data;
+
+    app_thread = pthread_self();
+
+    /* stopped by the driver */
+    start(&ctx, &driver_data);
+    hotplug(&driver_data, 1);
+    hotplug(&driver_data, 2);
+    teardown(&driver_data, VA_STATUS_SUCCESS);
+    close(server_fd);
+    CHECK(app_dpy_foreign == 0);
+
+    /* the X connection goes away first, the thread leaves on its own */
+    start(&ctx, &driver_data);
+    hotplug(&driver_data, 1);
+    close(server_fd);
+    wait_for(&event_dpy_closed, 1);
+    CHECK(event_dpy_closed);
+    teardown(&driver_data, VA_STATUS_SUCCESS);
+    CHECK(app_dpy_foreign == 0);
+
+    if (failures) {
+        printf("psb_xrandr_thread: %u failures\n", failures);
+        return 1;
+    }
+
+    printf("psb_xrandr_thread: ok\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Just enough of Xlib for the xrandr thread (src/x11/psb_xrandr.c). A
+ * Display is a file descriptor the test feeds events through, the test
+ * provides the functions.
+ */
+
+#ifndef _X11_XLIB_H_
+#define _X11_XLIB_H_
+
+typedef unsigned long XID;
+typedef XID Window;
+typedef unsigned long Atom;
+typedef unsigned long Time;
+typedef int Bool;
+typedef int Status;
+
+#define True    1
+#define False   0
+
+#define AnyPropertyType         0L
+#define PropModeReplace         0
+#define CWOverrideRedirect      (1L << 9)
+
+typedef struct _XDisplay {
+    int fd;
+    char *display_name;
+} Display;
+
+typedef union _XEvent {
+    int type;
+    long pad[24];
+} XEvent;
+
+typedef struct {
+    Bool override_redirect;
+} XSetWindowAttributes;
+
+#define ConnectionNumber(dpy)           ((dpy)->fd)
+#define DisplayString(dpy)              ((dpy)->display_name)
+#define DefaultScreen(dpy)              0
+#define ScreenCount(dpy)                1
+#define RootWindow(dpy, scr)            ((Window)1)
+#define DefaultRootWindow(dpy)          ((Window)1)
+
+Display *XOpenDisplay(const char *display_name);
+int XCloseDisplay(Display *dpy);
+int XPending(Display *dpy);
+int XNextEvent(Display *dpy, XEvent *event);
+int XFlush(Display *dpy);
+char *XGetAtomName(Display *dpy, Atom atom);
+Atom XInternAtom(Display *dpy, const char *atom_name, Bool only_if_exists);
+Window XCreateSimpleWindow(Display *dpy, Window parent, int x, int y,
+                           unsigned int width, unsigned int height, unsigned int border_width,
+                           unsigned long border, unsigned long background);
+int XChangeProperty(Display *dpy, Window w, Atom property, Atom type, int format,
+                    int mode, const unsigned char *data, int nelements);
+int XChangeWindowAttributes(Display *dpy, Window w, unsigned long valuemask,
+                            XSetWindowAttributes *attributes);
+int XMapWindow(Display *dpy, Window w);
+
+#endif /* _X11_XLIB_H_ */
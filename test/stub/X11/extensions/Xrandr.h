@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Just enough of libXrandr for the xrandr thread, the test provides the
+ * functions.
+ */
+
+#ifndef _X11_EXTENSIONS_XRANDR_H_
+#define _X11_EXTENSIONS_XRANDR_H_
+
+#include <X11/Xlib.h>
+
+typedef XID RRCrtc;
+typedef XID RROutput;
+typedef XID RRMode;
+typedef unsigned short Rotation;
+typedef unsigned short Connection;
+
+#define RR_Rotate_0             1
+#define RR_Rotate_90            2
+#define RR_Rotate_180           4
+#define RR_Rotate_270           8
+
+#define RR_Connected            0
+#define RR_Disconnected         1
+
+#define RRScreenChangeNotify    0
+#define RRNotify                1
+
+#define RRScreenChangeNotifyMask        (1L << 0)
+#define RRCrtcChangeNotifyMask          (1L << 1)
+#define RROutputChangeNotifyMask        (1L << 2)
+#define RROutputPropertyNotifyMask      (1L << 3)
+
+typedef struct _XRRScreenResources {
+    int ncrtc;
+    RRCrtc *crtcs;
+    int noutput;
+    RROutput *outputs;
+} XRRScreenResources;
+
+typedef struct _XRRCrtcInfo {
+    int x, y;
+    unsigned int width, height;
+    RRMode mode;
+    Rotation rotation;
+    int noutput;
+} XRRCrtcInfo;
+
+typedef struct _XRROutputInfo {
+    RRCrtc crtc;
+    char *name;
+    Connection connection;
+} XRROutputInfo;
+
+typedef struct _XRRPropertyInfo {
+    Bool pending;
+} XRRPropertyInfo;
+
+Bool XRRQueryExtension(Display *dpy, int *event_base, int *error_base);
+Status XRRQueryVersion(Display *dpy, int *major, int *minor);
+void XRRSelectInput(Display *dpy, Window window, int mask);
+int XRRUpdateConfiguration(XEvent *event);
+XRRScreenResources *XRRGetScreenResources(Display *dpy, Window window);
+XRRCrtcInfo *XRRGetCrtcInfo(Display *dpy, XRRScreenResources *resources, RRCrtc crtc);
+void XRRFreeCrtcInfo(XRRCrtcInfo *crtc_info);
+XRROutputInfo *XRRGetOutputInfo(Display *dpy, XRRScreenResources *resources, RROutput output);
+void XRRFreeOutputInfo(XRROutputInfo *output_info);
+Atom *XRRListOutputProperties(Display *dpy, RROutput output, int *nprop);
+int XRRGetOutputProperty(Display *dpy, RROutput output, Atom property,
+                         long offset, long length, Bool _delete, Bool pending, Atom req_type,
+                         Atom *actual_type, int *actual_format,
+                         unsigned long *nitems, unsigned long *bytes_after, unsigned char **prop);
+XRRPropertyInfo *XRRQueryOutputProperty(Display *dpy, RROutput output, Atom property);
+
+#endif /* _X11_EXTENSIONS_XRANDR_H_ */
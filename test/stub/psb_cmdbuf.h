@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Just enough of psb_cmdbuf.h to build the MSVDX second pass deblock
+ * generator (src/mrst/psb_deblock.c) without libva and wsbm. The test
+ * provides the functions and checks the REGIO words it writes.
+ */
+
+#ifndef _PSB_CMDBUF_H_
+#define _PSB_CMDBUF_H_
+
+#include <stdint.h>
+
+typedef struct psb_buffer_s {
+    uint32_t buffer_ofs;
+} *psb_buffer_p;
+
+typedef struct psb_cmdbuf_s {
+    struct psb_buffer_s regio_buf;
+    unsigned char * regio_base;
+    uint32_t *regio_idx;
+} *psb_cmdbuf_p;
+
+typedef struct object_context_s {
+    psb_cmdbuf_p cmdbuf;
+} *object_context_p;
+
+#define RELOC_REGIO(dest, offset, buf, dst)     do { (dest) = (offset); (void)(dst); } while (0)
+
+int psb_buffer_map(psb_buffer_p buf, unsigned char **address /* out */);
+int psb_buffer_unmap(psb_buffer_p buf);
+int psb_cmdbuf_buffer_ref(psb_cmdbuf_p cmdbuf, psb_buffer_p buf);
+
+int psb_cmdbuf_second_pass(object_context_p obj_context,
+                           uint32_t OperatingModeCmd,
+                           unsigned char * pvParamBase,
+                           uint32_t PicWidthInMbs,
+                           uint32_t FrameHeightInMbs,
+                           psb_buffer_p target_buffer,
+                           uint32_t chroma_offset
+                          );
+
+#endif /* _PSB_CMDBUF_H_ */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Just enough of the driver's psb_drv_video.h to build the surface import
+ * table (src/psb_surface_import.c) and the xrandr thread
+ * (src/x11/psb_xrandr.c) without libva, X11 and wsbm.
+ */
+
+#ifndef _PSB_DRV_VIDEO_H_
+#define _PSB_DRV_VIDEO_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <va/va.h>
+
+#define PSB_SURFACE_IMPORT_HASH_SIZE    32  /* power of two */
+
+#define PSB_NEW_ROTATION        1
+#define PSB_NEW_EXTVIDEO        2
+
+#define IS_MRST(driver_data)    0
+
+struct psb_driver_data_s {
+    struct psb_surface_import_s *surface_import_hash[PSB_SURFACE_IMPORT_HASH_SIZE];
+    int ion_fd;
+
+    pthread_t xrandr_thread_id;
+    int mipi0_rotation;
+    int mipi1_rotation;
+    int hdmi_rotation;
+    uint32_t xrandr_dirty;
+    uint32_t xrandr_update;
+};
+typedef struct psb_driver_data_s *psb_driver_data_p;
+
+struct object_surface_s {
+    VASurfaceID surface_id;
+    struct psb_surface_s *psb_surface;
+    struct psb_surface_import_s *import;
+};
+typedef struct object_surface_s *object_surface_p;
+
+#endif /* _PSB_DRV_VIDEO_H_ */
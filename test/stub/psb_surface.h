@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Just enough of psb_surface.h for the surface import table. A buffer
+ * object is a number here, the test provides the reference counting.
+ */
+
+#ifndef _PSB_SURFACE_H_
+#define _PSB_SURFACE_H_
+
+#include "psb_drv_video.h"
+
+typedef struct psb_buffer_s {
+    int bo;
+} *psb_buffer_p;
+
+struct psb_surface_s {
+    struct psb_buffer_s buf;
+};
+typedef struct psb_surface_s *psb_surface_p;
+
+VAStatus psb_buffer_reference(psb_driver_data_p driver_data,
+                              psb_buffer_p buf,
+                              psb_buffer_p reference_buf);
+void psb_buffer_destroy(psb_buffer_p buf);
+
+#endif /* _PSB_SURFACE_H_ */
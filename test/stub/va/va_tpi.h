@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Just enough of libva's va_tpi.h for the surface import table
+ */
+
+#ifndef _VA_TPI_H_
+#define _VA_TPI_H_
+
+typedef enum {
+    VAExternalMemoryNULL,
+    VAExternalMemoryV4L2Buffer,
+    VAExternalMemoryCIFrame,
+    VAExternalMemoryUserPointer,
+    VAExternalMemoryKernelDRMBufffer,
+    VAExternalMemoryAndroidGrallocBuffer,
+    VAExternalMemoryIONSharedFD,
+} VASurfaceMemoryType;
+
+typedef struct _VASurfaceAttributeTPI {
+    VASurfaceMemoryType type;
+    unsigned int width;
+    unsigned int height;
+    unsigned int size;
+    unsigned int pixel_format;
+    unsigned int tiling;
+    unsigned int luma_stride;
+    unsigned int chroma_u_stride;
+    unsigned int chroma_v_stride;
+    unsigned int luma_offset;
+    unsigned int chroma_u_offset;
+    unsigned int chroma_v_offset;
+    unsigned int count;
+    unsigned long *buffers;
+    unsigned long reserved[4];
+} VASurfaceAttributeTPI;
+
+#endif /* _VA_TPI_H_ */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Walks the coding order of getFrameDpyOrder() (src/tng_slotorder.c) for
+ * B frame setups and checks isMiniGopClosed() against it: a mini GOP is
+ * closed exactly when every frame displayed before the next one coded has
+ * been coded, and the frame coded there is an anchor. tng_EndPicture()
+ * holds a forced IDR or a reference invalidation until then, so such a
+ * request is also checked to wait no more than the B frames of one mini GOP.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tng_slotorder.h"
+
+#define FRAMES          200
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static void walk(int bframes, int hierarchical, int intracnt, int idrcnt)
+{
+    FRAME_ORDER_INFO last_info;
+    int dpy_order[8], enc_order[8]; /* one slot per B frame and two anchors */
+    unsigned long long dpy, count, applied;
+    unsigned char coded[FRAMES * 2];
+    int closed[FRAMES];
+    unsigned int prefix = 0;
+
+    memset(&last_info, 0, sizeof(last_info));
+    last_info.slot_consume_dpy_order = dpy_order;
+    last_info.slot_consume_enc_order = enc_order;
+    memset(coded, 0, sizeof(coded));
+
+    for (count = 0; count < FRAMES; count++) {
+        /* display orders 0..prefix-1 are coded, nothing past them */
+        int contiguous = 1;
+        unsigned int i;
+
+        for (i = prefix; i < sizeof(coded); i++)
+            if (coded[i])
+                contiguous = 0;
+
+        closed[count] = isMiniGopClosed(count, bframes, intracnt, idrcnt);
+        CHECK(closed[count] == contiguous);
+
+        CHECK(getFrameDpyOrder(count, bframes, hierarchical, intracnt, idrcnt,
+                               &last_info, &dpy) == 0);
+        CHECK(dpy < sizeof(coded) && !coded[dpy]);
+        if (dpy >= sizeof(coded))
+            return;
+        coded[dpy] = 1;
+        while (prefix < sizeof(coded) && coded[prefix])
+            prefix++;
+
+        if (closed[count])
+            CHECK(last_info.last_frame_type != IMG_INTER_B);
+    }
+
+    /* a request sent with any frame is honoured within one mini GOP */
+    for (count = 1; count < FRAMES - bframes - 1; count++) {
+        for (applied = count; !closed[applied]; applied++)
+            ;
+        CHECK(applied - count <= (unsigned long long)bframes);
+    }
+}
+
+int main(void)
+{
+    static const int aiIntraCnt[] = { 1, 2, 3, 4, 6, 12, 30 };
+    static const int aiIdrCnt[] = { 0, 1, 2, 5 };
+    unsigned int i, j;
+    int bframes, hierarchical;
+
+    /* without B frames every frame can start over */
+    for (i = 0; i < 64; i++)
+        CHECK(isMiniGopClosed(i, 0, 30, 0));
+
+    for (bframes = 1; bframes <= 3; bframes++)
+        for (hierarchical = 0; hierarchical <= 1; hierarchical++)
+            for (i = 0; i < sizeof(aiIntraCnt) / sizeof(aiIntraCnt[0]); i++)
+                for (j = 0; j < sizeof(aiIdrCnt) / sizeof(aiIdrCnt[0]); j++) {
+                    int intracnt = aiIntraCnt[i] * (bframes + 1);
+
+                    walk(bframes, hierarchical, intracnt, aiIdrCnt[j]);
+                }
+
+    if (failures)
+        printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
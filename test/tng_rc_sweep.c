@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2011 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sweeps the host side rate control heuristics of tng_hostrc.c over stream
+ * setups, with and without B frames, and checks the invariants the
+ * firmware relies on: QPs within their range, an initial level the buffer
+ * holds, whole mini GOPs per intra period. The frame complexity estimate
+ * is checked on synthetic frames whose cost is known, see test/Makefile.am.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "tng_hostrc.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(expr, expected)                                            \
+    do {                                                                    \
+        long long got_ = (long long)(expr);                                 \
+        if (got_ != (long long)(expected)) {                                \
+            printf("%s:%d: %s = %lld, expected %lld\n", __FILE__, __LINE__, \
+                   #expr, got_, (long long)(expected));                     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_NEAR(expr, expected)                                          \
+    do {                                                                    \
+        double got_ = (expr);                                               \
+        if (fabs(got_ - (expected)) > 1e-9 * fabs(expected)) {              \
+            printf("%s:%d: %s = %.12g, expected %.12g\n", __FILE__, __LINE__, \
+                   #expr, got_, (double)(expected));                        \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const IMG_UINT16 aui16Width[] = { 176, 352, 720, 1280, 1920, 4096 };
+static const IMG_UINT16 aui16Height[] = { 144, 288, 480, 720, 1088, 2304 };
+static const IMG_UINT32 aui32FrameRate[] = { 1, 15, 30, 60, 240, 3000 };
+static const IMG_UINT32 aui32BitsPerSecond[] = { 1, 20, 64000, 255999, 256000, 1000000, 20000000,
+                                                 135000000, 1000000000, 0xffffffff };
+static const IMG_UINT32 aui32IntraFreq[] = { 1, 2, 3, 5, 30, 300, 65536, 2147483647 };
+static const IMG_UINT32 aui32BufferTenths[] = { 0, 1, 10, 20, 100 };
+static const IMG_UINT8 aui8AppQp[] = { 0, 1, 20, 49, 50, 51 };
+
+/* the rate control's view of the GOP bits against the room in the buffer */
+static void check_scale_factor(void)
+{
+    unsigned int b, f, g;
+    IMG_UINT32 ui32Factor, ui32Last;
+    IMG_INT32 i32BufferSize;
+    double flExpected;
+
+    /* no room above the initial level, no bits per frame or frame rate */
+    CHECK_EQ(tng__rc_h264_scale_factor(4000000, 30, 30, 2000000, 2000000), 0);
+    CHECK_EQ(tng__rc_h264_scale_factor(4000000, 30, 30, 1000000, 2000000), 0);
+    CHECK_EQ(tng__rc_h264_scale_factor(20, 30, 30, 2000000, 0), 0);
+    CHECK_EQ(tng__rc_h264_scale_factor(4000000, 0, 30, 2000000, 0), 0);
+
+    for (b = 0; b < ARRAY_SIZE(aui32BitsPerSecond); b++) {
+        for (f = 0; f < ARRAY_SIZE(aui32FrameRate); f++) {
+            if (aui32BitsPerSecond[b] < aui32FrameRate[f])
+                continue;
+            i32BufferSize = tng__rc_buffer_size(aui32BitsPerSecond[b], 0);
+            ui32Last = 0;
+            for (g = 0; g < ARRAY_SIZE(aui32IntraFreq); g++) {
+                ui32Factor = tng__rc_h264_scale_factor(aui32BitsPerSecond[b], aui32FrameRate[f],
+                                                       aui32IntraFreq[g], i32BufferSize, 0);
+                /* 256 * GOP bits / room, saturated to 32 bits */
+                flExpected = 256.0 * (aui32BitsPerSecond[b] / aui32FrameRate[f]) *
+                             aui32IntraFreq[g] / i32BufferSize;
+                if (flExpected >= 4294967295.0)
+                    CHECK_EQ(ui32Factor, 0xffffffff);
+                else
+                    CHECK(fabs(ui32Factor - flExpected) < 1.0);
+                /* a longer GOP never lowers the factor */
+                CHECK(ui32Factor >= ui32Last);
+                ui32Last = ui32Factor;
+            }
+        }
+    }
+}
+
+static void check_bu_size(void)
+{
+    CHECK_EQ(tng__rc_bu_size(0, 8160), 8160);       /* default, one BU per frame */
+    CHECK_EQ(tng__rc_bu_size(396, 8160), 396);
+    CHECK_EQ(tng__rc_bu_size(8160, 8160), 8160);
+    CHECK_EQ(tng__rc_bu_size(8160, 396), 396);      /* 1080p BU after a switch to CIF */
+    CHECK_EQ(tng__rc_bu_size(397, 396), 396);
+}
+
+static void check_buffer(void)
+{
+    unsigned int b, t;
+    IMG_UINT32 ui32Buffer;
+    double flSeconds;
+
+    for (b = 0; b < ARRAY_SIZE(aui32BitsPerSecond); b++) {
+        for (t = 0; t < ARRAY_SIZE(aui32BufferTenths); t++) {
+            ui32Buffer = tng__rc_buffer_size(aui32BitsPerSecond[b], aui32BufferTenths[t]);
+            /* the firmware takes a signed size */
+            CHECK(ui32Buffer <= 0x7fffffff);
+            if (aui32BufferTenths[t])
+                flSeconds = aui32BufferTenths[t] / 10.0;
+            else
+                flSeconds = (aui32BitsPerSecond[b] < 256000) ? 4.5 : 2.5;
+            if (aui32BitsPerSecond[b] * flSeconds < 0x7fffffff)
+                CHECK(fabs(ui32Buffer - aui32BitsPerSecond[b] * flSeconds) < 1.0);
+            else
+                CHECK_EQ(ui32Buffer, 0x7fffffff);
+        }
+    }
+}
+
+/* the initial level sits on a frame boundary inside the buffer */
+static void check_initial_level(IMG_UINT32 ui32BufferSize, IMG_UINT32 ui32BitsPerFrame)
+{
+    IMG_INT32 i32Level = tng__rc_initial_level(ui32BufferSize, ui32BitsPerFrame);
+
+    CHECK(i32Level >= 0);
+    CHECK((IMG_UINT32)i32Level <= ui32BufferSize);
+    if (ui32BitsPerFrame && (IMG_UINT32)i32Level < ui32BufferSize) {
+        CHECK(i32Level % ui32BitsPerFrame == 0);
+        CHECK((IMG_UINT32)i32Level >= ui32BitsPerFrame);
+    }
+    if (ui32BitsPerFrame == 0)
+        CHECK_EQ(i32Level, ((IMG_UINT64)3 * ui32BufferSize) >> 4);
+}
+
+/* B frames come in mini GOPs, the intra period is a whole number of them */
+static void check_intra_period(void)
+{
+    unsigned int g, n;
+    IMG_UINT32 ui32Gop, ui32Intra;
+
+    for (ui32Gop = 1; ui32Gop <= 4; ui32Gop++) {
+        for (g = 0; g < ARRAY_SIZE(aui32IntraFreq); g++) {
+            for (n = 0; n < 3; n++) {
+                IMG_UINT32 ui32In = aui32IntraFreq[g] - (aui32IntraFreq[g] > n ? n : 0);
+
+                ui32Intra = tng__rc_intra_period(ui32In, ui32Gop);
+                CHECK(ui32Intra % ui32Gop == 0);
+                CHECK(ui32Intra <= 0x7fffffff);
+                /* rounded up, only the top of the range rounds down */
+                if (ui32Intra >= ui32In)
+                    CHECK(ui32Intra - ui32In < ui32Gop);
+                else
+                    CHECK(ui32In - ui32Intra < ui32Gop && ui32In > 0x7fffffff - ui32Gop);
+            }
+        }
+    }
+}
+
+static void check_qp_tables(void)
+{
+    unsigned int b;
+    IMG_UINT8 ui8Last = 0xff, ui8Qp;
+
+    CHECK_NEAR(tng__rc_bits_per_pixel(4000000, 30, 1280, 720), 4000000.0 / (30.0 * 1280 * 720));
+    /* 3000 fps at 1080p is 6.3e9 pixels per second, above 32 bits */
+    CHECK_NEAR(tng__rc_bits_per_pixel(20000000, 3000, 1920, 1088), 20000000.0 / (3000.0 * 1920 * 1088));
+
+    for (b = 0; b < ARRAY_SIZE(aui32BitsPerSecond); b++) {
+        /* more bits never ask for a coarser start */
+        ui8Qp = tng__rc_other_initial_qp(tng__rc_bits_per_pixel(aui32BitsPerSecond[b], 30, 352, 288),
+                                         352, 30, 30);
+        CHECK(ui8Qp >= 8 && ui8Qp <= 31);
+        CHECK(ui8Qp <= ui8Last);
+        ui8Last = ui8Qp;
+
+        CHECK(tng__rc_scale_factor(aui32BitsPerSecond[b], IMG_TRUE) <= 8);
+        CHECK(tng__rc_scale_factor(aui32BitsPerSecond[b], IMG_FALSE) <= 4);
+        if (b > 0) {
+            CHECK(tng__rc_scale_factor(aui32BitsPerSecond[b], IMG_TRUE) >=
+                  tng__rc_scale_factor(aui32BitsPerSecond[b - 1], IMG_TRUE));
+            CHECK(tng__rc_scale_factor(aui32BitsPerSecond[b], IMG_FALSE) >=
+                  tng__rc_scale_factor(aui32BitsPerSecond[b - 1], IMG_FALSE));
+        }
+    }
+
+    /* at most half a bit per pixel per second at QCIF halves the frame rate */
+    CHECK_EQ(tng__rc_half_frame_rate(64000, 30, 176, 144, 99), 1);
+    CHECK_EQ(tng__rc_half_frame_rate(2000000, 30, 176, 144, 99), 0);
+}
+
+/*
+ * What tng__setup_rcdata() derives for one H.264 stream. The application
+ * may give its own initial QP and min QP, the rest comes from the helpers.
+ */
+static void check_h264_setup(
+    IMG_UINT16 ui16Width,
+    IMG_UINT16 ui16Height,
+    IMG_UINT32 ui32FrameRate,
+    IMG_UINT32 ui32BitsPerSecond,
+    IMG_UINT32 ui32IntraFreq,
+    IMG_UINT32 ui32BFrames,
+    IMG_UINT32 ui32BufferTenths)
+{
+    IMG_UINT16 ui16MBPerFrm = (ui16Width >> 4) * (ui16Height >> 4);
+    IMG_UINT32 ui32BufferSize, ui32BitsPerFrame, ui32Intra;
+    IMG_INT32 i32Level, i32Frames;
+    IMG_UINT8 ui8MinQP, ui8InitQP;
+    unsigned int q, m;
+    double flBpp;
+
+    ui32Intra = tng__rc_intra_period(ui32IntraFreq, ui32BFrames + 1);
+    ui32BufferSize = tng__rc_buffer_size(ui32BitsPerSecond, ui32BufferTenths);
+    ui32BitsPerFrame = ui32BitsPerSecond / ui32FrameRate;
+    i32Level = tng__rc_initial_level(ui32BufferSize, ui32BitsPerFrame);
+    CHECK(i32Level >= 0 && (IMG_UINT32)i32Level <= ui32BufferSize);
+
+    i32Frames = tng__rc_buffer_size_in_frames(ui32BufferSize,
+                                              (ui32BitsPerSecond + ui32FrameRate / 2) / ui32FrameRate);
+    CHECK(i32Frames >= 0);
+
+    flBpp = tng__rc_bits_per_pixel(ui32BitsPerSecond, ui16Width <= 176 ? 30 : ui32FrameRate,
+                                   ui16Width, ui16Height);
+    CHECK(flBpp > 0.0 && !isinf(flBpp));
+
+    ui8MinQP = tng__rc_h264_min_qp(flBpp, i32Frames, ui16MBPerFrm);
+    CHECK(ui8MinQP >= 2 && ui8MinQP <= 51);
+
+    for (q = 0; q < ARRAY_SIZE(aui8AppQp); q++) {
+        /* the derived min QP, or the application's */
+        for (m = 0; m < 2; m++) {
+            IMG_UINT8 ui8Min = m ? (aui8AppQp[q] < 2 ? 2 : aui8AppQp[q]) : ui8MinQP;
+
+            ui8InitQP = tng__rc_h264_initial_qp(flBpp, i32Frames, ui32Intra, ui16MBPerFrm,
+                                                aui8AppQp[q], ui8Min);
+            CHECK(ui8InitQP >= ui8Min && ui8InitQP <= 51);
+            if (ui8Min <= 49)
+                CHECK(ui8InitQP <= 49);
+            if (aui8AppQp[q] >= ui8Min && aui8AppQp[q] <= 49)
+                CHECK_EQ(ui8InitQP, aui8AppQp[q]);
+        }
+    }
+}
+
+/* invariants over resolution, frame rate, bitrate, GOP, B frames and buffer */
+static void sweep(void)
+{
+    unsigned int r, f, b, g, t;
+    IMG_UINT32 ui32BFrames, ui32MBPerFrm;
+
+    for (r = 0; r < ARRAY_SIZE(aui16Width); r++) {
+        ui32MBPerFrm = (aui16Width[r] >> 4) * (aui16Height[r] >> 4);
+        CHECK_EQ(tng__rc_bu_size(ui32MBPerFrm * 2, ui32MBPerFrm), ui32MBPerFrm);
+
+        for (f = 0; f < ARRAY_SIZE(aui32FrameRate); f++)
+            for (b = 0; b < ARRAY_SIZE(aui32BitsPerSecond); b++)
+                for (g = 0; g < ARRAY_SIZE(aui32IntraFreq); g++)
+                    for (ui32BFrames = 0; ui32BFrames <= 3; ui32BFrames++)
+                        for (t = 0; t < ARRAY_SIZE(aui32BufferTenths); t++)
+                            check_h264_setup(aui16Width[r], aui16Height[r], aui32FrameRate[f],
+                                             aui32BitsPerSecond[b], aui32IntraFreq[g], ui32BFrames,
+                                             aui32BufferTenths[t]);
+    }
+
+    for (b = 0; b < ARRAY_SIZE(aui32BitsPerSecond); b++) {
+        for (t = 0; t < ARRAY_SIZE(aui32BufferTenths); t++) {
+            IMG_UINT32 ui32Buffer = tng__rc_buffer_size(aui32BitsPerSecond[b], aui32BufferTenths[t]);
+
+            for (f = 0; f < ARRAY_SIZE(aui32FrameRate); f++)
+                check_initial_level(ui32Buffer, aui32BitsPerSecond[b] / aui32FrameRate[f]);
+        }
+    }
+    /* a frame bigger than the buffer */
+    check_initial_level(1000, 5000);
+    check_initial_level(0, 5000);
+    check_initial_level(0xffffffff, 1);
+
+    /* no bits per frame, only in MVC mode */
+    CHECK_EQ(tng__rc_buffer_size_in_frames(2000000, 0), 30);
+    CHECK_EQ(tng__rc_buffer_size_in_frames(0x7fffffff, 1), 0x7fffffff);
+}
+
+/* synthetic 64x64 luma frames, 4 rows of 7 samples on the complexity grid */
+#define FRAME_W 64
+#define FRAME_H 64
+#define FRAME_SAMPLES (((FRAME_H + TNG_COMPLEXITY_STEP_Y / 2 - 1) / TNG_COMPLEXITY_STEP_Y) * \
+                       ((FRAME_W - 1) / TNG_COMPLEXITY_STEP_X))
+
+static void check_frame_complexity(void)
+{
+    static IMG_UINT8 aui8Flat[FRAME_W * FRAME_H], aui8Ramp[FRAME_W * FRAME_H], aui8Dots[FRAME_W * FRAME_H];
+    IMG_UINT8 aui8Samples[FRAME_SAMPLES];
+    unsigned int x, y;
+
+    CHECK_EQ(FRAME_SAMPLES, 28);
+
+    for (y = 0; y < FRAME_H; y++) {
+        for (x = 0; x < FRAME_W; x++) {
+            aui8Flat[y * FRAME_W + x] = 128;
+            aui8Ramp[y * FRAME_W + x] = x;
+            /* isolated dots on the sample grid, 0 to the left and above */
+            aui8Dots[y * FRAME_W + x] = ((x % TNG_COMPLEXITY_STEP_X) == 0 &&
+                                         (y % TNG_COMPLEXITY_STEP_Y) == TNG_COMPLEXITY_STEP_Y / 2) ? 200 : 0;
+        }
+    }
+
+    CHECK_EQ(tng__frame_complexity(aui8Flat, FRAME_W, FRAME_W, FRAME_H, aui8Samples, IMG_FALSE), 0);
+    CHECK_EQ(aui8Samples[FRAME_SAMPLES - 1], 128);
+
+    /* a horizontal ramp costs its gradient, 1 per sample */
+    CHECK_EQ(tng__frame_complexity(aui8Ramp, FRAME_W, FRAME_W, FRAME_H, aui8Samples, IMG_FALSE), 28);
+    /* the same frame again costs nothing */
+    CHECK_EQ(tng__frame_complexity(aui8Ramp, FRAME_W, FRAME_W, FRAME_H, aui8Samples, IMG_TRUE), 0);
+
+    /* a scene cut is priced like an intra frame: 200 + 200 per sample either way */
+    CHECK_EQ(tng__frame_complexity(aui8Dots, FRAME_W, FRAME_W, FRAME_H, aui8Samples, IMG_FALSE), 28 * 400);
+    memset(aui8Samples, 0, sizeof(aui8Samples));
+    CHECK_EQ(tng__frame_complexity(aui8Dots, FRAME_W, FRAME_W, FRAME_H, aui8Samples, IMG_TRUE), 28 * 400);
+    /* a small temporal change is cheaper than the spatial detail */
+    memset(aui8Samples, 190, sizeof(aui8Samples));
+    CHECK_EQ(tng__frame_complexity(aui8Dots, FRAME_W, FRAME_W, FRAME_H, aui8Samples, IMG_TRUE), 28 * 20);
+}
+
+static void check_complexity_steps(void)
+{
+    CHECK_EQ(tng__complexity_steps(100, 100, 0, 1000), 0);
+    CHECK_EQ(tng__complexity_steps(500, 0, 0, 1000), 0);            /* no average yet */
+    CHECK_EQ(tng__complexity_steps(134, 100, 0, 1000), 1);
+    CHECK_EQ(tng__complexity_steps(74, 100, 0, 1000), -1);
+    CHECK_EQ(tng__complexity_steps(1000000, 100, 0, 1000), TNG_COMPLEXITY_MAX_STEPS);
+    CHECK_EQ(tng__complexity_steps(0, 100, 0, 1000), -TNG_COMPLEXITY_MAX_STEPS);
+
+    /* overspending pulls the rate back, one step per 8 frames of bits */
+    CHECK_EQ(tng__complexity_steps(100, 100, 7999, 1000), 0);
+    CHECK_EQ(tng__complexity_steps(100, 100, 16000, 1000), -2);
+    CHECK_EQ(tng__complexity_steps(100, 100, -24000, 1000), 3);
+    CHECK_EQ(tng__complexity_steps(1000000, 100, 24000, 1000), TNG_COMPLEXITY_MAX_STEPS - 3);
+    CHECK_EQ(tng__complexity_steps(100, 100, 1000000000000LL, 1000), -TNG_COMPLEXITY_MAX_STEPS);
+    CHECK_EQ(tng__complexity_steps(100, 100, 16000, 0), 0);         /* no budget known */
+}
+
+int main(void)
+{
+    check_scale_factor();
+    check_bu_size();
+    check_buffer();
+    check_intra_period();
+    check_qp_tables();
+    check_frame_complexity();
+    check_complexity_steps();
+    sweep();
+
+    if (failures)
+        printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}